@@ -919,6 +919,10 @@ static gboolean delayreport_ind(struct avdtp *session,
 	else
 		debug("Source %p: DelayReport_Ind", sep);
 
+	/* Only a remote sink reports the delay of our stream */
+	if (a2dp_sep->type == AVDTP_SEP_TYPE_SOURCE && dev->sink)
+		sink_delay_changed(dev, delay);
+
 	unix_delay_report(dev, rseid, delay);
 
 	return TRUE;
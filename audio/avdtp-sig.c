@@ -0,0 +1,324 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2006-2007  Nokia Corporation
+ *  Copyright (C) 2004-2009  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "logging.h"
+
+#include "avdtp-sig.h"
+
+static gboolean try_send(int sk, const struct iovec *iov, int iovcnt,
+								size_t len)
+{
+	ssize_t err;
+
+	do {
+		err = writev(sk, iov, iovcnt);
+	} while (err < 0 && errno == EINTR);
+
+	if (err < 0) {
+		error("send: %s (%d)", strerror(errno), errno);
+		return FALSE;
+	} else if ((size_t) err != len) {
+		error("try_send: complete buffer not sent (%zd/%zu bytes)",
+								err, len);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Sends a signaling message, fragmented to the outgoing MTU when needed.
+ * Every packet is written straight from its header and the caller's
+ * payload, the payload is never copied. */
+gboolean avdtp_sig_send(int sk, uint16_t omtu, uint8_t transaction,
+				uint8_t message_type, uint8_t signal_id,
+				const void *data, size_t len)
+{
+	unsigned int cont_fragments;
+	size_t sent;
+	struct avdtp_start_header start;
+	struct avdtp_continue_header cont;
+	struct iovec iov[2];
+
+	/* Single packet - no fragmentation */
+	if (sizeof(struct avdtp_single_header) + len <= omtu) {
+		struct avdtp_single_header single;
+
+		memset(&single, 0, sizeof(single));
+
+		single.transaction = transaction;
+		single.packet_type = AVDTP_PKT_TYPE_SINGLE;
+		single.message_type = message_type;
+		single.signal_id = signal_id;
+
+		iov[0].iov_base = &single;
+		iov[0].iov_len = sizeof(single);
+		iov[1].iov_base = (void *) data;
+		iov[1].iov_len = len;
+
+		return try_send(sk, iov, 2, sizeof(single) + len);
+	}
+
+	if (omtu <= sizeof(start)) {
+		error("avdtp_send: MTU %u too small for fragmentation", omtu);
+		return FALSE;
+	}
+
+	/* Count the number of needed fragments, rounding up so that a last
+	 * fragment filling the MTU exactly isn't counted twice */
+	cont_fragments = (len - (omtu - sizeof(start)) +
+				omtu - sizeof(cont) - 1) / (omtu - sizeof(cont));
+
+	if (cont_fragments + 1 > UINT8_MAX) {
+		error("avdtp_send: %zu bytes need too many fragments", len);
+		return FALSE;
+	}
+
+	debug("avdtp_send: %zu bytes split into %d fragments", len,
+							cont_fragments + 1);
+
+	/* Send the start packet */
+	memset(&start, 0, sizeof(start));
+	start.transaction = transaction;
+	start.packet_type = AVDTP_PKT_TYPE_START;
+	start.message_type = message_type;
+	start.no_of_packets = cont_fragments + 1;
+	start.signal_id = signal_id;
+
+	iov[0].iov_base = &start;
+	iov[0].iov_len = sizeof(start);
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = omtu - sizeof(start);
+
+	if (!try_send(sk, iov, 2, omtu))
+		return FALSE;
+
+	debug("avdtp_send: first packet with %zu bytes sent",
+						omtu - sizeof(start));
+
+	sent = omtu - sizeof(start);
+
+	memset(&cont, 0, sizeof(cont));
+	cont.transaction = transaction;
+	cont.message_type = message_type;
+
+	iov[0].iov_base = &cont;
+	iov[0].iov_len = sizeof(cont);
+
+	/* Send the continue fragments and the end packet */
+	while (sent < len) {
+		size_t left, to_send;
+
+		left = len - sent;
+		if (left + sizeof(cont) > omtu) {
+			cont.packet_type = AVDTP_PKT_TYPE_CONTINUE;
+			to_send = omtu - sizeof(cont);
+			debug("avdtp_send: sending continue with %zu bytes",
+								to_send);
+		} else {
+			cont.packet_type = AVDTP_PKT_TYPE_END;
+			to_send = left;
+			debug("avdtp_send: sending end with %zu bytes",
+								to_send);
+		}
+
+		iov[1].iov_base = (uint8_t *) data + sent;
+		iov[1].iov_len = to_send;
+
+		if (!try_send(sk, iov, 2, to_send + sizeof(cont)))
+			return FALSE;
+
+		sent += to_send;
+	}
+
+	return TRUE;
+}
+
+void avdtp_sig_reset(struct avdtp_sig_in *in)
+{
+	in->active = FALSE;
+	in->no_of_packets = 0;
+	in->offset = 0;
+	in->data_size = 0;
+}
+
+/* Receives one signaling packet, the message is complete when
+ * PARSE_SUCCESS is returned and its payload is then at in->buf +
+ * in->offset */
+enum avdtp_parse_result avdtp_sig_recv(int sk, struct avdtp_sig_in *in)
+{
+	struct avdtp_continue_header cont;
+	struct avdtp_common_header *header;
+	struct avdtp_single_header *single = (void *) in->buf;
+	struct avdtp_start_header *start = (void *) in->buf;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t size;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+
+	if (in->active) {
+		/* Keep the header of a continue or end packet out of the
+		 * payload received so far */
+		iov[0].iov_base = &cont;
+		iov[0].iov_len = sizeof(cont);
+		iov[1].iov_base = in->buf + in->offset + in->data_size;
+		iov[1].iov_len = sizeof(in->buf) - in->offset - in->data_size;
+		msg.msg_iovlen = 2;
+		header = (void *) &cont;
+	} else {
+		iov[0].iov_base = in->buf;
+		iov[0].iov_len = sizeof(in->buf);
+		msg.msg_iovlen = 1;
+		header = (void *) in->buf;
+	}
+
+	do {
+		size = recvmsg(sk, &msg, 0);
+	} while (size < 0 && errno == EINTR);
+
+	if (size < 0) {
+		error("recvmsg: %s (%d)", strerror(errno), errno);
+		return PARSE_ERROR;
+	}
+
+	if (msg.msg_flags & MSG_TRUNC) {
+		error("Not enough incoming buffer space!");
+		return PARSE_ERROR;
+	}
+
+	if ((size_t) size < sizeof(struct avdtp_common_header)) {
+		error("Received too small packet (%zd bytes)", size);
+		return PARSE_ERROR;
+	}
+
+	switch (header->packet_type) {
+	case AVDTP_PKT_TYPE_SINGLE:
+		if (in->active) {
+			error("SINGLE: Invalid AVDTP packet fragmentation");
+			return PARSE_ERROR;
+		}
+		if ((size_t) size < sizeof(*single)) {
+			error("Received too small single packet (%zd bytes)",
+									size);
+			return PARSE_ERROR;
+		}
+
+		in->active = TRUE;
+		in->offset = sizeof(*single);
+		in->data_size = size - sizeof(*single);
+		in->no_of_packets = 1;
+		in->transaction = header->transaction;
+		in->message_type = header->message_type;
+		in->signal_id = single->signal_id;
+
+		break;
+	case AVDTP_PKT_TYPE_START:
+		if (in->active) {
+			error("START: Invalid AVDTP packet fragmentation");
+			return PARSE_ERROR;
+		}
+		if ((size_t) size < sizeof(*start)) {
+			error("Received too small start packet (%zd bytes)",
+									size);
+			return PARSE_ERROR;
+		}
+		if (start->no_of_packets < 2) {
+			error("Invalid number of packets %u in start packet",
+							start->no_of_packets);
+			return PARSE_ERROR;
+		}
+
+		in->active = TRUE;
+		in->offset = sizeof(*start);
+		in->data_size = size - sizeof(*start);
+		in->transaction = header->transaction;
+		in->message_type = header->message_type;
+		in->no_of_packets = start->no_of_packets;
+		in->signal_id = start->signal_id;
+
+		break;
+	case AVDTP_PKT_TYPE_CONTINUE:
+		if (!in->active) {
+			error("CONTINUE: Invalid AVDTP packet fragmentation");
+			return PARSE_ERROR;
+		}
+		if (in->transaction != header->transaction) {
+			error("Continue transaction id doesn't match");
+			return PARSE_ERROR;
+		}
+		if (in->no_of_packets <= 1) {
+			error("Too few continue packets");
+			return PARSE_ERROR;
+		}
+
+		in->data_size += size - sizeof(cont);
+
+		break;
+	case AVDTP_PKT_TYPE_END:
+		if (!in->active) {
+			error("END: Invalid AVDTP packet fragmentation");
+			return PARSE_ERROR;
+		}
+		if (in->transaction != header->transaction) {
+			error("End transaction id doesn't match");
+			return PARSE_ERROR;
+		}
+		if (in->no_of_packets > 1) {
+			error("Got an end packet too early");
+			return PARSE_ERROR;
+		}
+
+		in->data_size += size - sizeof(cont);
+
+		break;
+	default:
+		error("Invalid AVDTP packet type 0x%02X", header->packet_type);
+		return PARSE_ERROR;
+	}
+
+	if (in->no_of_packets > 1) {
+		in->no_of_packets--;
+		debug("Received AVDTP fragment. %d to go", in->no_of_packets);
+		return PARSE_FRAGMENT;
+	}
+
+	in->active = FALSE;
+
+	return PARSE_SUCCESS;
+}
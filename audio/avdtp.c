@@ -52,6 +52,7 @@
 #include "manager.h"
 #include "control.h"
 #include "avdtp.h"
+#include "avdtp-sig.h"
 #include "glib-helper.h"
 #include "btio.h"
 #include "sink.h"
@@ -77,51 +78,12 @@
 #define AVDTP_GET_ALL_CAPABILITIES		0x0C
 #define AVDTP_DELAY_REPORT			0x0D
 
-#define AVDTP_PKT_TYPE_SINGLE			0x00
-#define AVDTP_PKT_TYPE_START			0x01
-#define AVDTP_PKT_TYPE_CONTINUE			0x02
-#define AVDTP_PKT_TYPE_END			0x03
-
-#define AVDTP_MSG_TYPE_COMMAND			0x00
-#define AVDTP_MSG_TYPE_GEN_REJECT		0x01
-#define AVDTP_MSG_TYPE_ACCEPT			0x02
-#define AVDTP_MSG_TYPE_REJECT			0x03
-
 #define REQ_TIMEOUT 4
 #define DISCONNECT_TIMEOUT 1
 #define STREAM_TIMEOUT 20
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
-struct avdtp_common_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-} __attribute__ ((packed));
-
-struct avdtp_single_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-	uint8_t signal_id:6;
-	uint8_t rfa0:2;
-} __attribute__ ((packed));
-
-struct avdtp_start_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-	uint8_t no_of_packets;
-	uint8_t signal_id:6;
-	uint8_t rfa0:2;
-} __attribute__ ((packed));
-
-struct avdtp_continue_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-} __attribute__ ((packed));
-
 struct seid_info {
 	uint8_t rfa0:1;
 	uint8_t inuse:1;
@@ -138,35 +100,6 @@ struct seid {
 
 #elif __BYTE_ORDER == __BIG_ENDIAN
 
-struct avdtp_common_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-} __attribute__ ((packed));
-
-struct avdtp_single_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-	uint8_t rfa0:2;
-	uint8_t signal_id:6;
-} __attribute__ ((packed));
-
-struct avdtp_start_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-	uint8_t no_of_packets;
-	uint8_t rfa0:2;
-	uint8_t signal_id:6;
-} __attribute__ ((packed));
-
-struct avdtp_continue_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-} __attribute__ ((packed));
-
 struct seid_info {
 	uint8_t seid:6;
 	uint8_t inuse:1;
@@ -294,16 +227,6 @@ struct delay_req {
 #error "Unknown byte order"
 #endif
 
-struct in_buf {
-	gboolean active;
-	int no_of_packets;
-	uint8_t transaction;
-	uint8_t message_type;
-	uint8_t signal_id;
-	uint8_t buf[1024];
-	uint8_t data_size;
-};
-
 struct pending_req {
 	uint8_t transaction;
 	uint8_t signal_id;
@@ -323,12 +246,21 @@ struct avdtp_remote_sep {
 	struct avdtp_stream *stream;
 };
 
+/* Remote SEPs and capabilities found by the last complete discovery of
+ * a device, used to skip DISCOVER and GET_CAPABILITIES on reconnect */
+struct avdtp_sep_cache {
+	bdaddr_t dst;
+	uint16_t version;
+	GSList *seps; /* of type struct avdtp_remote_sep */
+};
+
 struct avdtp_server {
 	bdaddr_t src;
 	uint16_t version;
 	GIOChannel *io;
 	GSList *seps;
 	GSList *sessions;
+	GSList *sep_cache; /* of type struct avdtp_sep_cache */
 };
 
 struct avdtp_local_sep {
@@ -397,6 +329,7 @@ struct avdtp {
 	guint io_id;
 
 	GSList *seps; /* Elements of type struct avdtp_remote_sep * */
+	gboolean seps_cached; /* seps were not discovered on this connection */
 
 	GSList *streams; /* Elements of type struct avdtp_stream * */
 
@@ -408,15 +341,17 @@ struct avdtp {
 	uint16_t imtu;
 	uint16_t omtu;
 
-	struct in_buf in;
-
-	char *buf;
+	struct avdtp_sig_in in;
 
 	avdtp_discover_cb_t discov_cb;
 	void *user_data;
 
 	struct pending_req *req;
 
+	/* SET_CONFIGURATION to resend once the cached seps are refreshed */
+	struct pending_req *retry_req;
+	struct avdtp_error retry_err;
+
 	guint dc_timer;
 
 	/* Attempt stream setup instead of disconnecting */
@@ -483,116 +418,18 @@ static const char *avdtp_statestr(avdtp_state_t state)
 	}
 }
 
-static gboolean try_send(int sk, void *data, size_t len)
-{
-	int err;
-
-	do {
-		err = send(sk, data, len, 0);
-	} while (err < 0 && errno == EINTR);
-
-	if (err < 0) {
-		error("send: %s (%d)", strerror(errno), errno);
-		return FALSE;
-	} else if ((size_t) err != len) {
-		error("try_send: complete buffer not sent (%d/%zu bytes)",
-								err, len);
-		return FALSE;
-	}
-
-	return TRUE;
-}
-
 static gboolean avdtp_send(struct avdtp *session, uint8_t transaction,
 				uint8_t message_type, uint8_t signal_id,
 				void *data, size_t len)
 {
-	unsigned int cont_fragments, sent;
-	struct avdtp_start_header start;
-	struct avdtp_continue_header cont;
-	int sock;
-
 	if (session->io == NULL) {
 		error("avdtp_send: session is closed");
 		return FALSE;
 	}
 
-	sock = g_io_channel_unix_get_fd(session->io);
-
-	/* Single packet - no fragmentation */
-	if (sizeof(struct avdtp_single_header) + len <= session->omtu) {
-		struct avdtp_single_header single;
-
-		memset(&single, 0, sizeof(single));
-
-		single.transaction = transaction;
-		single.packet_type = AVDTP_PKT_TYPE_SINGLE;
-		single.message_type = message_type;
-		single.signal_id = signal_id;
-
-		memcpy(session->buf, &single, sizeof(single));
-		memcpy(session->buf + sizeof(single), data, len);
-
-		return try_send(sock, session->buf, sizeof(single) + len);
-	}
-
-	/* Count the number of needed fragments */
-	cont_fragments = (len - (session->omtu - sizeof(start))) /
-					(session->omtu - sizeof(cont)) + 1;
-
-	debug("avdtp_send: %zu bytes split into %d fragments", len,
-							cont_fragments + 1);
-
-	/* Send the start packet */
-	memset(&start, 0, sizeof(start));
-	start.transaction = transaction;
-	start.packet_type = AVDTP_PKT_TYPE_START;
-	start.message_type = message_type;
-	start.no_of_packets = cont_fragments + 1;
-	start.signal_id = signal_id;
-
-	memcpy(session->buf, &start, sizeof(start));
-	memcpy(session->buf + sizeof(start), data,
-					session->omtu - sizeof(start));
-
-	if (!try_send(sock, session->buf, session->omtu))
-		return FALSE;
-
-	debug("avdtp_send: first packet with %zu bytes sent",
-						session->omtu - sizeof(start));
-
-	sent = session->omtu - sizeof(start);
-
-	/* Send the continue fragments and the end packet */
-	while (sent < len) {
-		int left, to_copy;
-
-		left = len - sent;
-		if (left + sizeof(cont) > session->omtu) {
-			cont.packet_type = AVDTP_PKT_TYPE_CONTINUE;
-			to_copy = session->omtu - sizeof(cont);
-			debug("avdtp_send: sending continue with %d bytes",
-								to_copy);
-		} else {
-			cont.packet_type = AVDTP_PKT_TYPE_END;
-			to_copy = left;
-			debug("avdtp_send: sending end with %d bytes",
-								to_copy);
-		}
-
-		cont.transaction = transaction;
-		cont.message_type = message_type;
-
-		memcpy(session->buf, &cont, sizeof(cont));
-		memcpy(session->buf + sizeof(cont), data + sent, to_copy);
-
-		if (!try_send(sock, session->buf, to_copy + sizeof(cont)))
-			return FALSE;
-
-		sent += to_copy;
-	}
-
-	return TRUE;
+	return avdtp_sig_send(g_io_channel_unix_get_fd(session->io),
+				session->omtu, transaction, message_type,
+				signal_id, data, len);
 }
 
 static void pending_req_free(struct pending_req *req)
@@ -746,6 +583,130 @@ static struct avdtp_remote_sep *find_remote_sep(GSList *seps, uint8_t seid)
 	return NULL;
 }
 
+static void remote_sep_free(struct avdtp_remote_sep *sep)
+{
+	g_slist_foreach(sep->caps, (GFunc) g_free, NULL);
+	g_slist_free(sep->caps);
+	g_free(sep);
+}
+
+static void remote_seps_free(GSList *seps)
+{
+	g_slist_foreach(seps, (GFunc) remote_sep_free, NULL);
+	g_slist_free(seps);
+}
+
+/* Copies the seps whose capabilities are known, without stream state */
+static GSList *remote_seps_copy(GSList *seps)
+{
+	GSList *l, *copy = NULL;
+
+	for (l = seps; l != NULL; l = g_slist_next(l)) {
+		struct avdtp_remote_sep *sep = l->data;
+		struct avdtp_remote_sep *new_sep;
+		GSList *c;
+
+		if (!sep->codec)
+			continue;
+
+		new_sep = g_new0(struct avdtp_remote_sep, 1);
+		new_sep->seid = sep->seid;
+		new_sep->type = sep->type;
+		new_sep->media_type = sep->media_type;
+		new_sep->delay_reporting = sep->delay_reporting;
+
+		for (c = sep->caps; c != NULL; c = g_slist_next(c)) {
+			struct avdtp_service_capability *cap = c->data;
+			struct avdtp_service_capability *new_cap;
+
+			new_cap = g_malloc(sizeof(*cap) + cap->length);
+			memcpy(new_cap, cap, sizeof(*cap) + cap->length);
+
+			new_sep->caps = g_slist_append(new_sep->caps, new_cap);
+			if (cap == sep->codec)
+				new_sep->codec = new_cap;
+		}
+
+		copy = g_slist_append(copy, new_sep);
+	}
+
+	return copy;
+}
+
+static struct avdtp_sep_cache *find_sep_cache(struct avdtp_server *server,
+							const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = server->sep_cache; l != NULL; l = g_slist_next(l)) {
+		struct avdtp_sep_cache *cache = l->data;
+
+		if (bacmp(&cache->dst, dst) == 0)
+			return cache;
+	}
+
+	return NULL;
+}
+
+static void sep_cache_free(struct avdtp_sep_cache *cache)
+{
+	remote_seps_free(cache->seps);
+	g_free(cache);
+}
+
+static void sep_cache_remove(struct avdtp_server *server, const bdaddr_t *dst)
+{
+	struct avdtp_sep_cache *cache;
+
+	cache = find_sep_cache(server, dst);
+	if (!cache)
+		return;
+
+	server->sep_cache = g_slist_remove(server->sep_cache, cache);
+	sep_cache_free(cache);
+}
+
+static void sep_cache_store(struct avdtp *session)
+{
+	struct avdtp_server *server = session->server;
+	struct avdtp_sep_cache *cache;
+	GSList *seps;
+
+	sep_cache_remove(server, &session->dst);
+
+	seps = remote_seps_copy(session->seps);
+	if (!seps)
+		return;
+
+	cache = g_new0(struct avdtp_sep_cache, 1);
+	bacpy(&cache->dst, &session->dst);
+	cache->version = session->version;
+	cache->seps = seps;
+
+	server->sep_cache = g_slist_append(server->sep_cache, cache);
+}
+
+/* Only trust the cache while the AVDTP version in the remote SDP record
+ * is still the one the seps were discovered with */
+static void sep_cache_load(struct avdtp *session)
+{
+	struct avdtp_sep_cache *cache;
+
+	cache = find_sep_cache(session->server, &session->dst);
+	if (!cache)
+		return;
+
+	if (cache->version != session->version) {
+		sep_cache_remove(session->server, &session->dst);
+		return;
+	}
+
+	debug("Using cached SEPs for session %p", session);
+
+	session->seps = remote_seps_copy(cache->seps);
+	session->seps_cached = session->seps ? TRUE : FALSE;
+}
+
 static void avdtp_set_state(struct avdtp *session,
 					avdtp_session_state_t new_state)
 {
@@ -971,12 +932,20 @@ static void avdtp_sep_set_state(struct avdtp *session,
 	}
 }
 
+static void retry_set_configuration(struct avdtp *session, int err);
+
 static void finalize_discovery(struct avdtp *session, int err)
 {
 	struct avdtp_error avdtp_err;
 
 	avdtp_error_init(&avdtp_err, AVDTP_ERROR_ERRNO, err);
 
+	if (!err && !session->seps_cached)
+		sep_cache_store(session);
+
+	if (session->retry_req)
+		retry_set_configuration(session, err);
+
 	if (!session->discov_cb)
 		return;
 
@@ -1094,10 +1063,10 @@ void avdtp_unref(struct avdtp *session)
 	if (session->req)
 		pending_req_free(session->req);
 
-	g_slist_foreach(session->seps, (GFunc) g_free, NULL);
-	g_slist_free(session->seps);
+	if (session->retry_req)
+		pending_req_free(session->retry_req);
 
-	g_free(session->buf);
+	remote_seps_free(session->seps);
 
 	g_free(session);
 }
@@ -1784,160 +1753,22 @@ static gboolean avdtp_parse_cmd(struct avdtp *session, uint8_t transaction,
 	}
 }
 
-enum avdtp_parse_result { PARSE_ERROR, PARSE_FRAGMENT, PARSE_SUCCESS };
-
-static enum avdtp_parse_result avdtp_parse_data(struct avdtp *session,
-							void *buf, size_t size)
-{
-	struct avdtp_common_header *header = buf;
-	struct avdtp_single_header *single = (void *) session->buf;
-	struct avdtp_start_header *start = (void *) session->buf;
-	void *payload;
-	gsize payload_size;
-
-	switch (header->packet_type) {
-	case AVDTP_PKT_TYPE_SINGLE:
-		if (size < sizeof(*single)) {
-			error("Received too small single packet (%zu bytes)", size);
-			return PARSE_ERROR;
-		}
-		if (session->in.active) {
-			error("SINGLE: Invalid AVDTP packet fragmentation");
-			return PARSE_ERROR;
-		}
-
-		payload = session->buf + sizeof(*single);
-		payload_size = size - sizeof(*single);
-
-		session->in.active = TRUE;
-		session->in.data_size = 0;
-		session->in.no_of_packets = 1;
-		session->in.transaction = header->transaction;
-		session->in.message_type = header->message_type;
-		session->in.signal_id = single->signal_id;
-
-		break;
-	case AVDTP_PKT_TYPE_START:
-		if (size < sizeof(*start)) {
-			error("Received too small start packet (%zu bytes)", size);
-			return PARSE_ERROR;
-		}
-		if (session->in.active) {
-			error("START: Invalid AVDTP packet fragmentation");
-			return PARSE_ERROR;
-		}
-
-		session->in.active = TRUE;
-		session->in.data_size = 0;
-		session->in.transaction = header->transaction;
-		session->in.message_type = header->message_type;
-		session->in.no_of_packets = start->no_of_packets;
-		session->in.signal_id = start->signal_id;
-
-		payload = session->buf + sizeof(*start);
-		payload_size = size - sizeof(*start);
-
-		break;
-	case AVDTP_PKT_TYPE_CONTINUE:
-		if (size < sizeof(struct avdtp_continue_header)) {
-			error("Received too small continue packet (%zu bytes)",
-									size);
-			return PARSE_ERROR;
-		}
-		if (!session->in.active) {
-			error("CONTINUE: Invalid AVDTP packet fragmentation");
-			return PARSE_ERROR;
-		}
-		if (session->in.transaction != header->transaction) {
-			error("Continue transaction id doesn't match");
-			return PARSE_ERROR;
-		}
-		if (session->in.no_of_packets <= 1) {
-			error("Too few continue packets");
-			return PARSE_ERROR;
-		}
-
-		payload = session->buf + sizeof(struct avdtp_continue_header);
-		payload_size = size - sizeof(struct avdtp_continue_header);
-
-		break;
-	case AVDTP_PKT_TYPE_END:
-		if (size < sizeof(struct avdtp_continue_header)) {
-			error("Received too small end packet (%zu bytes)", size);
-			return PARSE_ERROR;
-		}
-		if (!session->in.active) {
-			error("END: Invalid AVDTP packet fragmentation");
-			return PARSE_ERROR;
-		}
-		if (session->in.transaction != header->transaction) {
-			error("End transaction id doesn't match");
-			return PARSE_ERROR;
-		}
-		if (session->in.no_of_packets > 1) {
-			error("Got an end packet too early");
-			return PARSE_ERROR;
-		}
-
-		payload = session->buf + sizeof(struct avdtp_continue_header);
-		payload_size = size - sizeof(struct avdtp_continue_header);
-
-		break;
-	default:
-		error("Invalid AVDTP packet type 0x%02X", header->packet_type);
-		return PARSE_ERROR;
-	}
-
-	if (session->in.data_size + payload_size >
-					sizeof(session->in.buf)) {
-		error("Not enough incoming buffer space!");
-		return PARSE_ERROR;
-	}
-
-	memcpy(session->in.buf + session->in.data_size, payload, payload_size);
-	session->in.data_size += payload_size;
-
-	if (session->in.no_of_packets > 1) {
-		session->in.no_of_packets--;
-		debug("Received AVDTP fragment. %d to go",
-						session->in.no_of_packets);
-		return PARSE_FRAGMENT;
-	}
-
-	session->in.active = FALSE;
-
-	return PARSE_SUCCESS;
-}
-
 static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 				gpointer data)
 {
 	struct avdtp *session = data;
-	struct avdtp_common_header *header;
-	gsize size;
+	struct avdtp_sig_in *in = &session->in;
+	uint8_t *payload;
 
 	debug("session_cb");
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
 
-	header = (void *) session->buf;
-
 	if (cond & (G_IO_HUP | G_IO_ERR))
 		goto failed;
 
-	if (g_io_channel_read(chan, session->buf, session->imtu, &size)
-							!= G_IO_ERROR_NONE) {
-		error("IO Channel read error");
-		goto failed;
-	}
-
-	if (size < sizeof(struct avdtp_common_header)) {
-		error("Received too small packet (%zu bytes)", size);
-		goto failed;
-	}
-
-	switch (avdtp_parse_data(session, session->buf, size)) {
+	switch (avdtp_sig_recv(g_io_channel_unix_get_fd(chan), in)) {
 	case PARSE_ERROR:
 		goto failed;
 	case PARSE_FRAGMENT:
@@ -1946,11 +1777,13 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		break;
 	}
 
-	if (session->in.message_type == AVDTP_MSG_TYPE_COMMAND) {
-		if (!avdtp_parse_cmd(session, session->in.transaction,
-					session->in.signal_id,
-					session->in.buf,
-					session->in.data_size)) {
+	payload = in->buf + in->offset;
+
+	if (in->message_type == AVDTP_MSG_TYPE_COMMAND) {
+		if (!avdtp_parse_cmd(session, in->transaction,
+					in->signal_id,
+					payload,
+					in->data_size)) {
 			error("Unable to handle command. Disconnecting");
 			goto failed;
 		}
@@ -1969,12 +1802,12 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		return TRUE;
 	}
 
-	if (header->transaction != session->req->transaction) {
+	if (in->transaction != session->req->transaction) {
 		error("Transaction label doesn't match");
 		return TRUE;
 	}
 
-	if (session->in.signal_id != session->req->signal_id) {
+	if (in->signal_id != session->req->signal_id) {
 		error("Reponse signal doesn't match");
 		return TRUE;
 	}
@@ -1982,23 +1815,23 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 	g_source_remove(session->req->timeout);
 	session->req->timeout = 0;
 
-	switch (header->message_type) {
+	switch (in->message_type) {
 	case AVDTP_MSG_TYPE_ACCEPT:
 		if (!avdtp_parse_resp(session, session->req->stream,
-						session->in.transaction,
-						session->in.signal_id,
-						session->in.buf,
-						session->in.data_size)) {
+						in->transaction,
+						in->signal_id,
+						payload,
+						in->data_size)) {
 			error("Unable to parse accept response");
 			goto failed;
 		}
 		break;
 	case AVDTP_MSG_TYPE_REJECT:
 		if (!avdtp_parse_rej(session, session->req->stream,
-						session->in.transaction,
-						session->in.signal_id,
-						session->in.buf,
-						session->in.data_size)) {
+						in->transaction,
+						in->signal_id,
+						payload,
+						in->data_size)) {
 			error("Unable to parse reject response");
 			goto failed;
 		}
@@ -2007,7 +1840,7 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		error("Received a General Reject message");
 		break;
 	default:
-		error("Unknown message type 0x%02X", header->message_type);
+		error("Unknown message type 0x%02X", in->message_type);
 		break;
 	}
 
@@ -2112,6 +1945,8 @@ static struct avdtp *avdtp_get_internal(const bdaddr_t *src, const bdaddr_t *dst
 
 	session->version = get_version(session);
 
+	sep_cache_load(session);
+
 	server->sessions = g_slist_append(server->sessions, session);
 
 	return session;
@@ -2161,7 +1996,7 @@ static void avdtp_connect_cb(GIOChannel *chan, GError *err, gpointer user_data)
 	if (session->state == AVDTP_SESSION_STATE_CONNECTING) {
 		debug("AVDTP imtu=%u, omtu=%u", session->imtu, session->omtu);
 
-		session->buf = g_malloc0(session->imtu);
+		avdtp_sig_reset(&session->in);
 		avdtp_set_state(session, AVDTP_SESSION_STATE_CONNECTED);
 
 		if (session->io_id)
@@ -2519,7 +2354,7 @@ static int send_request(struct avdtp *session, gboolean priority,
 static gboolean avdtp_discover_resp(struct avdtp *session,
 					struct discover_resp *resp, int size)
 {
-	int sep_count, i;
+	int sep_count, i, queued = 0;
 	uint8_t getcap_cmd;
 
 	if (session->version >= 0x0103 && session->server->version >= 0x0103)
@@ -2529,6 +2364,8 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 
 	sep_count = size / sizeof(struct seid_info);
 
+	session->seps_cached = FALSE;
+
 	for (i = 0; i < sep_count; i++) {
 		struct avdtp_remote_sep *sep;
 		struct avdtp_stream *stream;
@@ -2561,10 +2398,16 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 							&req, sizeof(req));
 		if (ret < 0) {
 			finalize_discovery(session, -ret);
-			break;
+			return TRUE;
 		}
+
+		queued++;
 	}
 
+	/* No capabilities to wait for */
+	if (queued == 0)
+		finalize_discovery(session, 0);
+
 	return TRUE;
 }
 
@@ -2788,6 +2631,91 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 	return TRUE;
 }
 
+/* A rejected configuration of a cached SEP may just mean the remote
+ * changed, so refresh the seps and send it once more before failing */
+static gboolean rediscover_seps(struct avdtp *session,
+				struct avdtp_stream *stream,
+				struct avdtp_error *err)
+{
+	struct pending_req *req = session->req;
+
+	if (!session->seps_cached || !stream || session->retry_req)
+		return FALSE;
+
+	debug("Cached SEPs rejected, rediscovering");
+
+	sep_cache_remove(session->server, &session->dst);
+
+	remote_seps_free(session->seps);
+	session->seps = NULL;
+	session->seps_cached = FALSE;
+
+	if (send_request(session, TRUE, NULL, AVDTP_DISCOVER, NULL, 0) < 0)
+		return FALSE;
+
+	session->retry_req = g_new0(struct pending_req, 1);
+	session->retry_req->signal_id = req->signal_id;
+	session->retry_req->data = g_memdup(req->data, req->data_size);
+	session->retry_req->data_size = req->data_size;
+	session->retry_req->stream = stream;
+	session->retry_err = *err;
+
+	return TRUE;
+}
+
+static void retry_set_configuration(struct avdtp *session, int err)
+{
+	struct pending_req *req = session->retry_req;
+	struct avdtp_stream *stream = req->stream;
+	struct setconf_req *setconf = req->data;
+	struct avdtp_local_sep *lsep, *tmp;
+	struct avdtp_remote_sep *rsep;
+	uint8_t acp_type;
+
+	session->retry_req = NULL;
+
+	if (!g_slist_find(session->streams, stream)) {
+		pending_req_free(req);
+		return;
+	}
+
+	lsep = stream->lsep;
+
+	if (err)
+		goto failed;
+
+	/* The old remote seid may be gone or reused by another SEP */
+	rsep = find_remote_sep(session->seps, stream->rseid);
+	if (rsep && rsep->stream == stream)
+		rsep->stream = NULL;
+
+	acp_type = lsep->info.type == AVDTP_SEP_TYPE_SINK ?
+				AVDTP_SEP_TYPE_SOURCE : AVDTP_SEP_TYPE_SINK;
+
+	if (avdtp_get_seps(session, acp_type, lsep->info.media_type,
+					lsep->codec, &tmp, &rsep) < 0)
+		goto failed;
+
+	debug("Retrying SET_CONFIGURATION with acp_seid %u", rsep->seid);
+
+	setconf->acp_seid = rsep->seid;
+	stream->rseid = rsep->seid;
+	rsep->stream = stream;
+
+	if (send_req(session, FALSE, req) == 0)
+		return;
+
+	req = NULL;
+
+failed:
+	if (req)
+		pending_req_free(req);
+
+	if (lsep->cfm && lsep->cfm->set_configuration)
+		lsep->cfm->set_configuration(session, lsep, stream,
+					&session->retry_err, lsep->user_data);
+}
+
 static gboolean seid_rej_to_err(struct seid_rej *rej, unsigned int size,
 					struct avdtp_error *err)
 {
@@ -2849,6 +2777,7 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("DISCOVER request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		finalize_discovery(session, EPROTO);
 		return TRUE;
 	case AVDTP_GET_CAPABILITIES:
 	case AVDTP_GET_ALL_CAPABILITIES:
@@ -2871,6 +2800,8 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("SET_CONFIGURATION request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		if (rediscover_seps(session, stream, &err))
+			return TRUE;
 		if (sep && sep->cfm && sep->cfm->set_configuration)
 			sep->cfm->set_configuration(session, sep, stream,
 							&err, sep->user_data);
@@ -2971,6 +2902,16 @@ struct avdtp_service_capability *avdtp_stream_get_codec(
 	return NULL;
 }
 
+/* Returns FALSE when delay reporting isn't used on the stream, delay is
+ * in 1/10 milliseconds and zero until the first report */
+gboolean avdtp_stream_get_delay(struct avdtp_stream *stream, uint16_t *delay)
+{
+	if (delay)
+		*delay = stream->delay;
+
+	return stream->delay_reporting;
+}
+
 gboolean avdtp_stream_has_capability(struct avdtp_stream *stream,
 				struct avdtp_service_capability *cap)
 {
@@ -3695,6 +3636,9 @@ void avdtp_exit(const bdaddr_t *src)
 
 	servers = g_slist_remove(servers, server);
 
+	g_slist_foreach(server->sep_cache, (GFunc) sep_cache_free, NULL);
+	g_slist_free(server->sep_cache);
+
 	g_io_channel_shutdown(server->io, TRUE, NULL);
 	g_io_channel_unref(server->io);
 	g_free(server);
@@ -27,6 +27,7 @@
 
 #include <unistd.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -49,6 +50,7 @@ GST_DEBUG_CATEGORY_STATIC(avdtp_sink_debug);
 #define TEMPLATE_MAX_BITPOOL 64
 #define CRC_PROTECTED 1
 #define CRC_UNPROTECTED 0
+#define MAX_PACKET_PARTS 8
 
 #define DEFAULT_AUTOCONNECT TRUE
 
@@ -1144,18 +1146,18 @@ static GstFlowReturn gst_avdtp_sink_preroll(GstBaseSink *basesink,
 	return GST_FLOW_OK;
 }
 
-static GstFlowReturn gst_avdtp_sink_render(GstBaseSink *basesink,
-					GstBuffer *buffer)
+/* Sends one packet gathered from several buffers with a single call */
+static GstFlowReturn gst_avdtp_sink_writev(GstAvdtpSink *self,
+					const struct iovec *iov, int iovcnt)
 {
-	GstAvdtpSink *self = GST_AVDTP_SINK(basesink);
-	gsize ret;
-	GIOError err;
+	int fd = g_io_channel_unix_get_fd(self->stream);
+	ssize_t ret;
 
-	err = g_io_channel_write(self->stream,
-				(gchar *) GST_BUFFER_DATA(buffer),
-				(gsize) (GST_BUFFER_SIZE(buffer)), &ret);
+	do {
+		ret = writev(fd, iov, iovcnt);
+	} while (ret < 0 && errno == EINTR);
 
-	if (err != G_IO_ERROR_NONE) {
+	if (ret < 0) {
 		GST_ERROR_OBJECT(self, "Error while writting to socket: %d %s",
 				errno, strerror(errno));
 		return GST_FLOW_ERROR;
@@ -1164,6 +1166,60 @@ static GstFlowReturn gst_avdtp_sink_render(GstBaseSink *basesink,
 	return GST_FLOW_OK;
 }
 
+static GstFlowReturn gst_avdtp_sink_render(GstBaseSink *basesink,
+					GstBuffer *buffer)
+{
+	GstAvdtpSink *self = GST_AVDTP_SINK(basesink);
+	struct iovec iov;
+
+	iov.iov_base = GST_BUFFER_DATA(buffer);
+	iov.iov_len = GST_BUFFER_SIZE(buffer);
+
+	return gst_avdtp_sink_writev(self, &iov, 1);
+}
+
+/* Every group of the list is one RTP packet, usually the header and a
+ * sub-buffer of the encoder output as pushed by rtpsbcpay */
+static GstFlowReturn gst_avdtp_sink_render_list(GstBaseSink *basesink,
+					GstBufferList *list)
+{
+	GstAvdtpSink *self = GST_AVDTP_SINK(basesink);
+	GstBufferListIterator *it;
+	GstFlowReturn res = GST_FLOW_OK;
+
+	it = gst_buffer_list_iterate(list);
+
+	while (res == GST_FLOW_OK && gst_buffer_list_iterator_next_group(it)) {
+		struct iovec iov[MAX_PACKET_PARTS];
+		GstBuffer *buffer;
+		int count = 0;
+
+		if (gst_buffer_list_iterator_n_buffers(it) >
+							MAX_PACKET_PARTS) {
+			buffer = gst_buffer_list_iterator_merge_group(it);
+			if (buffer == NULL)
+				continue;
+
+			res = gst_avdtp_sink_render(basesink, buffer);
+			gst_buffer_unref(buffer);
+			continue;
+		}
+
+		while ((buffer = gst_buffer_list_iterator_next(it))) {
+			iov[count].iov_base = GST_BUFFER_DATA(buffer);
+			iov[count].iov_len = GST_BUFFER_SIZE(buffer);
+			count++;
+		}
+
+		if (count > 0)
+			res = gst_avdtp_sink_writev(self, iov, count);
+	}
+
+	gst_buffer_list_iterator_free(it);
+
+	return res;
+}
+
 static gboolean gst_avdtp_sink_unlock(GstBaseSink *basesink)
 {
 	GstAvdtpSink *self = GST_AVDTP_SINK(basesink);
@@ -1211,6 +1267,8 @@ static void gst_avdtp_sink_class_init(GstAvdtpSinkClass *klass)
 	basesink_class->stop = GST_DEBUG_FUNCPTR(gst_avdtp_sink_stop);
 	basesink_class->render = GST_DEBUG_FUNCPTR(
 					gst_avdtp_sink_render);
+	basesink_class->render_list = GST_DEBUG_FUNCPTR(
+					gst_avdtp_sink_render_list);
 	basesink_class->preroll = GST_DEBUG_FUNCPTR(
 					gst_avdtp_sink_preroll);
 	basesink_class->unlock = GST_DEBUG_FUNCPTR(
@@ -32,6 +32,7 @@
 #define RTP_SBC_PAYLOAD_HEADER_SIZE 1
 #define DEFAULT_MIN_FRAMES 0
 #define RTP_SBC_HEADER_TOTAL (12 + RTP_SBC_PAYLOAD_HEADER_SIZE)
+#define RTP_SBC_MAX_FRAME_COUNT 15
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
@@ -152,6 +153,8 @@ static gboolean gst_rtp_sbc_pay_set_caps(GstBaseRTPPayload *payload,
 				bitpool, channel_mode);
 
 	sbcpay->frame_length = frame_len;
+	sbcpay->frame_duration = gst_util_uint64_scale_int(GST_SECOND,
+						blocks * subbands, rate);
 
 	gst_basertppayload_set_options(payload, "audio", TRUE, "SBC", rate);
 
@@ -160,6 +163,18 @@ static gboolean gst_rtp_sbc_pay_set_caps(GstBaseRTPPayload *payload,
 	return gst_basertppayload_set_outcaps(payload, NULL);
 }
 
+static guint gst_rtp_sbc_pay_max_frames(GstRtpSBCPay *sbcpay)
+{
+	guint max_payload;
+
+	max_payload = gst_rtp_buffer_calc_payload_len(
+		GST_BASE_RTP_PAYLOAD_MTU(sbcpay) - RTP_SBC_PAYLOAD_HEADER_SIZE,
+		0, 0);
+
+	return MIN(max_payload / sbcpay->frame_length,
+						RTP_SBC_MAX_FRAME_COUNT);
+}
+
 static GstFlowReturn gst_rtp_sbc_pay_flush_buffers(GstRtpSBCPay *sbcpay)
 {
 	guint available;
@@ -177,9 +192,8 @@ static GstFlowReturn gst_rtp_sbc_pay_flush_buffers(GstRtpSBCPay *sbcpay)
 
 	available = gst_adapter_available(sbcpay->adapter);
 
-	max_payload = gst_rtp_buffer_calc_payload_len(
-		GST_BASE_RTP_PAYLOAD_MTU(sbcpay) - RTP_SBC_PAYLOAD_HEADER_SIZE,
-		0, 0);
+	max_payload = gst_rtp_sbc_pay_max_frames(sbcpay) *
+						sbcpay->frame_length;
 
 	max_payload = MIN(max_payload, available);
 	frame_count = max_payload / sbcpay->frame_length;
@@ -208,17 +222,110 @@ static GstFlowReturn gst_rtp_sbc_pay_flush_buffers(GstRtpSBCPay *sbcpay)
 	return gst_basertppayload_push(GST_BASE_RTP_PAYLOAD(sbcpay), outbuf);
 }
 
+/* Payloads whole frames straight from the encoder output, every packet
+ * is a buffer list group of a header only RTP buffer followed by a
+ * sub-buffer of the input so the frames are never copied. The base
+ * class stamps one RTP timestamp per list, hence one list per packet.
+ * Returns the number of bytes consumed, a short tail is left to the
+ * adapter. */
+static guint gst_rtp_sbc_pay_push_list(GstRtpSBCPay *sbcpay,
+					GstBuffer *buffer, GstFlowReturn *res)
+{
+	guint max_frames, frames, size, offset = 0;
+
+	max_frames = gst_rtp_sbc_pay_max_frames(sbcpay);
+	if (max_frames == 0)
+		return 0;
+
+	while (offset < GST_BUFFER_SIZE(buffer) && *res == GST_FLOW_OK) {
+		GstBufferList *list;
+		GstBufferListIterator *it;
+		GstBuffer *header, *data;
+		struct rtp_payload *payload;
+
+		frames = MIN(max_frames, (GST_BUFFER_SIZE(buffer) - offset) /
+							sbcpay->frame_length);
+		size = frames * sbcpay->frame_length;
+
+		/* Leave short packets to the adapter like min-frames asks */
+		if (frames < max_frames && frames <= sbcpay->min_frames)
+			break;
+
+		header = gst_rtp_buffer_new_allocate(
+					RTP_SBC_PAYLOAD_HEADER_SIZE, 0, 0);
+		gst_rtp_buffer_set_payload_type(header,
+					GST_BASE_RTP_PAYLOAD_PT(sbcpay));
+
+		payload = (struct rtp_payload *)
+					gst_rtp_buffer_get_payload(header);
+		memset(payload, 0, sizeof(struct rtp_payload));
+		payload->frame_count = frames;
+
+		GST_BUFFER_TIMESTAMP(header) = sbcpay->timestamp;
+		if (GST_CLOCK_TIME_IS_VALID(sbcpay->timestamp))
+			GST_BUFFER_TIMESTAMP(header) += sbcpay->frame_duration *
+					(offset / sbcpay->frame_length);
+
+		data = gst_buffer_create_sub(buffer, offset, size);
+
+		list = gst_buffer_list_new();
+		it = gst_buffer_list_iterate(list);
+		gst_buffer_list_iterator_add_group(it);
+		gst_buffer_list_iterator_add(it, header);
+		gst_buffer_list_iterator_add(it, data);
+		gst_buffer_list_iterator_free(it);
+
+		GST_DEBUG_OBJECT(sbcpay, "Pushing %d bytes without copy", size);
+
+		*res = gst_basertppayload_push_list(
+					GST_BASE_RTP_PAYLOAD(sbcpay), list);
+
+		offset += size;
+	}
+
+	return offset;
+}
+
 static GstFlowReturn gst_rtp_sbc_pay_handle_buffer(GstBaseRTPPayload *payload,
 			GstBuffer *buffer)
 {
 	GstRtpSBCPay *sbcpay;
-	guint available;
+	GstFlowReturn res = GST_FLOW_OK;
+	guint available, consumed;
 
 	/* FIXME check for negotiation */
 
 	sbcpay = GST_RTP_SBC_PAY(payload);
 	sbcpay->timestamp = GST_BUFFER_TIMESTAMP(buffer);
 
+	/* Multi frame buffers from sbcenc are payloaded in place as long
+	 * as no earlier frames are waiting */
+	if (sbcpay->frame_length > 0 &&
+			gst_adapter_available(sbcpay->adapter) == 0 &&
+			GST_BUFFER_SIZE(buffer) % sbcpay->frame_length == 0) {
+		consumed = gst_rtp_sbc_pay_push_list(sbcpay, buffer, &res);
+		if (consumed == GST_BUFFER_SIZE(buffer) ||
+						res != GST_FLOW_OK) {
+			gst_buffer_unref(buffer);
+			return res;
+		}
+
+		if (consumed > 0) {
+			GstBuffer *rest;
+
+			rest = gst_buffer_create_sub(buffer, consumed,
+					GST_BUFFER_SIZE(buffer) - consumed);
+			GST_BUFFER_TIMESTAMP(rest) = GST_CLOCK_TIME_NONE;
+			if (GST_CLOCK_TIME_IS_VALID(sbcpay->timestamp))
+				GST_BUFFER_TIMESTAMP(rest) = sbcpay->timestamp +
+					sbcpay->frame_duration *
+					(consumed / sbcpay->frame_length);
+			sbcpay->timestamp = GST_BUFFER_TIMESTAMP(rest);
+			gst_buffer_unref(buffer);
+			buffer = rest;
+		}
+	}
+
 	gst_adapter_push(sbcpay->adapter, buffer);
 
 	available = gst_adapter_available(sbcpay->adapter);
@@ -339,6 +446,7 @@ static void gst_rtp_sbc_pay_init(GstRtpSBCPay *self, GstRtpSBCPayClass *klass)
 	self->adapter = gst_adapter_new();
 	self->frame_length = 0;
 	self->timestamp = 0;
+	self->frame_duration = 0;
 
 	self->min_frames = DEFAULT_MIN_FRAMES;
 }
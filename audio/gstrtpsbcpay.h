@@ -51,6 +51,7 @@ struct _GstRtpSBCPay {
 	GstClockTime timestamp;
 
 	guint frame_length;
+	GstClockTime frame_duration;
 
 	guint min_frames;
 };
@@ -43,6 +43,8 @@
 #define SBC_ENC_BITPOOL_MAX 64
 #define SBC_ENC_BITPOOL_MAX_STR "64"
 
+#define SBC_ENC_DEFAULT_MAX_BUFFER_SIZE 0
+
 GST_DEBUG_CATEGORY_STATIC(sbc_enc_debug);
 #define GST_CAT_DEFAULT sbc_enc_debug
 
@@ -131,7 +133,8 @@ enum {
 	PROP_ALLOCATION,
 	PROP_BLOCKS,
 	PROP_SUBBANDS,
-	PROP_BITPOOL
+	PROP_BITPOOL,
+	PROP_MAX_BUFFER_SIZE
 };
 
 GST_BOILERPLATE(GstSbcEnc, gst_sbc_enc, GstElement, GST_TYPE_ELEMENT);
@@ -150,7 +153,19 @@ static GstStaticPadTemplate sbc_enc_sink_factory =
 				"endianness = (int) BYTE_ORDER, "
 				"signed = (boolean) true, "
 				"width = (int) 16, "
-				"depth = (int) 16"));
+				"depth = (int) 16; "
+				"audio/x-raw-int, "
+				"rate = (int) { 16000, 32000, 44100, 48000 }, "
+				"channels = (int) [ 1, 2 ], "
+				"endianness = (int) BYTE_ORDER, "
+				"signed = (boolean) true, "
+				"width = (int) 32, "
+				"depth = (int) { 24, 32 }; "
+				"audio/x-raw-float, "
+				"rate = (int) { 16000, 32000, 44100, 48000 }, "
+				"channels = (int) [ 1, 2 ], "
+				"endianness = (int) BYTE_ORDER, "
+				"width = (int) 32"));
 
 static GstStaticPadTemplate sbc_enc_src_factory =
 	GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS,
@@ -286,7 +301,7 @@ static gboolean sbc_enc_sink_setcaps(GstPad *pad, GstCaps *caps)
 	GstSbcEnc *enc;
 	GstStructure *structure;
 	GstCaps *src_caps;
-	gint rate, channels;
+	gint rate, channels, depth;
 	gboolean res;
 
 	enc = GST_SBC_ENC(GST_PAD_PARENT(pad));
@@ -297,6 +312,19 @@ static gboolean sbc_enc_sink_setcaps(GstPad *pad, GstCaps *caps)
 	if (!gst_structure_get_int(structure, "channels", &channels))
 		return FALSE;
 
+	/* wider samples are converted while encoding, which saves
+	 * an audioconvert element in front of the encoder */
+	if (gst_structure_has_name(structure, "audio/x-raw-float"))
+		enc->format = SBC_FORMAT_FLOAT;
+	else if (!gst_structure_get_int(structure, "depth", &depth))
+		return FALSE;
+	else if (depth == 24)
+		enc->format = SBC_FORMAT_S24;
+	else if (depth == 32)
+		enc->format = SBC_FORMAT_S32;
+	else
+		enc->format = SBC_FORMAT_S16;
+
 	enc->rate = rate;
 	enc->channels = channels;
 
@@ -320,6 +348,8 @@ gboolean gst_sbc_enc_fill_sbc_params(GstSbcEnc *enc, GstCaps *caps)
 	if (!gst_sbc_util_fill_sbc_params(&enc->sbc, caps))
 		return FALSE;
 
+	enc->sbc.format = enc->format;
+
 	if (enc->rate != 0 && gst_sbc_parse_rate_from_sbc(enc->sbc.frequency)
 				 != enc->rate)
 		goto fail;
@@ -375,34 +405,59 @@ static GstFlowReturn sbc_enc_chain(GstPad *pad, GstBuffer *buffer)
 		GstBuffer *output;
 		GstCaps *caps;
 		const guint8 *data;
+		guint frames, offset, step, size;
 		gint consumed;
+		size_t written;
+
+		/* Encode every complete frame in the adapter at once */
+		frames = gst_adapter_available(adapter) / enc->codesize;
 
 		caps = GST_PAD_CAPS(enc->srcpad);
 		res = gst_pad_alloc_buffer_and_set_caps(enc->srcpad,
 						GST_BUFFER_OFFSET_NONE,
-						enc->frame_length, caps,
+						frames * enc->frame_length, caps,
 						&output);
 		if (res != GST_FLOW_OK)
 			goto done;
 
-		data = gst_adapter_peek(adapter, enc->codesize);
+		data = gst_adapter_peek(adapter, frames * enc->codesize);
 
-		consumed = sbc_encode(&enc->sbc, (gpointer) data,
-					enc->codesize,
+		consumed = sbc_encode_multi(&enc->sbc, (gpointer) data,
+					frames * enc->codesize,
 					GST_BUFFER_DATA(output),
-					GST_BUFFER_SIZE(output), NULL);
+					GST_BUFFER_SIZE(output), &written);
 		if (consumed <= 0) {
 			GST_DEBUG_OBJECT(enc, "comsumed < 0, codesize: %d",
 					enc->codesize);
+			gst_buffer_unref(output);
 			break;
 		}
 		gst_adapter_flush(adapter, consumed);
 
-		GST_BUFFER_TIMESTAMP(output) = GST_BUFFER_TIMESTAMP(buffer);
-		/* we have only 1 frame */
-		GST_BUFFER_DURATION(output) = enc->frame_duration;
+		/* Push the frames downstream one per buffer, or as many
+		 * whole frames as fit in max-buffer-size */
+		step = 1;
+		if (enc->max_buffer_size > (guint) enc->frame_length)
+			step = enc->max_buffer_size / enc->frame_length;
+
+		for (offset = 0; offset < written && res == GST_FLOW_OK;
+					offset += size) {
+			GstBuffer *frame;
+
+			size = MIN(step * enc->frame_length, written - offset);
+
+			frame = gst_buffer_create_sub(output, offset, size);
+			gst_buffer_set_caps(frame, caps);
+
+			GST_BUFFER_TIMESTAMP(frame) =
+					GST_BUFFER_TIMESTAMP(buffer);
+			GST_BUFFER_DURATION(frame) = enc->frame_duration *
+						(size / enc->frame_length);
 
-		res = gst_pad_push(enc->srcpad, output);
+			res = gst_pad_push(enc->srcpad, frame);
+		}
+
+		gst_buffer_unref(output);
 
 		if (res != GST_FLOW_OK)
 			goto done;
@@ -484,6 +539,9 @@ static void gst_sbc_enc_set_property(GObject *object, guint prop_id,
 	case PROP_BITPOOL:
 		enc->bitpool = g_value_get_int(value);
 		break;
+	case PROP_MAX_BUFFER_SIZE:
+		enc->max_buffer_size = g_value_get_uint(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -511,6 +569,9 @@ static void gst_sbc_enc_get_property(GObject *object, guint prop_id,
 	case PROP_BITPOOL:
 		g_value_set_int(value, enc->bitpool);
 		break;
+	case PROP_MAX_BUFFER_SIZE:
+		g_value_set_uint(value, enc->max_buffer_size);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -556,6 +617,13 @@ static void gst_sbc_enc_class_init(GstSbcEncClass *klass)
 				SBC_ENC_BITPOOL_AUTO, SBC_ENC_BITPOOL_MAX,
 				SBC_ENC_BITPOOL_AUTO, G_PARAM_READWRITE));
 
+	g_object_class_install_property(object_class, PROP_MAX_BUFFER_SIZE,
+			g_param_spec_uint("max-buffer-size", "Max buffer size",
+				"Push as many whole frames per buffer as fit "
+				"in this size (0 for one frame per buffer)",
+				0, G_MAXUINT, SBC_ENC_DEFAULT_MAX_BUFFER_SIZE,
+				G_PARAM_READWRITE));
+
 	GST_DEBUG_CATEGORY_INIT(sbc_enc_debug, "sbcenc", 0,
 						"SBC encoding element");
 }
@@ -586,6 +654,7 @@ static void gst_sbc_enc_init(GstSbcEnc *self, GstSbcEncClass *klass)
 	self->rate = SBC_ENC_DEFAULT_RATE;
 	self->channels = SBC_ENC_DEFAULT_CHANNELS;
 	self->bitpool = SBC_ENC_BITPOOL_AUTO;
+	self->max_buffer_size = SBC_ENC_DEFAULT_MAX_BUFFER_SIZE;
 
 	self->frame_length = 0;
 	self->frame_duration = 0;
@@ -56,6 +56,8 @@ struct _GstSbcEnc {
 	gint allocation;
 	gint subbands;
 	gint bitpool;
+	gint format;
+	guint max_buffer_size;
 
 	guint codesize;
 	gint frame_length;
@@ -55,6 +55,18 @@
 				on IPC close or appl crash
   <Moves to idle>
 
+  The open, configuration and start steps can also be done with a single
+  request, the response carries the link MTU and is followed by the new
+  stream indication exactly like for BT_START_STREAM_REQ:
+
+				on snd_pcm_hw_params
+				<--BT_SETUP_STREAM_REQ
+
+  <Moves to streaming state>
+  BT_SETUP_STREAM_RSP-->
+
+  BT_NEW_STREAM_IND -->
+
  */
 
 #ifndef BT_AUDIOCLIENT_H
@@ -102,6 +114,7 @@ typedef struct {
 #define BT_CLOSE			6
 #define BT_CONTROL			7
 #define BT_DELAY_REPORT			8
+#define BT_SETUP_STREAM			9
 
 #define BT_CAPABILITIES_TRANSPORT_A2DP	0
 #define BT_CAPABILITIES_TRANSPORT_SCO	1
@@ -335,6 +348,23 @@ struct bt_delay_report_ind {
 	uint16_t		delay;
 } __attribute__ ((packed));
 
+/* BT_OPEN, BT_SET_CONFIGURATION and BT_START_STREAM in one request, an
+ * error is reported as BT_SETUP_STREAM whichever step failed */
+struct bt_setup_stream_req {
+	bt_audio_msg_header_t	h;
+	char			source[18];	/* Address of the local Device */
+	char			destination[18];/* Address of the remote Device */
+	char			object[128];	/* DBus object path */
+	uint8_t			lock;		/* Requested lock */
+	codec_capabilities_t	codec;		/* Requested codec, includes
+						 * the seid to lock */
+} __attribute__ ((packed));
+
+struct bt_setup_stream_rsp {
+	bt_audio_msg_header_t	h;
+	uint16_t		link_mtu;	/* Max length that transport supports */
+} __attribute__ ((packed));
+
 /* Function declaration */
 
 /* Opens a connection to the audio service: return a socket descriptor */
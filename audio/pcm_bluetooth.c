@@ -26,9 +26,13 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <sys/time.h>
 #include <pthread.h>
@@ -36,6 +40,7 @@
 #include <limits.h>
 
 #include <netinet/in.h>
+#include <linux/sockios.h>
 
 #include <alsa/asoundlib.h>
 #include <alsa/pcm_external.h>
@@ -46,11 +51,15 @@
 
 //#define ENABLE_DEBUG
 
-#define UINT_SECS_MAX (UINT_MAX / 1000000 - 1)
+#define BUFFER_SIZE 2048
 
-#define MIN_PERIOD_TIME 1
+#define JITTER_PACKETS 8		/* Media packets kept for reordering */
 
-#define BUFFER_SIZE 2048
+#define SEND_PACKETS 8			/* Media packets kept while stalled */
+
+#define MAX_SINKS 4			/* Devices an A2DP playback is sent to */
+
+#define PCM_BUFFER_SIZE 8192
 
 #ifdef ENABLE_DEBUG
 #define DBG(fmt, arg...)  printf("DEBUG: %s: " fmt "\n" , __FUNCTION__ , ## arg)
@@ -81,34 +90,76 @@
 #define MAX_BITPOOL 64
 #define MIN_BITPOOL 2
 
-/* adapted from glibc sys/time.h timersub() macro */
-#define priv_timespecsub(a, b, result)					\
-	do {								\
-		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
-		(result)->tv_nsec = (a)->tv_nsec - (b)->tv_nsec;	\
-		if ((result)->tv_nsec < 0) {				\
-			--(result)->tv_sec;				\
-			(result)->tv_nsec += 1000000000;		\
-		}							\
-	} while (0)
+/* Packets that have to leave the socket queue short before the bitpool
+ * is raised again by one step */
+#define BITPOOL_RAISE_PACKETS 32
+
+/* Interval at which the hw thread moves its point of reference, so
+ * that the frame counts it keeps fit in an unsigned long */
+#define HW_CLOCK_REBASE 3600
+
+struct bluetooth_a2dp_header {
+	struct rtp_header rtp;
+	struct rtp_payload payload;
+} __attribute__ ((packed));
+
+struct bluetooth_a2dp_packet {
+	uint16_t seq_num;
+	uint32_t timestamp;
+	unsigned int frame_count;
+	unsigned int len;			/* Zero when the slot is free */
+	uint8_t data[BUFFER_SIZE];		/* SBC frames of the packet */
+};
+
+struct bluetooth_a2dp_sink {
+	char device[18];			/* Address of the remote Device */
+	int server_fd;				/* Audio daemon connection */
+	int stream_fd;				/* Media transport */
+	uint8_t seid;
+	unsigned int link_mtu;
+	uint16_t seq_num;			/* Sequence number of its next packet */
+	unsigned int send_head;			/* Oldest packet not sent to it */
+};
 
 struct bluetooth_a2dp {
 	sbc_capabilities_t sbc_capabilities;
 	sbc_t sbc;				/* Codec data */
 	int sbc_initialized;			/* Keep track if the encoder is initialized */
 	unsigned int codesize;			/* SBC codesize */
+	unsigned int frame_length;		/* SBC frame length */
 	int samples;				/* Number of encoded samples */
-	uint8_t buffer[BUFFER_SIZE];		/* Codec transfer buffer */
-	unsigned int count;			/* Codec transfer buffer counter */
+
+	/* Playback only, every packet is encoded once and sent to all the
+	 * sinks, sinks[0] being the main device */
+	struct bluetooth_a2dp_packet send_queue[SEND_PACKETS];
+	unsigned int send_tail;			/* Packet being filled */
+	struct bluetooth_a2dp_sink sinks[MAX_SINKS];
+	unsigned int num_sinks;
 
 	int nsamples;				/* Cumulative number of codec samples */
-	uint16_t seq_num;			/* Cumulative packet sequence */
-	int frame_count;			/* Current frames in buffer*/
+
+	uint8_t min_bitpool;			/* Negotiated bitpool range */
+	uint8_t max_bitpool;
+	int good_packets;			/* Sent since the last bitpool change */
+
+	/* Capture only */
+	struct bluetooth_a2dp_packet jitter[JITTER_PACKETS]; /* By seq_num */
+	unsigned int jitter_count;		/* Packets in the jitter buffer */
+	int jitter_started;			/* next_seq is valid */
+	uint16_t next_seq;			/* Packet to decode next */
+	unsigned int next_offset;		/* Bytes of it already decoded */
+	uint32_t next_timestamp;		/* Timestamp of the next sample */
+	uint32_t recv_timestamp;		/* End of the newest packet */
+	uint8_t pcm[PCM_BUFFER_SIZE];		/* Decoded samples */
+	unsigned int pcm_count;
+	unsigned int pcm_offset;
 };
 
 struct bluetooth_alsa_config {
 	char device[18];		/* Address of the remote Device */
 	int has_device;
+	char extra_device[MAX_SINKS - 1][18];	/* A2DP playback only */
+	int num_extra_devices;
 	uint8_t transport;		/* Requested transport */
 	int has_transport;
 	uint16_t rate;
@@ -139,14 +190,19 @@ struct bluetooth_data {
 	struct bluetooth_a2dp a2dp;			/* A2DP data */
 
 	pthread_t hw_thread;				/* Makes virtual hw pointer move */
+	int timer_fd;					/* Clock of the hw thread */
 	int pipefd[2];					/* Inter thread communication */
 	int stopped;
 	sig_atomic_t reset;				/* Request XRUN handling */
+	int stream_ready;				/* Started by hw_params */
+	volatile uint16_t remote_delay;			/* Sink delay in 1/10 ms */
 };
 
 static int audioservice_send(int sk, const bt_audio_msg_header_t *msg);
+static int audioservice_recv(int sk, bt_audio_msg_header_t *inmsg);
 static int audioservice_expect(int sk, bt_audio_msg_header_t *outmsg,
 							int expected_type);
+static void bluetooth_a2dp_capture_reset(struct bluetooth_a2dp *a2dp);
 
 static int bluetooth_start(snd_pcm_ioplug_t *io)
 {
@@ -162,89 +218,222 @@ static int bluetooth_stop(snd_pcm_ioplug_t *io)
 	return 0;
 }
 
+/*
+ * Returns the number of frames still waiting in the socket send queue,
+ * A2DP frames are converted using the encoded size of one SBC frame.
+ */
+static snd_pcm_uframes_t bluetooth_queued_frames(struct bluetooth_data *data,
+							unsigned int bytes)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int frame_size = data->io.channels * 2;
+
+	if (data->transport != BT_CAPABILITIES_TRANSPORT_A2DP)
+		return bytes / frame_size;
+
+	if (a2dp->frame_length == 0)
+		return 0;
+
+	return (uint64_t) bytes * (a2dp->codesize / frame_size) /
+							a2dp->frame_length;
+}
+
+/* Picks up what the daemon sends on its own while playing, only the
+ * delay reports are of interest */
+static void bluetooth_read_indication(struct bluetooth_data *data)
+{
+	char buf[BT_SUGGESTED_BUFFER_SIZE];
+	struct bt_delay_report_ind *ind = (void *) buf;
+	int state;
+
+	/* a message read halfway would break the daemon connection */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+	if (audioservice_recv(data->server.fd, &ind->h) == 0 &&
+				ind->h.type == BT_INDICATION &&
+				ind->h.name == BT_DELAY_REPORT) {
+		DBG("Delay report %u.%ums", ind->delay / 10, ind->delay % 10);
+		data->remote_delay = ind->delay;
+	}
+
+	pthread_setcancelstate(state, NULL);
+}
+
 static void *playback_hw_thread(void *param)
 {
 	struct bluetooth_data *data = param;
-	unsigned int prev_periods;
-	double period_time;
+	snd_pcm_uframes_t tick, max_queued, prev_pos, skew, periods;
+	snd_pcm_sframes_t base;
+	struct itimerspec timer;
 	struct timespec start;
-	struct pollfd fds[2];
-	int poll_timeout;
+	struct pollfd fds[3];
+	uint64_t interval;
+	int poll_timeout, restart = 1;
 
+	/* the server only sends delay reports while playing */
 	data->server.events = POLLIN;
 	/* note: only errors for data->stream.events */
 
 	fds[0] = data->server;
 	fds[1] = data->stream;
+	fds[2].fd = data->timer_fd;
+	fds[2].events = POLLIN;
 
-	prev_periods = 0;
-	period_time = 1000000.0 * data->io.period_size / data->io.rate;
-	if (period_time > (int) (MIN_PERIOD_TIME * 1000))
-		poll_timeout = (int) (period_time / 1000.0f);
-	else
-		poll_timeout = MIN_PERIOD_TIME;
+	/* advance the pointer four times per period, but not more often
+	 * than once per millisecond */
+	tick = MAX(data->io.period_size / 4, data->io.rate / 1000);
+	interval = (uint64_t) tick * 1000000000 / data->io.rate;
+	poll_timeout = MAX(1000 * data->io.period_size / data->io.rate, 1);
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	/* the socket should never hold more than two packets, anything
+	 * above that means the link drains slower than our clock */
+	max_queued = bluetooth_queued_frames(data, 2 * data->link_mtu);
 
-	while (1) {
-		unsigned int dtime, periods;
-		struct timespec cur, delta;
-		int ret;
+	base = prev_pos = skew = periods = 0;
 
-		if (data->stopped)
+	while (1) {
+		snd_pcm_uframes_t pos, queued;
+		struct timespec cur;
+		uint64_t expired, sec;
+		long nsec;
+		int ret, outq;
+
+		if (data->stopped) {
+			/* stop ticking, the clock restarts with playback */
+			if (!restart) {
+				memset(&timer, 0, sizeof(timer));
+				timerfd_settime(data->timer_fd, 0, &timer,
+									NULL);
+				restart = 1;
+			}
 			goto iter_sleep;
+		}
 
-		if (data->reset) {
-			DBG("Handle XRUN in hw-thread.");
+		if (data->reset || restart) {
+			DBG("Restart hw pointer clock.");
 			data->reset = 0;
+			restart = 0;
+
 			clock_gettime(CLOCK_MONOTONIC, &start);
-			prev_periods = 0;
+			base = data->hw_ptr;
+			prev_pos = skew = periods = 0;
+
+			/* absolute deadlines keep the ticks from drifting
+			 * however late the thread gets scheduled */
+			timer.it_value = start;
+			timer.it_value.tv_nsec += interval;
+			while (timer.it_value.tv_nsec >= 1000000000) {
+				timer.it_value.tv_nsec -= 1000000000;
+				timer.it_value.tv_sec++;
+			}
+			timer.it_interval.tv_sec = interval / 1000000000;
+			timer.it_interval.tv_nsec = interval % 1000000000;
+
+			if (timerfd_settime(data->timer_fd, TFD_TIMER_ABSTIME,
+							&timer, NULL) < 0) {
+				SNDERR("timerfd_settime: %s (%d)",
+						strerror(errno), errno);
+				break;
+			}
+
+			goto iter_sleep;
 		}
 
 		clock_gettime(CLOCK_MONOTONIC, &cur);
 
-		priv_timespecsub(&cur, &start, &delta);
+		/* whole seconds and the rest apart, so that no product
+		 * gets anywhere near overflowing */
+		sec = cur.tv_sec - start.tv_sec;
+		nsec = cur.tv_nsec - start.tv_nsec;
+		if (nsec < 0) {
+			nsec += 1000000000;
+			sec--;
+		}
 
-		dtime = delta.tv_sec * 1000000 + delta.tv_nsec / 1000;
-		periods = 1.0 * dtime / period_time;
+		pos = sec * data->io.rate +
+			(uint64_t) nsec * data->io.rate / 1000000000 - skew;
+
+		/* hold the pointer back while the link lags behind, and
+		 * catch up at half speed once the socket runs dry */
+		if (ioctl(data->stream.fd, SIOCOUTQ, &outq) == 0 && outq >= 0) {
+			queued = bluetooth_queued_frames(data, outq);
+
+			if (queued > max_queued && pos > prev_pos) {
+				snd_pcm_uframes_t hold = MIN(pos - prev_pos,
+							queued - max_queued);
+				skew += hold;
+				pos -= hold;
+			} else if (queued == 0 && skew > 0) {
+				snd_pcm_uframes_t gain = MIN(skew, tick / 2);
+				skew -= gain;
+				pos += gain;
+			}
+		}
 
-		if (periods > prev_periods) {
+		if (pos > prev_pos) {
 			char c = 'w';
-			int frags = periods - prev_periods, n;
-
-			data->hw_ptr += frags *	data->io.period_size;
-			data->hw_ptr %= data->io.buffer_size;
-
-			for (n = 0; n < frags; n++) {
-				/* Notify user that hardware pointer
-				 * has moved * */
-				if (write(data->pipefd[1], &c, 1) < 0)
-					pthread_testcancel();
+			int pending;
+
+			data->hw_ptr = (base + pos) % data->io.buffer_size;
+			prev_pos = pos;
+
+			/* Notify user that hardware pointer has moved by a
+			 * period, a single byte in the pipe is enough */
+			if (pos / data->io.period_size > periods) {
+				periods = pos / data->io.period_size;
+
+				if (ioctl(data->pipefd[0], FIONREAD,
+							&pending) < 0 ||
+							pending == 0) {
+					if (write(data->pipefd[1], &c, 1) < 0)
+						pthread_testcancel();
+				}
 			}
+		}
 
-			/* Reset point of reference to avoid too big values
-			 * that wont fit an unsigned int */
-			if ((unsigned int) delta.tv_sec < UINT_SECS_MAX)
-				prev_periods = periods;
-			else {
-				prev_periods = 0;
-				clock_gettime(CLOCK_MONOTONIC, &start);
-			}
+		/* Reset point of reference to avoid too big values, by
+		 * whole seconds so the pointer keeps its exact place */
+		if (prev_pos >= (snd_pcm_uframes_t) HW_CLOCK_REBASE *
+							data->io.rate) {
+			snd_pcm_uframes_t shift = (snd_pcm_uframes_t)
+					HW_CLOCK_REBASE * data->io.rate;
+
+			start.tv_sec += HW_CLOCK_REBASE;
+			base = (base + shift) % data->io.buffer_size;
+			prev_pos -= shift;
+			periods = prev_pos / data->io.period_size;
 		}
 
 iter_sleep:
-		/* sleep up to one period interval */
-		ret = poll(fds, 2, poll_timeout);
+		/* sleep until the next tick, or check once per period
+		 * whether playback has been started again */
+		ret = poll(fds, 3, data->stopped ? poll_timeout : -1);
 
 		if (ret < 0) {
 			SNDERR("poll error: %s (%d)", strerror(errno), errno);
 			if (errno != EINTR)
 				break;
 		} else if (ret > 0) {
+			if (fds[2].revents & POLLIN) {
+				if (read(data->timer_fd, &expired,
+						sizeof(expired)) < 0 &&
+						errno != EAGAIN)
+					break;
+			}
+
+			if (fds[0].revents & POLLIN) {
+				bluetooth_read_indication(data);
+				fds[0].revents &= ~POLLIN;
+			}
+
 			ret = (fds[0].revents) ? 0 : 1;
-			SNDERR("poll fd %d revents %d", ret, fds[ret].revents);
-			if (fds[ret].revents & (POLLERR | POLLHUP | POLLNVAL))
-				break;
+			if (fds[ret].revents) {
+				SNDERR("poll fd %d revents %d", ret,
+							fds[ret].revents);
+				if (fds[ret].revents &
+						(POLLERR | POLLHUP | POLLNVAL))
+					break;
+			}
 		}
 
 		/* Offer opportunity to be canceled by main thread */
@@ -255,6 +444,17 @@ iter_sleep:
 	pthread_exit(NULL);
 }
 
+/* The hw thread reads the indications from the server socket, it must
+ * not be running while the main thread exchanges messages on it */
+static void bluetooth_stop_hw_thread(struct bluetooth_data *data)
+{
+	if (data->hw_thread) {
+		pthread_cancel(data->hw_thread);
+		pthread_join(data->hw_thread, 0);
+		data->hw_thread = 0;
+	}
+}
+
 static int bluetooth_playback_start(snd_pcm_ioplug_t *io)
 {
 	struct bluetooth_data *data = io->private_data;
@@ -300,11 +500,18 @@ static void bluetooth_exit(struct bluetooth_data *data)
 	if (data->stream.fd >= 0)
 		close(data->stream.fd);
 
-	if (data->hw_thread) {
-		pthread_cancel(data->hw_thread);
-		pthread_join(data->hw_thread, 0);
+	while (a2dp->num_sinks > 1) {
+		struct bluetooth_a2dp_sink *sink =
+					&a2dp->sinks[--a2dp->num_sinks];
+
+		if (sink->stream_fd >= 0)
+			close(sink->stream_fd);
+
+		bt_audio_service_close(sink->server_fd);
 	}
 
+	bluetooth_stop_hw_thread(data);
+
 	if (a2dp->sbc_initialized)
 		sbc_finish(&a2dp->sbc);
 
@@ -314,6 +521,9 @@ static void bluetooth_exit(struct bluetooth_data *data)
 	if (data->pipefd[1] > 0)
 		close(data->pipefd[1]);
 
+	if (data->timer_fd >= 0)
+		close(data->timer_fd);
+
 	free(data);
 }
 
@@ -328,14 +538,89 @@ static int bluetooth_close(snd_pcm_ioplug_t *io)
 	return 0;
 }
 
-static int bluetooth_prepare(snd_pcm_ioplug_t *io)
+/* Starts the stream set up on the daemon connection sk and returns the
+ * media transport filedescriptor */
+static int bluetooth_start_stream(int sk)
 {
-	struct bluetooth_data *data = io->private_data;
-	char c = 'w';
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
 	struct bt_start_stream_req *req = (void *) buf;
 	struct bt_start_stream_rsp *rsp = (void *) buf;
 	struct bt_new_stream_ind *ind = (void *) buf;
+	int fd, err;
+
+	/* send start */
+	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
+	req->h.type = BT_REQUEST;
+	req->h.name = BT_START_STREAM;
+	req->h.length = sizeof(*req);
+
+	err = audioservice_send(sk, &req->h);
+	if (err < 0)
+		return err;
+
+	rsp->h.length = sizeof(*rsp);
+	err = audioservice_expect(sk, &rsp->h, BT_START_STREAM);
+	if (err < 0)
+		return err;
+
+	ind->h.length = sizeof(*ind);
+	err = audioservice_expect(sk, &ind->h, BT_NEW_STREAM);
+	if (err < 0)
+		return err;
+
+	fd = bt_audio_service_get_data_fd(sk);
+	if (fd < 0)
+		return -errno;
+
+	return fd;
+}
+
+static void bluetooth_a2dp_remove_sink(struct bluetooth_a2dp *a2dp,
+							unsigned int i)
+{
+	struct bluetooth_a2dp_sink *sink = &a2dp->sinks[i];
+
+	SNDERR("Not streaming to %s anymore", sink->device);
+
+	if (sink->stream_fd >= 0)
+		close(sink->stream_fd);
+
+	bt_audio_service_close(sink->server_fd);
+
+	a2dp->num_sinks--;
+	memmove(sink, sink + 1, (a2dp->num_sinks - i) * sizeof(*sink));
+}
+
+/* Starts the streams of the additional playback devices, a device
+ * failing to start is dropped without affecting the others */
+static void bluetooth_a2dp_start_sinks(struct bluetooth_data *data,
+							struct timeval *t)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int i;
+
+	a2dp->sinks[0].stream_fd = data->stream.fd;
+
+	for (i = 1; i < a2dp->num_sinks; i++) {
+		struct bluetooth_a2dp_sink *sink = &a2dp->sinks[i];
+
+		if (sink->stream_fd >= 0)
+			close(sink->stream_fd);
+
+		sink->stream_fd = bluetooth_start_stream(sink->server_fd);
+		if (sink->stream_fd < 0 ||
+				setsockopt(sink->stream_fd, SOL_SOCKET,
+					SO_SNDTIMEO, t, sizeof(*t)) < 0) {
+			bluetooth_a2dp_remove_sink(a2dp, i--);
+			continue;
+		}
+	}
+}
+
+static int bluetooth_prepare(snd_pcm_ioplug_t *io)
+{
+	struct bluetooth_data *data = io->private_data;
+	char c = 'w';
 	uint32_t period_count = io->buffer_size / io->period_size;
 	int opt_name, err;
 	struct timeval t = { 0, period_count };
@@ -347,11 +632,7 @@ static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 
 	/* As we're gonna receive messages on the server socket, we have to stop the
 	   hw thread that is polling on it, if any */
-	if (data->hw_thread) {
-		pthread_cancel(data->hw_thread);
-		pthread_join(data->hw_thread, 0);
-		data->hw_thread = 0;
-	}
+	bluetooth_stop_hw_thread(data);
 
 	if (io->stream == SND_PCM_STREAM_PLAYBACK)
 		/* If not null for playback, xmms doesn't display time
@@ -362,43 +643,37 @@ static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 		 * If it is, capture won't start */
 		data->hw_ptr = io->period_size;
 
-	/* send start */
-	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
-	req->h.type = BT_REQUEST;
-	req->h.name = BT_START_STREAM;
-	req->h.length = sizeof(*req);
-
-	err = audioservice_send(data->server.fd, &req->h);
-	if (err < 0)
-		return err;
-
-	rsp->h.length = sizeof(*rsp);
-	err = audioservice_expect(data->server.fd, &rsp->h,
-					BT_START_STREAM);
-	if (err < 0)
-		return err;
-
-	ind->h.length = sizeof(*ind);
-	err = audioservice_expect(data->server.fd, &ind->h,
-					BT_NEW_STREAM);
-	if (err < 0)
-		return err;
-
-	if (data->stream.fd >= 0)
-		close(data->stream.fd);
+	/* The first prepare after hw_params finds the stream already
+	 * started by BT_SETUP_STREAM */
+	if (data->stream_ready)
+		data->stream_ready = 0;
+	else {
+		if (data->stream.fd >= 0)
+			close(data->stream.fd);
 
-	data->stream.fd = bt_audio_service_get_data_fd(data->server.fd);
-	if (data->stream.fd < 0) {
-		return -errno;
+		data->stream.fd = bluetooth_start_stream(data->server.fd);
+		if (data->stream.fd < 0)
+			return data->stream.fd;
 	}
 
 	if (data->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
 		opt_name = (io->stream == SND_PCM_STREAM_PLAYBACK) ?
 						SO_SNDTIMEO : SO_RCVTIMEO;
 
+		/* waiting for a missing packet longer than a period
+		 * would only make the capture fall behind */
+		if (io->stream != SND_PCM_STREAM_PLAYBACK) {
+			bluetooth_a2dp_capture_reset(&data->a2dp);
+			t.tv_usec = (uint64_t) io->period_size * 1000000 /
+								io->rate;
+		}
+
 		if (setsockopt(data->stream.fd, SOL_SOCKET, opt_name, &t,
 							sizeof(t)) < 0)
 			return -errno;
+
+		if (io->stream == SND_PCM_STREAM_PLAYBACK)
+			bluetooth_a2dp_start_sinks(data, &t);
 	} else {
 		opt_name = (io->stream == SND_PCM_STREAM_PLAYBACK) ?
 						SCO_TXBUFS : SCO_RXBUFS;
@@ -439,6 +714,8 @@ static int bluetooth_hsp_hw_params(snd_pcm_ioplug_t *io,
 	DBG("Preparing with io->period_size=%lu io->buffer_size=%lu",
 					io->period_size, io->buffer_size);
 
+	bluetooth_stop_hw_thread(data);
+
 	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
 	open_req->h.type = BT_REQUEST;
 	open_req->h.name = BT_OPEN;
@@ -620,6 +897,7 @@ static int bluetooth_a2dp_init(struct bluetooth_data *data,
 static void bluetooth_a2dp_setup(struct bluetooth_a2dp *a2dp)
 {
 	sbc_capabilities_t active_capabilities = a2dp->sbc_capabilities;
+	unsigned int i;
 
 	if (a2dp->sbc_initialized)
 		sbc_reinit(&a2dp->sbc, 0);
@@ -679,55 +957,121 @@ static void bluetooth_a2dp_setup(struct bluetooth_a2dp *a2dp)
 		break;
 	}
 
+	a2dp->min_bitpool = active_capabilities.min_bitpool;
+	a2dp->max_bitpool = active_capabilities.max_bitpool;
+	a2dp->good_packets = 0;
+
 	a2dp->sbc.bitpool = active_capabilities.max_bitpool;
 	a2dp->codesize = sbc_get_codesize(&a2dp->sbc);
-	a2dp->count = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+	a2dp->send_tail = 0;
+	a2dp->send_queue[0].len = 0;
+	for (i = 0; i < a2dp->num_sinks; i++)
+		a2dp->sinks[i].send_head = 0;
 }
 
-static int bluetooth_a2dp_hw_params(snd_pcm_ioplug_t *io,
-					snd_pcm_hw_params_t *params)
+/*
+ * Configures the additional playback devices with the parameters chosen
+ * for the main one, so that a single encoder serves all of them. The
+ * packets are sized for the smallest MTU.
+ */
+static void bluetooth_a2dp_configure_sinks(struct bluetooth_data *data)
 {
-	struct bluetooth_data *data = io->private_data;
 	struct bluetooth_a2dp *a2dp = &data->a2dp;
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
 	struct bt_open_req *open_req = (void *) buf;
 	struct bt_open_rsp *open_rsp = (void *) buf;
 	struct bt_set_configuration_req *req = (void *) buf;
 	struct bt_set_configuration_rsp *rsp = (void *) buf;
+	unsigned int i;
 	int err;
 
-	DBG("Preparing with io->period_size=%lu io->buffer_size=%lu",
-					io->period_size, io->buffer_size);
+	for (i = 1; i < a2dp->num_sinks; i++) {
+		struct bluetooth_a2dp_sink *sink = &a2dp->sinks[i];
 
-	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
-	open_req->h.type = BT_REQUEST;
-	open_req->h.name = BT_OPEN;
-	open_req->h.length = sizeof(*open_req);
+		memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
+		open_req->h.type = BT_REQUEST;
+		open_req->h.name = BT_OPEN;
+		open_req->h.length = sizeof(*open_req);
 
-	strncpy(open_req->destination, data->alsa_config.device, 18);
-	open_req->seid = a2dp->sbc_capabilities.capability.seid;
-	open_req->lock = (io->stream == SND_PCM_STREAM_PLAYBACK ?
-			BT_WRITE_LOCK : BT_READ_LOCK);
+		strncpy(open_req->destination, sink->device, 18);
+		open_req->seid = sink->seid;
+		open_req->lock = BT_WRITE_LOCK;
 
-	err = audioservice_send(data->server.fd, &open_req->h);
-	if (err < 0)
-		return err;
+		err = audioservice_send(sink->server_fd, &open_req->h);
+		if (err < 0)
+			goto failed;
 
-	open_rsp->h.length = sizeof(*open_rsp);
-	err = audioservice_expect(data->server.fd, &open_rsp->h,
-					BT_OPEN);
-	if (err < 0)
-		return err;
+		open_rsp->h.length = sizeof(*open_rsp);
+		err = audioservice_expect(sink->server_fd, &open_rsp->h,
+								BT_OPEN);
+		if (err < 0)
+			goto failed;
+
+		memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
+		req->h.type = BT_REQUEST;
+		req->h.name = BT_SET_CONFIGURATION;
+		req->h.length = sizeof(*req);
+
+		memcpy(&req->codec, &a2dp->sbc_capabilities,
+				sizeof(a2dp->sbc_capabilities));
+
+		req->codec.seid = sink->seid;
+		req->codec.transport = BT_CAPABILITIES_TRANSPORT_A2DP;
+		req->codec.length = sizeof(a2dp->sbc_capabilities);
+		req->h.length += req->codec.length - sizeof(req->codec);
+
+		err = audioservice_send(sink->server_fd, &req->h);
+		if (err < 0)
+			goto failed;
+
+		rsp->h.length = sizeof(*rsp);
+		err = audioservice_expect(sink->server_fd, &rsp->h,
+						BT_SET_CONFIGURATION);
+		if (err < 0)
+			goto failed;
+
+		sink->link_mtu = rsp->link_mtu;
+		data->link_mtu = MIN(data->link_mtu, sink->link_mtu);
+		continue;
+
+failed:
+		bluetooth_a2dp_remove_sink(a2dp, i--);
+	}
+}
+
+static int bluetooth_a2dp_hw_params(snd_pcm_ioplug_t *io,
+					snd_pcm_hw_params_t *params)
+{
+	struct bluetooth_data *data = io->private_data;
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	char buf[BT_SUGGESTED_BUFFER_SIZE];
+	struct bt_setup_stream_req *req = (void *) buf;
+	struct bt_setup_stream_rsp *rsp = (void *) buf;
+	struct bt_new_stream_ind *ind = (void *) buf;
+	unsigned int link_mtu;
+	int fd, err;
+
+	DBG("Preparing with io->period_size=%lu io->buffer_size=%lu",
+					io->period_size, io->buffer_size);
+
+	bluetooth_stop_hw_thread(data);
 
 	err = bluetooth_a2dp_init(data, params);
 	if (err < 0)
 		return err;
 
+	/* Open, configure and start the stream in a single round trip,
+	 * the following prepare then only has to pick up the stream */
 	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
 	req->h.type = BT_REQUEST;
-	req->h.name = BT_SET_CONFIGURATION;
+	req->h.name = BT_SETUP_STREAM;
 	req->h.length = sizeof(*req);
 
+	strncpy(req->destination, data->alsa_config.device, 18);
+	req->lock = (io->stream == SND_PCM_STREAM_PLAYBACK ?
+			BT_WRITE_LOCK : BT_READ_LOCK);
+
 	memcpy(&req->codec, &a2dp->sbc_capabilities,
 			sizeof(a2dp->sbc_capabilities));
 
@@ -741,12 +1085,34 @@ static int bluetooth_a2dp_hw_params(snd_pcm_ioplug_t *io,
 
 	rsp->h.length = sizeof(*rsp);
 	err = audioservice_expect(data->server.fd, &rsp->h,
-					BT_SET_CONFIGURATION);
+					BT_SETUP_STREAM);
 	if (err < 0)
 		return err;
 
+	link_mtu = rsp->link_mtu;
+
+	ind->h.length = sizeof(*ind);
+	err = audioservice_expect(data->server.fd, &ind->h, BT_NEW_STREAM);
+	if (err < 0)
+		return err;
+
+	fd = bt_audio_service_get_data_fd(data->server.fd);
+	if (fd < 0)
+		return -errno;
+
+	if (data->stream.fd >= 0)
+		close(data->stream.fd);
+
+	data->stream.fd = fd;
+	data->stream_ready = 1;
+
 	data->transport = BT_CAPABILITIES_TRANSPORT_A2DP;
-	data->link_mtu = rsp->link_mtu;
+	data->link_mtu = link_mtu;
+
+	if (a2dp->num_sinks > 0) {
+		a2dp->sinks[0].link_mtu = link_mtu;
+		bluetooth_a2dp_configure_sinks(data);
+	}
 
 	/* Setup SBC encoder now we agree on parameters */
 	bluetooth_a2dp_setup(a2dp);
@@ -817,7 +1183,7 @@ static int bluetooth_playback_poll_revents(snd_pcm_ioplug_t *io,
 					struct pollfd *pfds, unsigned int nfds,
 					unsigned short *revents)
 {
-	static char buf[1];
+	static char buf[16];
 	int ret;
 
 	DBG("");
@@ -828,8 +1194,10 @@ static int bluetooth_playback_poll_revents(snd_pcm_ioplug_t *io,
 	assert(pfds[0].fd >= 0);
 	assert(pfds[1].fd >= 0);
 
-	if (io->state != SND_PCM_STATE_PREPARED)
-		ret = read(pfds[0].fd, buf, 1);
+	/* the hw thread coalesces wakeups, so drain whatever is there */
+	if (io->state != SND_PCM_STATE_PREPARED &&
+					(pfds[0].revents & POLLIN))
+		ret = read(pfds[0].fd, buf, sizeof(buf));
 
 	if (pfds[1].revents & (POLLERR | POLLHUP | POLLNVAL))
 		io->state = SND_PCM_STATE_DISCONNECTED;
@@ -956,48 +1324,452 @@ done:
 	return ret;
 }
 
+static void bluetooth_a2dp_capture_reset(struct bluetooth_a2dp *a2dp)
+{
+	int i;
+
+	for (i = 0; i < JITTER_PACKETS; i++)
+		a2dp->jitter[i].len = 0;
+
+	a2dp->jitter_count = 0;
+	a2dp->jitter_started = 0;
+	a2dp->next_offset = 0;
+	a2dp->pcm_count = 0;
+	a2dp->pcm_offset = 0;
+}
+
+static void bluetooth_a2dp_drop_next(struct bluetooth_a2dp *a2dp)
+{
+	struct bluetooth_a2dp_packet *pkt;
+
+	pkt = &a2dp->jitter[a2dp->next_seq % JITTER_PACKETS];
+	if (pkt->len > 0 && pkt->seq_num == a2dp->next_seq) {
+		pkt->len = 0;
+		a2dp->jitter_count--;
+	}
+
+	a2dp->next_seq++;
+	a2dp->next_offset = 0;
+}
+
+/*
+ * Puts a received media packet into the jitter buffer. Packets arriving
+ * after their turn or more than JITTER_PACKETS ahead of the next one
+ * to decode make the buffer give up on the missing ones.
+ */
+static void bluetooth_a2dp_queue(struct bluetooth_a2dp *a2dp,
+					const uint8_t *buf, unsigned int len)
+{
+	const struct rtp_header *header = (const void *) buf;
+	const struct rtp_payload *payload;
+	struct bluetooth_a2dp_packet *pkt;
+	unsigned int hdr_len, blocks, subbands;
+	uint16_t seq_num;
+	uint32_t timestamp, end;
+
+	if (len < sizeof(*header) + sizeof(*payload) || header->v != 2)
+		return;
+
+	hdr_len = sizeof(*header) + header->cc * 4;
+	if (len < hdr_len + sizeof(*payload) + 2)
+		return;
+
+	/* fragmented frames are not supported */
+	payload = (const void *) (buf + hdr_len);
+	if (payload->is_fragmented)
+		return;
+
+	hdr_len += sizeof(*payload);
+	seq_num = ntohs(header->sequence_number);
+	timestamp = ntohl(header->timestamp);
+
+	if (!a2dp->jitter_started) {
+		a2dp->jitter_started = 1;
+		a2dp->next_seq = seq_num;
+		a2dp->next_timestamp = timestamp;
+		a2dp->recv_timestamp = timestamp;
+	}
+
+	if ((int16_t) (seq_num - a2dp->next_seq) < 0) {
+		DBG("Late packet %u, expected %u", seq_num, a2dp->next_seq);
+		return;
+	}
+
+	while ((int16_t) (seq_num - a2dp->next_seq) >= JITTER_PACKETS)
+		bluetooth_a2dp_drop_next(a2dp);
+
+	pkt = &a2dp->jitter[seq_num % JITTER_PACKETS];
+	if (pkt->len > 0)
+		return;
+
+	pkt->seq_num = seq_num;
+	pkt->timestamp = timestamp;
+	pkt->len = len - hdr_len;
+	memcpy(pkt->data, buf + hdr_len, pkt->len);
+	a2dp->jitter_count++;
+
+	/* the timestamp counts samples, take the frame size from the
+	 * header of the first SBC frame */
+	blocks = 4 + ((pkt->data[1] >> 4) & 0x03) * 4;
+	subbands = pkt->data[1] & 0x01 ? 8 : 4;
+	end = timestamp + payload->frame_count * blocks * subbands;
+	if ((int32_t) (end - a2dp->recv_timestamp) > 0)
+		a2dp->recv_timestamp = end;
+}
+
+/*
+ * Decodes the next packet of the jitter buffer into the PCM buffer, as
+ * many frames as fit at once. Samples missing before the packet are
+ * replaced by silence. Returns the number of frames made available.
+ */
+static int bluetooth_a2dp_decode(struct bluetooth_data *data,
+					unsigned int frame_size, int force)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	struct bluetooth_a2dp_packet *pkt;
+	ssize_t consumed;
+	size_t written;
+	int32_t gap;
+
+	if (a2dp->jitter_count == 0)
+		return 0;
+
+	pkt = &a2dp->jitter[a2dp->next_seq % JITTER_PACKETS];
+	if (pkt->len == 0 || pkt->seq_num != a2dp->next_seq) {
+		/* give the missing packet some time to show up */
+		if (!force && a2dp->jitter_count < JITTER_PACKETS / 2)
+			return 0;
+
+		while (pkt->len == 0 || pkt->seq_num != a2dp->next_seq) {
+			DBG("Lost packet %u", a2dp->next_seq);
+			bluetooth_a2dp_drop_next(a2dp);
+			pkt = &a2dp->jitter[a2dp->next_seq % JITTER_PACKETS];
+		}
+	}
+
+	a2dp->pcm_offset = 0;
+
+	/* a jump of more than half a second is a restart of the stream
+	 * rather than lost packets */
+	gap = pkt->timestamp - a2dp->next_timestamp;
+	if (gap > (int32_t) data->io.rate / 2)
+		gap = 0;
+
+	if (a2dp->next_offset == 0 && gap > 0) {
+		a2dp->pcm_count = MIN(gap * frame_size,
+					PCM_BUFFER_SIZE / frame_size * frame_size);
+		memset(a2dp->pcm, 0, a2dp->pcm_count);
+		a2dp->next_timestamp += a2dp->pcm_count / frame_size;
+		return a2dp->pcm_count / frame_size;
+	}
+
+	if (a2dp->next_offset == 0)
+		a2dp->next_timestamp = pkt->timestamp;
+
+	consumed = sbc_decode_multi(&a2dp->sbc, pkt->data + a2dp->next_offset,
+				pkt->len - a2dp->next_offset, a2dp->pcm,
+				sizeof(a2dp->pcm), &written);
+	if (consumed <= 0) {
+		DBG("Decoding error %zd in packet %u", consumed,
+							pkt->seq_num);
+		bluetooth_a2dp_drop_next(a2dp);
+		a2dp->pcm_count = 0;
+		return 0;
+	}
+
+	a2dp->next_offset += consumed;
+	if (a2dp->next_offset >= pkt->len)
+		bluetooth_a2dp_drop_next(a2dp);
+
+	a2dp->pcm_count = written;
+	a2dp->next_timestamp += written / frame_size;
+
+	return written / frame_size;
+}
+
 static snd_pcm_sframes_t bluetooth_a2dp_read(snd_pcm_ioplug_t *io,
 				const snd_pcm_channel_area_t *areas,
 				snd_pcm_uframes_t offset, snd_pcm_uframes_t size)
 {
-	snd_pcm_uframes_t ret = 0;
-	return ret;
+	struct bluetooth_data *data = io->private_data;
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	snd_pcm_uframes_t frames;
+	unsigned int frame_size;
+	uint8_t *buff;
+	int nrecv, force = 0;
+
+	DBG("areas->step=%u areas->first=%u offset=%lu size=%lu io->nonblock=%u",
+			areas->step, areas->first, offset, size, io->nonblock);
+
+	frame_size = areas->step / 8;
+
+	while (a2dp->pcm_offset >= a2dp->pcm_count) {
+		int decoded = bluetooth_a2dp_decode(data, frame_size, force);
+
+		if (decoded > 0) {
+			/* Increment hardware transmition pointer */
+			data->hw_ptr = (data->hw_ptr + decoded) %
+							io->buffer_size;
+			break;
+		}
+
+		if (force && a2dp->jitter_count > 0)
+			continue;
+
+		nrecv = recv(data->stream.fd, data->buffer, sizeof(data->buffer),
+					io->nonblock ? MSG_DONTWAIT : 0);
+		if (nrecv < 0) {
+			/* nothing arrived within a period, stop waiting
+			 * for the packets that are missing */
+			if (errno == EAGAIN && !io->nonblock && !force &&
+						a2dp->jitter_count > 0) {
+				force = 1;
+				continue;
+			}
+
+			return (errno == EPIPE) ? -EIO : -errno;
+		}
+
+		if (nrecv == 0)
+			return -EIO;
+
+		bluetooth_a2dp_queue(a2dp, data->buffer, nrecv);
+		force = 0;
+	}
+
+	frames = MIN(size, (a2dp->pcm_count - a2dp->pcm_offset) / frame_size);
+
+	buff = (uint8_t *) areas->addr +
+			(areas->first + areas->step * offset) / 8;
+	memcpy(buff, a2dp->pcm + a2dp->pcm_offset, frames * frame_size);
+	a2dp->pcm_offset += frames * frame_size;
+
+	DBG("returning %lu", frames);
+
+	return frames;
+}
+
+/*
+ * Adjusts the bitpool of the next packet to what the link is able to
+ * carry: a send failing on a full socket queue or a queue holding more
+ * than two packets lowers it, a queue that stays short for a while
+ * raises it again.
+ */
+static void bluetooth_a2dp_adapt_bitpool(struct bluetooth_data *data,
+								int err)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	int bitpool = a2dp->sbc.bitpool;
+	int outq = -1;
+	unsigned int i;
+
+	if (a2dp->min_bitpool >= a2dp->max_bitpool)
+		return;
+
+	/* with several sinks the most congested one decides */
+	for (i = 0; i < a2dp->num_sinks && err >= 0; i++) {
+		int sink_outq;
+
+		if (ioctl(a2dp->sinks[i].stream_fd, SIOCOUTQ, &sink_outq) < 0)
+			return;
+
+		outq = MAX(outq, sink_outq);
+	}
+
+	if (err < 0) {
+		/* the packet got dropped, back off quickly */
+		bitpool -= MAX(bitpool / 4, 1);
+		a2dp->good_packets = 0;
+	} else if (outq < 0)
+		return;
+	else if ((unsigned int) outq > 2 * data->link_mtu) {
+		bitpool--;
+		a2dp->good_packets = 0;
+	} else if ((unsigned int) outq <= data->link_mtu &&
+			++a2dp->good_packets >= BITPOOL_RAISE_PACKETS) {
+		bitpool++;
+		a2dp->good_packets = 0;
+	}
+
+	bitpool = MAX(bitpool, a2dp->min_bitpool);
+	bitpool = MIN(bitpool, a2dp->max_bitpool);
+
+	if (bitpool == a2dp->sbc.bitpool)
+		return;
+
+	DBG("bitpool %u -> %d, outq %d", a2dp->sbc.bitpool, bitpool, outq);
+
+	a2dp->sbc.bitpool = bitpool;
+	a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+}
+
+/*
+ * Sends the packets queued for one sink, all of them with a single
+ * sendmmsg call when more than one piled up while its link was stalled.
+ * The RTP and payload headers are gathered from a separate array, so
+ * the frames never have to be moved. Returns the number of packets sent.
+ */
+static int bluetooth_a2dp_flush(struct bluetooth_data *data,
+					struct bluetooth_a2dp_sink *sink)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	struct bluetooth_a2dp_header headers[SEND_PACKETS];
+	struct iovec iov[SEND_PACKETS][2];
+	struct msghdr msg[SEND_PACKETS];
+	unsigned int i, count, sent = 0;
+	int ret;
+
+	count = (a2dp->send_tail + SEND_PACKETS - sink->send_head) %
+								SEND_PACKETS;
+
+	for (i = 0; i < count; i++) {
+		struct bluetooth_a2dp_packet *pkt;
+		struct bluetooth_a2dp_header *hdr = &headers[i];
+
+		pkt = &a2dp->send_queue[(sink->send_head + i) % SEND_PACKETS];
+
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->payload.frame_count = pkt->frame_count;
+		hdr->rtp.v = 2;
+		hdr->rtp.pt = 1;
+		hdr->rtp.sequence_number = htons(sink->seq_num + i);
+		hdr->rtp.timestamp = htonl(pkt->timestamp);
+		hdr->rtp.ssrc = htonl(1);
+
+		iov[i][0].iov_base = hdr;
+		iov[i][0].iov_len = sizeof(*hdr);
+		iov[i][1].iov_base = pkt->data;
+		iov[i][1].iov_len = pkt->len;
+
+		memset(&msg[i], 0, sizeof(msg[i]));
+		msg[i].msg_iov = iov[i];
+		msg[i].msg_iovlen = 2;
+	}
+
+#ifdef HAVE_SENDMMSG
+	if (count > 1) {
+		struct mmsghdr mmsg[SEND_PACKETS];
+
+		for (i = 0; i < count; i++) {
+			mmsg[i].msg_hdr = msg[i];
+			mmsg[i].msg_len = 0;
+		}
+
+		ret = sendmmsg(sink->stream_fd, mmsg, count, MSG_DONTWAIT);
+		if (ret > 0)
+			sent = ret;
+	} else
+#endif
+	for (ret = 0; sent < count; sent++) {
+		ret = sendmsg(sink->stream_fd, &msg[sent], MSG_DONTWAIT);
+		if (ret < 0)
+			break;
+	}
+
+	if (sent == 0 && ret < 0) {
+		DBG("sendmsg returned %d errno %s.", ret, strerror(errno));
+		return -errno;
+	}
+
+	sink->send_head = (sink->send_head + sent) % SEND_PACKETS;
+	sink->seq_num += sent;
+
+	return sent;
 }
 
 static int avdtp_write(struct bluetooth_data *data)
 {
-	int ret = 0;
-	struct rtp_header *header;
-	struct rtp_payload *payload;
 	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int i;
+	int ret = 0, congested = 0;
 
-	header = (void *) a2dp->buffer;
-	payload = (void *) (a2dp->buffer + sizeof(*header));
+	a2dp->send_tail = (a2dp->send_tail + 1) % SEND_PACKETS;
 
-	memset(a2dp->buffer, 0, sizeof(*header) + sizeof(*payload));
+	/* Every sink has its own backlog, a sink that is a whole queue
+	 * behind loses its oldest packet to make room for the next one */
+	for (i = 0; i < a2dp->num_sinks; i++) {
+		struct bluetooth_a2dp_sink *sink = &a2dp->sinks[i];
+		int err;
 
-	payload->frame_count = a2dp->frame_count;
-	header->v = 2;
-	header->pt = 1;
-	header->sequence_number = htons(a2dp->seq_num);
-	header->timestamp = htonl(a2dp->nsamples);
-	header->ssrc = htonl(1);
+		if (sink->send_head == a2dp->send_tail) {
+			DBG("Dropping packet for sink %u", i);
+			sink->send_head = (sink->send_head + 1) % SEND_PACKETS;
+		}
 
-	ret = send(data->stream.fd, a2dp->buffer, a2dp->count, MSG_DONTWAIT);
-	if (ret < 0) {
-		DBG("send returned %d errno %s.", ret, strerror(errno));
-		ret = -errno;
+		err = bluetooth_a2dp_flush(data, sink);
+		if (err >= 0)
+			continue;
+
+		/* only a full socket queue says anything about the link,
+		 * an additional device that went away is dropped */
+		if (err == -EAGAIN || err == -ENOBUFS)
+			congested = 1;
+		else if (i > 0)
+			bluetooth_a2dp_remove_sink(a2dp, i--);
+		else
+			ret = err;
 	}
 
+	bluetooth_a2dp_adapt_bitpool(data, congested ? -EAGAIN : 0);
+
 	/* Reset buffer of data to send */
-	a2dp->count = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
-	a2dp->frame_count = 0;
+	a2dp->send_queue[a2dp->send_tail].len = 0;
 	a2dp->samples = 0;
-	a2dp->seq_num++;
 
 	return ret;
 }
 
+/*
+ * Encodes as many whole SBC frames from buff as fit in the room left in
+ * the current RTP packet, and queues the packet for sending once no
+ * further frame fits into the link MTU. Returns the number of PCM bytes
+ * consumed.
+ */
+static int bluetooth_a2dp_encode(struct bluetooth_data *data,
+				const uint8_t *buff, unsigned int len,
+				int frame_size)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	struct bluetooth_a2dp_packet *pkt;
+	unsigned int mtu, limit;
+	ssize_t encoded;
+	size_t written;
+
+	pkt = &a2dp->send_queue[a2dp->send_tail];
+	if (pkt->len == 0) {
+		pkt->timestamp = a2dp->nsamples;
+		pkt->frame_count = 0;
+	}
+
+	/* A packet is sent as soon as len + frame_length >= mtu, so
+	 * fill everything up to that point with a single encoder call */
+	mtu = data->link_mtu - sizeof(struct bluetooth_a2dp_header);
+	limit = MIN(mtu - 1, sizeof(pkt->data));
+	if (limit < pkt->len + a2dp->frame_length)
+		limit = MIN(pkt->len + a2dp->frame_length, sizeof(pkt->data));
+
+	encoded = sbc_encode_multi(&a2dp->sbc, buff, len,
+					pkt->data + pkt->len,
+					limit - pkt->len, &written);
+	if (encoded <= 0)
+		return encoded;
+
+	/* Increment a2dp buffers */
+	pkt->len += written;
+	pkt->frame_count += written / a2dp->frame_length;
+	a2dp->samples += encoded / frame_size;
+	a2dp->nsamples += encoded / frame_size;
+
+	/* No space left for another frame then send */
+	if (pkt->len + a2dp->frame_length >= mtu) {
+		DBG("sending packet %u, len %d, link_mtu %u",
+				a2dp->send_tail, pkt->len, data->link_mtu);
+		avdtp_write(data);
+	}
+
+	return encoded;
+}
+
 static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 				const snd_pcm_channel_area_t *areas,
 				snd_pcm_uframes_t offset, snd_pcm_uframes_t size)
@@ -1007,7 +1779,6 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 	snd_pcm_sframes_t ret = 0;
 	unsigned int bytes_left;
 	int frame_size, encoded;
-	size_t written;
 	uint8_t *buff;
 
 	DBG("areas->step=%u areas->first=%u offset=%lu size=%lu",
@@ -1057,29 +1828,13 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 						additional_bytes_needed);
 
 		/* Enough data to encode (sbc wants 1k blocks) */
-		encoded = sbc_encode(&a2dp->sbc, data->buffer, a2dp->codesize,
-					a2dp->buffer + a2dp->count,
-					sizeof(a2dp->buffer) - a2dp->count,
-								&written);
+		encoded = bluetooth_a2dp_encode(data, data->buffer,
+						a2dp->codesize, frame_size);
 		if (encoded <= 0) {
 			DBG("Encoding error %d", encoded);
 			goto done;
 		}
 
-		/* Increment a2dp buffers */
-		a2dp->count += written;
-		a2dp->frame_count++;
-		a2dp->samples += encoded / frame_size;
-		a2dp->nsamples += encoded / frame_size;
-
-		/* No space left for another frame then send */
-		if (a2dp->count + written >= data->link_mtu) {
-			avdtp_write(data);
-			DBG("sending packet %d, count %d, link_mtu %u",
-					a2dp->seq_num, a2dp->count,
-							data->link_mtu);
-		}
-
 		/* Increment up buff pointer to take into account
 		 * the data processed */
 		buff += additional_bytes_needed;
@@ -1089,14 +1844,10 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 		data->count = 0;
 	}
 
-
-	/* Process this buffer in full chunks */
+	/* Process this buffer in runs of full chunks */
 	while (bytes_left >= a2dp->codesize) {
-		/* Enough data to encode (sbc wants 1k blocks) */
-		encoded = sbc_encode(&a2dp->sbc, buff, a2dp->codesize,
-					a2dp->buffer + a2dp->count,
-					sizeof(a2dp->buffer) - a2dp->count,
-								&written);
+		encoded = bluetooth_a2dp_encode(data, buff, bytes_left,
+								frame_size);
 		if (encoded <= 0) {
 			DBG("Encoding error %d", encoded);
 			goto done;
@@ -1104,22 +1855,8 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 
 		/* Increment up buff pointer to take into account
 		 * the data processed */
-		buff += a2dp->codesize;
-		bytes_left -= a2dp->codesize;
-
-		/* Increment a2dp buffers */
-		a2dp->count += written;
-		a2dp->frame_count++;
-		a2dp->samples += encoded / frame_size;
-		a2dp->nsamples += encoded / frame_size;
-
-		/* No space left for another frame then send */
-		if (a2dp->count + written >= data->link_mtu) {
-			avdtp_write(data);
-			DBG("sending packet %d, count %d, link_mtu %u",
-						a2dp->seq_num, a2dp->count,
-							data->link_mtu);
-		}
+		buff += encoded;
+		bytes_left -= encoded;
 	}
 
 	/* Copy the extra to our temp buffer for the next write */
@@ -1135,9 +1872,43 @@ done:
 	return size - bytes_left / frame_size;
 }
 
+/*
+ * Returns the number of frames written by the application that did not
+ * leave the socket yet: PCM waiting for a whole SBC frame, the packet
+ * being filled, packets queued for the main device and the L2CAP send
+ * queue.
+ */
+static snd_pcm_sframes_t bluetooth_local_delay(struct bluetooth_data *data)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int frame_size = data->io.channels * 2;
+	snd_pcm_sframes_t frames = data->count / frame_size;
+	int outq;
+
+	if (data->transport == BT_CAPABILITIES_TRANSPORT_A2DP &&
+						a2dp->num_sinks > 0) {
+		unsigned int i;
+
+		frames += a2dp->samples;
+
+		for (i = a2dp->sinks[0].send_head; i != a2dp->send_tail;
+						i = (i + 1) % SEND_PACKETS)
+			frames += a2dp->send_queue[i].frame_count *
+					a2dp->codesize / frame_size;
+	}
+
+	if (ioctl(data->stream.fd, SIOCOUTQ, &outq) == 0 && outq > 0)
+		frames += bluetooth_queued_frames(data, outq);
+
+	return frames;
+}
+
 static int bluetooth_playback_delay(snd_pcm_ioplug_t *io,
 					snd_pcm_sframes_t *delayp)
 {
+	struct bluetooth_data *data = io->private_data;
+	snd_pcm_sframes_t local;
+
 	DBG("");
 
 	/* This updates io->hw_ptr value using pointer() function */
@@ -1150,11 +1921,41 @@ static int bluetooth_playback_delay(snd_pcm_ioplug_t *io,
 		*delayp = 0;
 	}
 
+	/* The hw pointer clock may run ahead of what really left, while
+	 * frames still in our buffers or the socket can't have been
+	 * played yet */
+	local = bluetooth_local_delay(data);
+	if (local > *delayp)
+		*delayp = local;
+
+	/* Then the time the sink takes to play what it received */
+	*delayp += (snd_pcm_sframes_t) data->remote_delay * io->rate / 10000;
+
 	/* This should never fail, ALSA API is really not
 	prepared to handle a non zero return value */
 	return 0;
 }
 
+static int bluetooth_a2dp_capture_delay(snd_pcm_ioplug_t *io,
+					snd_pcm_sframes_t *delayp)
+{
+	struct bluetooth_data *data = io->private_data;
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	int32_t buffered;
+
+	/* This updates io->hw_ptr value using pointer() function */
+	snd_pcm_hwsync(io->pcm);
+
+	/* decoded but not read yet, plus what waits in the jitter buffer */
+	*delayp = io->hw_ptr - io->appl_ptr;
+
+	buffered = a2dp->recv_timestamp - a2dp->next_timestamp;
+	if (a2dp->jitter_started && buffered > 0)
+		*delayp += buffered;
+
+	return 0;
+}
+
 static snd_pcm_ioplug_callback_t bluetooth_hsp_playback = {
 	.start			= bluetooth_playback_start,
 	.stop			= bluetooth_playback_stop,
@@ -1205,6 +2006,7 @@ static snd_pcm_ioplug_callback_t bluetooth_a2dp_capture = {
 	.transfer		= bluetooth_a2dp_read,
 	.poll_descriptors	= bluetooth_poll_descriptors,
 	.poll_revents		= bluetooth_poll_revents,
+	.delay			= bluetooth_a2dp_capture_delay,
 };
 
 #define ARRAY_NELEMS(a) (sizeof((a)) / sizeof((a)[0]))
@@ -1281,6 +2083,7 @@ static int bluetooth_a2dp_hw_constraint(snd_pcm_ioplug_t *io)
 	unsigned int rate_count;
 	int err, min_channels, max_channels;
 	unsigned int period_list[] = {
+		1024, /* e.g. 5.8msec/period (stereo 16bit at 44.1kHz) */
 		2048,
 		4096, /* e.g. 23.2msec/period (stereo 16bit at 44.1kHz) */
 		8192
@@ -1411,8 +2214,25 @@ static int bluetooth_parse_config(snd_config_t *conf,
 				return -EINVAL;
 			}
 
+			/* A2DP playback can go to several devices at once */
 			bt_config->has_device = 1;
-			strncpy(bt_config->device, value, 18);
+			bt_config->num_extra_devices = 0;
+			strncpy(bt_config->device, value, 17);
+			bt_config->device[strcspn(bt_config->device, ", ")] = 0;
+
+			while ((value = strpbrk(value, ", ")) != NULL) {
+				char *extra;
+
+				value += strspn(value, ", ");
+				if (*value == 0 || bt_config->num_extra_devices ==
+								MAX_SINKS - 1)
+					break;
+
+				extra = bt_config->extra_device[
+					bt_config->num_extra_devices++];
+				strncpy(extra, value, 17);
+				extra[strcspn(extra, ", ")] = 0;
+			}
 			continue;
 		}
 
@@ -1551,18 +2371,32 @@ static int audioservice_recv(int sk, bt_audio_msg_header_t *inmsg)
 	int err;
 	ssize_t ret;
 	const char *type, *name;
-	uint16_t length;
-
-	length = inmsg->length ? inmsg->length : BT_SUGGESTED_BUFFER_SIZE;
 
 	DBG("trying to receive msg from audio service...");
 
-	ret = recv(sk, inmsg, length, 0);
+	/* Read the header first so that exactly one message is consumed,
+	 * an indication may be queued right behind a response. Every
+	 * caller passes a BT_SUGGESTED_BUFFER_SIZE buffer. */
+	ret = recv(sk, inmsg, sizeof(*inmsg), MSG_WAITALL);
+	if (ret == sizeof(*inmsg) && inmsg->length > sizeof(*inmsg)) {
+		if (inmsg->length > BT_SUGGESTED_BUFFER_SIZE) {
+			SNDERR("Too long (%d bytes) IPC packet from bluetoothd",
+								inmsg->length);
+			return -EINVAL;
+		}
+
+		ret = recv(sk, (uint8_t *) inmsg + sizeof(*inmsg),
+				inmsg->length - sizeof(*inmsg), MSG_WAITALL);
+		if (ret >= 0)
+			ret += sizeof(*inmsg);
+	}
+
 	if (ret < 0) {
 		err = -errno;
 		SNDERR("Error receiving IPC data from bluetoothd: %s (%d)",
 						strerror(errno), errno);
-	} else if ((size_t) ret < sizeof(bt_audio_msg_header_t)) {
+	} else if ((size_t) ret < sizeof(bt_audio_msg_header_t) ||
+					(size_t) ret < inmsg->length) {
 		SNDERR("Too short (%d bytes) IPC packet from bluetoothd", ret);
 		err = -EINVAL;
 	} else {
@@ -1587,10 +2421,16 @@ static int audioservice_expect(int sk, bt_audio_msg_header_t *rsp,
 							int expected_name)
 {
 	bt_audio_error_t *error;
-	int err = audioservice_recv(sk, rsp);
+	int err;
 
-	if (err != 0)
-		return err;
+	/* Delay reports may come at any time, the daemon sends the current
+	 * one again once the stream is started */
+	do {
+		err = audioservice_recv(sk, rsp);
+		if (err != 0)
+			return err;
+	} while (rsp->type == BT_INDICATION && rsp->name == BT_DELAY_REPORT &&
+					expected_name != BT_DELAY_REPORT);
 
 	if (rsp->name != expected_name) {
 		err = -EINVAL;
@@ -1611,33 +2451,130 @@ static int audioservice_expect(int sk, bt_audio_msg_header_t *rsp,
 	return err;
 }
 
-static int bluetooth_parse_capabilities(struct bluetooth_data *data,
-					struct bt_get_capabilities_rsp *rsp)
+/* Picks the SBC endpoint of the remote device matching the stream:
+ * playback goes to a sink, capture comes from a source, and an
+ * endpoint already locked in that direction is skipped */
+static int bluetooth_parse_sbc(struct bt_get_capabilities_rsp *rsp,
+				snd_pcm_stream_t stream, sbc_capabilities_t *sbc)
 {
 	int bytes_left = rsp->h.length - sizeof(*rsp);
 	codec_capabilities_t *codec = (void *) rsp->data;
+	uint8_t type, lock;
 
-	data->transport = codec->transport;
-
-	if (codec->transport != BT_CAPABILITIES_TRANSPORT_A2DP)
-		return 0;
+	if (stream == SND_PCM_STREAM_PLAYBACK) {
+		type = BT_A2DP_SBC_SINK;
+		lock = BT_WRITE_LOCK;
+	} else {
+		type = BT_A2DP_SBC_SOURCE;
+		lock = BT_READ_LOCK;
+	}
 
 	while (bytes_left > 0) {
-		if ((codec->type == BT_A2DP_SBC_SINK) &&
-				!(codec->lock & BT_WRITE_LOCK))
+		if (codec->type == type && !(codec->lock & lock))
 			break;
 
 		bytes_left -= codec->length;
 		codec = (void *) codec + codec->length;
 	}
 
-	if (bytes_left <= 0 ||
-			codec->length != sizeof(data->a2dp.sbc_capabilities))
+	if (bytes_left <= 0 || codec->length != sizeof(*sbc))
 		return -EINVAL;
 
-	memcpy(&data->a2dp.sbc_capabilities, codec, codec->length);
+	memcpy(sbc, codec, codec->length);
+
+	return 0;
+}
+
+static int bluetooth_parse_capabilities(struct bluetooth_data *data,
+					snd_pcm_stream_t stream,
+					struct bt_get_capabilities_rsp *rsp)
+{
+	codec_capabilities_t *codec = (void *) rsp->data;
+
+	data->transport = codec->transport;
+
+	if (codec->transport != BT_CAPABILITIES_TRANSPORT_A2DP)
+		return 0;
+
+	return bluetooth_parse_sbc(rsp, stream, &data->a2dp.sbc_capabilities);
+}
+
+/*
+ * Adds a device the A2DP playback is sent to as well. Only devices
+ * supporting a common configuration with the main device can share its
+ * encoder, the capabilities are narrowed down to what all of them have.
+ */
+static int bluetooth_a2dp_add_sink(struct bluetooth_data *data,
+							const char *device)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	sbc_capabilities_t *cap = &a2dp->sbc_capabilities;
+	struct bluetooth_a2dp_sink *sink;
+	sbc_capabilities_t sink_cap;
+	char buf[BT_SUGGESTED_BUFFER_SIZE];
+	struct bt_get_capabilities_req *req = (void *) buf;
+	struct bt_get_capabilities_rsp *rsp = (void *) buf;
+	int sk, err;
+
+	sk = bt_audio_service_open();
+	if (sk < 0)
+		return -errno;
+
+	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
+	req->h.type = BT_REQUEST;
+	req->h.name = BT_GET_CAPABILITIES;
+	req->h.length = sizeof(*req);
+
+	if (data->alsa_config.autoconnect)
+		req->flags |= BT_FLAG_AUTOCONNECT;
+	strncpy(req->destination, device, 18);
+	req->transport = BT_CAPABILITIES_TRANSPORT_A2DP;
+
+	err = audioservice_send(sk, &req->h);
+	if (err < 0)
+		goto failed;
+
+	rsp->h.length = 0;
+	err = audioservice_expect(sk, &rsp->h, BT_GET_CAPABILITIES);
+	if (err < 0)
+		goto failed;
+
+	err = bluetooth_parse_sbc(rsp, SND_PCM_STREAM_PLAYBACK, &sink_cap);
+	if (err < 0)
+		goto failed;
+
+	if (!(cap->frequency & sink_cap.frequency) ||
+			!(cap->channel_mode & sink_cap.channel_mode) ||
+			!(cap->block_length & sink_cap.block_length) ||
+			!(cap->subbands & sink_cap.subbands) ||
+			!(cap->allocation_method & sink_cap.allocation_method) ||
+			cap->min_bitpool > sink_cap.max_bitpool ||
+			sink_cap.min_bitpool > cap->max_bitpool) {
+		SNDERR("%s has no SBC configuration in common with %s",
+					device, data->alsa_config.device);
+		err = -EINVAL;
+		goto failed;
+	}
+
+	cap->frequency &= sink_cap.frequency;
+	cap->channel_mode &= sink_cap.channel_mode;
+	cap->block_length &= sink_cap.block_length;
+	cap->subbands &= sink_cap.subbands;
+	cap->allocation_method &= sink_cap.allocation_method;
+	cap->min_bitpool = MAX(cap->min_bitpool, sink_cap.min_bitpool);
+	cap->max_bitpool = MIN(cap->max_bitpool, sink_cap.max_bitpool);
+
+	sink = &a2dp->sinks[a2dp->num_sinks++];
+	strncpy(sink->device, device, 18);
+	sink->server_fd = sk;
+	sink->stream_fd = -1;
+	sink->seid = sink_cap.capability.seid;
 
 	return 0;
+
+failed:
+	bt_audio_service_close(sk);
+	return err;
 }
 
 static int bluetooth_init(struct bluetooth_data *data,
@@ -1657,6 +2594,7 @@ static int bluetooth_init(struct bluetooth_data *data,
 
 	data->server.fd = -1;
 	data->stream.fd = -1;
+	data->timer_fd = -1;
 
 	sk = bt_audio_service_open();
 	if (sk <= 0) {
@@ -1683,6 +2621,16 @@ static int bluetooth_init(struct bluetooth_data *data,
 		goto failed;
 	}
 
+	data->timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (data->timer_fd < 0) {
+		err = -errno;
+		goto failed;
+	}
+	if (fcntl(data->timer_fd, F_SETFL, O_NONBLOCK) < 0) {
+		err = -errno;
+		goto failed;
+	}
+
 	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
 	req->h.type = BT_REQUEST;
 	req->h.name = BT_GET_CAPABILITIES;
@@ -1706,13 +2654,37 @@ static int bluetooth_init(struct bluetooth_data *data,
 	if (err < 0)
 		goto failed;
 
-	bluetooth_parse_capabilities(data, rsp);
+	err = bluetooth_parse_capabilities(data, stream, rsp);
+	if (err < 0) {
+		SNDERR("%s has no usable SBC endpoint for %s",
+			alsa_conf->device, stream == SND_PCM_STREAM_PLAYBACK ?
+						"playback" : "capture");
+		goto failed;
+	}
+
+	if (stream == SND_PCM_STREAM_PLAYBACK &&
+			data->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
+		struct bluetooth_a2dp_sink *sink = &data->a2dp.sinks[0];
+		int i;
+
+		strncpy(sink->device, alsa_conf->device, 18);
+		sink->server_fd = data->server.fd;
+		sink->stream_fd = -1;
+		sink->seid = data->a2dp.sbc_capabilities.capability.seid;
+		data->a2dp.num_sinks = 1;
+
+		for (i = 0; i < alsa_conf->num_extra_devices; i++)
+			bluetooth_a2dp_add_sink(data,
+						alsa_conf->extra_device[i]);
+	}
 
 	return 0;
 
 failed:
-	if (sk >= 0)
+	if (sk >= 0) {
 		bt_audio_service_close(sk);
+		data->server.fd = -1;
+	}
 	return err;
 }
 
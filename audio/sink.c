@@ -678,6 +678,7 @@ static DBusMessage *sink_get_properties(DBusConnection *conn,
 	DBusMessageIter dict;
 	const char *state;
 	gboolean value;
+	uint16_t delay;
 
 	reply = dbus_message_new_method_return(msg);
 	if (!reply)
@@ -703,6 +704,10 @@ static DBusMessage *sink_get_properties(DBusConnection *conn,
 	if (state)
 		dict_append_entry(&dict, "State", DBUS_TYPE_STRING, &state);
 
+	/* Delay */
+	if (sink->stream && avdtp_stream_get_delay(sink->stream, &delay))
+		dict_append_entry(&dict, "Delay", DBUS_TYPE_UINT16, &delay);
+
 	dbus_message_iter_close_container(&iter, &dict);
 
 	return reply;
@@ -812,6 +817,12 @@ avdtp_state_t sink_get_state(struct audio_device *dev)
 	return sink->stream_state;
 }
 
+void sink_delay_changed(struct audio_device *dev, uint16_t delay)
+{
+	emit_property_changed(dev->conn, dev->path, AUDIO_SINK_INTERFACE,
+					"Delay", DBUS_TYPE_UINT16, &delay);
+}
+
 gboolean sink_new_stream(struct audio_device *dev, struct avdtp *session,
 				struct avdtp_stream *stream)
 {
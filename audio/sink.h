@@ -43,6 +43,7 @@ struct sink *sink_init(struct audio_device *dev);
 void sink_unregister(struct audio_device *dev);
 gboolean sink_is_active(struct audio_device *dev);
 avdtp_state_t sink_get_state(struct audio_device *dev);
+void sink_delay_changed(struct audio_device *dev, uint16_t delay);
 gboolean sink_new_stream(struct audio_device *dev, struct avdtp *session,
 				struct avdtp_stream *stream);
 gboolean sink_setup_stream(struct sink *sink, struct avdtp *session);
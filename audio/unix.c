@@ -89,12 +89,17 @@ struct unix_client {
 	unsigned int req_id;
 	unsigned int cb_id;
 	gboolean (*cancel) (struct audio_device *dev, unsigned int id);
+	gboolean setup_stream; /* Open, configure and start in one go */
+	uint16_t link_mtu; /* Configured MTU for the BT_SETUP_STREAM answer */
 };
 
 static GSList *clients = NULL;
 
 static int unix_sock = -1;
 
+static void start_config(struct audio_device *dev, struct unix_client *client);
+static void start_resume(struct audio_device *dev, struct unix_client *client);
+
 static void client_free(struct unix_client *client)
 {
 	debug("client_free(%p)", client);
@@ -161,6 +166,14 @@ static void unix_ipc_error(struct unix_client *client, uint8_t name, int err)
 	if (!g_slist_find(clients, client))
 		return;
 
+	/* Whichever step of a BT_SETUP_STREAM failed, that is the answer */
+	if (client->setup_stream && (name == BT_OPEN ||
+					name == BT_SET_CONFIGURATION ||
+					name == BT_START_STREAM)) {
+		client->setup_stream = FALSE;
+		name = BT_SETUP_STREAM;
+	}
+
 	memset(buf, 0, sizeof(buf));
 	rsp->h.type = BT_ERROR;
 	rsp->h.name = name;
@@ -172,6 +185,74 @@ static void unix_ipc_error(struct unix_client *client, uint8_t name, int err)
 	unix_ipc_sendmsg(client, &rsp->h);
 }
 
+/* Answers BT_SET_CONFIGURATION, or starts the stream right away when the
+ * configuration is a step of BT_SETUP_STREAM */
+static void unix_config_complete(struct unix_client *client,
+							uint16_t link_mtu)
+{
+	char buf[BT_SUGGESTED_BUFFER_SIZE];
+	struct bt_set_configuration_rsp *rsp = (void *) buf;
+
+	if (client->setup_stream) {
+		client->link_mtu = link_mtu;
+		start_resume(client->dev, client);
+		return;
+	}
+
+	memset(buf, 0, sizeof(buf));
+
+	rsp->h.type = BT_RESPONSE;
+	rsp->h.name = BT_SET_CONFIGURATION;
+	rsp->h.length = sizeof(*rsp);
+
+	rsp->link_mtu = link_mtu;
+
+	unix_ipc_sendmsg(client, &rsp->h);
+}
+
+/* Answers BT_START_STREAM or BT_SETUP_STREAM, the caller then sends the
+ * new stream indication in both cases */
+static void unix_start_complete(struct unix_client *client)
+{
+	char buf[BT_SUGGESTED_BUFFER_SIZE];
+	struct bt_start_stream_rsp *rsp = (void *) buf;
+	struct bt_setup_stream_rsp *setup_rsp = (void *) buf;
+
+	memset(buf, 0, sizeof(buf));
+
+	if (client->setup_stream) {
+		client->setup_stream = FALSE;
+
+		setup_rsp->h.type = BT_RESPONSE;
+		setup_rsp->h.name = BT_SETUP_STREAM;
+		setup_rsp->h.length = sizeof(*setup_rsp);
+
+		setup_rsp->link_mtu = client->link_mtu;
+
+		unix_ipc_sendmsg(client, &setup_rsp->h);
+		return;
+	}
+
+	rsp->h.type = BT_RESPONSE;
+	rsp->h.name = BT_START_STREAM;
+	rsp->h.length = sizeof(*rsp);
+
+	unix_ipc_sendmsg(client, &rsp->h);
+}
+
+static void unix_send_delay(struct unix_client *client, uint16_t delay)
+{
+	struct bt_delay_report_ind ind;
+
+	memset(&ind, 0, sizeof(ind));
+	ind.h.type = BT_INDICATION;
+	ind.h.name = BT_DELAY_REPORT;
+	ind.h.length = sizeof(ind);
+	ind.delay = delay;
+
+	unix_ipc_sendmsg(client, &ind.h);
+}
+
 static service_type_t select_service(struct audio_device *dev, const char *interface)
 {
 	if (!interface) {
@@ -291,25 +372,15 @@ failed:
 static void headset_setup_complete(struct audio_device *dev, void *user_data)
 {
 	struct unix_client *client = user_data;
-	char buf[BT_SUGGESTED_BUFFER_SIZE];
-	struct bt_set_configuration_rsp *rsp = (void *) buf;
 
 	client->req_id = 0;
 
 	if (!dev)
 		goto failed;
 
-	memset(buf, 0, sizeof(buf));
-
-	rsp->h.type = BT_RESPONSE;
-	rsp->h.name = BT_SET_CONFIGURATION;
-	rsp->h.length = sizeof(*rsp);
-
-	rsp->link_mtu = 48;
-
 	client->data_fd = headset_get_sco_fd(dev);
 
-	unix_ipc_sendmsg(client, &rsp->h);
+	unix_config_complete(client, 48);
 
 	return;
 
@@ -321,8 +392,6 @@ failed:
 static void gateway_setup_complete(struct audio_device *dev, void *user_data)
 {
 	struct unix_client *client = user_data;
-	char buf[BT_SUGGESTED_BUFFER_SIZE];
-	struct bt_set_configuration_rsp *rsp = (void *) buf;
 
 	if (!dev) {
 		unix_ipc_error(client, BT_SET_CONFIGURATION, EIO);
@@ -331,24 +400,15 @@ static void gateway_setup_complete(struct audio_device *dev, void *user_data)
 
 	client->req_id = 0;
 
-	memset(buf, 0, sizeof(buf));
-
-	rsp->h.type = BT_RESPONSE;
-	rsp->h.name = BT_SET_CONFIGURATION;
-	rsp->h.length = sizeof(*rsp);
-
-	rsp->link_mtu = 48;
-
 	client->data_fd = gateway_get_sco_fd(dev);
 
-	unix_ipc_sendmsg(client, &rsp->h);
+	unix_config_complete(client, 48);
 }
 
 static void headset_resume_complete(struct audio_device *dev, void *user_data)
 {
 	struct unix_client *client = user_data;
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
-	struct bt_start_stream_rsp *rsp = (void *) buf;
 	struct bt_new_stream_ind *ind = (void *) buf;
 
 	client->req_id = 0;
@@ -362,12 +422,7 @@ static void headset_resume_complete(struct audio_device *dev, void *user_data)
 		goto failed;
 	}
 
-	memset(buf, 0, sizeof(buf));
-	rsp->h.type = BT_RESPONSE;
-	rsp->h.name = BT_START_STREAM;
-	rsp->h.length = sizeof(*rsp);
-
-	unix_ipc_sendmsg(client, &rsp->h);
+	unix_start_complete(client);
 
 	memset(buf, 0, sizeof(buf));
 	ind->h.type = BT_INDICATION;
@@ -392,15 +447,9 @@ static void gateway_resume_complete(struct audio_device *dev, void *user_data)
 {
 	struct unix_client *client = user_data;
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
-	struct bt_start_stream_rsp *rsp = (void *) buf;
 	struct bt_new_stream_ind *ind = (void *) buf;
 
-	memset(buf, 0, sizeof(buf));
-	rsp->h.type = BT_RESPONSE;
-	rsp->h.name = BT_START_STREAM;
-	rsp->h.length = sizeof(*rsp);
-
-	unix_ipc_sendmsg(client, &rsp->h);
+	unix_start_complete(client);
 
 	memset(buf, 0, sizeof(buf));
 	ind->h.type = BT_INDICATION;
@@ -695,8 +744,6 @@ static void a2dp_config_complete(struct avdtp *session, struct a2dp_sep *sep,
 					void *user_data)
 {
 	struct unix_client *client = user_data;
-	char buf[BT_SUGGESTED_BUFFER_SIZE];
-	struct bt_set_configuration_rsp *rsp = (void *) buf;
 	struct a2dp_data *a2dp = &client->d.a2dp;
 	uint16_t imtu, omtu;
 	GSList *caps;
@@ -706,8 +753,6 @@ static void a2dp_config_complete(struct avdtp *session, struct a2dp_sep *sep,
 	if (err)
 		goto failed;
 
-	memset(buf, 0, sizeof(buf));
-
 	if (!stream)
 		goto failed;
 
@@ -724,18 +769,12 @@ static void a2dp_config_complete(struct avdtp *session, struct a2dp_sep *sep,
 		goto failed;
 	}
 
-	rsp->h.type = BT_RESPONSE;
-	rsp->h.name = BT_SET_CONFIGURATION;
-	rsp->h.length = sizeof(*rsp);
-
-	/* FIXME: Use imtu when fd_opt is CFG_FD_OPT_READ */
-	rsp->link_mtu = omtu;
-
-	unix_ipc_sendmsg(client, &rsp->h);
-
 	client->cb_id = avdtp_stream_add_cb(session, stream,
 						stream_state_changed, client);
 
+	/* FIXME: Use imtu when fd_opt is CFG_FD_OPT_READ */
+	unix_config_complete(client, omtu);
+
 	return;
 
 failed:
@@ -755,24 +794,19 @@ static void a2dp_resume_complete(struct avdtp *session,
 {
 	struct unix_client *client = user_data;
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
-	struct bt_start_stream_rsp *rsp = (void *) buf;
 	struct bt_new_stream_ind *ind = (void *) buf;
 	struct a2dp_data *a2dp = &client->d.a2dp;
+	uint16_t delay;
 
 	if (err)
 		goto failed;
 
-	memset(buf, 0, sizeof(buf));
-	rsp->h.type = BT_RESPONSE;
-	rsp->h.name = BT_START_STREAM;
-	rsp->h.length = sizeof(*rsp);
-
-	unix_ipc_sendmsg(client, &rsp->h);
+	unix_start_complete(client);
 
 	memset(buf, 0, sizeof(buf));
 	ind->h.type = BT_RESPONSE;
 	ind->h.name = BT_NEW_STREAM;
-	rsp->h.length = sizeof(*ind);
+	ind->h.length = sizeof(*ind);
 
 	unix_ipc_sendmsg(client, &ind->h);
 
@@ -781,6 +815,11 @@ static void a2dp_resume_complete(struct avdtp *session,
 		goto failed;
 	}
 
+	/* Reports received while the client was busy with a request may
+	 * have been skipped, so it always starts with the current one */
+	if (avdtp_stream_get_delay(a2dp->stream, &delay))
+		unix_send_delay(client, delay);
+
 	return;
 
 failed:
@@ -892,6 +931,11 @@ static void open_complete(struct audio_device *dev, void *user_data)
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
 	struct bt_open_rsp *rsp = (void *) buf;
 
+	if (client->setup_stream) {
+		start_config(dev, client);
+		return;
+	}
+
 	memset(buf, 0, sizeof(buf));
 
 	rsp->h.type = BT_RESPONSE;
@@ -1385,37 +1429,33 @@ static int handle_a2dp_open(struct unix_client *client, struct bt_open_req *req)
 	return 0;
 }
 
-static void handle_open_req(struct unix_client *client, struct bt_open_req *req)
+static struct audio_device *find_open_device(struct unix_client *client,
+					struct bt_open_req *req, int *err)
 {
 	struct audio_device *dev;
 	bdaddr_t src, dst;
-	int err = 0;
+
+	*err = 0;
 
 	if (!check_nul(req->source) || !check_nul(req->destination) ||
 			!check_nul(req->object)) {
-		err = EINVAL;
-		goto failed;
+		*err = EINVAL;
+		return NULL;
 	}
 
 	str2ba(req->source, &src);
 	str2ba(req->destination, &dst);
 
-	if (req->seid > BT_A2DP_SEID_RANGE) {
-		err = handle_sco_open(client, req);
-		if (err < 0) {
-			err = -err;
-			goto failed;
-		}
-	} else {
-		err = handle_a2dp_open(client, req);
-		if (err < 0) {
-			err = -err;
-			goto failed;
-		}
-	}
+	if (req->seid > BT_A2DP_SEID_RANGE)
+		*err = -handle_sco_open(client, req);
+	else
+		*err = -handle_a2dp_open(client, req);
+
+	if (*err)
+		return NULL;
 
 	if (!manager_find_device(req->object, &src, &dst, NULL, FALSE))
-		goto failed;
+		return NULL;
 
 	dev = manager_find_device(req->object, &src, &dst, client->interface,
 				TRUE);
@@ -1424,11 +1464,23 @@ static void handle_open_req(struct unix_client *client, struct bt_open_req *req)
 					client->interface, FALSE);
 
 	if (!dev)
-		goto failed;
+		return NULL;
 
 	client->seid = req->seid;
 	client->lock = req->lock;
 
+	return dev;
+}
+
+static void handle_open_req(struct unix_client *client, struct bt_open_req *req)
+{
+	struct audio_device *dev;
+	int err;
+
+	dev = find_open_device(client, req, &err);
+	if (!dev)
+		goto failed;
+
 	start_open(dev, client);
 
 	return;
@@ -1438,7 +1490,7 @@ failed:
 }
 
 static int handle_sco_transport(struct unix_client *client,
-				struct bt_set_configuration_req *req)
+				codec_capabilities_t *codec)
 {
 	struct audio_device *dev = client->dev;
 
@@ -1457,7 +1509,7 @@ static int handle_sco_transport(struct unix_client *client,
 }
 
 static int handle_a2dp_transport(struct unix_client *client,
-				struct bt_set_configuration_req *req)
+				codec_capabilities_t *codec)
 {
 	struct avdtp_service_capability *media_transport, *media_codec;
 	struct sbc_codec_cap sbc_cap;
@@ -1481,9 +1533,9 @@ static int handle_a2dp_transport(struct unix_client *client,
 
 	client->caps = g_slist_append(client->caps, media_transport);
 
-	if (req->codec.type == BT_A2DP_MPEG12_SINK ||
-		req->codec.type == BT_A2DP_MPEG12_SOURCE) {
-		mpeg_capabilities_t *mpeg = (void *) &req->codec;
+	if (codec->type == BT_A2DP_MPEG12_SINK ||
+		codec->type == BT_A2DP_MPEG12_SOURCE) {
+		mpeg_capabilities_t *mpeg = (void *) codec;
 
 		memset(&mpeg_cap, 0, sizeof(mpeg_cap));
 
@@ -1500,9 +1552,9 @@ static int handle_a2dp_transport(struct unix_client *client,
 							sizeof(mpeg_cap));
 
 		print_mpeg12(&mpeg_cap);
-	} else if (req->codec.type == BT_A2DP_SBC_SINK ||
-			req->codec.type == BT_A2DP_SBC_SOURCE) {
-		sbc_capabilities_t *sbc = (void *) &req->codec;
+	} else if (codec->type == BT_A2DP_SBC_SINK ||
+			codec->type == BT_A2DP_SBC_SOURCE) {
+		sbc_capabilities_t *sbc = (void *) codec;
 
 		memset(&sbc_cap, 0, sizeof(sbc_cap));
 
@@ -1528,6 +1580,17 @@ static int handle_a2dp_transport(struct unix_client *client,
 	return 0;
 }
 
+static int handle_transport(struct unix_client *client,
+				codec_capabilities_t *codec)
+{
+	if (codec->transport == BT_CAPABILITIES_TRANSPORT_SCO)
+		return handle_sco_transport(client, codec);
+	else if (codec->transport == BT_CAPABILITIES_TRANSPORT_A2DP)
+		return handle_a2dp_transport(client, codec);
+
+	return 0;
+}
+
 static void handle_setconfiguration_req(struct unix_client *client,
 					struct bt_set_configuration_req *req)
 {
@@ -1542,18 +1605,10 @@ static void handle_setconfiguration_req(struct unix_client *client,
 	if (!client->dev)
 		goto failed;
 
-	if (req->codec.transport == BT_CAPABILITIES_TRANSPORT_SCO) {
-		err = handle_sco_transport(client, req);
-		if (err < 0) {
-			err = -err;
-			goto failed;
-		}
-	} else if (req->codec.transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
-		err = handle_a2dp_transport(client, req);
-		if (err < 0) {
-			err = -err;
-			goto failed;
-		}
+	err = handle_transport(client, &req->codec);
+	if (err < 0) {
+		err = -err;
+		goto failed;
 	}
 
 	start_config(client->dev, client);
@@ -1564,6 +1619,48 @@ failed:
 	unix_ipc_error(client, BT_SET_CONFIGURATION, err ? : EIO);
 }
 
+/* Runs the open, configuration and start steps back to back, each step
+ * completion continues with the next one instead of answering */
+static void handle_setup_stream_req(struct unix_client *client,
+					struct bt_setup_stream_req *req)
+{
+	struct bt_open_req open_req;
+	struct audio_device *dev;
+	int err;
+
+	if (req->h.length < sizeof(*req) ||
+			req->h.length < sizeof(*req) - sizeof(req->codec) +
+							req->codec.length) {
+		err = EINVAL;
+		goto failed;
+	}
+
+	memset(&open_req, 0, sizeof(open_req));
+	memcpy(open_req.source, req->source, sizeof(open_req.source));
+	memcpy(open_req.destination, req->destination,
+					sizeof(open_req.destination));
+	memcpy(open_req.object, req->object, sizeof(open_req.object));
+	open_req.seid = req->codec.seid;
+	open_req.lock = req->lock;
+
+	dev = find_open_device(client, &open_req, &err);
+	if (!dev)
+		goto failed;
+
+	err = -handle_transport(client, &req->codec);
+	if (err)
+		goto failed;
+
+	client->setup_stream = TRUE;
+
+	start_open(dev, client);
+
+	return;
+
+failed:
+	unix_ipc_error(client, BT_SETUP_STREAM, err ? : EIO);
+}
+
 static void handle_streamstart_req(struct unix_client *client,
 					struct bt_start_stream_req *req)
 {
@@ -1739,6 +1836,10 @@ static gboolean client_cb(GIOChannel *chan, GIOCondition cond, gpointer data)
 		handle_delay_report_req(client,
 				(struct bt_delay_report_req *) msghdr);
 		break;
+	case BT_SETUP_STREAM:
+		handle_setup_stream_req(client,
+				(struct bt_setup_stream_req *) msghdr);
+		break;
 	default:
 		error("Audio API: received unexpected message name %d",
 				msghdr->name);
@@ -1818,23 +1919,16 @@ void unix_device_removed(struct audio_device *dev)
 void unix_delay_report(struct audio_device *dev, uint8_t seid, uint16_t delay)
 {
 	GSList *l;
-	struct bt_delay_report_ind ind;
 
 	debug("unix_delay_report(%p): %u.%ums", dev, delay / 10, delay % 10);
 
-	memset(&ind, 0, sizeof(ind));
-	ind.h.type = BT_INDICATION;
-	ind.h.name = BT_DELAY_REPORT;
-	ind.h.length = sizeof(ind);
-	ind.delay = delay;
-
 	for (l = clients; l != NULL; l = g_slist_next(l)) {
 		struct unix_client *client = l->data;
 
 		if (client->dev != dev || client->seid != seid)
 			continue;
 
-		unix_ipc_sendmsg(client, (void *) &ind);
+		unix_send_delay(client, delay);
 	}
 }
 
@@ -954,6 +954,9 @@ int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 	memset(buf, 0, sizeof(sdp_buf_t));
 	sdp_list_foreach(rec->attrlist, sdp_attr_size, buf);
 
+	/* room for the header of the attribute list sequence */
+	buf->buf_size += sizeof(uint8_t) + sizeof(uint32_t);
+
 	buf->data = malloc(buf->buf_size);
 	if (!buf->data)
 		return -ENOMEM;
@@ -89,82 +89,431 @@ struct sbc_frame {
 	int16_t SBC_ALIGNED pcm_sample[2][16*8];
 };
 
-struct sbc_decoder_state {
-	int subbands;
-	int32_t V[2][170];
-	int offset[2][16];
+/*
+ * CRC-8 lookup tables for the SBC polynomial x^8 + x^4 + x^3 + x^2 + 1,
+ * crc_table[k][b] is the CRC of byte b followed by k zero bytes, which
+ * allows eight bytes to be folded into the CRC with independent lookups
+ */
+static const uint8_t crc_table[8][256] = {
+	{
+		0x00, 0x1D, 0x3A, 0x27, 0x74, 0x69, 0x4E, 0x53,
+		0xE8, 0xF5, 0xD2, 0xCF, 0x9C, 0x81, 0xA6, 0xBB,
+		0xCD, 0xD0, 0xF7, 0xEA, 0xB9, 0xA4, 0x83, 0x9E,
+		0x25, 0x38, 0x1F, 0x02, 0x51, 0x4C, 0x6B, 0x76,
+		0x87, 0x9A, 0xBD, 0xA0, 0xF3, 0xEE, 0xC9, 0xD4,
+		0x6F, 0x72, 0x55, 0x48, 0x1B, 0x06, 0x21, 0x3C,
+		0x4A, 0x57, 0x70, 0x6D, 0x3E, 0x23, 0x04, 0x19,
+		0xA2, 0xBF, 0x98, 0x85, 0xD6, 0xCB, 0xEC, 0xF1,
+		0x13, 0x0E, 0x29, 0x34, 0x67, 0x7A, 0x5D, 0x40,
+		0xFB, 0xE6, 0xC1, 0xDC, 0x8F, 0x92, 0xB5, 0xA8,
+		0xDE, 0xC3, 0xE4, 0xF9, 0xAA, 0xB7, 0x90, 0x8D,
+		0x36, 0x2B, 0x0C, 0x11, 0x42, 0x5F, 0x78, 0x65,
+		0x94, 0x89, 0xAE, 0xB3, 0xE0, 0xFD, 0xDA, 0xC7,
+		0x7C, 0x61, 0x46, 0x5B, 0x08, 0x15, 0x32, 0x2F,
+		0x59, 0x44, 0x63, 0x7E, 0x2D, 0x30, 0x17, 0x0A,
+		0xB1, 0xAC, 0x8B, 0x96, 0xC5, 0xD8, 0xFF, 0xE2,
+		0x26, 0x3B, 0x1C, 0x01, 0x52, 0x4F, 0x68, 0x75,
+		0xCE, 0xD3, 0xF4, 0xE9, 0xBA, 0xA7, 0x80, 0x9D,
+		0xEB, 0xF6, 0xD1, 0xCC, 0x9F, 0x82, 0xA5, 0xB8,
+		0x03, 0x1E, 0x39, 0x24, 0x77, 0x6A, 0x4D, 0x50,
+		0xA1, 0xBC, 0x9B, 0x86, 0xD5, 0xC8, 0xEF, 0xF2,
+		0x49, 0x54, 0x73, 0x6E, 0x3D, 0x20, 0x07, 0x1A,
+		0x6C, 0x71, 0x56, 0x4B, 0x18, 0x05, 0x22, 0x3F,
+		0x84, 0x99, 0xBE, 0xA3, 0xF0, 0xED, 0xCA, 0xD7,
+		0x35, 0x28, 0x0F, 0x12, 0x41, 0x5C, 0x7B, 0x66,
+		0xDD, 0xC0, 0xE7, 0xFA, 0xA9, 0xB4, 0x93, 0x8E,
+		0xF8, 0xE5, 0xC2, 0xDF, 0x8C, 0x91, 0xB6, 0xAB,
+		0x10, 0x0D, 0x2A, 0x37, 0x64, 0x79, 0x5E, 0x43,
+		0xB2, 0xAF, 0x88, 0x95, 0xC6, 0xDB, 0xFC, 0xE1,
+		0x5A, 0x47, 0x60, 0x7D, 0x2E, 0x33, 0x14, 0x09,
+		0x7F, 0x62, 0x45, 0x58, 0x0B, 0x16, 0x31, 0x2C,
+		0x97, 0x8A, 0xAD, 0xB0, 0xE3, 0xFE, 0xD9, 0xC4
+	},
+	{
+		0x00, 0x4C, 0x98, 0xD4, 0x2D, 0x61, 0xB5, 0xF9,
+		0x5A, 0x16, 0xC2, 0x8E, 0x77, 0x3B, 0xEF, 0xA3,
+		0xB4, 0xF8, 0x2C, 0x60, 0x99, 0xD5, 0x01, 0x4D,
+		0xEE, 0xA2, 0x76, 0x3A, 0xC3, 0x8F, 0x5B, 0x17,
+		0x75, 0x39, 0xED, 0xA1, 0x58, 0x14, 0xC0, 0x8C,
+		0x2F, 0x63, 0xB7, 0xFB, 0x02, 0x4E, 0x9A, 0xD6,
+		0xC1, 0x8D, 0x59, 0x15, 0xEC, 0xA0, 0x74, 0x38,
+		0x9B, 0xD7, 0x03, 0x4F, 0xB6, 0xFA, 0x2E, 0x62,
+		0xEA, 0xA6, 0x72, 0x3E, 0xC7, 0x8B, 0x5F, 0x13,
+		0xB0, 0xFC, 0x28, 0x64, 0x9D, 0xD1, 0x05, 0x49,
+		0x5E, 0x12, 0xC6, 0x8A, 0x73, 0x3F, 0xEB, 0xA7,
+		0x04, 0x48, 0x9C, 0xD0, 0x29, 0x65, 0xB1, 0xFD,
+		0x9F, 0xD3, 0x07, 0x4B, 0xB2, 0xFE, 0x2A, 0x66,
+		0xC5, 0x89, 0x5D, 0x11, 0xE8, 0xA4, 0x70, 0x3C,
+		0x2B, 0x67, 0xB3, 0xFF, 0x06, 0x4A, 0x9E, 0xD2,
+		0x71, 0x3D, 0xE9, 0xA5, 0x5C, 0x10, 0xC4, 0x88,
+		0xC9, 0x85, 0x51, 0x1D, 0xE4, 0xA8, 0x7C, 0x30,
+		0x93, 0xDF, 0x0B, 0x47, 0xBE, 0xF2, 0x26, 0x6A,
+		0x7D, 0x31, 0xE5, 0xA9, 0x50, 0x1C, 0xC8, 0x84,
+		0x27, 0x6B, 0xBF, 0xF3, 0x0A, 0x46, 0x92, 0xDE,
+		0xBC, 0xF0, 0x24, 0x68, 0x91, 0xDD, 0x09, 0x45,
+		0xE6, 0xAA, 0x7E, 0x32, 0xCB, 0x87, 0x53, 0x1F,
+		0x08, 0x44, 0x90, 0xDC, 0x25, 0x69, 0xBD, 0xF1,
+		0x52, 0x1E, 0xCA, 0x86, 0x7F, 0x33, 0xE7, 0xAB,
+		0x23, 0x6F, 0xBB, 0xF7, 0x0E, 0x42, 0x96, 0xDA,
+		0x79, 0x35, 0xE1, 0xAD, 0x54, 0x18, 0xCC, 0x80,
+		0x97, 0xDB, 0x0F, 0x43, 0xBA, 0xF6, 0x22, 0x6E,
+		0xCD, 0x81, 0x55, 0x19, 0xE0, 0xAC, 0x78, 0x34,
+		0x56, 0x1A, 0xCE, 0x82, 0x7B, 0x37, 0xE3, 0xAF,
+		0x0C, 0x40, 0x94, 0xD8, 0x21, 0x6D, 0xB9, 0xF5,
+		0xE2, 0xAE, 0x7A, 0x36, 0xCF, 0x83, 0x57, 0x1B,
+		0xB8, 0xF4, 0x20, 0x6C, 0x95, 0xD9, 0x0D, 0x41
+	},
+	{
+		0x00, 0x8F, 0x03, 0x8C, 0x06, 0x89, 0x05, 0x8A,
+		0x0C, 0x83, 0x0F, 0x80, 0x0A, 0x85, 0x09, 0x86,
+		0x18, 0x97, 0x1B, 0x94, 0x1E, 0x91, 0x1D, 0x92,
+		0x14, 0x9B, 0x17, 0x98, 0x12, 0x9D, 0x11, 0x9E,
+		0x30, 0xBF, 0x33, 0xBC, 0x36, 0xB9, 0x35, 0xBA,
+		0x3C, 0xB3, 0x3F, 0xB0, 0x3A, 0xB5, 0x39, 0xB6,
+		0x28, 0xA7, 0x2B, 0xA4, 0x2E, 0xA1, 0x2D, 0xA2,
+		0x24, 0xAB, 0x27, 0xA8, 0x22, 0xAD, 0x21, 0xAE,
+		0x60, 0xEF, 0x63, 0xEC, 0x66, 0xE9, 0x65, 0xEA,
+		0x6C, 0xE3, 0x6F, 0xE0, 0x6A, 0xE5, 0x69, 0xE6,
+		0x78, 0xF7, 0x7B, 0xF4, 0x7E, 0xF1, 0x7D, 0xF2,
+		0x74, 0xFB, 0x77, 0xF8, 0x72, 0xFD, 0x71, 0xFE,
+		0x50, 0xDF, 0x53, 0xDC, 0x56, 0xD9, 0x55, 0xDA,
+		0x5C, 0xD3, 0x5F, 0xD0, 0x5A, 0xD5, 0x59, 0xD6,
+		0x48, 0xC7, 0x4B, 0xC4, 0x4E, 0xC1, 0x4D, 0xC2,
+		0x44, 0xCB, 0x47, 0xC8, 0x42, 0xCD, 0x41, 0xCE,
+		0xC0, 0x4F, 0xC3, 0x4C, 0xC6, 0x49, 0xC5, 0x4A,
+		0xCC, 0x43, 0xCF, 0x40, 0xCA, 0x45, 0xC9, 0x46,
+		0xD8, 0x57, 0xDB, 0x54, 0xDE, 0x51, 0xDD, 0x52,
+		0xD4, 0x5B, 0xD7, 0x58, 0xD2, 0x5D, 0xD1, 0x5E,
+		0xF0, 0x7F, 0xF3, 0x7C, 0xF6, 0x79, 0xF5, 0x7A,
+		0xFC, 0x73, 0xFF, 0x70, 0xFA, 0x75, 0xF9, 0x76,
+		0xE8, 0x67, 0xEB, 0x64, 0xEE, 0x61, 0xED, 0x62,
+		0xE4, 0x6B, 0xE7, 0x68, 0xE2, 0x6D, 0xE1, 0x6E,
+		0xA0, 0x2F, 0xA3, 0x2C, 0xA6, 0x29, 0xA5, 0x2A,
+		0xAC, 0x23, 0xAF, 0x20, 0xAA, 0x25, 0xA9, 0x26,
+		0xB8, 0x37, 0xBB, 0x34, 0xBE, 0x31, 0xBD, 0x32,
+		0xB4, 0x3B, 0xB7, 0x38, 0xB2, 0x3D, 0xB1, 0x3E,
+		0x90, 0x1F, 0x93, 0x1C, 0x96, 0x19, 0x95, 0x1A,
+		0x9C, 0x13, 0x9F, 0x10, 0x9A, 0x15, 0x99, 0x16,
+		0x88, 0x07, 0x8B, 0x04, 0x8E, 0x01, 0x8D, 0x02,
+		0x84, 0x0B, 0x87, 0x08, 0x82, 0x0D, 0x81, 0x0E
+	},
+	{
+		0x00, 0x9D, 0x27, 0xBA, 0x4E, 0xD3, 0x69, 0xF4,
+		0x9C, 0x01, 0xBB, 0x26, 0xD2, 0x4F, 0xF5, 0x68,
+		0x25, 0xB8, 0x02, 0x9F, 0x6B, 0xF6, 0x4C, 0xD1,
+		0xB9, 0x24, 0x9E, 0x03, 0xF7, 0x6A, 0xD0, 0x4D,
+		0x4A, 0xD7, 0x6D, 0xF0, 0x04, 0x99, 0x23, 0xBE,
+		0xD6, 0x4B, 0xF1, 0x6C, 0x98, 0x05, 0xBF, 0x22,
+		0x6F, 0xF2, 0x48, 0xD5, 0x21, 0xBC, 0x06, 0x9B,
+		0xF3, 0x6E, 0xD4, 0x49, 0xBD, 0x20, 0x9A, 0x07,
+		0x94, 0x09, 0xB3, 0x2E, 0xDA, 0x47, 0xFD, 0x60,
+		0x08, 0x95, 0x2F, 0xB2, 0x46, 0xDB, 0x61, 0xFC,
+		0xB1, 0x2C, 0x96, 0x0B, 0xFF, 0x62, 0xD8, 0x45,
+		0x2D, 0xB0, 0x0A, 0x97, 0x63, 0xFE, 0x44, 0xD9,
+		0xDE, 0x43, 0xF9, 0x64, 0x90, 0x0D, 0xB7, 0x2A,
+		0x42, 0xDF, 0x65, 0xF8, 0x0C, 0x91, 0x2B, 0xB6,
+		0xFB, 0x66, 0xDC, 0x41, 0xB5, 0x28, 0x92, 0x0F,
+		0x67, 0xFA, 0x40, 0xDD, 0x29, 0xB4, 0x0E, 0x93,
+		0x35, 0xA8, 0x12, 0x8F, 0x7B, 0xE6, 0x5C, 0xC1,
+		0xA9, 0x34, 0x8E, 0x13, 0xE7, 0x7A, 0xC0, 0x5D,
+		0x10, 0x8D, 0x37, 0xAA, 0x5E, 0xC3, 0x79, 0xE4,
+		0x8C, 0x11, 0xAB, 0x36, 0xC2, 0x5F, 0xE5, 0x78,
+		0x7F, 0xE2, 0x58, 0xC5, 0x31, 0xAC, 0x16, 0x8B,
+		0xE3, 0x7E, 0xC4, 0x59, 0xAD, 0x30, 0x8A, 0x17,
+		0x5A, 0xC7, 0x7D, 0xE0, 0x14, 0x89, 0x33, 0xAE,
+		0xC6, 0x5B, 0xE1, 0x7C, 0x88, 0x15, 0xAF, 0x32,
+		0xA1, 0x3C, 0x86, 0x1B, 0xEF, 0x72, 0xC8, 0x55,
+		0x3D, 0xA0, 0x1A, 0x87, 0x73, 0xEE, 0x54, 0xC9,
+		0x84, 0x19, 0xA3, 0x3E, 0xCA, 0x57, 0xED, 0x70,
+		0x18, 0x85, 0x3F, 0xA2, 0x56, 0xCB, 0x71, 0xEC,
+		0xEB, 0x76, 0xCC, 0x51, 0xA5, 0x38, 0x82, 0x1F,
+		0x77, 0xEA, 0x50, 0xCD, 0x39, 0xA4, 0x1E, 0x83,
+		0xCE, 0x53, 0xE9, 0x74, 0x80, 0x1D, 0xA7, 0x3A,
+		0x52, 0xCF, 0x75, 0xE8, 0x1C, 0x81, 0x3B, 0xA6
+	},
+	{
+		0x00, 0x6A, 0xD4, 0xBE, 0xB5, 0xDF, 0x61, 0x0B,
+		0x77, 0x1D, 0xA3, 0xC9, 0xC2, 0xA8, 0x16, 0x7C,
+		0xEE, 0x84, 0x3A, 0x50, 0x5B, 0x31, 0x8F, 0xE5,
+		0x99, 0xF3, 0x4D, 0x27, 0x2C, 0x46, 0xF8, 0x92,
+		0xC1, 0xAB, 0x15, 0x7F, 0x74, 0x1E, 0xA0, 0xCA,
+		0xB6, 0xDC, 0x62, 0x08, 0x03, 0x69, 0xD7, 0xBD,
+		0x2F, 0x45, 0xFB, 0x91, 0x9A, 0xF0, 0x4E, 0x24,
+		0x58, 0x32, 0x8C, 0xE6, 0xED, 0x87, 0x39, 0x53,
+		0x9F, 0xF5, 0x4B, 0x21, 0x2A, 0x40, 0xFE, 0x94,
+		0xE8, 0x82, 0x3C, 0x56, 0x5D, 0x37, 0x89, 0xE3,
+		0x71, 0x1B, 0xA5, 0xCF, 0xC4, 0xAE, 0x10, 0x7A,
+		0x06, 0x6C, 0xD2, 0xB8, 0xB3, 0xD9, 0x67, 0x0D,
+		0x5E, 0x34, 0x8A, 0xE0, 0xEB, 0x81, 0x3F, 0x55,
+		0x29, 0x43, 0xFD, 0x97, 0x9C, 0xF6, 0x48, 0x22,
+		0xB0, 0xDA, 0x64, 0x0E, 0x05, 0x6F, 0xD1, 0xBB,
+		0xC7, 0xAD, 0x13, 0x79, 0x72, 0x18, 0xA6, 0xCC,
+		0x23, 0x49, 0xF7, 0x9D, 0x96, 0xFC, 0x42, 0x28,
+		0x54, 0x3E, 0x80, 0xEA, 0xE1, 0x8B, 0x35, 0x5F,
+		0xCD, 0xA7, 0x19, 0x73, 0x78, 0x12, 0xAC, 0xC6,
+		0xBA, 0xD0, 0x6E, 0x04, 0x0F, 0x65, 0xDB, 0xB1,
+		0xE2, 0x88, 0x36, 0x5C, 0x57, 0x3D, 0x83, 0xE9,
+		0x95, 0xFF, 0x41, 0x2B, 0x20, 0x4A, 0xF4, 0x9E,
+		0x0C, 0x66, 0xD8, 0xB2, 0xB9, 0xD3, 0x6D, 0x07,
+		0x7B, 0x11, 0xAF, 0xC5, 0xCE, 0xA4, 0x1A, 0x70,
+		0xBC, 0xD6, 0x68, 0x02, 0x09, 0x63, 0xDD, 0xB7,
+		0xCB, 0xA1, 0x1F, 0x75, 0x7E, 0x14, 0xAA, 0xC0,
+		0x52, 0x38, 0x86, 0xEC, 0xE7, 0x8D, 0x33, 0x59,
+		0x25, 0x4F, 0xF1, 0x9B, 0x90, 0xFA, 0x44, 0x2E,
+		0x7D, 0x17, 0xA9, 0xC3, 0xC8, 0xA2, 0x1C, 0x76,
+		0x0A, 0x60, 0xDE, 0xB4, 0xBF, 0xD5, 0x6B, 0x01,
+		0x93, 0xF9, 0x47, 0x2D, 0x26, 0x4C, 0xF2, 0x98,
+		0xE4, 0x8E, 0x30, 0x5A, 0x51, 0x3B, 0x85, 0xEF
+	},
+	{
+		0x00, 0x46, 0x8C, 0xCA, 0x05, 0x43, 0x89, 0xCF,
+		0x0A, 0x4C, 0x86, 0xC0, 0x0F, 0x49, 0x83, 0xC5,
+		0x14, 0x52, 0x98, 0xDE, 0x11, 0x57, 0x9D, 0xDB,
+		0x1E, 0x58, 0x92, 0xD4, 0x1B, 0x5D, 0x97, 0xD1,
+		0x28, 0x6E, 0xA4, 0xE2, 0x2D, 0x6B, 0xA1, 0xE7,
+		0x22, 0x64, 0xAE, 0xE8, 0x27, 0x61, 0xAB, 0xED,
+		0x3C, 0x7A, 0xB0, 0xF6, 0x39, 0x7F, 0xB5, 0xF3,
+		0x36, 0x70, 0xBA, 0xFC, 0x33, 0x75, 0xBF, 0xF9,
+		0x50, 0x16, 0xDC, 0x9A, 0x55, 0x13, 0xD9, 0x9F,
+		0x5A, 0x1C, 0xD6, 0x90, 0x5F, 0x19, 0xD3, 0x95,
+		0x44, 0x02, 0xC8, 0x8E, 0x41, 0x07, 0xCD, 0x8B,
+		0x4E, 0x08, 0xC2, 0x84, 0x4B, 0x0D, 0xC7, 0x81,
+		0x78, 0x3E, 0xF4, 0xB2, 0x7D, 0x3B, 0xF1, 0xB7,
+		0x72, 0x34, 0xFE, 0xB8, 0x77, 0x31, 0xFB, 0xBD,
+		0x6C, 0x2A, 0xE0, 0xA6, 0x69, 0x2F, 0xE5, 0xA3,
+		0x66, 0x20, 0xEA, 0xAC, 0x63, 0x25, 0xEF, 0xA9,
+		0xA0, 0xE6, 0x2C, 0x6A, 0xA5, 0xE3, 0x29, 0x6F,
+		0xAA, 0xEC, 0x26, 0x60, 0xAF, 0xE9, 0x23, 0x65,
+		0xB4, 0xF2, 0x38, 0x7E, 0xB1, 0xF7, 0x3D, 0x7B,
+		0xBE, 0xF8, 0x32, 0x74, 0xBB, 0xFD, 0x37, 0x71,
+		0x88, 0xCE, 0x04, 0x42, 0x8D, 0xCB, 0x01, 0x47,
+		0x82, 0xC4, 0x0E, 0x48, 0x87, 0xC1, 0x0B, 0x4D,
+		0x9C, 0xDA, 0x10, 0x56, 0x99, 0xDF, 0x15, 0x53,
+		0x96, 0xD0, 0x1A, 0x5C, 0x93, 0xD5, 0x1F, 0x59,
+		0xF0, 0xB6, 0x7C, 0x3A, 0xF5, 0xB3, 0x79, 0x3F,
+		0xFA, 0xBC, 0x76, 0x30, 0xFF, 0xB9, 0x73, 0x35,
+		0xE4, 0xA2, 0x68, 0x2E, 0xE1, 0xA7, 0x6D, 0x2B,
+		0xEE, 0xA8, 0x62, 0x24, 0xEB, 0xAD, 0x67, 0x21,
+		0xD8, 0x9E, 0x54, 0x12, 0xDD, 0x9B, 0x51, 0x17,
+		0xD2, 0x94, 0x5E, 0x18, 0xD7, 0x91, 0x5B, 0x1D,
+		0xCC, 0x8A, 0x40, 0x06, 0xC9, 0x8F, 0x45, 0x03,
+		0xC6, 0x80, 0x4A, 0x0C, 0xC3, 0x85, 0x4F, 0x09
+	},
+	{
+		0x00, 0x5D, 0xBA, 0xE7, 0x69, 0x34, 0xD3, 0x8E,
+		0xD2, 0x8F, 0x68, 0x35, 0xBB, 0xE6, 0x01, 0x5C,
+		0xB9, 0xE4, 0x03, 0x5E, 0xD0, 0x8D, 0x6A, 0x37,
+		0x6B, 0x36, 0xD1, 0x8C, 0x02, 0x5F, 0xB8, 0xE5,
+		0x6F, 0x32, 0xD5, 0x88, 0x06, 0x5B, 0xBC, 0xE1,
+		0xBD, 0xE0, 0x07, 0x5A, 0xD4, 0x89, 0x6E, 0x33,
+		0xD6, 0x8B, 0x6C, 0x31, 0xBF, 0xE2, 0x05, 0x58,
+		0x04, 0x59, 0xBE, 0xE3, 0x6D, 0x30, 0xD7, 0x8A,
+		0xDE, 0x83, 0x64, 0x39, 0xB7, 0xEA, 0x0D, 0x50,
+		0x0C, 0x51, 0xB6, 0xEB, 0x65, 0x38, 0xDF, 0x82,
+		0x67, 0x3A, 0xDD, 0x80, 0x0E, 0x53, 0xB4, 0xE9,
+		0xB5, 0xE8, 0x0F, 0x52, 0xDC, 0x81, 0x66, 0x3B,
+		0xB1, 0xEC, 0x0B, 0x56, 0xD8, 0x85, 0x62, 0x3F,
+		0x63, 0x3E, 0xD9, 0x84, 0x0A, 0x57, 0xB0, 0xED,
+		0x08, 0x55, 0xB2, 0xEF, 0x61, 0x3C, 0xDB, 0x86,
+		0xDA, 0x87, 0x60, 0x3D, 0xB3, 0xEE, 0x09, 0x54,
+		0xA1, 0xFC, 0x1B, 0x46, 0xC8, 0x95, 0x72, 0x2F,
+		0x73, 0x2E, 0xC9, 0x94, 0x1A, 0x47, 0xA0, 0xFD,
+		0x18, 0x45, 0xA2, 0xFF, 0x71, 0x2C, 0xCB, 0x96,
+		0xCA, 0x97, 0x70, 0x2D, 0xA3, 0xFE, 0x19, 0x44,
+		0xCE, 0x93, 0x74, 0x29, 0xA7, 0xFA, 0x1D, 0x40,
+		0x1C, 0x41, 0xA6, 0xFB, 0x75, 0x28, 0xCF, 0x92,
+		0x77, 0x2A, 0xCD, 0x90, 0x1E, 0x43, 0xA4, 0xF9,
+		0xA5, 0xF8, 0x1F, 0x42, 0xCC, 0x91, 0x76, 0x2B,
+		0x7F, 0x22, 0xC5, 0x98, 0x16, 0x4B, 0xAC, 0xF1,
+		0xAD, 0xF0, 0x17, 0x4A, 0xC4, 0x99, 0x7E, 0x23,
+		0xC6, 0x9B, 0x7C, 0x21, 0xAF, 0xF2, 0x15, 0x48,
+		0x14, 0x49, 0xAE, 0xF3, 0x7D, 0x20, 0xC7, 0x9A,
+		0x10, 0x4D, 0xAA, 0xF7, 0x79, 0x24, 0xC3, 0x9E,
+		0xC2, 0x9F, 0x78, 0x25, 0xAB, 0xF6, 0x11, 0x4C,
+		0xA9, 0xF4, 0x13, 0x4E, 0xC0, 0x9D, 0x7A, 0x27,
+		0x7B, 0x26, 0xC1, 0x9C, 0x12, 0x4F, 0xA8, 0xF5
+	},
+	{
+		0x00, 0x5F, 0xBE, 0xE1, 0x61, 0x3E, 0xDF, 0x80,
+		0xC2, 0x9D, 0x7C, 0x23, 0xA3, 0xFC, 0x1D, 0x42,
+		0x99, 0xC6, 0x27, 0x78, 0xF8, 0xA7, 0x46, 0x19,
+		0x5B, 0x04, 0xE5, 0xBA, 0x3A, 0x65, 0x84, 0xDB,
+		0x2F, 0x70, 0x91, 0xCE, 0x4E, 0x11, 0xF0, 0xAF,
+		0xED, 0xB2, 0x53, 0x0C, 0x8C, 0xD3, 0x32, 0x6D,
+		0xB6, 0xE9, 0x08, 0x57, 0xD7, 0x88, 0x69, 0x36,
+		0x74, 0x2B, 0xCA, 0x95, 0x15, 0x4A, 0xAB, 0xF4,
+		0x5E, 0x01, 0xE0, 0xBF, 0x3F, 0x60, 0x81, 0xDE,
+		0x9C, 0xC3, 0x22, 0x7D, 0xFD, 0xA2, 0x43, 0x1C,
+		0xC7, 0x98, 0x79, 0x26, 0xA6, 0xF9, 0x18, 0x47,
+		0x05, 0x5A, 0xBB, 0xE4, 0x64, 0x3B, 0xDA, 0x85,
+		0x71, 0x2E, 0xCF, 0x90, 0x10, 0x4F, 0xAE, 0xF1,
+		0xB3, 0xEC, 0x0D, 0x52, 0xD2, 0x8D, 0x6C, 0x33,
+		0xE8, 0xB7, 0x56, 0x09, 0x89, 0xD6, 0x37, 0x68,
+		0x2A, 0x75, 0x94, 0xCB, 0x4B, 0x14, 0xF5, 0xAA,
+		0xBC, 0xE3, 0x02, 0x5D, 0xDD, 0x82, 0x63, 0x3C,
+		0x7E, 0x21, 0xC0, 0x9F, 0x1F, 0x40, 0xA1, 0xFE,
+		0x25, 0x7A, 0x9B, 0xC4, 0x44, 0x1B, 0xFA, 0xA5,
+		0xE7, 0xB8, 0x59, 0x06, 0x86, 0xD9, 0x38, 0x67,
+		0x93, 0xCC, 0x2D, 0x72, 0xF2, 0xAD, 0x4C, 0x13,
+		0x51, 0x0E, 0xEF, 0xB0, 0x30, 0x6F, 0x8E, 0xD1,
+		0x0A, 0x55, 0xB4, 0xEB, 0x6B, 0x34, 0xD5, 0x8A,
+		0xC8, 0x97, 0x76, 0x29, 0xA9, 0xF6, 0x17, 0x48,
+		0xE2, 0xBD, 0x5C, 0x03, 0x83, 0xDC, 0x3D, 0x62,
+		0x20, 0x7F, 0x9E, 0xC1, 0x41, 0x1E, 0xFF, 0xA0,
+		0x7B, 0x24, 0xC5, 0x9A, 0x1A, 0x45, 0xA4, 0xFB,
+		0xB9, 0xE6, 0x07, 0x58, 0xD8, 0x87, 0x66, 0x39,
+		0xCD, 0x92, 0x73, 0x2C, 0xAC, 0xF3, 0x12, 0x4D,
+		0x0F, 0x50, 0xB1, 0xEE, 0x6E, 0x31, 0xD0, 0x8F,
+		0x54, 0x0B, 0xEA, 0xB5, 0x35, 0x6A, 0x8B, 0xD4,
+		0x96, 0xC9, 0x28, 0x77, 0xF7, 0xA8, 0x49, 0x16
+	}
 };
 
 /*
  * Calculates the CRC-8 of the first len bits in data
  */
-static const uint8_t crc_table[256] = {
-	0x00, 0x1D, 0x3A, 0x27, 0x74, 0x69, 0x4E, 0x53,
-	0xE8, 0xF5, 0xD2, 0xCF, 0x9C, 0x81, 0xA6, 0xBB,
-	0xCD, 0xD0, 0xF7, 0xEA, 0xB9, 0xA4, 0x83, 0x9E,
-	0x25, 0x38, 0x1F, 0x02, 0x51, 0x4C, 0x6B, 0x76,
-	0x87, 0x9A, 0xBD, 0xA0, 0xF3, 0xEE, 0xC9, 0xD4,
-	0x6F, 0x72, 0x55, 0x48, 0x1B, 0x06, 0x21, 0x3C,
-	0x4A, 0x57, 0x70, 0x6D, 0x3E, 0x23, 0x04, 0x19,
-	0xA2, 0xBF, 0x98, 0x85, 0xD6, 0xCB, 0xEC, 0xF1,
-	0x13, 0x0E, 0x29, 0x34, 0x67, 0x7A, 0x5D, 0x40,
-	0xFB, 0xE6, 0xC1, 0xDC, 0x8F, 0x92, 0xB5, 0xA8,
-	0xDE, 0xC3, 0xE4, 0xF9, 0xAA, 0xB7, 0x90, 0x8D,
-	0x36, 0x2B, 0x0C, 0x11, 0x42, 0x5F, 0x78, 0x65,
-	0x94, 0x89, 0xAE, 0xB3, 0xE0, 0xFD, 0xDA, 0xC7,
-	0x7C, 0x61, 0x46, 0x5B, 0x08, 0x15, 0x32, 0x2F,
-	0x59, 0x44, 0x63, 0x7E, 0x2D, 0x30, 0x17, 0x0A,
-	0xB1, 0xAC, 0x8B, 0x96, 0xC5, 0xD8, 0xFF, 0xE2,
-	0x26, 0x3B, 0x1C, 0x01, 0x52, 0x4F, 0x68, 0x75,
-	0xCE, 0xD3, 0xF4, 0xE9, 0xBA, 0xA7, 0x80, 0x9D,
-	0xEB, 0xF6, 0xD1, 0xCC, 0x9F, 0x82, 0xA5, 0xB8,
-	0x03, 0x1E, 0x39, 0x24, 0x77, 0x6A, 0x4D, 0x50,
-	0xA1, 0xBC, 0x9B, 0x86, 0xD5, 0xC8, 0xEF, 0xF2,
-	0x49, 0x54, 0x73, 0x6E, 0x3D, 0x20, 0x07, 0x1A,
-	0x6C, 0x71, 0x56, 0x4B, 0x18, 0x05, 0x22, 0x3F,
-	0x84, 0x99, 0xBE, 0xA3, 0xF0, 0xED, 0xCA, 0xD7,
-	0x35, 0x28, 0x0F, 0x12, 0x41, 0x5C, 0x7B, 0x66,
-	0xDD, 0xC0, 0xE7, 0xFA, 0xA9, 0xB4, 0x93, 0x8E,
-	0xF8, 0xE5, 0xC2, 0xDF, 0x8C, 0x91, 0xB6, 0xAB,
-	0x10, 0x0D, 0x2A, 0x37, 0x64, 0x79, 0x5E, 0x43,
-	0xB2, 0xAF, 0x88, 0x95, 0xC6, 0xDB, 0xFC, 0xE1,
-	0x5A, 0x47, 0x60, 0x7D, 0x2E, 0x33, 0x14, 0x09,
-	0x7F, 0x62, 0x45, 0x58, 0x0B, 0x16, 0x31, 0x2C,
-	0x97, 0x8A, 0xAD, 0xB0, 0xE3, 0xFE, 0xD9, 0xC4
-};
-
 static uint8_t sbc_crc8(const uint8_t *data, size_t len)
 {
 	uint8_t crc = 0x0f;
-	size_t i;
+	size_t i, bytes = len / 8;
 	uint8_t octet;
 
-	for (i = 0; i < len / 8; i++)
-		crc = crc_table[crc ^ data[i]];
+	for (i = 0; i + 8 <= bytes; i += 8)
+		crc = crc_table[7][crc ^ data[i]] ^
+			crc_table[6][data[i + 1]] ^
+			crc_table[5][data[i + 2]] ^
+			crc_table[4][data[i + 3]] ^
+			crc_table[3][data[i + 4]] ^
+			crc_table[2][data[i + 5]] ^
+			crc_table[1][data[i + 6]] ^
+			crc_table[0][data[i + 7]];
+
+	for (; i < bytes; i++)
+		crc = crc_table[0][crc ^ data[i]];
+
+	/* The remaining bits are the top bits of the last octet, feeding
+	 * them in is the same as the table lookup of just those bits */
+	if (len % 8) {
+		octet = (crc ^ data[i]) >> (8 - len % 8);
+		crc = (crc << (len % 8)) ^ crc_table[0][octet];
+	}
+
+	return crc;
+}
+
+/*
+ * Bit allocation state kept across frames. Streams normally never change
+ * their configuration, so the loudness bitneed of every possible scale
+ * factor is computed once per configuration, and the last allocation is
+ * reused as long as the frame parameters and scale factors are the same.
+ */
+struct sbc_bitalloc {
+	/* loudness bitneed indexed by subband and scale factor, valid for
+	 * the given sampling frequency and number of subbands */
+	int frequency;
+	int subbands;
+	int8_t loudness_bitneed[8][16];
+
+	/* last allocation and the frame parameters it was computed from */
+	int valid;
+	uint8_t mode;
+	uint8_t allocation;
+	uint8_t bitpool;
+	uint32_t scale_factor[2][8];
+	int bits[2][8];
+};
+
+static void sbc_bitalloc_setup_loudness(struct sbc_bitalloc *alloc,
+					const struct sbc_frame *frame)
+{
+	int sb, sf, loudness;
+
+	for (sb = 0; sb < frame->subbands; sb++) {
+		alloc->loudness_bitneed[sb][0] = -5;
+		for (sf = 1; sf < 16; sf++) {
+			if (frame->subbands == 4)
+				loudness = sf - sbc_offset4[frame->frequency][sb];
+			else
+				loudness = sf - sbc_offset8[frame->frequency][sb];
+			if (loudness > 0)
+				alloc->loudness_bitneed[sb][sf] = loudness / 2;
+			else
+				alloc->loudness_bitneed[sb][sf] = loudness;
+		}
+	}
 
-	octet = data[i];
-	for (i = 0; i < len % 8; i++) {
-		char bit = ((octet ^ crc) & 0x80) >> 7;
+	alloc->frequency = frame->frequency;
+	alloc->subbands = frame->subbands;
+}
 
-		crc = ((crc & 0x7f) << 1) ^ (bit ? 0x1d : 0);
+/*
+ * Bitneed values are within -5 (zero scale factor) and 15, the histogram
+ * of cumulative counts indexes them with this bias
+ */
+#define SBC_BITNEED_BIAS	8
+#define SBC_BITNEED_RANGE	32
 
-		octet = octet << 1;
+/*
+ * Finds the bitslice and bitcount the spec bit allocation loop stops at.
+ * The number of bitneed values within each slice is taken from cumulative
+ * counts instead of scanning all subbands for every slice.
+ */
+static int sbc_find_bitslice(int (*bitneed)[8], int channels, int subbands,
+				int max_bitneed, int bitpool, int *bitcount)
+{
+	int cum[SBC_BITNEED_RANGE];
+	int ch, sb, i, total, count, slicecount, bitslice;
+
+	memset(cum, 0, sizeof(cum));
+	for (ch = 0; ch < channels; ch++)
+		for (sb = 0; sb < subbands; sb++)
+			cum[bitneed[ch][sb] + SBC_BITNEED_BIAS]++;
+
+	total = 0;
+	for (i = 0; i < SBC_BITNEED_RANGE; i++) {
+		total += cum[i];
+		cum[i] = total;
 	}
 
-	return crc;
+#define CUM(v) ((v) + SBC_BITNEED_BIAS < 0 ? 0 : \
+		(v) + SBC_BITNEED_BIAS >= SBC_BITNEED_RANGE ? total : \
+		cum[(v) + SBC_BITNEED_BIAS])
+
+	count = 0;
+	slicecount = 0;
+	bitslice = max_bitneed + 1;
+	do {
+		bitslice--;
+		count += slicecount;
+		/* bitneed within bitslice + 2 .. bitslice + 15 takes one more
+		 * bit, bitneed equal to bitslice + 1 takes the first two */
+		slicecount = CUM(bitslice + 15) - CUM(bitslice + 1) +
+				2 * (CUM(bitslice + 1) - CUM(bitslice));
+	} while (count + slicecount < bitpool);
+
+#undef CUM
+
+	if (count + slicecount == bitpool) {
+		count += slicecount;
+		bitslice--;
+	}
+
+	*bitcount = count;
+
+	return bitslice;
 }
 
 /*
  * Code straight from the spec to calculate the bits array
- * Takes a pointer to the frame in question, a pointer to the bits array and
- * the sampling frequency (as 2 bit integer)
+ * Takes a pointer to the frame in question, the bit allocation state holding
+ * the loudness bitneed table for the frame configuration and a pointer to
+ * the bits array
  */
-static void sbc_calculate_bits(const struct sbc_frame *frame, int (*bits)[8])
+static void sbc_calculate_bits_internal(const struct sbc_frame *frame,
+				const struct sbc_bitalloc *alloc, int (*bits)[8])
 {
-	uint8_t sf = frame->frequency;
-
 	if (frame->mode == MONO || frame->mode == DUAL_CHANNEL) {
-		int bitneed[2][8], loudness, max_bitneed, bitcount, slicecount, bitslice;
+		int bitneed[2][8], max_bitneed, bitcount, bitslice;
 		int ch, sb;
 
 		for (ch = 0; ch < frame->channels; ch++) {
@@ -177,42 +526,16 @@ static void sbc_calculate_bits(const struct sbc_frame *frame, int (*bits)[8])
 				}
 			} else {
 				for (sb = 0; sb < frame->subbands; sb++) {
-					if (frame->scale_factor[ch][sb] == 0)
-						bitneed[ch][sb] = -5;
-					else {
-						if (frame->subbands == 4)
-							loudness = frame->scale_factor[ch][sb] - sbc_offset4[sf][sb];
-						else
-							loudness = frame->scale_factor[ch][sb] - sbc_offset8[sf][sb];
-						if (loudness > 0)
-							bitneed[ch][sb] = loudness / 2;
-						else
-							bitneed[ch][sb] = loudness;
-					}
+					bitneed[ch][sb] = alloc->loudness_bitneed[sb][
+						frame->scale_factor[ch][sb] & 0x0F];
 					if (bitneed[ch][sb] > max_bitneed)
 						max_bitneed = bitneed[ch][sb];
 				}
 			}
 
-			bitcount = 0;
-			slicecount = 0;
-			bitslice = max_bitneed + 1;
-			do {
-				bitslice--;
-				bitcount += slicecount;
-				slicecount = 0;
-				for (sb = 0; sb < frame->subbands; sb++) {
-					if ((bitneed[ch][sb] > bitslice + 1) && (bitneed[ch][sb] < bitslice + 16))
-						slicecount++;
-					else if (bitneed[ch][sb] == bitslice + 1)
-						slicecount += 2;
-				}
-			} while (bitcount + slicecount < frame->bitpool);
-
-			if (bitcount + slicecount == frame->bitpool) {
-				bitcount += slicecount;
-				bitslice--;
-			}
+			bitslice = sbc_find_bitslice(&bitneed[ch], 1,
+					frame->subbands, max_bitneed,
+					frame->bitpool, &bitcount);
 
 			for (sb = 0; sb < frame->subbands; sb++) {
 				if (bitneed[ch][sb] < bitslice + 2)
@@ -244,7 +567,7 @@ static void sbc_calculate_bits(const struct sbc_frame *frame, int (*bits)[8])
 		}
 
 	} else if (frame->mode == STEREO || frame->mode == JOINT_STEREO) {
-		int bitneed[2][8], loudness, max_bitneed, bitcount, slicecount, bitslice;
+		int bitneed[2][8], max_bitneed, bitcount, bitslice;
 		int ch, sb;
 
 		max_bitneed = 0;
@@ -259,45 +582,16 @@ static void sbc_calculate_bits(const struct sbc_frame *frame, int (*bits)[8])
 		} else {
 			for (ch = 0; ch < 2; ch++) {
 				for (sb = 0; sb < frame->subbands; sb++) {
-					if (frame->scale_factor[ch][sb] == 0)
-						bitneed[ch][sb] = -5;
-					else {
-						if (frame->subbands == 4)
-							loudness = frame->scale_factor[ch][sb] - sbc_offset4[sf][sb];
-						else
-							loudness = frame->scale_factor[ch][sb] - sbc_offset8[sf][sb];
-						if (loudness > 0)
-							bitneed[ch][sb] = loudness / 2;
-						else
-							bitneed[ch][sb] = loudness;
-					}
+					bitneed[ch][sb] = alloc->loudness_bitneed[sb][
+						frame->scale_factor[ch][sb] & 0x0F];
 					if (bitneed[ch][sb] > max_bitneed)
 						max_bitneed = bitneed[ch][sb];
 				}
 			}
 		}
 
-		bitcount = 0;
-		slicecount = 0;
-		bitslice = max_bitneed + 1;
-		do {
-			bitslice--;
-			bitcount += slicecount;
-			slicecount = 0;
-			for (ch = 0; ch < 2; ch++) {
-				for (sb = 0; sb < frame->subbands; sb++) {
-					if ((bitneed[ch][sb] > bitslice + 1) && (bitneed[ch][sb] < bitslice + 16))
-						slicecount++;
-					else if (bitneed[ch][sb] == bitslice + 1)
-						slicecount += 2;
-				}
-			}
-		} while (bitcount + slicecount < frame->bitpool);
-
-		if (bitcount + slicecount == frame->bitpool) {
-			bitcount += slicecount;
-			bitslice--;
-		}
+		bitslice = sbc_find_bitslice(bitneed, 2, frame->subbands,
+					max_bitneed, frame->bitpool, &bitcount);
 
 		for (ch = 0; ch < 2; ch++) {
 			for (sb = 0; sb < frame->subbands; sb++) {
@@ -348,9 +642,62 @@ static void sbc_calculate_bits(const struct sbc_frame *frame, int (*bits)[8])
 
 }
 
+/*
+ * Calculates the bits array for the frame, reusing the previous result
+ * when the frame carries the same allocation parameters and scale factors
+ */
+static void sbc_calculate_bits(const struct sbc_frame *frame,
+				struct sbc_bitalloc *alloc, int (*bits)[8])
+{
+	if (alloc->valid && alloc->frequency == frame->frequency &&
+			alloc->subbands == frame->subbands &&
+			alloc->mode == frame->mode &&
+			alloc->allocation == frame->allocation &&
+			alloc->bitpool == frame->bitpool &&
+			memcmp(alloc->scale_factor, frame->scale_factor,
+					sizeof(alloc->scale_factor)) == 0) {
+		memcpy(bits, alloc->bits, sizeof(alloc->bits));
+		return;
+	}
+
+	if (alloc->frequency != frame->frequency ||
+			alloc->subbands != frame->subbands)
+		sbc_bitalloc_setup_loudness(alloc, frame);
+
+	sbc_calculate_bits_internal(frame, alloc, bits);
+
+	alloc->mode = frame->mode;
+	alloc->allocation = frame->allocation;
+	alloc->bitpool = frame->bitpool;
+	memcpy(alloc->scale_factor, frame->scale_factor,
+					sizeof(alloc->scale_factor));
+	memcpy(alloc->bits, bits, sizeof(alloc->bits));
+	alloc->valid = 1;
+}
+
+/*
+ * Reads n bits (at most 32) through a 64-bit cache, refilling it a byte
+ * at a time without reading past data_end
+ */
+#define GET_BITS(data_ptr, data_end, bits_cache, bits_count, v, n)	\
+	do {								\
+		if (bits_count < (n)) {					\
+			while (bits_count <= 56 && data_ptr < data_end) { \
+				bits_cache = (bits_cache << 8) |	\
+							*data_ptr++;	\
+				bits_count += 8;			\
+			}						\
+		}							\
+		bits_count -= (n);					\
+		v = (uint32_t) (bits_cache >> bits_count) &		\
+					((1U << (n)) - 1);		\
+	} while (0)
+
 /*
  * Unpacks a SBC frame at the beginning of the stream in data,
- * which has at most len bytes into frame.
+ * which has at most len bytes into frame. With parse_only set just
+ * the header and scale factors are unpacked and the audio samples
+ * are skipped.
  * Returns the length in bytes of the packed frame, or a negative
  * value on error. The error codes are:
  *
@@ -360,7 +707,8 @@ static void sbc_calculate_bits(const struct sbc_frame *frame, int (*bits)[8])
  *  -4   Bitpool value out of bounds
  */
 static int sbc_unpack_frame(const uint8_t *data, struct sbc_frame *frame,
-								size_t len)
+				size_t len, struct sbc_bitalloc *alloc,
+				int parse_only)
 {
 	unsigned int consumed;
 	/* Will copy the parts of the header that are relevant to crc
@@ -369,11 +717,17 @@ static int sbc_unpack_frame(const uint8_t *data, struct sbc_frame *frame,
 	int crc_pos = 0;
 	int32_t temp;
 
-	int audio_sample;
-	int ch, sb, blk, bit;	/* channel, subband, block and bit standard
-				   counters */
+	/* Bitstream reader starts from the fifth byte */
+	const uint8_t *data_ptr = data + 4;
+	const uint8_t *data_end = data + len;
+	uint64_t bits_cache = 0;
+	unsigned int bits_count = 0;
+
+	uint32_t audio_sample, joint;
+	int ch, sb, blk;	/* channel, subband and block counters */
 	int bits[2][8];		/* bits distribution */
 	uint32_t levels[2][8];	/* levels derived from that */
+	unsigned int audio_bits;
 
 	if (len < 4)
 		return -1;
@@ -438,13 +792,15 @@ static int sbc_unpack_frame(const uint8_t *data, struct sbc_frame *frame,
 		if (len * 8 < consumed + frame->subbands)
 			return -1;
 
+		GET_BITS(data_ptr, data_end, bits_cache, bits_count,
+				joint, frame->subbands);
+
+		/* bit 0 of the stream field is the first subband */
 		frame->joint = 0x00;
 		for (sb = 0; sb < frame->subbands - 1; sb++)
-			frame->joint |= ((data[4] >> (7 - sb)) & 0x01) << sb;
-		if (frame->subbands == 4)
-			crc_header[crc_pos / 8] = data[4] & 0xf0;
-		else
-			crc_header[crc_pos / 8] = data[4];
+			frame->joint |= ((joint >> (frame->subbands - 1 - sb))
+							& 0x01) << sb;
+		crc_header[crc_pos / 8] = joint << (8 - frame->subbands);
 
 		consumed += frame->subbands;
 		crc_pos += frame->subbands;
@@ -455,9 +811,8 @@ static int sbc_unpack_frame(const uint8_t *data, struct sbc_frame *frame,
 
 	for (ch = 0; ch < frame->channels; ch++) {
 		for (sb = 0; sb < frame->subbands; sb++) {
-			/* FIXME assert(consumed % 4 == 0); */
-			frame->scale_factor[ch][sb] =
-				(data[consumed >> 3] >> (4 - (consumed & 0x7))) & 0x0F;
+			GET_BITS(data_ptr, data_end, bits_cache, bits_count,
+					frame->scale_factor[ch][sb], 4);
 			crc_header[crc_pos >> 3] |=
 				frame->scale_factor[ch][sb] << (4 - (crc_pos & 0x7));
 
@@ -469,27 +824,35 @@ static int sbc_unpack_frame(const uint8_t *data, struct sbc_frame *frame,
 	if (data[3] != sbc_crc8(crc_header, crc_pos))
 		return -3;
 
-	sbc_calculate_bits(frame, bits);
+	sbc_calculate_bits(frame, alloc, bits);
 
+	audio_bits = 0;
 	for (ch = 0; ch < frame->channels; ch++) {
-		for (sb = 0; sb < frame->subbands; sb++)
+		for (sb = 0; sb < frame->subbands; sb++) {
 			levels[ch][sb] = (1 << bits[ch][sb]) - 1;
+			audio_bits += bits[ch][sb];
+		}
 	}
+	audio_bits *= frame->blocks;
+
+	if (len * 8 < consumed + audio_bits)
+		return -1;
+
+	consumed += audio_bits;
+
+	if ((consumed & 0x7) != 0)
+		consumed += 8 - (consumed & 0x7);
+
+	if (parse_only)
+		return consumed >> 3;
 
 	for (blk = 0; blk < frame->blocks; blk++) {
 		for (ch = 0; ch < frame->channels; ch++) {
 			for (sb = 0; sb < frame->subbands; sb++) {
 				if (levels[ch][sb] > 0) {
-					audio_sample = 0;
-					for (bit = 0; bit < bits[ch][sb]; bit++) {
-						if (consumed > len * 8)
-							return -1;
-
-						if ((data[consumed >> 3] >> (7 - (consumed & 0x7))) & 0x01)
-							audio_sample |= 1 << (bits[ch][sb] - bit - 1);
-
-						consumed++;
-					}
+					GET_BITS(data_ptr, data_end,
+						bits_cache, bits_count,
+						audio_sample, bits[ch][sb]);
 
 					frame->sb_sample[blk][ch][sb] =
 						(((audio_sample << 1) | 1) << frame->scale_factor[ch][sb]) /
@@ -515,140 +878,68 @@ static int sbc_unpack_frame(const uint8_t *data, struct sbc_frame *frame,
 		}
 	}
 
-	if ((consumed & 0x7) != 0)
-		consumed += 8 - (consumed & 0x7);
-
 	return consumed >> 3;
 }
 
 static void sbc_decoder_init(struct sbc_decoder_state *state,
 					const struct sbc_frame *frame)
 {
-	int i, ch;
-
-	memset(state->V, 0, sizeof(state->V));
+	memset(&state->V, 0, sizeof(state->V));
 	state->subbands = frame->subbands;
-
-	for (ch = 0; ch < 2; ch++)
-		for (i = 0; i < frame->subbands * 2; i++)
-			state->offset[ch][i] = (10 * i + 10);
-}
-
-static SBC_ALWAYS_INLINE int16_t sbc_clip16(int32_t s)
-{
-	if (s > 0x7FFF)
-		return 0x7FFF;
-	else if (s < -0x8000)
-		return -0x8000;
-	else
-		return s;
+	state->position = SBC_V_BUFFER_SIZE - frame->subbands * 18;
 }
 
-static inline void sbc_synthesize_four(struct sbc_decoder_state *state,
-				struct sbc_frame *frame, int ch, int blk)
+/*
+ * Reserves space for 4 more blocks at the bottom of V history buffers,
+ * moving the last 9 blocks of history to the top on buffer wraparound.
+ */
+static inline int sbc_decoder_advance(struct sbc_decoder_state *state,
+						int subbands, int channels)
 {
-	int i, k, idx;
-	int32_t *v = state->V[ch];
-	int *offset = state->offset[ch];
-
-	for (i = 0; i < 8; i++) {
-		/* Shifting */
-		offset[i]--;
-		if (offset[i] < 0) {
-			offset[i] = 79;
-			memcpy(v + 80, v, 9 * sizeof(*v));
-		}
-
-		/* Distribute the new matrix value to the shifted position */
-		v[offset[i]] = SCALE4_STAGED1(
-			MULA(synmatrix4[i][0], frame->sb_sample[blk][ch][0],
-			MULA(synmatrix4[i][1], frame->sb_sample[blk][ch][1],
-			MULA(synmatrix4[i][2], frame->sb_sample[blk][ch][2],
-			MUL (synmatrix4[i][3], frame->sb_sample[blk][ch][3])))));
+	int ch;
+
+	if (state->position < subbands * 8) {
+		for (ch = 0; ch < channels; ch++)
+			memcpy(&state->V[ch][SBC_V_BUFFER_SIZE - subbands * 18],
+				&state->V[ch][state->position],
+				subbands * 18 * sizeof(int32_t));
+		state->position = SBC_V_BUFFER_SIZE - subbands * 18;
 	}
 
-	/* Compute the samples */
-	for (idx = 0, i = 0; i < 4; i++, idx += 5) {
-		k = (i + 4) & 0xf;
-
-		/* Store in output, Q0 */
-		frame->pcm_sample[ch][blk * 4 + i] = sbc_clip16(SCALE4_STAGED1(
-			MULA(v[offset[i] + 0], sbc_proto_4_40m0[idx + 0],
-			MULA(v[offset[k] + 1], sbc_proto_4_40m1[idx + 0],
-			MULA(v[offset[i] + 2], sbc_proto_4_40m0[idx + 1],
-			MULA(v[offset[k] + 3], sbc_proto_4_40m1[idx + 1],
-			MULA(v[offset[i] + 4], sbc_proto_4_40m0[idx + 2],
-			MULA(v[offset[k] + 5], sbc_proto_4_40m1[idx + 2],
-			MULA(v[offset[i] + 6], sbc_proto_4_40m0[idx + 3],
-			MULA(v[offset[k] + 7], sbc_proto_4_40m1[idx + 3],
-			MULA(v[offset[i] + 8], sbc_proto_4_40m0[idx + 4],
-			MUL( v[offset[k] + 9], sbc_proto_4_40m1[idx + 4]))))))))))));
-	}
-}
+	state->position -= subbands * 8;
 
-static inline void sbc_synthesize_eight(struct sbc_decoder_state *state,
-				struct sbc_frame *frame, int ch, int blk)
-{
-	int i, j, k, idx;
-	int *offset = state->offset[ch];
-
-	for (i = 0; i < 16; i++) {
-		/* Shifting */
-		offset[i]--;
-		if (offset[i] < 0) {
-			offset[i] = 159;
-			for (j = 0; j < 9; j++)
-				state->V[ch][j + 160] = state->V[ch][j];
-		}
-
-		/* Distribute the new matrix value to the shifted position */
-		state->V[ch][offset[i]] = SCALE8_STAGED1(
-			MULA(synmatrix8[i][0], frame->sb_sample[blk][ch][0],
-			MULA(synmatrix8[i][1], frame->sb_sample[blk][ch][1],
-			MULA(synmatrix8[i][2], frame->sb_sample[blk][ch][2],
-			MULA(synmatrix8[i][3], frame->sb_sample[blk][ch][3],
-			MULA(synmatrix8[i][4], frame->sb_sample[blk][ch][4],
-			MULA(synmatrix8[i][5], frame->sb_sample[blk][ch][5],
-			MULA(synmatrix8[i][6], frame->sb_sample[blk][ch][6],
-			MUL( synmatrix8[i][7], frame->sb_sample[blk][ch][7])))))))));
-	}
-
-	/* Compute the samples */
-	for (idx = 0, i = 0; i < 8; i++, idx += 5) {
-		k = (i + 8) & 0xf;
-
-		/* Store in output, Q0 */
-		frame->pcm_sample[ch][blk * 8 + i] = sbc_clip16(SCALE8_STAGED1(
-			MULA(state->V[ch][offset[i] + 0], sbc_proto_8_80m0[idx + 0],
-			MULA(state->V[ch][offset[k] + 1], sbc_proto_8_80m1[idx + 0],
-			MULA(state->V[ch][offset[i] + 2], sbc_proto_8_80m0[idx + 1],
-			MULA(state->V[ch][offset[k] + 3], sbc_proto_8_80m1[idx + 1],
-			MULA(state->V[ch][offset[i] + 4], sbc_proto_8_80m0[idx + 2],
-			MULA(state->V[ch][offset[k] + 5], sbc_proto_8_80m1[idx + 2],
-			MULA(state->V[ch][offset[i] + 6], sbc_proto_8_80m0[idx + 3],
-			MULA(state->V[ch][offset[k] + 7], sbc_proto_8_80m1[idx + 3],
-			MULA(state->V[ch][offset[i] + 8], sbc_proto_8_80m0[idx + 4],
-			MUL( state->V[ch][offset[k] + 9], sbc_proto_8_80m1[idx + 4]))))))))))));
-	}
+	return state->position;
 }
 
 static int sbc_synthesize_audio(struct sbc_decoder_state *state,
 						struct sbc_frame *frame)
 {
-	int ch, blk;
+	int ch, blk, pos;
 
 	switch (frame->subbands) {
 	case 4:
-		for (ch = 0; ch < frame->channels; ch++) {
-			for (blk = 0; blk < frame->blocks; blk++)
-				sbc_synthesize_four(state, frame, ch, blk);
+		for (blk = 0; blk < frame->blocks; blk += 4) {
+			pos = sbc_decoder_advance(state, 4, frame->channels);
+			for (ch = 0; ch < frame->channels; ch++)
+				state->sbc_synthesize_4b_4s(
+					frame->sb_sample[blk][ch],
+					frame->sb_sample[blk + 1][ch] -
+					frame->sb_sample[blk][ch],
+					&state->V[ch][pos],
+					&frame->pcm_sample[ch][blk * 4]);
 		}
 		return frame->blocks * 4;
 
 	case 8:
-		for (ch = 0; ch < frame->channels; ch++) {
-			for (blk = 0; blk < frame->blocks; blk++)
-				sbc_synthesize_eight(state, frame, ch, blk);
+		for (blk = 0; blk < frame->blocks; blk += 4) {
+			pos = sbc_decoder_advance(state, 8, frame->channels);
+			for (ch = 0; ch < frame->channels; ch++)
+				state->sbc_synthesize_4b_8s(
+					frame->sb_sample[blk][ch],
+					frame->sb_sample[blk + 1][ch] -
+					frame->sb_sample[blk][ch],
+					&state->V[ch][pos],
+					&frame->pcm_sample[ch][blk * 8]);
 		}
 		return frame->blocks * 8;
 
@@ -744,7 +1035,8 @@ static int sbc_analyze_audio(struct sbc_encoder_state *state,
 
 static SBC_ALWAYS_INLINE int sbc_pack_frame_internal(uint8_t *data,
 					struct sbc_frame *frame, size_t len,
-					int frame_subbands, int frame_channels)
+					int frame_subbands, int frame_channels,
+					int joint, struct sbc_bitalloc *alloc)
 {
 	/* Bitstream writer starts from the fourth byte */
 	uint8_t *data_ptr = data + 4;
@@ -801,63 +1093,6 @@ static SBC_ALWAYS_INLINE int sbc_pack_frame_internal(uint8_t *data,
 	crc_pos = 16;
 
 	if (frame->mode == JOINT_STEREO) {
-		/* like frame->sb_sample but joint stereo */
-		int32_t sb_sample_j[16][2];
-		/* scalefactor and scale_factor in joint case */
-		uint32_t scalefactor_j[2];
-		uint8_t scale_factor_j[2];
-
-		uint8_t joint = 0;
-		frame->joint = 0;
-
-		for (sb = 0; sb < frame_subbands - 1; sb++) {
-			scale_factor_j[0] = 0;
-			scalefactor_j[0] = 2 << SCALE_OUT_BITS;
-			scale_factor_j[1] = 0;
-			scalefactor_j[1] = 2 << SCALE_OUT_BITS;
-
-			for (blk = 0; blk < frame->blocks; blk++) {
-				uint32_t tmp;
-				/* Calculate joint stereo signal */
-				sb_sample_j[blk][0] =
-					ASR(frame->sb_sample_f[blk][0][sb], 1) +
-					ASR(frame->sb_sample_f[blk][1][sb], 1);
-				sb_sample_j[blk][1] =
-					ASR(frame->sb_sample_f[blk][0][sb], 1) -
-					ASR(frame->sb_sample_f[blk][1][sb], 1);
-
-				/* calculate scale_factor_j and scalefactor_j for joint case */
-				tmp = fabs(sb_sample_j[blk][0]);
-				while (scalefactor_j[0] < tmp) {
-					scale_factor_j[0]++;
-					scalefactor_j[0] *= 2;
-				}
-				tmp = fabs(sb_sample_j[blk][1]);
-				while (scalefactor_j[1] < tmp) {
-					scale_factor_j[1]++;
-					scalefactor_j[1] *= 2;
-				}
-			}
-
-			/* decide whether to join this subband */
-			if ((frame->scale_factor[0][sb] +
-					frame->scale_factor[1][sb]) >
-					(scale_factor_j[0] +
-					scale_factor_j[1])) {
-				/* use joint stereo for this subband */
-				joint |= 1 << (frame_subbands - 1 - sb);
-				frame->joint |= 1 << sb;
-				frame->scale_factor[0][sb] = scale_factor_j[0];
-				frame->scale_factor[1][sb] = scale_factor_j[1];
-				for (blk = 0; blk < frame->blocks; blk++) {
-					frame->sb_sample_f[blk][0][sb] =
-							sb_sample_j[blk][0];
-					frame->sb_sample_f[blk][1][sb] =
-							sb_sample_j[blk][1];
-				}
-			}
-		}
-
 		PUT_BITS(data_ptr, bits_cache, bits_count,
 			joint, frame_subbands);
 		crc_header[crc_pos >> 3] = joint;
@@ -880,7 +1115,7 @@ static SBC_ALWAYS_INLINE int sbc_pack_frame_internal(uint8_t *data,
 
 	data[3] = sbc_crc8(crc_header, crc_pos);
 
-	sbc_calculate_bits(frame, bits);
+	sbc_calculate_bits(frame, alloc, bits);
 
 	for (ch = 0; ch < frame_channels; ch++) {
 		for (sb = 0; sb < frame_subbands; sb++) {
@@ -915,18 +1150,23 @@ static SBC_ALWAYS_INLINE int sbc_pack_frame_internal(uint8_t *data,
 	return data_ptr - data;
 }
 
-static int sbc_pack_frame(uint8_t *data, struct sbc_frame *frame, size_t len)
+static int sbc_pack_frame(uint8_t *data, struct sbc_frame *frame, size_t len,
+				int joint, struct sbc_bitalloc *alloc)
 {
 	if (frame->subbands == 4) {
 		if (frame->channels == 1)
-			return sbc_pack_frame_internal(data, frame, len, 4, 1);
+			return sbc_pack_frame_internal(
+				data, frame, len, 4, 1, joint, alloc);
 		else
-			return sbc_pack_frame_internal(data, frame, len, 4, 2);
+			return sbc_pack_frame_internal(
+				data, frame, len, 4, 2, joint, alloc);
 	} else {
 		if (frame->channels == 1)
-			return sbc_pack_frame_internal(data, frame, len, 8, 1);
+			return sbc_pack_frame_internal(
+				data, frame, len, 8, 1, joint, alloc);
 		else
-			return sbc_pack_frame_internal(data, frame, len, 8, 2);
+			return sbc_pack_frame_internal(
+				data, frame, len, 8, 2, joint, alloc);
 	}
 }
 
@@ -935,8 +1175,6 @@ static void sbc_encoder_init(struct sbc_encoder_state *state,
 {
 	memset(&state->X, 0, sizeof(state->X));
 	state->position = (SBC_X_BUFFER_SIZE - frame->subbands * 9) & ~7;
-
-	sbc_init_primitives(state);
 }
 
 struct sbc_priv {
@@ -944,15 +1182,68 @@ struct sbc_priv {
 	struct SBC_ALIGNED sbc_frame frame;
 	struct SBC_ALIGNED sbc_decoder_state dec_state;
 	struct SBC_ALIGNED sbc_encoder_state enc_state;
+	struct sbc_bitalloc alloc;
+	/* encoder input sample format, fixed at the first frame */
+	int format;
 };
 
+static const struct {
+	const char *name;
+	int impl;
+} sbc_implementations[] = {
+	{ "auto",	SBC_IMPL_AUTO		},
+	{ "generic",	SBC_IMPL_GENERIC	},
+	{ "mmx",	SBC_IMPL_MMX		},
+	{ "sse2",	SBC_IMPL_SSE2		},
+	{ "avx2",	SBC_IMPL_AVX2		},
+	{ "neon",	SBC_IMPL_NEON		},
+	{ NULL }
+};
+
+/*
+ * Sets up the primitives requested in flags. Without an explicit request
+ * the SBC_IMPLEMENTATION environment variable may name one, which is
+ * ignored when it is not available.
+ */
+static int sbc_setup_primitives(struct sbc_priv *priv, unsigned long flags)
+{
+	int impl = flags & SBC_IMPL_MASK;
+
+	if (impl == SBC_IMPL_AUTO) {
+		const char *env = getenv("SBC_IMPLEMENTATION");
+		int i;
+
+		for (i = 0; env && sbc_implementations[i].name; i++) {
+			if (strcasecmp(env, sbc_implementations[i].name) == 0) {
+				impl = sbc_implementations[i].impl;
+				break;
+			}
+		}
+	}
+
+	if (sbc_init_primitives(&priv->enc_state, impl) < 0) {
+		if (flags & SBC_IMPL_MASK)
+			return -ENOTSUP;
+
+		impl = SBC_IMPL_AUTO;
+		sbc_init_primitives(&priv->enc_state, impl);
+	}
+
+	sbc_init_primitives_decoder(&priv->dec_state, impl);
+
+	return 0;
+}
+
 static void sbc_set_defaults(sbc_t *sbc, unsigned long flags)
 {
+	sbc->flags = flags;
+
 	sbc->frequency = SBC_FREQ_44100;
 	sbc->mode = SBC_MODE_STEREO;
 	sbc->subbands = SBC_SB_8;
 	sbc->blocks = SBC_BLK_16;
 	sbc->bitpool = 32;
+	sbc->format = SBC_FORMAT_S16;
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	sbc->endian = SBC_LE;
 #elif __BYTE_ORDER == __BIG_ENDIAN
@@ -978,6 +1269,13 @@ int sbc_init(sbc_t *sbc, unsigned long flags)
 
 	memset(sbc->priv, 0, sizeof(struct sbc_priv));
 
+	if (sbc_setup_primitives(sbc->priv, flags) < 0) {
+		free(sbc->priv_alloc_base);
+		sbc->priv_alloc_base = NULL;
+		sbc->priv = NULL;
+		return -ENOTSUP;
+	}
+
 	sbc_set_defaults(sbc, flags);
 
 	return 0;
@@ -988,19 +1286,14 @@ ssize_t sbc_parse(sbc_t *sbc, const void *input, size_t input_len)
 	return sbc_decode(sbc, input, input_len, NULL, 0, NULL);
 }
 
-ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
-			void *output, size_t output_len, size_t *written)
+static int sbc_decoder_unpack(sbc_t *sbc, struct sbc_priv *priv,
+				const uint8_t *input, size_t input_len,
+				int parse_only)
 {
-	struct sbc_priv *priv;
-	char *ptr;
-	int i, ch, framelen, samples;
-
-	if (!sbc || !input)
-		return -EIO;
+	int framelen;
 
-	priv = sbc->priv;
-
-	framelen = sbc_unpack_frame(input, &priv->frame, input_len);
+	framelen = sbc_unpack_frame(input, &priv->frame, input_len,
+						&priv->alloc, parse_only);
 
 	if (!priv->init) {
 		sbc_decoder_init(&priv->dec_state, &priv->frame);
@@ -1017,28 +1310,50 @@ ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
 		priv->frame.length = framelen;
 	}
 
-	if (!output)
-		return framelen;
-
-	if (written)
-		*written = 0;
+	return framelen;
+}
 
-	if (framelen <= 0)
-		return framelen;
+/*
+ * Stores the first 'samples' decoded samples of each channel as
+ * interleaved S16 with the requested endianness. The native endian
+ * case is a plain copy for mono and a vectorizable loop for stereo.
+ */
+static void sbc_decoder_interleave(const struct sbc_frame *frame,
+					int samples, int endian, uint8_t *ptr)
+{
+	const int16_t *l = frame->pcm_sample[0];
+	const int16_t *r = frame->pcm_sample[1];
+	int i;
 
-	samples = sbc_synthesize_audio(&priv->dec_state, &priv->frame);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	if (endian == SBC_LE) {
+#else
+	if (endian == SBC_BE) {
+#endif
+		if (frame->channels == 1) {
+			memcpy(ptr, l, samples * 2);
+			return;
+		}
 
-	ptr = output;
+		for (i = 0; i < samples; i++) {
+			int16_t pair[2];
 
-	if (output_len < (size_t) (samples * priv->frame.channels * 2))
-		samples = output_len / (priv->frame.channels * 2);
+			pair[0] = l[i];
+			pair[1] = r[i];
+			memcpy(ptr, pair, sizeof(pair));
+			ptr += sizeof(pair);
+		}
+		return;
+	}
 
 	for (i = 0; i < samples; i++) {
-		for (ch = 0; ch < priv->frame.channels; ch++) {
+		int ch;
+
+		for (ch = 0; ch < frame->channels; ch++) {
 			int16_t s;
-			s = priv->frame.pcm_sample[ch][i];
+			s = frame->pcm_sample[ch][i];
 
-			if (sbc->endian == SBC_BE) {
+			if (endian == SBC_BE) {
 				*ptr++ = (s & 0xff00) >> 8;
 				*ptr++ = (s & 0x00ff);
 			} else {
@@ -1047,6 +1362,36 @@ ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
 			}
 		}
 	}
+}
+
+ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
+			void *output, size_t output_len, size_t *written)
+{
+	struct sbc_priv *priv;
+	int framelen, samples;
+
+	if (!sbc || !input)
+		return -EIO;
+
+	priv = sbc->priv;
+
+	framelen = sbc_decoder_unpack(sbc, priv, input, input_len, !output);
+
+	if (!output)
+		return framelen;
+
+	if (written)
+		*written = 0;
+
+	if (framelen <= 0)
+		return framelen;
+
+	samples = sbc_synthesize_audio(&priv->dec_state, &priv->frame);
+
+	if (output_len < (size_t) (samples * priv->frame.channels * 2))
+		samples = output_len / (priv->frame.channels * 2);
+
+	sbc_decoder_interleave(&priv->frame, samples, sbc->endian, output);
 
 	if (written)
 		*written = samples * priv->frame.channels * 2;
@@ -1054,14 +1399,138 @@ ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
 	return framelen;
 }
 
-ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
+/*
+ * Decodes consecutive frames from 'input' (e.g. the payload of one media
+ * packet) as long as both a complete frame and room for all of its
+ * samples are available. With 'planar' set, 'output' points to an array
+ * of one native endian buffer per channel, each 'output_len' bytes long,
+ * and '*written' is the number of bytes stored in each of them.
+ * Returns the number of input bytes consumed.
+ */
+static ssize_t sbc_decode_frames(sbc_t *sbc, const uint8_t *input,
+				size_t input_len, void *output,
+				size_t output_len, size_t *written, int planar)
+{
+	struct sbc_priv *priv;
+	ssize_t consumed;
+	size_t done;
+	int framelen, samples, ch;
+
+	if (!sbc || !input)
+		return -EIO;
+
+	if (written)
+		*written = 0;
+
+	if (!output)
+		return -ENOSPC;
+
+	priv = sbc->priv;
+	consumed = 0;
+	done = 0;
+
+	while (input_len > 0) {
+		framelen = sbc_decoder_unpack(sbc, priv, input, input_len, 0);
+		if (framelen <= 0) {
+			if (consumed == 0)
+				return framelen;
+			break;
+		}
+
+		samples = priv->frame.blocks * priv->frame.subbands;
+		if (!planar)
+			samples *= priv->frame.channels;
+
+		if (output_len - done < (size_t) samples * 2) {
+			if (consumed == 0)
+				return -ENOSPC;
+			break;
+		}
+
+		samples = sbc_synthesize_audio(&priv->dec_state, &priv->frame);
+
+		if (planar) {
+			int16_t **planes = output;
+
+			for (ch = 0; ch < priv->frame.channels; ch++)
+				memcpy((uint8_t *) planes[ch] + done,
+					priv->frame.pcm_sample[ch],
+					samples * 2);
+
+			done += samples * 2;
+		} else {
+			sbc_decoder_interleave(&priv->frame, samples,
+					sbc->endian, (uint8_t *) output + done);
+
+			done += samples * priv->frame.channels * 2;
+		}
+
+		input += framelen;
+		input_len -= framelen;
+		consumed += framelen;
+	}
+
+	if (written)
+		*written = done;
+
+	return consumed;
+}
+
+ssize_t sbc_decode_multi(sbc_t *sbc, const void *input, size_t input_len,
 			void *output, size_t output_len, size_t *written)
+{
+	return sbc_decode_frames(sbc, input, input_len, output, output_len,
+								written, 0);
+}
+
+ssize_t sbc_decode_multi_planar(sbc_t *sbc, const void *input,
+			size_t input_len, int16_t *output[2],
+			size_t output_len, size_t *written)
+{
+	return sbc_decode_frames(sbc, input, input_len, output, output_len,
+								written, 1);
+}
+
+static void sbc_encoder_setup(sbc_t *sbc, struct sbc_priv *priv)
+{
+	priv->frame.frequency = sbc->frequency;
+	priv->frame.mode = sbc->mode;
+	priv->frame.channels = sbc->mode == SBC_MODE_MONO ? 1 : 2;
+	priv->frame.allocation = sbc->allocation;
+	priv->frame.subband_mode = sbc->subbands;
+	priv->frame.subbands = sbc->subbands ? 8 : 4;
+	priv->frame.block_mode = sbc->blocks;
+	priv->frame.blocks = 4 + (sbc->blocks * 4);
+	priv->frame.bitpool = sbc->bitpool;
+	priv->format = sbc->format;
+	priv->frame.codesize = sbc_get_codesize(sbc);
+	priv->frame.length = sbc_get_frame_length(sbc);
+
+	sbc_encoder_init(&priv->enc_state, &priv->frame);
+	priv->init = 1;
+}
+
+/*
+ * Encodes up to 'max_frames' frames from 'input' to 'output'. The setup
+ * work (lazy initialization, input processing function selection) is
+ * done only once per call, so encoding several frames in a row keeps
+ * the encoder state hot in the cache.
+ */
+static ssize_t sbc_encode_frames(sbc_t *sbc, const uint8_t *input,
+				size_t input_len, uint8_t *output,
+				size_t output_len, size_t *written,
+				int max_frames)
 {
 	struct sbc_priv *priv;
-	int framelen, samples;
+	int framelen, frames;
+	ssize_t consumed;
 	int (*sbc_enc_process_input)(int position,
 			const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
 			int nsamples, int nchannels);
+	int (*process_input_fmt)(int position,
+			const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
+			int nsamples, int nchannels, int format,
+			int big_endian) = NULL;
 
 	if (!sbc || !input)
 		return -EIO;
@@ -1071,21 +1540,13 @@ ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
 	if (written)
 		*written = 0;
 
-	if (!priv->init) {
-		priv->frame.frequency = sbc->frequency;
-		priv->frame.mode = sbc->mode;
-		priv->frame.channels = sbc->mode == SBC_MODE_MONO ? 1 : 2;
-		priv->frame.allocation = sbc->allocation;
-		priv->frame.subband_mode = sbc->subbands;
-		priv->frame.subbands = sbc->subbands ? 8 : 4;
-		priv->frame.block_mode = sbc->blocks;
-		priv->frame.blocks = 4 + (sbc->blocks * 4);
+	if (!priv->init)
+		sbc_encoder_setup(sbc, priv);
+	else if (priv->frame.bitpool != sbc->bitpool) {
+		/* the bitpool can change between any two frames, the
+		 * analysis state does not depend on it */
 		priv->frame.bitpool = sbc->bitpool;
-		priv->frame.codesize = sbc_get_codesize(sbc);
 		priv->frame.length = sbc_get_frame_length(sbc);
-
-		sbc_encoder_init(&priv->enc_state, &priv->frame);
-		priv->init = 1;
 	}
 
 	/* input must be large enough to encode a complete frame */
@@ -1096,8 +1557,16 @@ ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
 	if (!output || output_len < priv->frame.length)
 		return -ENOSPC;
 
-	/* Select the needed input data processing function and call it */
-	if (priv->frame.subbands == 8) {
+	/* Select the needed input data processing function */
+	if (priv->format != SBC_FORMAT_S16) {
+		if (priv->frame.subbands == 8)
+			process_input_fmt =
+				priv->enc_state.sbc_enc_process_input_8s_fmt;
+		else
+			process_input_fmt =
+				priv->enc_state.sbc_enc_process_input_4s_fmt;
+		sbc_enc_process_input = NULL;
+	} else if (priv->frame.subbands == 8) {
 		if (sbc->endian == SBC_BE)
 			sbc_enc_process_input =
 				priv->enc_state.sbc_enc_process_input_8s_be;
@@ -1113,23 +1582,80 @@ ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
 				priv->enc_state.sbc_enc_process_input_4s_le;
 	}
 
-	priv->enc_state.position = sbc_enc_process_input(
-		priv->enc_state.position, (const uint8_t *) input,
-		priv->enc_state.X, priv->frame.subbands * priv->frame.blocks,
-		priv->frame.channels);
+	consumed = 0;
 
-	samples = sbc_analyze_audio(&priv->enc_state, &priv->frame);
+	for (frames = 0; frames < max_frames; frames++) {
+		if (input_len < priv->frame.codesize ||
+				output_len < priv->frame.length)
+			break;
 
-	priv->enc_state.sbc_calc_scalefactors(
-		priv->frame.sb_sample_f, priv->frame.scale_factor,
-		priv->frame.blocks, priv->frame.channels, priv->frame.subbands);
+		if (sbc_enc_process_input)
+			priv->enc_state.position = sbc_enc_process_input(
+				priv->enc_state.position, input,
+				priv->enc_state.X,
+				priv->frame.subbands * priv->frame.blocks,
+				priv->frame.channels);
+		else
+			priv->enc_state.position = process_input_fmt(
+				priv->enc_state.position, input,
+				priv->enc_state.X,
+				priv->frame.subbands * priv->frame.blocks,
+				priv->frame.channels, priv->format,
+				sbc->endian == SBC_BE);
+
+		sbc_analyze_audio(&priv->enc_state, &priv->frame);
+
+		if (priv->frame.mode == JOINT_STEREO) {
+			int j = priv->enc_state.sbc_calc_scalefactors_j(
+				priv->frame.sb_sample_f,
+				priv->frame.scale_factor,
+				priv->frame.blocks, priv->frame.subbands);
+			framelen = sbc_pack_frame(output, &priv->frame,
+						output_len, j, &priv->alloc);
+		} else {
+			priv->enc_state.sbc_calc_scalefactors(
+				priv->frame.sb_sample_f,
+				priv->frame.scale_factor,
+				priv->frame.blocks, priv->frame.channels,
+				priv->frame.subbands);
+			framelen = sbc_pack_frame(output, &priv->frame,
+						output_len, 0, &priv->alloc);
+		}
+
+		/* a bitpool above the limit of the mode can't be packed,
+		 * report what has been encoded before it if anything */
+		if (framelen < 0) {
+			if (frames == 0)
+				return framelen;
+			break;
+		}
 
-	framelen = sbc_pack_frame(output, &priv->frame, output_len);
+		input += priv->frame.codesize;
+		input_len -= priv->frame.codesize;
+		output += framelen;
+		output_len -= framelen;
 
-	if (written)
-		*written = framelen;
+		consumed += priv->frame.codesize;
 
-	return samples * priv->frame.channels * 2;
+		if (written)
+			*written += framelen;
+	}
+
+	return consumed;
+}
+
+ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
+			void *output, size_t output_len, size_t *written)
+{
+	return sbc_encode_frames(sbc, input, input_len, output, output_len,
+								written, 1);
+}
+
+ssize_t sbc_encode_multi(sbc_t *sbc, const void *input, size_t input_len,
+			void *output, size_t output_len, size_t *written)
+{
+	return sbc_encode_frames(sbc, input, input_len, output, output_len,
+							written, INT_MAX);
 }
 
 void sbc_finish(sbc_t *sbc)
@@ -1150,7 +1676,7 @@ size_t sbc_get_frame_length(sbc_t *sbc)
 	struct sbc_priv *priv;
 
 	priv = sbc->priv;
-	if (priv->init)
+	if (priv->init && priv->frame.bitpool == sbc->bitpool)
 		return priv->frame.length;
 
 	subbands = sbc->subbands ? 8 : 4;
@@ -1161,7 +1687,8 @@ size_t sbc_get_frame_length(sbc_t *sbc)
 
 	ret = 4 + (4 * subbands * channels) / 8;
 	/* This term is not always evenly divide so we round it up */
-	if (channels == 1)
+	if (sbc->mode == SBC_MODE_MONO ||
+			sbc->mode == SBC_MODE_DUAL_CHANNEL)
 		ret += ((blocks * channels * bitpool) + 7) / 8;
 	else
 		ret += (((joint ? subbands : 0) + blocks * bitpool) + 7) / 8;
@@ -1209,7 +1736,7 @@ unsigned sbc_get_frame_duration(sbc_t *sbc)
 
 size_t sbc_get_codesize(sbc_t *sbc)
 {
-	uint16_t subbands, channels, blocks;
+	uint16_t subbands, channels, blocks, sample_size;
 	struct sbc_priv *priv;
 
 	priv = sbc->priv;
@@ -1217,13 +1744,15 @@ size_t sbc_get_codesize(sbc_t *sbc)
 		subbands = sbc->subbands ? 8 : 4;
 		blocks = 4 + (sbc->blocks * 4);
 		channels = sbc->mode == SBC_MODE_MONO ? 1 : 2;
+		sample_size = sbc->format == SBC_FORMAT_S16 ? 2 : 4;
 	} else {
 		subbands = priv->frame.subbands;
 		blocks = priv->frame.blocks;
 		channels = priv->frame.channels;
+		sample_size = priv->format == SBC_FORMAT_S16 ? 2 : 4;
 	}
 
-	return subbands * blocks * channels * 2;
+	return subbands * blocks * channels * sample_size;
 }
 
 const char *sbc_get_implementation_info(sbc_t *sbc)
@@ -1240,6 +1769,167 @@ const char *sbc_get_implementation_info(sbc_t *sbc)
 	return priv->enc_state.implementation_info;
 }
 
+#define SBC_SELFTEST_FRAMES	24
+
+/*
+ * Random input alternating between full scale noise, quiet noise and
+ * silence, so that both saturation and small scale factors are covered
+ */
+static void sbc_selftest_input(int16_t *pcm, int samples, uint32_t seed)
+{
+	int i;
+
+	for (i = 0; i < samples; i++) {
+		seed = seed * 1103515245 + 12345;
+
+		switch ((i / 256) % 3) {
+		case 0:
+			pcm[i] = seed >> 16;
+			break;
+		case 1:
+			pcm[i] = (int16_t) (seed >> 16) >> 8;
+			break;
+		default:
+			pcm[i] = 0;
+			break;
+		}
+	}
+}
+
+static int sbc_selftest_config(sbc_t *ref, sbc_t *tst, int16_t *pcm,
+				uint8_t *ref_buf, uint8_t *tst_buf, size_t len)
+{
+	size_t codesize, ref_written, tst_written, stream_len;
+	ssize_t ref_len, tst_len;
+
+	codesize = sbc_get_codesize(ref);
+
+	ref_len = sbc_encode_multi(ref, pcm, codesize * SBC_SELFTEST_FRAMES,
+					ref_buf, len, &ref_written);
+	tst_len = sbc_encode_multi(tst, pcm, codesize * SBC_SELFTEST_FRAMES,
+					tst_buf, len, &tst_written);
+
+	if (ref_len != tst_len || ref_written != tst_written ||
+			memcmp(ref_buf, tst_buf, ref_written) != 0)
+		return 1;
+
+	/* Decode the same stream with fresh decoders */
+	stream_len = ref_written;
+	memcpy(tst_buf, ref_buf, stream_len);
+
+	sbc_reinit(ref, SBC_IMPL_GENERIC);
+	sbc_reinit(tst, tst->flags);
+
+	ref_len = sbc_decode_multi(ref, tst_buf, stream_len, ref_buf,
+						len, &ref_written);
+	tst_len = sbc_decode_multi(tst, tst_buf, stream_len, ref_buf + len,
+						len, &tst_written);
+
+	if (ref_len != tst_len || ref_written != tst_written ||
+			memcmp(ref_buf, ref_buf + len, ref_written) != 0)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * A bitpool above the limit of the mode has to be refused before
+ * anything is written, not packed into a frame of negative length
+ */
+static int sbc_selftest_bitpool(sbc_t *tst, unsigned long flags,
+				int16_t *pcm, uint8_t *tst_buf, size_t len)
+{
+	size_t codesize, written;
+	ssize_t ret;
+
+	sbc_reinit(tst, flags);
+
+	tst->subbands = SBC_SB_8;
+	tst->blocks = SBC_BLK_16;
+	tst->mode = SBC_MODE_MONO;
+	tst->bitpool = 16 * 8 + 1;
+
+	codesize = sbc_get_codesize(tst);
+
+	ret = sbc_encode_multi(tst, pcm, codesize * SBC_SELFTEST_FRAMES,
+						tst_buf, len, &written);
+	if (ret >= 0 || written != 0)
+		return 1;
+
+	ret = sbc_encode(tst, pcm, codesize, tst_buf, len, &written);
+	if (ret >= 0 || written != 0)
+		return 1;
+
+	return 0;
+}
+
+int sbc_selftest(unsigned long flags)
+{
+	static const uint8_t bitpools[] = { 2, 32, 53, 250 };
+	size_t len = SBC_SELFTEST_FRAMES * 1024;
+	int16_t *pcm;
+	uint8_t *ref_buf, *tst_buf;
+	int i, mismatches = 0, err;
+	sbc_t ref, tst;
+
+	err = sbc_init(&tst, flags);
+	if (err < 0)
+		return err;
+
+	err = sbc_init(&ref, SBC_IMPL_GENERIC);
+	if (err < 0) {
+		sbc_finish(&tst);
+		return err;
+	}
+
+	pcm = malloc(SBC_SELFTEST_FRAMES * 16 * 8 * 2 * sizeof(int16_t));
+	ref_buf = malloc(len * 2);
+	tst_buf = malloc(len);
+	if (!pcm || !ref_buf || !tst_buf) {
+		mismatches = -ENOMEM;
+		goto done;
+	}
+
+	/* All combinations of subbands, blocks, mode, bitpool and endianess */
+	for (i = 0; i < 2 * 4 * 4 * 4 * 2; i++) {
+		int sb = i & 0x01, blk = (i >> 1) & 0x03;
+		int mode = (i >> 3) & 0x03, bp = (i >> 5) & 0x03;
+		int endian = (i >> 7) & 0x01;
+		int max = (mode == SBC_MODE_MONO ||
+				mode == SBC_MODE_DUAL_CHANNEL ? 16 : 32) *
+							(sb ? 8 : 4);
+
+		sbc_selftest_input(pcm, SBC_SELFTEST_FRAMES * 16 * 8 * 2,
+				(sb << 16) | (blk << 12) | (mode << 8) | bp);
+
+		sbc_reinit(&ref, SBC_IMPL_GENERIC);
+		sbc_reinit(&tst, flags);
+
+		ref.subbands = tst.subbands = sb;
+		ref.blocks = tst.blocks = blk;
+		ref.mode = tst.mode = mode;
+		ref.endian = tst.endian = endian;
+		ref.bitpool = tst.bitpool = bitpools[bp] < max ?
+							bitpools[bp] : max;
+		ref.allocation = tst.allocation =
+				bp & 1 ? SBC_AM_SNR : SBC_AM_LOUDNESS;
+
+		mismatches += sbc_selftest_config(&ref, &tst, pcm,
+						ref_buf, tst_buf, len);
+	}
+
+	mismatches += sbc_selftest_bitpool(&tst, flags, pcm, tst_buf, len);
+
+done:
+	free(tst_buf);
+	free(ref_buf);
+	free(pcm);
+	sbc_finish(&ref);
+	sbc_finish(&tst);
+
+	return mismatches;
+}
+
 int sbc_reinit(sbc_t *sbc, unsigned long flags)
 {
 	struct sbc_priv *priv;
@@ -1252,6 +1942,9 @@ int sbc_reinit(sbc_t *sbc, unsigned long flags)
 	if (priv->init == 1)
 		memset(sbc->priv, 0, sizeof(struct sbc_priv));
 
+	if (sbc_setup_primitives(priv, flags) < 0)
+		return -ENOTSUP;
+
 	sbc_set_defaults(sbc, flags);
 
 	return 0;
@@ -63,6 +63,24 @@ extern "C" {
 #define SBC_LE			0x00
 #define SBC_BE			0x01
 
+/* Encoder input sample format, S24 is stored in the low 24 bits of 32
+ * and float is in the -1.0 .. 1.0 range, all in the given endianess */
+#define SBC_FORMAT_S16		0x00
+#define SBC_FORMAT_S24		0x01
+#define SBC_FORMAT_S32		0x02
+#define SBC_FORMAT_FLOAT	0x03
+
+/* Primitive implementation, passed in the sbc_init() flags. The
+ * SBC_IMPLEMENTATION environment variable ("generic", "mmx", "sse2",
+ * "avx2" or "neon") is used instead of SBC_IMPL_AUTO when available. */
+#define SBC_IMPL_AUTO		0x00
+#define SBC_IMPL_GENERIC	0x01
+#define SBC_IMPL_MMX		0x02
+#define SBC_IMPL_SSE2		0x03
+#define SBC_IMPL_AVX2		0x04
+#define SBC_IMPL_NEON		0x05
+#define SBC_IMPL_MASK		0x0F
+
 struct sbc_struct {
 	unsigned long flags;
 
@@ -73,6 +91,7 @@ struct sbc_struct {
 	uint8_t allocation;
 	uint8_t bitpool;
 	uint8_t endian;
+	uint8_t format;
 
 	void *priv;
 	void *priv_alloc_base;
@@ -89,20 +108,46 @@ ssize_t sbc_parse(sbc_t *sbc, const void *input, size_t input_len);
 ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
 			void *output, size_t output_len, size_t *written);
 
+/* Decodes consecutive input blocks into interleaved output as long as
+ * each decoded block fits, returns the number of input bytes consumed */
+ssize_t sbc_decode_multi(sbc_t *sbc, const void *input, size_t input_len,
+			void *output, size_t output_len, size_t *written);
+
+/* Same as sbc_decode_multi, but stores native endian samples into one
+ * buffer of output_len bytes per channel */
+ssize_t sbc_decode_multi_planar(sbc_t *sbc, const void *input,
+			size_t input_len, int16_t *output[2],
+			size_t output_len, size_t *written);
+
 /* Encodes ONE input block into ONE output block */
 ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
 			void *output, size_t output_len, size_t *written);
 
-/* Returns the output block size in bytes */
+/* Encodes as many whole input blocks as fit into both input and output
+ * buffers, returns the number of input bytes consumed, or a negative
+ * error if not even the first block could be encoded */
+ssize_t sbc_encode_multi(sbc_t *sbc, const void *input, size_t input_len,
+			void *output, size_t output_len, size_t *written);
+
+/* Returns the output block size in bytes, the encoder bitpool may be
+ * changed between any two blocks so this has to be queried again */
 size_t sbc_get_frame_length(sbc_t *sbc);
 
 /* Returns the time one input/output block takes to play in msec*/
 unsigned sbc_get_frame_duration(sbc_t *sbc);
 
-/* Returns the input block size in bytes */
+/* Returns the input block size in bytes, for the encoder this depends
+ * on the input sample format */
 size_t sbc_get_codesize(sbc_t *sbc);
 
 const char *sbc_get_implementation_info(sbc_t *sbc);
+
+/* Encodes and decodes random input with the implementation selected by
+ * flags and with the generic one, returns the number of configurations
+ * with different results, counting an out of range bitpool that isn't
+ * refused as one, or -ENOTSUP if the implementation is missing */
+int sbc_selftest(unsigned long flags);
+
 void sbc_finish(sbc_t *sbc);
 
 #ifdef __cplusplus
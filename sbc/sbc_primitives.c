@@ -26,12 +26,14 @@
 #include <stdint.h>
 #include <limits.h>
 #include <string.h>
+#include <endian.h>
 #include "sbc.h"
 #include "sbc_math.h"
 #include "sbc_tables.h"
 
 #include "sbc_primitives.h"
 #include "sbc_primitives_mmx.h"
+#include "sbc_primitives_sse.h"
 #include "sbc_primitives_neon.h"
 
 /*
@@ -206,6 +208,111 @@ static inline void sbc_analyze_4b_8s_simd(int16_t *x,
 	sbc_analyze_eight_simd(x + 0, out, analysis_consts_fixed8_simd_even);
 }
 
+/*
+ * A reference C code of synthesis filter with SIMD-friendly tables and
+ * data layout. The history of matrixing results (V) is kept in a linear
+ * buffer which is filled from top to bottom, in the same way as the "X"
+ * buffer of the encoder. Each block prepends (2 * nrof_subbands) values,
+ * so that the (10 * 2 * nrof_subbands) contiguous values needed by the
+ * windowing stage are available without any index wrapping.
+ */
+
+static SBC_ALWAYS_INLINE int16_t sbc_clip16(int32_t s)
+{
+	if (s > 0x7FFF)
+		return 0x7FFF;
+	else if (s < -0x8000)
+		return -0x8000;
+	else
+		return s;
+}
+
+static inline void sbc_synthesize_four_simd(const int32_t *in, int32_t *v,
+							int16_t *out)
+{
+	int32_t t[8];
+	int i, k, hop;
+
+	/* matrixing */
+	for (i = 0; i < 8; i++)
+		t[i] = 0;
+
+	for (k = 0; k < 4; k++)
+		for (i = 0; i < 8; i++)
+			t[i] = MULA(in[k], synthesis_matrix4_simd[k][i], t[i]);
+
+	for (i = 0; i < 8; i++)
+		v[i] = SCALE4_STAGED1(t[i]);
+
+	/* windowing */
+	for (i = 0; i < 4; i++)
+		t[i] = 0;
+
+	for (hop = 0; hop < 10; hop++)
+		for (i = 0; i < 4; i++)
+			t[i] = MULA(v[hop * 8 + (hop & 1) * 4 + i],
+					synthesis_proto4_simd[hop][i], t[i]);
+
+	for (i = 0; i < 4; i++)
+		out[i] = sbc_clip16(SCALE4_STAGED1(t[i]));
+}
+
+static inline void sbc_synthesize_eight_simd(const int32_t *in, int32_t *v,
+							int16_t *out)
+{
+	int32_t t[16];
+	int i, k, hop;
+
+	/* matrixing */
+	for (i = 0; i < 16; i++)
+		t[i] = 0;
+
+	for (k = 0; k < 8; k++)
+		for (i = 0; i < 16; i++)
+			t[i] = MULA(in[k], synthesis_matrix8_simd[k][i], t[i]);
+
+	for (i = 0; i < 16; i++)
+		v[i] = SCALE8_STAGED1(t[i]);
+
+	/* windowing */
+	for (i = 0; i < 8; i++)
+		t[i] = 0;
+
+	for (hop = 0; hop < 10; hop++)
+		for (i = 0; i < 8; i++)
+			t[i] = MULA(v[hop * 16 + (hop & 1) * 8 + i],
+					synthesis_proto8_simd[hop][i], t[i]);
+
+	for (i = 0; i < 8; i++)
+		out[i] = sbc_clip16(SCALE8_STAGED1(t[i]));
+}
+
+static inline void sbc_synthesize_4b_4s_simd(const int32_t *in,
+					int in_stride, int32_t *v, int16_t *out)
+{
+	/* Synthesize blocks, the oldest one first */
+	sbc_synthesize_four_simd(in, v + 24, out);
+	in += in_stride;
+	sbc_synthesize_four_simd(in, v + 16, out + 4);
+	in += in_stride;
+	sbc_synthesize_four_simd(in, v + 8, out + 8);
+	in += in_stride;
+	sbc_synthesize_four_simd(in, v + 0, out + 12);
+}
+
+static inline void sbc_synthesize_4b_8s_simd(const int32_t *in,
+					int in_stride, int32_t *v, int16_t *out)
+{
+	/* Synthesize blocks, the oldest one first */
+	sbc_synthesize_eight_simd(in, v + 48, out);
+	in += in_stride;
+	sbc_synthesize_eight_simd(in, v + 32, out + 8);
+	in += in_stride;
+	sbc_synthesize_eight_simd(in, v + 16, out + 16);
+	in += in_stride;
+	sbc_synthesize_eight_simd(in, v + 0, out + 24);
+}
+
 static inline int16_t unaligned16_be(const uint8_t *ptr)
 {
 	return (int16_t) ((ptr[0] << 8) | ptr[1]);
@@ -216,18 +323,95 @@ static inline int16_t unaligned16_le(const uint8_t *ptr)
 	return (int16_t) (ptr[0] | (ptr[1] << 8));
 }
 
+static inline uint32_t unaligned32_be(const uint8_t *ptr)
+{
+	return ((uint32_t) ptr[0] << 24) | (ptr[1] << 16) |
+						(ptr[2] << 8) | ptr[3];
+}
+
+static inline uint32_t unaligned32_le(const uint8_t *ptr)
+{
+	return ((uint32_t) ptr[3] << 24) | (ptr[2] << 16) |
+						(ptr[1] << 8) | ptr[0];
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define SBC_NATIVE_BE 0
+#else
+#define SBC_NATIVE_BE 1
+#endif
+
+/*
+ * Converts a float sample in the -1.0 .. 1.0 range to 16 bit, rounding
+ * to nearest and saturating
+ */
+static inline int16_t sbc_float_to_s16(uint32_t bits)
+{
+	union {
+		uint32_t i;
+		float f;
+	} u;
+	float v;
+
+	u.i = bits;
+	v = u.f * 32768.0f;
+
+	if (v >= 32767.0f)
+		return 32767;
+	if (v <= -32768.0f)
+		return -32768;
+	if (v != v)
+		return 0;
+
+	return (int16_t) (v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+/*
+ * Reads sample i of the input as 16 bit. 32-bit containers hold S32,
+ * S24 in the low 24 bits or float samples. For native endian 16-bit
+ * input that is known to be aligned the plain load is used.
+ */
+static SBC_ALWAYS_INLINE int16_t sbc_input_sample(const uint8_t *pcm, int i,
+				int format, int big_endian, int aligned)
+{
+	uint32_t v;
+
+	if (format == SBC_FORMAT_S16) {
+		if (aligned && big_endian == SBC_NATIVE_BE)
+			return ((const int16_t *) pcm)[i];
+
+		return big_endian ? unaligned16_be(pcm + i * 2) :
+					unaligned16_le(pcm + i * 2);
+	}
+
+	v = big_endian ? unaligned32_be(pcm + i * 4) :
+					unaligned32_le(pcm + i * 4);
+
+	switch (format) {
+	case SBC_FORMAT_S24:
+		return (int16_t) (v >> 8);
+	case SBC_FORMAT_FLOAT:
+		return sbc_float_to_s16(v);
+	case SBC_FORMAT_S32:
+	default:
+		return (int16_t) (v >> 16);
+	}
+}
+
 /*
  * Internal helper functions for input data processing. In order to get
- * optimal performance, it is important to have "nsamples", "nchannels"
- * and "big_endian" arguments used with this inline function as compile
- * time constants.
+ * optimal performance, it is important to have "nsamples", "nchannels",
+ * "format", "big_endian" and "aligned" arguments used with this inline
+ * function as compile time constants.
  */
 
 static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s4_internal(
 	int position,
 	const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
-	int nsamples, int nchannels, int big_endian)
+	int nsamples, int nchannels, int format, int big_endian, int aligned)
 {
+	int sample_size = format == SBC_FORMAT_S16 ? 2 : 4;
+
 	/* handle X buffer wraparound */
 	if (position < nsamples) {
 		if (nchannels > 0)
@@ -239,8 +423,7 @@ static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s4_internal(
 		position = SBC_X_BUFFER_SIZE - 40;
 	}
 
-	#define PCM(i) (big_endian ? \
-		unaligned16_be(pcm + (i) * 2) : unaligned16_le(pcm + (i) * 2))
+	#define PCM(i) sbc_input_sample(pcm, (i), format, big_endian, aligned)
 
 	/* copy/permutate audio samples */
 	while ((nsamples -= 8) >= 0) {
@@ -267,7 +450,7 @@ static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s4_internal(
 			x[6]  = PCM(1 + 1 * nchannels);
 			x[7]  = PCM(1 + 5 * nchannels);
 		}
-		pcm += 16 * nchannels;
+		pcm += 8 * nchannels * sample_size;
 	}
 	#undef PCM
 
@@ -277,8 +460,10 @@ static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s4_internal(
 static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s8_internal(
 	int position,
 	const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
-	int nsamples, int nchannels, int big_endian)
+	int nsamples, int nchannels, int format, int big_endian, int aligned)
 {
+	int sample_size = format == SBC_FORMAT_S16 ? 2 : 4;
+
 	/* handle X buffer wraparound */
 	if (position < nsamples) {
 		if (nchannels > 0)
@@ -290,8 +475,7 @@ static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s8_internal(
 		position = SBC_X_BUFFER_SIZE - 72;
 	}
 
-	#define PCM(i) (big_endian ? \
-		unaligned16_be(pcm + (i) * 2) : unaligned16_le(pcm + (i) * 2))
+	#define PCM(i) sbc_input_sample(pcm, (i), format, big_endian, aligned)
 
 	/* copy/permutate audio samples */
 	while ((nsamples -= 16) >= 0) {
@@ -334,7 +518,7 @@ static SBC_ALWAYS_INLINE int sbc_encoder_process_input_s8_internal(
 			x[14] = PCM(1 + 4 * nchannels);
 			x[15] = PCM(1 + 2 * nchannels);
 		}
-		pcm += 32 * nchannels;
+		pcm += 16 * nchannels * sample_size;
 	}
 	#undef PCM
 
@@ -357,48 +541,141 @@ static int sbc_enc_process_input_4s_le(int position,
 		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
 		int nsamples, int nchannels)
 {
+	if (!SBC_NATIVE_BE && ((uintptr_t) pcm & 1) == 0) {
+		if (nchannels > 1)
+			return sbc_encoder_process_input_s4_internal(
+				position, pcm, X, nsamples, 2,
+				SBC_FORMAT_S16, 0, 1);
+		else
+			return sbc_encoder_process_input_s4_internal(
+				position, pcm, X, nsamples, 1,
+				SBC_FORMAT_S16, 0, 1);
+	}
+
 	if (nchannels > 1)
 		return sbc_encoder_process_input_s4_internal(
-			position, pcm, X, nsamples, 2, 0);
+			position, pcm, X, nsamples, 2, SBC_FORMAT_S16, 0, 0);
 	else
 		return sbc_encoder_process_input_s4_internal(
-			position, pcm, X, nsamples, 1, 0);
+			position, pcm, X, nsamples, 1, SBC_FORMAT_S16, 0, 0);
 }
 
 static int sbc_enc_process_input_4s_be(int position,
 		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
 		int nsamples, int nchannels)
 {
+	if (SBC_NATIVE_BE && ((uintptr_t) pcm & 1) == 0) {
+		if (nchannels > 1)
+			return sbc_encoder_process_input_s4_internal(
+				position, pcm, X, nsamples, 2,
+				SBC_FORMAT_S16, 1, 1);
+		else
+			return sbc_encoder_process_input_s4_internal(
+				position, pcm, X, nsamples, 1,
+				SBC_FORMAT_S16, 1, 1);
+	}
+
 	if (nchannels > 1)
 		return sbc_encoder_process_input_s4_internal(
-			position, pcm, X, nsamples, 2, 1);
+			position, pcm, X, nsamples, 2, SBC_FORMAT_S16, 1, 0);
 	else
 		return sbc_encoder_process_input_s4_internal(
-			position, pcm, X, nsamples, 1, 1);
+			position, pcm, X, nsamples, 1, SBC_FORMAT_S16, 1, 0);
 }
 
 static int sbc_enc_process_input_8s_le(int position,
 		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
 		int nsamples, int nchannels)
 {
+	if (!SBC_NATIVE_BE && ((uintptr_t) pcm & 1) == 0) {
+		if (nchannels > 1)
+			return sbc_encoder_process_input_s8_internal(
+				position, pcm, X, nsamples, 2,
+				SBC_FORMAT_S16, 0, 1);
+		else
+			return sbc_encoder_process_input_s8_internal(
+				position, pcm, X, nsamples, 1,
+				SBC_FORMAT_S16, 0, 1);
+	}
+
 	if (nchannels > 1)
 		return sbc_encoder_process_input_s8_internal(
-			position, pcm, X, nsamples, 2, 0);
+			position, pcm, X, nsamples, 2, SBC_FORMAT_S16, 0, 0);
 	else
 		return sbc_encoder_process_input_s8_internal(
-			position, pcm, X, nsamples, 1, 0);
+			position, pcm, X, nsamples, 1, SBC_FORMAT_S16, 0, 0);
 }
 
 static int sbc_enc_process_input_8s_be(int position,
 		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
 		int nsamples, int nchannels)
 {
+	if (SBC_NATIVE_BE && ((uintptr_t) pcm & 1) == 0) {
+		if (nchannels > 1)
+			return sbc_encoder_process_input_s8_internal(
+				position, pcm, X, nsamples, 2,
+				SBC_FORMAT_S16, 1, 1);
+		else
+			return sbc_encoder_process_input_s8_internal(
+				position, pcm, X, nsamples, 1,
+				SBC_FORMAT_S16, 1, 1);
+	}
+
 	if (nchannels > 1)
 		return sbc_encoder_process_input_s8_internal(
-			position, pcm, X, nsamples, 2, 1);
+			position, pcm, X, nsamples, 2, SBC_FORMAT_S16, 1, 0);
 	else
 		return sbc_encoder_process_input_s8_internal(
-			position, pcm, X, nsamples, 1, 1);
+			position, pcm, X, nsamples, 1, SBC_FORMAT_S16, 1, 0);
+}
+
+/*
+ * Input processing for the 32-bit sample formats, the samples are
+ * converted to 16 bit on the fly
+ */
+
+#define SBC_PROCESS_INPUT_32(subbands, fmt)				\
+	do {								\
+		if (big_endian && nchannels > 1)			\
+			return sbc_encoder_process_input_s##subbands##_internal( \
+				position, pcm, X, nsamples, 2, fmt, 1, 0); \
+		else if (big_endian)					\
+			return sbc_encoder_process_input_s##subbands##_internal( \
+				position, pcm, X, nsamples, 1, fmt, 1, 0); \
+		else if (nchannels > 1)					\
+			return sbc_encoder_process_input_s##subbands##_internal( \
+				position, pcm, X, nsamples, 2, fmt, 0, 0); \
+		else							\
+			return sbc_encoder_process_input_s##subbands##_internal( \
+				position, pcm, X, nsamples, 1, fmt, 0, 0); \
+	} while (0)
+
+static int sbc_enc_process_input_4s_fmt(int position,
+		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
+		int nsamples, int nchannels, int format, int big_endian)
+{
+	switch (format) {
+	case SBC_FORMAT_S24:
+		SBC_PROCESS_INPUT_32(4, SBC_FORMAT_S24);
+	case SBC_FORMAT_FLOAT:
+		SBC_PROCESS_INPUT_32(4, SBC_FORMAT_FLOAT);
+	default:
+		SBC_PROCESS_INPUT_32(4, SBC_FORMAT_S32);
+	}
+}
+
+static int sbc_enc_process_input_8s_fmt(int position,
+		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
+		int nsamples, int nchannels, int format, int big_endian)
+{
+	switch (format) {
+	case SBC_FORMAT_S24:
+		SBC_PROCESS_INPUT_32(8, SBC_FORMAT_S24);
+	case SBC_FORMAT_FLOAT:
+		SBC_PROCESS_INPUT_32(8, SBC_FORMAT_FLOAT);
+	default:
+		SBC_PROCESS_INPUT_32(8, SBC_FORMAT_S32);
+	}
 }
 
 /* Supplementary function to count the number of leading zeros */
@@ -439,10 +716,90 @@ static void sbc_calc_scalefactors(
 	}
 }
 
+/*
+ * Calculate scale factors for the joint stereo mode. Every subband except
+ * the last one is switched to the mid/side representation if that needs
+ * smaller scale factors. Returns the bitmask of joint stereo subbands in
+ * the bitstream order (the first subband is the most significant bit).
+ */
+static int sbc_calc_scalefactors_j(
+	int32_t sb_sample_f[16][2][8],
+	uint32_t scale_factor[2][8],
+	int blocks, int subbands)
+{
+	int blk, joint = 0;
+	int32_t tmp0, tmp1;
+	uint32_t x, y;
+
+	/* last subband does not use joint stereo */
+	int sb = subbands - 1;
+	x = 1 << SCALE_OUT_BITS;
+	y = 1 << SCALE_OUT_BITS;
+	for (blk = 0; blk < blocks; blk++) {
+		tmp0 = fabs(sb_sample_f[blk][0][sb]);
+		tmp1 = fabs(sb_sample_f[blk][1][sb]);
+		if (tmp0 != 0)
+			x |= tmp0 - 1;
+		if (tmp1 != 0)
+			y |= tmp1 - 1;
+	}
+	scale_factor[0][sb] = (31 - SCALE_OUT_BITS) - sbc_clz(x);
+	scale_factor[1][sb] = (31 - SCALE_OUT_BITS) - sbc_clz(y);
+
+	/* the rest of subbands can use joint stereo */
+	while (--sb >= 0) {
+		int32_t sb_sample_j[16][2];
+		uint32_t m = 1 << SCALE_OUT_BITS;
+		uint32_t s = 1 << SCALE_OUT_BITS;
+
+		x = 1 << SCALE_OUT_BITS;
+		y = 1 << SCALE_OUT_BITS;
+		for (blk = 0; blk < blocks; blk++) {
+			tmp0 = sb_sample_f[blk][0][sb];
+			tmp1 = sb_sample_f[blk][1][sb];
+			sb_sample_j[blk][0] = ASR(tmp0, 1) + ASR(tmp1, 1);
+			sb_sample_j[blk][1] = ASR(tmp0, 1) - ASR(tmp1, 1);
+			tmp0 = fabs(tmp0);
+			tmp1 = fabs(tmp1);
+			if (tmp0 != 0)
+				x |= tmp0 - 1;
+			if (tmp1 != 0)
+				y |= tmp1 - 1;
+			tmp0 = fabs(sb_sample_j[blk][0]);
+			tmp1 = fabs(sb_sample_j[blk][1]);
+			if (tmp0 != 0)
+				m |= tmp0 - 1;
+			if (tmp1 != 0)
+				s |= tmp1 - 1;
+		}
+		x = (31 - SCALE_OUT_BITS) - sbc_clz(x);
+		y = (31 - SCALE_OUT_BITS) - sbc_clz(y);
+		m = (31 - SCALE_OUT_BITS) - sbc_clz(m);
+		s = (31 - SCALE_OUT_BITS) - sbc_clz(s);
+
+		/* decide whether to use joint stereo for this subband */
+		if (x + y > m + s) {
+			joint |= 1 << (subbands - 1 - sb);
+			scale_factor[0][sb] = m;
+			scale_factor[1][sb] = s;
+			for (blk = 0; blk < blocks; blk++) {
+				sb_sample_f[blk][0][sb] = sb_sample_j[blk][0];
+				sb_sample_f[blk][1][sb] = sb_sample_j[blk][1];
+			}
+		} else {
+			scale_factor[0][sb] = x;
+			scale_factor[1][sb] = y;
+		}
+	}
+
+	/* bitmask with the information about subbands using joint stereo */
+	return joint;
+}
+
 /*
  * Detect CPU features and setup function pointers
  */
-void sbc_init_primitives(struct sbc_encoder_state *state)
+int sbc_init_primitives(struct sbc_encoder_state *state, int impl)
 {
 	/* Default implementation for analyze functions */
 	state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_simd;
@@ -453,18 +810,54 @@ void sbc_init_primitives(struct sbc_encoder_state *state)
 	state->sbc_enc_process_input_4s_be = sbc_enc_process_input_4s_be;
 	state->sbc_enc_process_input_8s_le = sbc_enc_process_input_8s_le;
 	state->sbc_enc_process_input_8s_be = sbc_enc_process_input_8s_be;
+	state->sbc_enc_process_input_4s_fmt = sbc_enc_process_input_4s_fmt;
+	state->sbc_enc_process_input_8s_fmt = sbc_enc_process_input_8s_fmt;
 
 	/* Default implementation for scale factors calculation */
 	state->sbc_calc_scalefactors = sbc_calc_scalefactors;
+	state->sbc_calc_scalefactors_j = sbc_calc_scalefactors_j;
+	state->implementation = SBC_IMPL_GENERIC;
 	state->implementation_info = "Generic C";
 
+	if (impl == SBC_IMPL_GENERIC)
+		return 0;
+
 	/* X86/AMD64 optimizations */
 #ifdef SBC_BUILD_WITH_MMX_SUPPORT
-	sbc_init_primitives_mmx(state);
+	sbc_init_primitives_mmx(state, impl);
+#endif
+#ifdef SBC_BUILD_WITH_SSE_SUPPORT
+	sbc_init_primitives_sse(state, impl);
+#endif
+
+	/* ARM optimizations */
+#ifdef SBC_BUILD_WITH_NEON_SUPPORT
+	sbc_init_primitives_neon(state, impl);
+#endif
+
+	if (impl != SBC_IMPL_AUTO && state->implementation != impl)
+		return -1;
+
+	return 0;
+}
+
+void sbc_init_primitives_decoder(struct sbc_decoder_state *state, int impl)
+{
+	/* Default implementation for synthesis functions */
+	state->sbc_synthesize_4b_4s = sbc_synthesize_4b_4s_simd;
+	state->sbc_synthesize_4b_8s = sbc_synthesize_4b_8s_simd;
+	state->implementation_info = "Generic C";
+
+	if (impl == SBC_IMPL_GENERIC)
+		return;
+
+	/* X86/AMD64 optimizations */
+#ifdef SBC_BUILD_WITH_SSE_SUPPORT
+	sbc_init_primitives_sse_decoder(state, impl);
 #endif
 
 	/* ARM optimizations */
 #ifdef SBC_BUILD_WITH_NEON_SUPPORT
-	sbc_init_primitives_neon(state);
+	sbc_init_primitives_neon_decoder(state, impl);
 #endif
 }
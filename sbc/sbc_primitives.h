@@ -28,6 +28,7 @@
 
 #define SCALE_OUT_BITS 15
 #define SBC_X_BUFFER_SIZE 328
+#define SBC_V_BUFFER_SIZE 512
 
 #ifdef __GNUC__
 #define SBC_ALWAYS_INLINE __attribute__((always_inline))
@@ -58,18 +59,51 @@ struct sbc_encoder_state {
 	int (*sbc_enc_process_input_8s_be)(int position,
 			const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
 			int nsamples, int nchannels);
+	/* Same for the 32-bit input formats (S24, S32 and float), which
+	 * are converted to 16 bit on the fly */
+	int (*sbc_enc_process_input_4s_fmt)(int position,
+			const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
+			int nsamples, int nchannels, int format, int big_endian);
+	int (*sbc_enc_process_input_8s_fmt)(int position,
+			const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
+			int nsamples, int nchannels, int format, int big_endian);
 	/* Scale factors calculation */
 	void (*sbc_calc_scalefactors)(int32_t sb_sample_f[16][2][8],
 			uint32_t scale_factor[2][8],
 			int blocks, int channels, int subbands);
+	/* Scale factors calculation with joint stereo decision, returns
+	 * the joint stereo bitmask as stored in the frame header */
+	int (*sbc_calc_scalefactors_j)(int32_t sb_sample_f[16][2][8],
+			uint32_t scale_factor[2][8],
+			int blocks, int subbands);
+	/* SBC_IMPL_* identifier and name of the selected implementation */
+	int implementation;
+	const char *implementation_info;
+};
+
+struct sbc_decoder_state {
+	int subbands;
+	int position;
+	int32_t SBC_ALIGNED V[2][SBC_V_BUFFER_SIZE];
+	/* Polyphase synthesis filter for 4 subbands configuration,
+	 * it handles 4 blocks at once */
+	void (*sbc_synthesize_4b_4s)(const int32_t *in, int in_stride,
+			int32_t *v, int16_t *out);
+	/* Polyphase synthesis filter for 8 subbands configuration,
+	 * it handles 4 blocks at once */
+	void (*sbc_synthesize_4b_8s)(const int32_t *in, int in_stride,
+			int32_t *v, int16_t *out);
 	const char *implementation_info;
 };
 
 /*
  * Initialize pointers to the functions which are the basic "building bricks"
- * of SBC codec. Best implementation is selected based on target CPU
- * capabilities.
+ * of SBC codec. With SBC_IMPL_AUTO the best implementation is selected based
+ * on target CPU capabilities, otherwise the requested one is used and -1 is
+ * returned if it is not built in or not supported by the CPU.
  */
-void sbc_init_primitives(struct sbc_encoder_state *encoder_state);
+int sbc_init_primitives(struct sbc_encoder_state *encoder_state, int impl);
+void sbc_init_primitives_decoder(struct sbc_decoder_state *decoder_state,
+								int impl);
 
 #endif
@@ -275,6 +275,100 @@ static inline void sbc_analyze_4b_8s_mmx(int16_t *x, int32_t *out,
 	asm volatile ("emms\n");
 }
 
+/*
+ * Replaces each 32-bit lane of 'v' with (abs(v) - 1), or zero for
+ * zero lanes, and ORs the result into 'acc'. Clobbers 't', expects
+ * mm7 to be zero.
+ */
+#define SBC_MMX_ABSM1_OR(v, t, acc) \
+		"movq         " v ", " t "\n" \
+		"pcmpgtd   %%mm7, " t "\n" \
+		"paddd        " t ", " v "\n" \
+		"movq         " v ", " t "\n" \
+		"psrad        $31, " t "\n" \
+		"pxor         " t ", " v "\n" \
+		"por          " v ", " acc "\n"
+
+static int sbc_calc_scalefactors_j_mmx(
+	int32_t sb_sample_f[16][2][8],
+	uint32_t scale_factor[2][8],
+	int blocks, int subbands)
+{
+	/* bitwise OR of abs(sample) - 1 for the left, right, mid and side
+	 * signals of every subband */
+	uint32_t SBC_ALIGNED acc[4][8];
+	int blk, sb, joint = 0;
+	intptr_t offs;
+
+	for (sb = 0; sb < subbands; sb += 2) {
+		offs = (blocks - 1) * sizeof(sb_sample_f[0]);
+		asm volatile (
+			"pxor         %%mm0, %%mm0\n"
+			"pxor         %%mm1, %%mm1\n"
+			"pxor         %%mm2, %%mm2\n"
+			"pxor         %%mm3, %%mm3\n"
+			"pxor         %%mm7, %%mm7\n"
+			"1:\n"
+			"movq     (%1, %0), %%mm4\n"
+			"movq   32(%1, %0), %%mm5\n"
+			SBC_MMX_ABSM1_OR("%%mm4", "%%mm6", "%%mm0")
+			SBC_MMX_ABSM1_OR("%%mm5", "%%mm6", "%%mm1")
+			"movq     (%1, %0), %%mm4\n"
+			"movq   32(%1, %0), %%mm5\n"
+			"psrad          $1, %%mm4\n"
+			"psrad          $1, %%mm5\n"
+			"movq         %%mm4, %%mm6\n"
+			"paddd        %%mm5, %%mm4\n"
+			"psubd        %%mm5, %%mm6\n"
+			SBC_MMX_ABSM1_OR("%%mm4", "%%mm5", "%%mm2")
+			SBC_MMX_ABSM1_OR("%%mm6", "%%mm5", "%%mm3")
+			"sub            %3, %0\n"
+			"jns            1b\n"
+			"movq         %%mm0, (%2)\n"
+			"movq         %%mm1, 32(%2)\n"
+			"movq         %%mm2, 64(%2)\n"
+			"movq         %%mm3, 96(%2)\n"
+			: "+r" (offs)
+			: "r" (&sb_sample_f[0][0][sb]), "r" (&acc[0][sb]),
+				"i" (sizeof(sb_sample_f[0]))
+			: "cc", "memory");
+	}
+
+	asm volatile ("emms\n");
+
+	for (sb = 0; sb < subbands; sb++) {
+		uint32_t x, y, m, s;
+
+		x = acc[0][sb] | (1 << SCALE_OUT_BITS);
+		y = acc[1][sb] | (1 << SCALE_OUT_BITS);
+		m = acc[2][sb] | (1 << SCALE_OUT_BITS);
+		s = acc[3][sb] | (1 << SCALE_OUT_BITS);
+		x = (31 - SCALE_OUT_BITS) - __builtin_clz(x);
+		y = (31 - SCALE_OUT_BITS) - __builtin_clz(y);
+		m = (31 - SCALE_OUT_BITS) - __builtin_clz(m);
+		s = (31 - SCALE_OUT_BITS) - __builtin_clz(s);
+
+		/* the last subband does not use joint stereo */
+		if (sb == subbands - 1 || x + y <= m + s) {
+			scale_factor[0][sb] = x;
+			scale_factor[1][sb] = y;
+			continue;
+		}
+
+		joint |= 1 << (subbands - 1 - sb);
+		scale_factor[0][sb] = m;
+		scale_factor[1][sb] = s;
+		for (blk = 0; blk < blocks; blk++) {
+			int32_t l = ASR(sb_sample_f[blk][0][sb], 1);
+			int32_t r = ASR(sb_sample_f[blk][1][sb], 1);
+			sb_sample_f[blk][0][sb] = l + r;
+			sb_sample_f[blk][1][sb] = l - r;
+		}
+	}
+
+	return joint;
+}
+
 static int check_mmx_support(void)
 {
 #ifdef __amd64__
@@ -308,11 +402,16 @@ static int check_mmx_support(void)
 #endif
 }
 
-void sbc_init_primitives_mmx(struct sbc_encoder_state *state)
+void sbc_init_primitives_mmx(struct sbc_encoder_state *state, int impl)
 {
+	if (impl != SBC_IMPL_AUTO && impl != SBC_IMPL_MMX)
+		return;
+
 	if (check_mmx_support()) {
 		state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_mmx;
 		state->sbc_analyze_4b_8s = sbc_analyze_4b_8s_mmx;
+		state->sbc_calc_scalefactors_j = sbc_calc_scalefactors_j_mmx;
+		state->implementation = SBC_IMPL_MMX;
 		state->implementation_info = "MMX";
 	}
 }
@@ -33,7 +33,8 @@
 
 #define SBC_BUILD_WITH_MMX_SUPPORT
 
-void sbc_init_primitives_mmx(struct sbc_encoder_state *encoder_state);
+void sbc_init_primitives_mmx(struct sbc_encoder_state *encoder_state,
+								int impl);
 
 #endif
 
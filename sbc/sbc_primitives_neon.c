@@ -236,10 +236,333 @@ static inline void sbc_analyze_4b_8s_neon(int16_t *x,
 	_sbc_analyze_eight_neon(x + 0, out, analysis_consts_fixed8_simd_even);
 }
 
-void sbc_init_primitives_neon(struct sbc_encoder_state *state)
+static inline void sbc_synthesize_four_neon(const int32_t *in, int32_t *v,
+							int16_t *out)
 {
+	const int32_t *matrix = synthesis_matrix4_simd[0];
+	const int32_t *proto = synthesis_proto4_simd[0];
+
+	asm volatile (
+		"vld1.32    {d0, d1}, [%0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vmul.i32   q8, q2, d0[0]\n"
+		"vmul.i32   q9, q3, d0[0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d0[1]\n"
+		"vmla.i32   q9, q3, d0[1]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d1[0]\n"
+		"vmla.i32   q9, q3, d1[0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d1[1]\n"
+		"vmla.i32   q9, q3, d1[1]\n"
+		"vshr.s32   q8, q8, %6\n"
+		"vshr.s32   q9, q9, %6\n"
+		"vst1.32    {d16, d17, d18, d19}, [%1, :128]\n"
+		"\n"
+		"vld1.32    {d4, d5}, [%1, :128], %5\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmul.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128]!\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128], %5\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128]!\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128], %5\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128]!\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128], %5\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128]!\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128], %5\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vld1.32    {d4, d5}, [%1, :128]!\n"
+		"vld1.32    {d6, d7}, [%3, :128]!\n"
+		"vmla.i32   q10, q2, q3\n"
+		"vqshrn.s32 d20, q10, %6\n"
+		"vst1.16    {d20}, [%4]\n"
+		: "+r" (in), "+r" (v), "+r" (matrix), "+r" (proto)
+		: "r" (out), "r" (48), "i" (SCALE4_STAGED1_BITS)
+		: "memory",
+			"d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+			"d16", "d17", "d18", "d19", "d20", "d21");
+}
+
+static inline void sbc_synthesize_eight_neon(const int32_t *in, int32_t *v,
+							int16_t *out)
+{
+	const int32_t *matrix = synthesis_matrix8_simd[0];
+	const int32_t *proto = synthesis_proto8_simd[0];
+
+	asm volatile (
+		"vld1.32    {d0, d1, d2, d3}, [%0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmul.i32   q8, q2, d0[0]\n"
+		"vmul.i32   q9, q3, d0[0]\n"
+		"vmul.i32   q10, q4, d0[0]\n"
+		"vmul.i32   q11, q5, d0[0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d0[1]\n"
+		"vmla.i32   q9, q3, d0[1]\n"
+		"vmla.i32   q10, q4, d0[1]\n"
+		"vmla.i32   q11, q5, d0[1]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d1[0]\n"
+		"vmla.i32   q9, q3, d1[0]\n"
+		"vmla.i32   q10, q4, d1[0]\n"
+		"vmla.i32   q11, q5, d1[0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d1[1]\n"
+		"vmla.i32   q9, q3, d1[1]\n"
+		"vmla.i32   q10, q4, d1[1]\n"
+		"vmla.i32   q11, q5, d1[1]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d2[0]\n"
+		"vmla.i32   q9, q3, d2[0]\n"
+		"vmla.i32   q10, q4, d2[0]\n"
+		"vmla.i32   q11, q5, d2[0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d2[1]\n"
+		"vmla.i32   q9, q3, d2[1]\n"
+		"vmla.i32   q10, q4, d2[1]\n"
+		"vmla.i32   q11, q5, d2[1]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d3[0]\n"
+		"vmla.i32   q9, q3, d3[0]\n"
+		"vmla.i32   q10, q4, d3[0]\n"
+		"vmla.i32   q11, q5, d3[0]\n"
+		"vld1.32    {d4, d5, d6, d7}, [%2, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%2, :128]!\n"
+		"vmla.i32   q8, q2, d3[1]\n"
+		"vmla.i32   q9, q3, d3[1]\n"
+		"vmla.i32   q10, q4, d3[1]\n"
+		"vmla.i32   q11, q5, d3[1]\n"
+		"vshr.s32   q8, q8, %6\n"
+		"vshr.s32   q9, q9, %6\n"
+		"vshr.s32   q10, q10, %6\n"
+		"vshr.s32   q11, q11, %6\n"
+		"vst1.32    {d16, d17, d18, d19}, [%1, :128]!\n"
+		"vst1.32    {d20, d21, d22, d23}, [%1, :128]\n"
+		"sub        %1, %1, #32\n"
+		"\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128], %5\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmul.i32   q12, q2, q4\n"
+		"vmul.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128], %5\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128], %5\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128], %5\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128], %5\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vld1.32    {d4, d5, d6, d7}, [%1, :128]!\n"
+		"vld1.32    {d8, d9, d10, d11}, [%3, :128]!\n"
+		"vmla.i32   q12, q2, q4\n"
+		"vmla.i32   q13, q3, q5\n"
+		"vqshrn.s32 d24, q12, %6\n"
+		"vqshrn.s32 d25, q13, %6\n"
+		"vst1.16    {d24, d25}, [%4]\n"
+		: "+r" (in), "+r" (v), "+r" (matrix), "+r" (proto)
+		: "r" (out), "r" (96), "i" (SCALE8_STAGED1_BITS)
+		: "memory",
+			"d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+			"d8", "d9", "d10", "d11",
+			"d16", "d17", "d18", "d19", "d20", "d21", "d22", "d23",
+			"d24", "d25", "d26", "d27");
+}
+
+static inline void sbc_synthesize_4b_4s_neon(const int32_t *in,
+					int in_stride, int32_t *v, int16_t *out)
+{
+	/* Synthesize blocks, the oldest one first */
+	sbc_synthesize_four_neon(in, v + 24, out);
+	in += in_stride;
+	sbc_synthesize_four_neon(in, v + 16, out + 4);
+	in += in_stride;
+	sbc_synthesize_four_neon(in, v + 8, out + 8);
+	in += in_stride;
+	sbc_synthesize_four_neon(in, v + 0, out + 12);
+}
+
+static inline void sbc_synthesize_4b_8s_neon(const int32_t *in,
+					int in_stride, int32_t *v, int16_t *out)
+{
+	/* Synthesize blocks, the oldest one first */
+	sbc_synthesize_eight_neon(in, v + 48, out);
+	in += in_stride;
+	sbc_synthesize_eight_neon(in, v + 32, out + 8);
+	in += in_stride;
+	sbc_synthesize_eight_neon(in, v + 16, out + 16);
+	in += in_stride;
+	sbc_synthesize_eight_neon(in, v + 0, out + 24);
+}
+
+static int sbc_calc_scalefactors_j_neon(
+	int32_t sb_sample_f[16][2][8],
+	uint32_t scale_factor[2][8],
+	int blocks, int subbands)
+{
+	/* scale factors of the left, right, mid and side signals */
+	uint32_t SBC_ALIGNED sf[4][8];
+	int blk, sb, joint = 0;
+
+	for (sb = 0; sb < subbands; sb += 4) {
+		int32_t *in = &sb_sample_f[0][0][sb];
+		uint32_t *out = &sf[0][sb];
+		int n = blocks;
+
+		asm volatile (
+			"vmov.i32   q8, #0\n"
+			"vmov.i32   q9, #0\n"
+			"vmov.i32   q10, #0\n"
+			"vmov.i32   q11, #0\n"
+			"1:\n"
+			"vld1.32    {d0, d1}, [%0, :128], %3\n"
+			"vld1.32    {d2, d3}, [%0, :128], %3\n"
+			"vshr.s32   q2, q0, #1\n"
+			"vshr.s32   q3, q1, #1\n"
+			"vadd.i32   q4, q2, q3\n"
+			"vsub.i32   q5, q2, q3\n"
+			/* abs(x) - 1 for nonzero lanes, zero otherwise */
+			"vcgt.s32   q12, q0, #0\n"
+			"vcgt.s32   q13, q1, #0\n"
+			"vcgt.s32   q14, q4, #0\n"
+			"vcgt.s32   q15, q5, #0\n"
+			"vadd.i32   q0, q0, q12\n"
+			"vadd.i32   q1, q1, q13\n"
+			"vadd.i32   q4, q4, q14\n"
+			"vadd.i32   q5, q5, q15\n"
+			"vshr.s32   q12, q0, #31\n"
+			"vshr.s32   q13, q1, #31\n"
+			"vshr.s32   q14, q4, #31\n"
+			"vshr.s32   q15, q5, #31\n"
+			"veor       q0, q0, q12\n"
+			"veor       q1, q1, q13\n"
+			"veor       q4, q4, q14\n"
+			"veor       q5, q5, q15\n"
+			"vorr       q8, q8, q0\n"
+			"vorr       q9, q9, q1\n"
+			"vorr       q10, q10, q4\n"
+			"vorr       q11, q11, q5\n"
+			"subs       %1, %1, #1\n"
+			"bgt        1b\n"
+			/* scale factor = (31 - SCALE_OUT_BITS) - clz(x) */
+			"vmov.i32   q12, %4\n"
+			"vmov.i32   q13, %5\n"
+			"vorr       q8, q8, q12\n"
+			"vorr       q9, q9, q12\n"
+			"vorr       q10, q10, q12\n"
+			"vorr       q11, q11, q12\n"
+			"vclz.i32   q8, q8\n"
+			"vclz.i32   q9, q9\n"
+			"vclz.i32   q10, q10\n"
+			"vclz.i32   q11, q11\n"
+			"vsub.i32   q8, q13, q8\n"
+			"vsub.i32   q9, q13, q9\n"
+			"vsub.i32   q10, q13, q10\n"
+			"vsub.i32   q11, q13, q11\n"
+			"vst1.32    {d16, d17}, [%2, :128], %3\n"
+			"vst1.32    {d18, d19}, [%2, :128], %3\n"
+			"vst1.32    {d20, d21}, [%2, :128], %3\n"
+			"vst1.32    {d22, d23}, [%2, :128], %3\n"
+			: "+r" (in), "+r" (n), "+r" (out)
+			: "r" (32), "i" (1 << SCALE_OUT_BITS),
+				"i" (31 - SCALE_OUT_BITS)
+			: "cc", "memory",
+				"d0", "d1", "d2", "d3", "d4", "d5",
+				"d6", "d7", "d8", "d9", "d10", "d11",
+				"d16", "d17", "d18", "d19", "d20", "d21",
+				"d22", "d23", "d24", "d25", "d26", "d27",
+				"d28", "d29", "d30", "d31");
+	}
+
+	for (sb = 0; sb < subbands; sb++) {
+		/* the last subband does not use joint stereo */
+		if (sb == subbands - 1 || sf[0][sb] + sf[1][sb] <=
+						sf[2][sb] + sf[3][sb]) {
+			scale_factor[0][sb] = sf[0][sb];
+			scale_factor[1][sb] = sf[1][sb];
+			continue;
+		}
+
+		joint |= 1 << (subbands - 1 - sb);
+		scale_factor[0][sb] = sf[2][sb];
+		scale_factor[1][sb] = sf[3][sb];
+		for (blk = 0; blk < blocks; blk++) {
+			int32_t l = ASR(sb_sample_f[blk][0][sb], 1);
+			int32_t r = ASR(sb_sample_f[blk][1][sb], 1);
+			sb_sample_f[blk][0][sb] = l + r;
+			sb_sample_f[blk][1][sb] = l - r;
+		}
+	}
+
+	return joint;
+}
+
+void sbc_init_primitives_neon(struct sbc_encoder_state *state, int impl)
+{
+	if (impl != SBC_IMPL_AUTO && impl != SBC_IMPL_NEON)
+		return;
+
 	state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_neon;
 	state->sbc_analyze_4b_8s = sbc_analyze_4b_8s_neon;
+	state->sbc_calc_scalefactors_j = sbc_calc_scalefactors_j_neon;
+	state->implementation = SBC_IMPL_NEON;
+	state->implementation_info = "NEON";
+}
+
+void sbc_init_primitives_neon_decoder(struct sbc_decoder_state *state,
+								int impl)
+{
+	if (impl != SBC_IMPL_AUTO && impl != SBC_IMPL_NEON)
+		return;
+
+	state->sbc_synthesize_4b_4s = sbc_synthesize_4b_4s_neon;
+	state->sbc_synthesize_4b_8s = sbc_synthesize_4b_8s_neon;
 	state->implementation_info = "NEON";
 }
 
@@ -33,7 +33,10 @@
 
 #define SBC_BUILD_WITH_NEON_SUPPORT
 
-void sbc_init_primitives_neon(struct sbc_encoder_state *encoder_state);
+void sbc_init_primitives_neon(struct sbc_encoder_state *encoder_state,
+								int impl);
+void sbc_init_primitives_neon_decoder(struct sbc_decoder_state *decoder_state,
+								int impl);
 
 #endif
 
@@ -0,0 +1,847 @@
+/*
+ *
+ *  Bluetooth low-complexity, subband codec (SBC) library
+ *
+ *  Copyright (C) 2004-2009  Marcel Holtmann <marcel@holtmann.org>
+ *  Copyright (C) 2004-2005  Henryk Ploetz <henryk@ploetzli.ch>
+ *  Copyright (C) 2005-2006  Brad Midgley <bmidgley@xmission.com>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include "sbc.h"
+#include "sbc_math.h"
+#include "sbc_tables.h"
+
+#include "sbc_primitives_sse.h"
+
+/*
+ * SSE2 and AVX2 optimizations
+ */
+
+#ifdef SBC_BUILD_WITH_SSE_SUPPORT
+
+/* XMM registers may only be declared as clobbered when the compiler
+ * itself is allowed to use them (not the case for plain i386 builds) */
+#ifdef __SSE__
+#define SBC_XMM_CLOBBERS "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+				"xmm4", "xmm5", "xmm6", "xmm7"
+#else
+#define SBC_XMM_CLOBBERS "memory"
+#endif
+
+static inline void sbc_analyze_four_sse2(const int16_t *in, int32_t *out,
+					const FIXED_T *consts)
+{
+	static const SBC_ALIGNED int32_t round_c[4] = {
+		1 << (SBC_PROTO_FIXED4_SCALE - 1),
+		1 << (SBC_PROTO_FIXED4_SCALE - 1),
+		1 << (SBC_PROTO_FIXED4_SCALE - 1),
+		1 << (SBC_PROTO_FIXED4_SCALE - 1),
+	};
+	asm volatile (
+		"movdqu      (%0), %%xmm0\n"
+		"movdqu    16(%0), %%xmm1\n"
+		"pmaddwd     (%1), %%xmm0\n"
+		"pmaddwd   16(%1), %%xmm1\n"
+		"paddd       (%2), %%xmm0\n"
+		"\n"
+		"movdqu    32(%0), %%xmm2\n"
+		"movdqu    48(%0), %%xmm3\n"
+		"pmaddwd   32(%1), %%xmm2\n"
+		"pmaddwd   48(%1), %%xmm3\n"
+		"paddd     %%xmm2, %%xmm0\n"
+		"paddd     %%xmm3, %%xmm1\n"
+		"\n"
+		"movdqu    64(%0), %%xmm2\n"
+		"pmaddwd   64(%1), %%xmm2\n"
+		"paddd     %%xmm2, %%xmm0\n"
+		"paddd     %%xmm1, %%xmm0\n"
+		"\n"
+		"psrad         %4, %%xmm0\n"
+		"packssdw  %%xmm0, %%xmm0\n"
+		"\n"
+		"pshufd $0x00, %%xmm0, %%xmm1\n"
+		"pshufd $0x55, %%xmm0, %%xmm2\n"
+		"pmaddwd   80(%1), %%xmm1\n"
+		"pmaddwd   96(%1), %%xmm2\n"
+		"paddd     %%xmm2, %%xmm1\n"
+		"\n"
+		"movdqu    %%xmm1, (%3)\n"
+		:
+		: "r" (in), "r" (consts), "r" (&round_c), "r" (out),
+			"i" (SBC_PROTO_FIXED4_SCALE)
+		: SBC_XMM_CLOBBERS);
+}
+
+static inline void sbc_analyze_eight_sse2(const int16_t *in, int32_t *out,
+							const FIXED_T *consts)
+{
+	static const SBC_ALIGNED int32_t round_c[4] = {
+		1 << (SBC_PROTO_FIXED8_SCALE - 1),
+		1 << (SBC_PROTO_FIXED8_SCALE - 1),
+		1 << (SBC_PROTO_FIXED8_SCALE - 1),
+		1 << (SBC_PROTO_FIXED8_SCALE - 1),
+	};
+	asm volatile (
+		"movdqu      (%0), %%xmm0\n"
+		"movdqu    16(%0), %%xmm1\n"
+		"pmaddwd     (%1), %%xmm0\n"
+		"pmaddwd   16(%1), %%xmm1\n"
+		"paddd       (%2), %%xmm0\n"
+		"paddd       (%2), %%xmm1\n"
+		"\n"
+		"movdqu    32(%0), %%xmm2\n"
+		"movdqu    48(%0), %%xmm3\n"
+		"movdqu    64(%0), %%xmm4\n"
+		"movdqu    80(%0), %%xmm5\n"
+		"pmaddwd   32(%1), %%xmm2\n"
+		"pmaddwd   48(%1), %%xmm3\n"
+		"pmaddwd   64(%1), %%xmm4\n"
+		"pmaddwd   80(%1), %%xmm5\n"
+		"paddd     %%xmm2, %%xmm0\n"
+		"paddd     %%xmm3, %%xmm1\n"
+		"paddd     %%xmm4, %%xmm0\n"
+		"paddd     %%xmm5, %%xmm1\n"
+		"\n"
+		"movdqu    96(%0), %%xmm2\n"
+		"movdqu   112(%0), %%xmm3\n"
+		"movdqu   128(%0), %%xmm4\n"
+		"movdqu   144(%0), %%xmm5\n"
+		"pmaddwd   96(%1), %%xmm2\n"
+		"pmaddwd  112(%1), %%xmm3\n"
+		"pmaddwd  128(%1), %%xmm4\n"
+		"pmaddwd  144(%1), %%xmm5\n"
+		"paddd     %%xmm2, %%xmm0\n"
+		"paddd     %%xmm3, %%xmm1\n"
+		"paddd     %%xmm4, %%xmm0\n"
+		"paddd     %%xmm5, %%xmm1\n"
+		"\n"
+		"psrad         %4, %%xmm0\n"
+		"psrad         %4, %%xmm1\n"
+		"packssdw  %%xmm1, %%xmm0\n"
+		"\n"
+		"pshufd $0x00, %%xmm0, %%xmm2\n"
+		"pshufd $0x55, %%xmm0, %%xmm4\n"
+		"movdqa    %%xmm2, %%xmm3\n"
+		"movdqa    %%xmm4, %%xmm5\n"
+		"pmaddwd  160(%1), %%xmm2\n"
+		"pmaddwd  176(%1), %%xmm3\n"
+		"pmaddwd  192(%1), %%xmm4\n"
+		"pmaddwd  208(%1), %%xmm5\n"
+		"paddd     %%xmm4, %%xmm2\n"
+		"paddd     %%xmm5, %%xmm3\n"
+		"\n"
+		"pshufd $0xaa, %%xmm0, %%xmm4\n"
+		"pshufd $0xff, %%xmm0, %%xmm6\n"
+		"movdqa    %%xmm4, %%xmm5\n"
+		"movdqa    %%xmm6, %%xmm7\n"
+		"pmaddwd  224(%1), %%xmm4\n"
+		"pmaddwd  240(%1), %%xmm5\n"
+		"pmaddwd  256(%1), %%xmm6\n"
+		"pmaddwd  272(%1), %%xmm7\n"
+		"paddd     %%xmm4, %%xmm2\n"
+		"paddd     %%xmm5, %%xmm3\n"
+		"paddd     %%xmm6, %%xmm2\n"
+		"paddd     %%xmm7, %%xmm3\n"
+		"\n"
+		"movdqu    %%xmm2, (%3)\n"
+		"movdqu    %%xmm3, 16(%3)\n"
+		:
+		: "r" (in), "r" (consts), "r" (&round_c), "r" (out),
+			"i" (SBC_PROTO_FIXED8_SCALE)
+		: SBC_XMM_CLOBBERS);
+}
+
+static inline void sbc_analyze_4b_4s_sse2(int16_t *x, int32_t *out,
+						int out_stride)
+{
+	/* Analyze blocks */
+	sbc_analyze_four_sse2(x + 12, out, analysis_consts_fixed4_simd_odd);
+	out += out_stride;
+	sbc_analyze_four_sse2(x + 8, out, analysis_consts_fixed4_simd_even);
+	out += out_stride;
+	sbc_analyze_four_sse2(x + 4, out, analysis_consts_fixed4_simd_odd);
+	out += out_stride;
+	sbc_analyze_four_sse2(x + 0, out, analysis_consts_fixed4_simd_even);
+}
+
+static inline void sbc_analyze_4b_8s_sse2(int16_t *x, int32_t *out,
+						int out_stride)
+{
+	/* Analyze blocks */
+	sbc_analyze_eight_sse2(x + 24, out, analysis_consts_fixed8_simd_odd);
+	out += out_stride;
+	sbc_analyze_eight_sse2(x + 16, out, analysis_consts_fixed8_simd_even);
+	out += out_stride;
+	sbc_analyze_eight_sse2(x + 8, out, analysis_consts_fixed8_simd_odd);
+	out += out_stride;
+	sbc_analyze_eight_sse2(x + 0, out, analysis_consts_fixed8_simd_even);
+}
+
+/*
+ * Two blocks sharing the same constants table are handled at once, one
+ * in each 128-bit lane. The second block starts 8 samples below the first
+ * one and its result goes to 'out2'.
+ */
+static inline void sbc_analyze_four_avx2(const int16_t *in, int32_t *out,
+					int32_t *out2, const FIXED_T *consts)
+{
+	static const int32_t round_c = 1 << (SBC_PROTO_FIXED4_SCALE - 1);
+	asm volatile (
+		"vbroadcasti128   (%1), %%ymm4\n"
+		"vbroadcasti128 16(%1), %%ymm5\n"
+		"vmovdqu          (%0), %%xmm0\n"
+		"vmovdqu        16(%0), %%xmm1\n"
+		"vinserti128 $1, -16(%0), %%ymm0, %%ymm0\n"
+		"vinserti128 $1,   (%0), %%ymm1, %%ymm1\n"
+		"vpmaddwd  %%ymm4, %%ymm0, %%ymm0\n"
+		"vpmaddwd  %%ymm5, %%ymm1, %%ymm1\n"
+		"vpbroadcastd (%2), %%ymm6\n"
+		"vpaddd    %%ymm6, %%ymm0, %%ymm0\n"
+		"\n"
+		"vbroadcasti128 32(%1), %%ymm4\n"
+		"vbroadcasti128 48(%1), %%ymm5\n"
+		"vmovdqu        32(%0), %%xmm2\n"
+		"vmovdqu        48(%0), %%xmm3\n"
+		"vinserti128 $1, 16(%0), %%ymm2, %%ymm2\n"
+		"vinserti128 $1, 32(%0), %%ymm3, %%ymm3\n"
+		"vpmaddwd  %%ymm4, %%ymm2, %%ymm2\n"
+		"vpmaddwd  %%ymm5, %%ymm3, %%ymm3\n"
+		"vpaddd    %%ymm2, %%ymm0, %%ymm0\n"
+		"vpaddd    %%ymm3, %%ymm1, %%ymm1\n"
+		"\n"
+		"vbroadcasti128 64(%1), %%ymm4\n"
+		"vmovdqu        64(%0), %%xmm2\n"
+		"vinserti128 $1, 48(%0), %%ymm2, %%ymm2\n"
+		"vpmaddwd  %%ymm4, %%ymm2, %%ymm2\n"
+		"vpaddd    %%ymm2, %%ymm0, %%ymm0\n"
+		"vpaddd    %%ymm1, %%ymm0, %%ymm0\n"
+		"\n"
+		"vpsrad        %5, %%ymm0, %%ymm0\n"
+		"vpackssdw %%ymm0, %%ymm0, %%ymm0\n"
+		"\n"
+		"vbroadcasti128 80(%1), %%ymm4\n"
+		"vbroadcasti128 96(%1), %%ymm5\n"
+		"vpshufd $0x00, %%ymm0, %%ymm1\n"
+		"vpshufd $0x55, %%ymm0, %%ymm2\n"
+		"vpmaddwd  %%ymm4, %%ymm1, %%ymm1\n"
+		"vpmaddwd  %%ymm5, %%ymm2, %%ymm2\n"
+		"vpaddd    %%ymm2, %%ymm1, %%ymm1\n"
+		"\n"
+		"vmovdqu   %%xmm1, (%3)\n"
+		"vextracti128 $1, %%ymm1, (%4)\n"
+		:
+		: "r" (in), "r" (consts), "r" (&round_c), "r" (out),
+			"r" (out2), "i" (SBC_PROTO_FIXED4_SCALE)
+		: SBC_XMM_CLOBBERS);
+}
+
+static inline void sbc_analyze_eight_avx2(const int16_t *in, int32_t *out,
+							const FIXED_T *consts)
+{
+	static const int32_t round_c = 1 << (SBC_PROTO_FIXED8_SCALE - 1);
+	asm volatile (
+		"vmovdqu      (%0), %%ymm0\n"
+		"vmovdqu    32(%0), %%ymm1\n"
+		"vmovdqu    64(%0), %%ymm2\n"
+		"vmovdqu    96(%0), %%ymm3\n"
+		"vmovdqu   128(%0), %%ymm4\n"
+		"vpmaddwd     (%1), %%ymm0, %%ymm0\n"
+		"vpmaddwd   32(%1), %%ymm1, %%ymm1\n"
+		"vpmaddwd   64(%1), %%ymm2, %%ymm2\n"
+		"vpmaddwd   96(%1), %%ymm3, %%ymm3\n"
+		"vpmaddwd  128(%1), %%ymm4, %%ymm4\n"
+		"vpbroadcastd (%2), %%ymm5\n"
+		"vpaddd     %%ymm1, %%ymm0, %%ymm0\n"
+		"vpaddd     %%ymm3, %%ymm2, %%ymm2\n"
+		"vpaddd     %%ymm5, %%ymm4, %%ymm4\n"
+		"vpaddd     %%ymm2, %%ymm0, %%ymm0\n"
+		"vpaddd     %%ymm4, %%ymm0, %%ymm0\n"
+		"\n"
+		"vpsrad         %4, %%ymm0, %%ymm0\n"
+		"vextracti128   $1, %%ymm0, %%xmm1\n"
+		"vpackssdw  %%xmm1, %%xmm0, %%xmm0\n"
+		"vinserti128    $1, %%xmm0, %%ymm0, %%ymm0\n"
+		"\n"
+		"vpshufd $0x00, %%ymm0, %%ymm1\n"
+		"vpshufd $0x55, %%ymm0, %%ymm2\n"
+		"vpshufd $0xaa, %%ymm0, %%ymm3\n"
+		"vpshufd $0xff, %%ymm0, %%ymm4\n"
+		"vpmaddwd  160(%1), %%ymm1, %%ymm1\n"
+		"vpmaddwd  192(%1), %%ymm2, %%ymm2\n"
+		"vpmaddwd  224(%1), %%ymm3, %%ymm3\n"
+		"vpmaddwd  256(%1), %%ymm4, %%ymm4\n"
+		"vpaddd     %%ymm2, %%ymm1, %%ymm1\n"
+		"vpaddd     %%ymm4, %%ymm3, %%ymm3\n"
+		"vpaddd     %%ymm3, %%ymm1, %%ymm1\n"
+		"\n"
+		"vmovdqu    %%ymm1, (%3)\n"
+		:
+		: "r" (in), "r" (consts), "r" (&round_c), "r" (out),
+			"i" (SBC_PROTO_FIXED8_SCALE)
+		: SBC_XMM_CLOBBERS);
+}
+
+static inline void sbc_analyze_4b_4s_avx2(int16_t *x, int32_t *out,
+						int out_stride)
+{
+	/* Analyze blocks (0, 2) and (1, 3) in pairs */
+	sbc_analyze_four_avx2(x + 12, out, out + 2 * out_stride,
+					analysis_consts_fixed4_simd_odd);
+	sbc_analyze_four_avx2(x + 8, out + out_stride, out + 3 * out_stride,
+					analysis_consts_fixed4_simd_even);
+
+	asm volatile ("vzeroupper\n");
+}
+
+static inline void sbc_analyze_4b_8s_avx2(int16_t *x, int32_t *out,
+						int out_stride)
+{
+	/* Analyze blocks */
+	sbc_analyze_eight_avx2(x + 24, out, analysis_consts_fixed8_simd_odd);
+	out += out_stride;
+	sbc_analyze_eight_avx2(x + 16, out, analysis_consts_fixed8_simd_even);
+	out += out_stride;
+	sbc_analyze_eight_avx2(x + 8, out, analysis_consts_fixed8_simd_odd);
+	out += out_stride;
+	sbc_analyze_eight_avx2(x + 0, out, analysis_consts_fixed8_simd_even);
+
+	asm volatile ("vzeroupper\n");
+}
+
+/*
+ * SSE2 has no instruction for 32-bit multiplication keeping the low half
+ * of the result, so it is emulated with a pair of PMULUDQ (which handle
+ * even and odd lanes) and shuffles. The low half of the product does not
+ * depend on the signedness of the operands, so the results are bit-exact
+ * with plain C int32_t arithmetic.
+ */
+
+/* acc += src * b, 'b' has the same value in all lanes */
+#define SBC_SSE2_MULB_ACC(src, b, acc)					\
+		"movdqa  " src ", %%xmm4\n"				\
+		"pshufd  $0xf5, %%xmm4, %%xmm5\n"			\
+		"pmuludq %%" b ", %%xmm4\n"				\
+		"pmuludq %%" b ", %%xmm5\n"				\
+		"pshufd  $0x08, %%xmm4, %%xmm4\n"			\
+		"pshufd  $0x08, %%xmm5, %%xmm5\n"			\
+		"punpckldq %%xmm5, %%xmm4\n"				\
+		"paddd   %%xmm4, %%" acc "\n"
+
+/* acc += src1 * src2 */
+#define SBC_SSE2_MUL_ACC(src1, src2, acc)				\
+		"movdqu  " src1 ", %%xmm4\n"				\
+		"movdqa  " src2 ", %%xmm5\n"				\
+		"pshufd  $0xf5, %%xmm4, %%xmm6\n"			\
+		"pshufd  $0xf5, %%xmm5, %%xmm7\n"			\
+		"pmuludq %%xmm5, %%xmm4\n"				\
+		"pmuludq %%xmm7, %%xmm6\n"				\
+		"pshufd  $0x08, %%xmm4, %%xmm4\n"			\
+		"pshufd  $0x08, %%xmm6, %%xmm6\n"			\
+		"punpckldq %%xmm6, %%xmm4\n"				\
+		"paddd   %%xmm4, %%" acc "\n"
+
+static inline void sbc_synthesize_four_sse2(const int32_t *in, int32_t *v,
+							int16_t *out)
+{
+	asm volatile (
+		/* matrixing */
+		"pxor      %%xmm0, %%xmm0\n"
+		"pxor      %%xmm1, %%xmm1\n"
+		"movd       0(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("0(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("16(%2)", "xmm6", "xmm1")
+		"movd       4(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("32(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("48(%2)", "xmm6", "xmm1")
+		"movd       8(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("64(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("80(%2)", "xmm6", "xmm1")
+		"movd      12(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("96(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("112(%2)", "xmm6", "xmm1")
+		"psrad        %5, %%xmm0\n"
+		"psrad        %5, %%xmm1\n"
+		"movdqu    %%xmm0, 0(%1)\n"
+		"movdqu    %%xmm1, 16(%1)\n"
+		"\n"
+		/* windowing */
+		"pxor      %%xmm0, %%xmm0\n"
+		SBC_SSE2_MUL_ACC("0(%1)", "0(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("48(%1)", "16(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("64(%1)", "32(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("112(%1)", "48(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("128(%1)", "64(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("176(%1)", "80(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("192(%1)", "96(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("240(%1)", "112(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("256(%1)", "128(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("304(%1)", "144(%3)", "xmm0")
+		"psrad        %5, %%xmm0\n"
+		"packssdw  %%xmm0, %%xmm0\n"
+		"movq      %%xmm0, (%4)\n"
+		:
+		: "r" (in), "r" (v), "r" (synthesis_matrix4_simd),
+			"r" (synthesis_proto4_simd), "r" (out),
+			"i" (SCALE4_STAGED1_BITS)
+		: SBC_XMM_CLOBBERS);
+}
+
+static inline void sbc_synthesize_eight_sse2(const int32_t *in, int32_t *v,
+							int16_t *out)
+{
+	asm volatile (
+		/* matrixing */
+		"pxor      %%xmm0, %%xmm0\n"
+		"pxor      %%xmm1, %%xmm1\n"
+		"pxor      %%xmm2, %%xmm2\n"
+		"pxor      %%xmm3, %%xmm3\n"
+		"movd       0(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("0(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("16(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("32(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("48(%2)", "xmm6", "xmm3")
+		"movd       4(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("64(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("80(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("96(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("112(%2)", "xmm6", "xmm3")
+		"movd       8(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("128(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("144(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("160(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("176(%2)", "xmm6", "xmm3")
+		"movd      12(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("192(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("208(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("224(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("240(%2)", "xmm6", "xmm3")
+		"movd      16(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("256(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("272(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("288(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("304(%2)", "xmm6", "xmm3")
+		"movd      20(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("320(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("336(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("352(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("368(%2)", "xmm6", "xmm3")
+		"movd      24(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("384(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("400(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("416(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("432(%2)", "xmm6", "xmm3")
+		"movd      28(%0), %%xmm6\n"
+		"pshufd $0x00, %%xmm6, %%xmm6\n"
+		SBC_SSE2_MULB_ACC("448(%2)", "xmm6", "xmm0")
+		SBC_SSE2_MULB_ACC("464(%2)", "xmm6", "xmm1")
+		SBC_SSE2_MULB_ACC("480(%2)", "xmm6", "xmm2")
+		SBC_SSE2_MULB_ACC("496(%2)", "xmm6", "xmm3")
+		"psrad        %5, %%xmm0\n"
+		"psrad        %5, %%xmm1\n"
+		"psrad        %5, %%xmm2\n"
+		"psrad        %5, %%xmm3\n"
+		"movdqu    %%xmm0, 0(%1)\n"
+		"movdqu    %%xmm1, 16(%1)\n"
+		"movdqu    %%xmm2, 32(%1)\n"
+		"movdqu    %%xmm3, 48(%1)\n"
+		"\n"
+		/* windowing */
+		"pxor      %%xmm0, %%xmm0\n"
+		"pxor      %%xmm1, %%xmm1\n"
+		SBC_SSE2_MUL_ACC("0(%1)", "0(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("16(%1)", "16(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("96(%1)", "32(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("112(%1)", "48(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("128(%1)", "64(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("144(%1)", "80(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("224(%1)", "96(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("240(%1)", "112(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("256(%1)", "128(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("272(%1)", "144(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("352(%1)", "160(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("368(%1)", "176(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("384(%1)", "192(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("400(%1)", "208(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("480(%1)", "224(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("496(%1)", "240(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("512(%1)", "256(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("528(%1)", "272(%3)", "xmm1")
+		SBC_SSE2_MUL_ACC("608(%1)", "288(%3)", "xmm0")
+		SBC_SSE2_MUL_ACC("624(%1)", "304(%3)", "xmm1")
+		"psrad        %5, %%xmm0\n"
+		"psrad        %5, %%xmm1\n"
+		"packssdw  %%xmm1, %%xmm0\n"
+		"movdqu    %%xmm0, (%4)\n"
+		:
+		: "r" (in), "r" (v), "r" (synthesis_matrix8_simd),
+			"r" (synthesis_proto8_simd), "r" (out),
+			"i" (SCALE8_STAGED1_BITS)
+		: SBC_XMM_CLOBBERS);
+}
+
+static inline void sbc_synthesize_4b_4s_sse2(const int32_t *in,
+					int in_stride, int32_t *v, int16_t *out)
+{
+	/* Synthesize blocks, the oldest one first */
+	sbc_synthesize_four_sse2(in, v + 24, out);
+	in += in_stride;
+	sbc_synthesize_four_sse2(in, v + 16, out + 4);
+	in += in_stride;
+	sbc_synthesize_four_sse2(in, v + 8, out + 8);
+	in += in_stride;
+	sbc_synthesize_four_sse2(in, v + 0, out + 12);
+}
+
+static inline void sbc_synthesize_4b_8s_sse2(const int32_t *in,
+					int in_stride, int32_t *v, int16_t *out)
+{
+	/* Synthesize blocks, the oldest one first */
+	sbc_synthesize_eight_sse2(in, v + 48, out);
+	in += in_stride;
+	sbc_synthesize_eight_sse2(in, v + 32, out + 8);
+	in += in_stride;
+	sbc_synthesize_eight_sse2(in, v + 16, out + 16);
+	in += in_stride;
+	sbc_synthesize_eight_sse2(in, v + 0, out + 24);
+}
+
+/*
+ * Replaces each 32-bit lane of 'v' with (abs(v) - 1), or zero for
+ * zero lanes, and ORs the result into 'acc'. Clobbers 't', expects
+ * xmm7 to be zero.
+ */
+#define SBC_SSE2_ABSM1_OR(v, t, acc)					\
+		"movdqa  %%" v ", %%" t "\n"				\
+		"pcmpgtd %%xmm7, %%" t "\n"				\
+		"paddd   %%" t ", %%" v "\n"				\
+		"movdqa  %%" v ", %%" t "\n"				\
+		"psrad   $31, %%" t "\n"					\
+		"pxor    %%" t ", %%" v "\n"				\
+		"por     %%" v ", %%" acc "\n"
+
+static int sbc_calc_scalefactors_j_sse2(
+	int32_t sb_sample_f[16][2][8],
+	uint32_t scale_factor[2][8],
+	int blocks, int subbands)
+{
+	/* bitwise OR of abs(sample) - 1 for the left, right, mid and side
+	 * signals of every subband */
+	uint32_t SBC_ALIGNED acc[4][8];
+	int blk, sb, joint = 0;
+	intptr_t offs;
+
+	for (sb = 0; sb < subbands; sb += 4) {
+		offs = (blocks - 1) * sizeof(sb_sample_f[0]);
+		asm volatile (
+			"pxor    %%xmm0, %%xmm0\n"
+			"pxor    %%xmm1, %%xmm1\n"
+			"pxor    %%xmm2, %%xmm2\n"
+			"pxor    %%xmm3, %%xmm3\n"
+			"pxor    %%xmm7, %%xmm7\n"
+			"1:\n"
+			"movdqa  (%1, %0), %%xmm4\n"
+			"movdqa  32(%1, %0), %%xmm5\n"
+			SBC_SSE2_ABSM1_OR("xmm4", "xmm6", "xmm0")
+			SBC_SSE2_ABSM1_OR("xmm5", "xmm6", "xmm1")
+			"movdqa  (%1, %0), %%xmm4\n"
+			"movdqa  32(%1, %0), %%xmm5\n"
+			"psrad   $1, %%xmm4\n"
+			"psrad   $1, %%xmm5\n"
+			"movdqa  %%xmm4, %%xmm6\n"
+			"paddd   %%xmm5, %%xmm4\n"
+			"psubd   %%xmm5, %%xmm6\n"
+			SBC_SSE2_ABSM1_OR("xmm4", "xmm5", "xmm2")
+			SBC_SSE2_ABSM1_OR("xmm6", "xmm5", "xmm3")
+			"sub     %3, %0\n"
+			"jns     1b\n"
+			"movdqa  %%xmm0, (%2)\n"
+			"movdqa  %%xmm1, 32(%2)\n"
+			"movdqa  %%xmm2, 64(%2)\n"
+			"movdqa  %%xmm3, 96(%2)\n"
+			: "+r" (offs)
+			: "r" (&sb_sample_f[0][0][sb]), "r" (&acc[0][sb]),
+				"i" (sizeof(sb_sample_f[0]))
+			: "cc", SBC_XMM_CLOBBERS);
+	}
+
+	for (sb = 0; sb < subbands; sb++) {
+		uint32_t x, y, m, s;
+
+		x = acc[0][sb] | (1 << SCALE_OUT_BITS);
+		y = acc[1][sb] | (1 << SCALE_OUT_BITS);
+		m = acc[2][sb] | (1 << SCALE_OUT_BITS);
+		s = acc[3][sb] | (1 << SCALE_OUT_BITS);
+		x = (31 - SCALE_OUT_BITS) - __builtin_clz(x);
+		y = (31 - SCALE_OUT_BITS) - __builtin_clz(y);
+		m = (31 - SCALE_OUT_BITS) - __builtin_clz(m);
+		s = (31 - SCALE_OUT_BITS) - __builtin_clz(s);
+
+		/* the last subband does not use joint stereo */
+		if (sb == subbands - 1 || x + y <= m + s) {
+			scale_factor[0][sb] = x;
+			scale_factor[1][sb] = y;
+			continue;
+		}
+
+		joint |= 1 << (subbands - 1 - sb);
+		scale_factor[0][sb] = m;
+		scale_factor[1][sb] = s;
+		for (blk = 0; blk < blocks; blk++) {
+			int32_t l = ASR(sb_sample_f[blk][0][sb], 1);
+			int32_t r = ASR(sb_sample_f[blk][1][sb], 1);
+			sb_sample_f[blk][0][sb] = l + r;
+			sb_sample_f[blk][1][sb] = l - r;
+		}
+	}
+
+	return joint;
+}
+
+static int check_cpuid_support(void)
+{
+#ifdef __amd64__
+	return 1; /* CPUID is always available on 64-bit processors */
+#else
+	int eflags_changed;
+	asm volatile (
+		/* According to Intel manual, CPUID instruction is supported
+		 * if the value of ID bit (bit 21) in EFLAGS can be modified */
+		"pushf\n"
+		"movl     (%%esp),   %0\n"
+		"xorl     $0x200000, (%%esp)\n" /* try to modify ID bit */
+		"popf\n"
+		"pushf\n"
+		"xorl     (%%esp),   %0\n"      /* check if ID bit changed */
+		"popf\n"
+		: "=r" (eflags_changed)
+		:
+		: "cc");
+	return eflags_changed & 0x200000;
+#endif
+}
+
+/* Reorders 16 consecutive samples of one channel (A holds samples 0..7,
+ * B holds samples 8..15) the same way as the generic input processing
+ * and stores them to 32 bytes at out, clobbers T1, T2, T3 and tmp */
+#define SBC_SSE2_PERMUTE_16(A, B, T1, T2, T3, out) \
+		"pshufd    $0xee, %%" B ", %%" T1 "\n" \
+		"pshuflw   $0x1b, %%" T1 ", %%" T1 "\n" \
+		"movdqa    %%" A ", %%" T2 "\n" \
+		"psrldq    $14, %%" T2 "\n" \
+		"movdqa    %%" B ", %%" T3 "\n" \
+		"pslldq    $2, %%" T3 "\n" \
+		"por       %%" T3 ", %%" T2 "\n" \
+		"punpcklwd %%" T2 ", %%" T1 "\n" \
+		"movdqu    %%" T1 ", " out "\n" \
+		"pshufhw   $0x1b, %%" A ", %%" T2 "\n" \
+		"pshufd    $0xee, %%" T2 ", %%" T2 "\n" \
+		"pextrw    $3, %%" B ", %k[tmp]\n" \
+		"pinsrw    $0, %k[tmp], %%" T2 "\n" \
+		"pshuflw   $0x93, %%" A ", %%" T3 "\n" \
+		"punpcklwd %%" T3 ", %%" T2 "\n" \
+		"movdqu    %%" T2 ", 16" out "\n"
+
+/* Splits 8 interleaved stereo samples into 4 left ones in the low and
+ * 4 right ones in the high half of the register */
+#define SBC_SSE2_DEINTERLEAVE(R) \
+		"pshuflw   $0xd8, %%" R ", %%" R "\n" \
+		"pshufhw   $0xd8, %%" R ", %%" R "\n" \
+		"pshufd    $0xd8, %%" R ", %%" R "\n"
+
+static int sbc_enc_process_input_8s_le_sse2(int position,
+		const uint8_t *pcm, int16_t X[2][SBC_X_BUFFER_SIZE],
+		int nsamples, int nchannels)
+{
+	intptr_t tmp;
+
+	/* handle X buffer wraparound */
+	if (position < nsamples) {
+		memcpy(&X[0][SBC_X_BUFFER_SIZE - 72], &X[0][position],
+							72 * sizeof(int16_t));
+		if (nchannels > 1)
+			memcpy(&X[1][SBC_X_BUFFER_SIZE - 72], &X[1][position],
+							72 * sizeof(int16_t));
+		position = SBC_X_BUFFER_SIZE - 72;
+	}
+
+	while ((nsamples -= 16) >= 0) {
+		position -= 16;
+		if (nchannels > 1) {
+			asm volatile (
+				"movdqu      (%[pcm]), %%xmm0\n"
+				"movdqu    16(%[pcm]), %%xmm1\n"
+				"movdqu    32(%[pcm]), %%xmm2\n"
+				"movdqu    48(%[pcm]), %%xmm3\n"
+				SBC_SSE2_DEINTERLEAVE("xmm0")
+				SBC_SSE2_DEINTERLEAVE("xmm1")
+				SBC_SSE2_DEINTERLEAVE("xmm2")
+				SBC_SSE2_DEINTERLEAVE("xmm3")
+				"movdqa    %%xmm0, %%xmm4\n"
+				"punpcklqdq %%xmm1, %%xmm0\n"
+				"punpckhqdq %%xmm1, %%xmm4\n"
+				"movdqa    %%xmm2, %%xmm5\n"
+				"punpcklqdq %%xmm3, %%xmm2\n"
+				"punpckhqdq %%xmm3, %%xmm5\n"
+				SBC_SSE2_PERMUTE_16("xmm0", "xmm2",
+					"xmm1", "xmm3", "xmm6", "(%[x0])")
+				SBC_SSE2_PERMUTE_16("xmm4", "xmm5",
+					"xmm1", "xmm3", "xmm6", "(%[x1])")
+				: [tmp] "=&r" (tmp)
+				: [pcm] "r" (pcm), [x0] "r" (&X[0][position]),
+					[x1] "r" (&X[1][position])
+				: SBC_XMM_CLOBBERS);
+			pcm += 64;
+		} else {
+			asm volatile (
+				"movdqu      (%[pcm]), %%xmm0\n"
+				"movdqu    16(%[pcm]), %%xmm2\n"
+				SBC_SSE2_PERMUTE_16("xmm0", "xmm2",
+					"xmm1", "xmm3", "xmm6", "(%[x0])")
+				: [tmp] "=&r" (tmp)
+				: [pcm] "r" (pcm), [x0] "r" (&X[0][position])
+				: SBC_XMM_CLOBBERS);
+			pcm += 32;
+		}
+	}
+
+	return position;
+}
+
+static void sbc_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef __amd64__
+	asm volatile (
+		"cpuid\n"
+		: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]),
+			"=d" (regs[3])
+		: "0" (leaf), "2" (subleaf));
+#else
+	/* %ebx may be reserved as PIC register, so preserve it */
+	asm volatile (
+		"xchgl    %%ebx,     %1\n"
+		"cpuid\n"
+		"xchgl    %%ebx,     %1\n"
+		: "=a" (regs[0]), "=&r" (regs[1]), "=c" (regs[2]),
+			"=d" (regs[3])
+		: "0" (leaf), "2" (subleaf));
+#endif
+}
+
+static int check_sse2_support(void)
+{
+#ifdef __amd64__
+	return 1; /* SSE2 is a part of the base AMD64 instruction set */
+#else
+	uint32_t regs[4];
+
+	if (!check_cpuid_support())
+		return 0;
+
+	sbc_cpuid(1, 0, regs);
+
+	return regs[3] & (1 << 26);
+#endif
+}
+
+static int check_avx2_support(void)
+{
+	uint32_t regs[4], xcr0, xcr0_hi;
+
+	if (!check_cpuid_support())
+		return 0;
+
+	sbc_cpuid(0, 0, regs);
+	if (regs[0] < 7)
+		return 0;
+
+	/* Both AVX and OSXSAVE bits need to be set */
+	sbc_cpuid(1, 0, regs);
+	if ((regs[2] & (3 << 27)) != (3 << 27))
+		return 0;
+
+	/* The OS has to save and restore both XMM and YMM registers */
+	asm volatile (
+		"xgetbv\n"
+		: "=a" (xcr0), "=d" (xcr0_hi)
+		: "c" (0));
+	if ((xcr0 & 6) != 6)
+		return 0;
+
+	sbc_cpuid(7, 0, regs);
+
+	return regs[1] & (1 << 5);
+}
+
+void sbc_init_primitives_sse(struct sbc_encoder_state *state, int impl)
+{
+	/* AVX2 only provides the analysis filters, the rest is SSE2 */
+	if (impl != SBC_IMPL_AUTO && impl != SBC_IMPL_SSE2 &&
+						impl != SBC_IMPL_AVX2)
+		return;
+
+	if (!check_sse2_support())
+		return;
+
+	state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_sse2;
+	state->sbc_analyze_4b_8s = sbc_analyze_4b_8s_sse2;
+	state->sbc_calc_scalefactors_j = sbc_calc_scalefactors_j_sse2;
+	state->sbc_enc_process_input_8s_le = sbc_enc_process_input_8s_le_sse2;
+	state->implementation = SBC_IMPL_SSE2;
+	state->implementation_info = "SSE2";
+
+	if (impl == SBC_IMPL_SSE2)
+		return;
+
+	if (check_avx2_support()) {
+		state->sbc_analyze_4b_4s = sbc_analyze_4b_4s_avx2;
+		state->sbc_analyze_4b_8s = sbc_analyze_4b_8s_avx2;
+		state->implementation = SBC_IMPL_AVX2;
+		state->implementation_info = "AVX2";
+	}
+}
+
+void sbc_init_primitives_sse_decoder(struct sbc_decoder_state *state,
+								int impl)
+{
+	if (impl != SBC_IMPL_AUTO && impl != SBC_IMPL_SSE2 &&
+						impl != SBC_IMPL_AVX2)
+		return;
+
+	if (check_sse2_support()) {
+		state->sbc_synthesize_4b_4s = sbc_synthesize_4b_4s_sse2;
+		state->sbc_synthesize_4b_8s = sbc_synthesize_4b_8s_sse2;
+		state->implementation_info = "SSE2";
+	}
+}
+
+#endif
@@ -0,0 +1,433 @@
+/*
+ *
+ *  Bluetooth low-complexity, subband codec (SBC) benchmark
+ *
+ *  Copyright (C) 2004-2009  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "sbc.h"
+
+/* One second of 48 kHz stereo input, reused cyclically */
+#define PCM_SAMPLES	48000
+#define PCM_SIZE	(PCM_SAMPLES * 2 * 2)
+
+#define MAX_FRAME_SIZE	1024
+
+static int16_t pcm[PCM_SAMPLES * 2];
+static unsigned char *stream;
+
+static const int bitpools[] = { 2, 19, 32, 53, 250 };
+
+static const struct {
+	const char *name;
+	int impl;
+} implementations[] = {
+	{ "generic",	SBC_IMPL_GENERIC	},
+	{ "mmx",	SBC_IMPL_MMX		},
+	{ "sse2",	SBC_IMPL_SSE2		},
+	{ "avx2",	SBC_IMPL_AVX2		},
+	{ "neon",	SBC_IMPL_NEON		},
+	{ NULL }
+};
+
+static const char *mode2str(int mode)
+{
+	switch (mode) {
+	case SBC_MODE_MONO:
+		return "mono";
+	case SBC_MODE_DUAL_CHANNEL:
+		return "dual";
+	case SBC_MODE_STEREO:
+		return "stereo";
+	case SBC_MODE_JOINT_STEREO:
+		return "joint";
+	default:
+		return "unknown";
+	}
+}
+
+/*
+ * Fills the input with a few sine waves per channel plus some noise,
+ * so that scale factors and the bit allocation vary over time
+ */
+static void synthesize_pcm(void)
+{
+	uint32_t seed = 1;
+	int i;
+
+	for (i = 0; i < PCM_SAMPLES; i++) {
+		double t = (double) i / 44100;
+		double l, r;
+
+		seed = seed * 1103515245 + 12345;
+
+		l = 8000 * sin(2 * M_PI * 440 * t) +
+			3000 * sin(2 * M_PI * 3520 * t) *
+					sin(2 * M_PI * 2 * t);
+		r = 6000 * sin(2 * M_PI * 660 * t + 1) +
+			2000 * sin(2 * M_PI * 9000 * t);
+
+		pcm[i * 2] = l + ((int) (seed >> 16) % 2048) - 1024;
+		pcm[i * 2 + 1] = r + ((int) (seed >> 20) % 512) - 256;
+	}
+}
+
+static double elapsed_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) * 1000000.0 +
+					(now.tv_usec - start->tv_usec);
+}
+
+static void report(const char *impl, const char *op, sbc_t *sbc,
+						int frames, double usec)
+{
+	printf("%s,%s,%d,%d,%s,%d,%d,%.0f,%.1f\n", impl, op,
+			(sbc->subbands + 1) * 4, (sbc->blocks + 1) * 4,
+			mode2str(sbc->mode), sbc->bitpool, frames,
+			usec > 0 ? frames * 1000000.0 / usec : 0,
+			frames > 0 ? usec * 1000.0 / frames : 0);
+}
+
+static int setup(sbc_t *sbc, int impl, int subbands, int blocks, int mode,
+								int bitpool)
+{
+	if (sbc_init(sbc, impl) < 0)
+		return -1;
+
+	sbc->frequency = SBC_FREQ_44100;
+	sbc->subbands = subbands;
+	sbc->blocks = blocks;
+	sbc->mode = mode;
+	sbc->bitpool = bitpool;
+
+	return 0;
+}
+
+static void bench(int impl, int subbands, int blocks, int mode, int bitpool,
+						int frames, int decode)
+{
+	const char *name;
+	struct timeval start;
+	unsigned char out[MAX_FRAME_SIZE * 4];
+	size_t codesize, framelen, pos, encoded;
+	ssize_t len;
+	double usec;
+	sbc_t sbc;
+	int i;
+
+	if (setup(&sbc, impl, subbands, blocks, mode, bitpool) < 0) {
+		fprintf(stderr, "Can't initialize SBC encoder\n");
+		exit(1);
+	}
+
+	codesize = sbc_get_codesize(&sbc);
+	framelen = sbc_get_frame_length(&sbc);
+
+	/* Warm up the encoder and keep the stream for the decoder */
+	for (i = 0, pos = 0; i < frames; i++) {
+		if (pos + codesize > PCM_SIZE)
+			pos = 0;
+
+		len = sbc_encode(&sbc, (unsigned char *) pcm + pos, codesize,
+					stream + i * framelen, framelen,
+					&encoded);
+		if (len <= 0 || encoded != framelen) {
+			fprintf(stderr, "Encoding failed\n");
+			exit(1);
+		}
+
+		pos += codesize;
+	}
+
+	name = sbc_get_implementation_info(&sbc);
+	if (!name)
+		name = "unknown";
+
+	gettimeofday(&start, NULL);
+	for (i = 0, pos = 0; i < frames; i++) {
+		if (pos + codesize > PCM_SIZE)
+			pos = 0;
+
+		sbc_encode(&sbc, (unsigned char *) pcm + pos, codesize,
+						out, sizeof(out), &encoded);
+
+		pos += codesize;
+	}
+	usec = elapsed_usec(&start);
+
+	report(name, "encode", &sbc, frames, usec);
+
+	sbc_finish(&sbc);
+
+	if (!decode)
+		return;
+
+	if (setup(&sbc, impl, subbands, blocks, mode, bitpool) < 0) {
+		fprintf(stderr, "Can't initialize SBC decoder\n");
+		exit(1);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < frames; i++) {
+		len = sbc_decode(&sbc, stream + i * framelen, framelen,
+						out, sizeof(out), &encoded);
+		if (len <= 0) {
+			fprintf(stderr, "Decoding failed\n");
+			exit(1);
+		}
+	}
+	usec = elapsed_usec(&start);
+
+	report(name, "decode", &sbc, frames, usec);
+
+	sbc_finish(&sbc);
+}
+
+static void run(int impl, int frames, int subbands, int blocks,
+						int bitpool, int decode)
+{
+	int sb, blk, mode, bp;
+
+	for (sb = SBC_SB_4; sb <= SBC_SB_8; sb++) {
+		if (subbands && (sb + 1) * 4 != subbands)
+			continue;
+
+		for (blk = SBC_BLK_4; blk <= SBC_BLK_16; blk++) {
+			if (blocks && (blk + 1) * 4 != blocks)
+				continue;
+
+			for (mode = SBC_MODE_MONO;
+					mode <= SBC_MODE_JOINT_STEREO; mode++) {
+				unsigned int i, max;
+
+				/* Maximum bitpool allowed by the spec */
+				if (mode == SBC_MODE_MONO ||
+						mode == SBC_MODE_DUAL_CHANNEL)
+					max = 16 * (sb + 1) * 4;
+				else
+					max = 32 * (sb + 1) * 4;
+				if (max > 250)
+					max = 250;
+
+				for (i = 0; i < sizeof(bitpools) /
+						sizeof(bitpools[0]); i++) {
+					bp = bitpools[i];
+					if (bitpool)
+						bp = bitpool;
+					else if (bp > (int) max)
+						bp = max;
+
+					if (bp > (int) max)
+						break;
+
+					bench(impl, sb, blk, mode, bp,
+							frames, decode);
+
+					if (bitpool || bp == (int) max)
+						break;
+				}
+			}
+		}
+	}
+}
+
+static void usage(void)
+{
+	printf("SBC benchmark utility ver %s\n", VERSION);
+	printf("Copyright (c) 2004-2009  Marcel Holtmann\n\n");
+
+	printf("Usage:\n"
+		"\tsbcbench [options]\n"
+		"\n");
+
+	printf("Options:\n"
+		"\t-h, --help           Display help\n"
+		"\t-n, --frames         Frames per configuration (default 10000)\n"
+		"\t-s, --subbands       Only use this number of subbands\n"
+		"\t-B, --blocks         Only use this number of blocks\n"
+		"\t-b, --bitpool        Only use this bitpool value\n"
+		"\t-d, --decode         Measure the decoder as well\n"
+		"\t-i, --impl           Only use this implementation (generic,\n"
+		"\t                     mmx, sse2, avx2 or neon)\n"
+		"\t-t, --selftest       Compare the implementations with the\n"
+		"\t                     generic one instead of measuring\n"
+		"\n");
+
+	printf("Every available implementation is measured, the output is one\n"
+		"comma separated line per implementation and configuration:\n"
+		"\timplementation,operation,subbands,blocks,mode,bitpool,"
+		"frames,frames/s,ns/frame\n"
+		"\n");
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "frames",	1, 0, 'n' },
+	{ "subbands",	1, 0, 's' },
+	{ "blocks",	1, 0, 'B' },
+	{ "bitpool",	1, 0, 'b' },
+	{ "decode",	0, 0, 'd' },
+	{ "impl",	1, 0, 'i' },
+	{ "selftest",	0, 0, 't' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	int opt, frames = 10000, subbands = 0, blocks = 0, bitpool = 0;
+	int decode = 0, selftest = 0, implementation = 0, mismatches = 0;
+	int i;
+
+	while ((opt = getopt_long(argc, argv, "+hn:s:B:b:di:t",
+						main_options, NULL)) != -1) {
+		switch(opt) {
+		case 'h':
+			usage();
+			exit(0);
+
+		case 'n':
+			frames = atoi(optarg);
+			if (frames <= 0) {
+				fprintf(stderr, "Invalid number of frames\n");
+				exit(1);
+			}
+			break;
+
+		case 's':
+			subbands = atoi(optarg);
+			if (subbands != 8 && subbands != 4) {
+				fprintf(stderr, "Invalid subbands\n");
+				exit(1);
+			}
+			break;
+
+		case 'B':
+			blocks = atoi(optarg);
+			if (blocks != 16 && blocks != 12 &&
+						blocks != 8 && blocks != 4) {
+				fprintf(stderr, "Invalid blocks\n");
+				exit(1);
+			}
+			break;
+
+		case 'b':
+			bitpool = atoi(optarg);
+			if (bitpool < 2 || bitpool > 250) {
+				fprintf(stderr, "Invalid bitpool\n");
+				exit(1);
+			}
+			break;
+
+		case 'd':
+			decode = 1;
+			break;
+
+		case 'i':
+			for (i = 0; implementations[i].name; i++) {
+				if (strcasecmp(optarg,
+						implementations[i].name) == 0)
+					break;
+			}
+			if (!implementations[i].name) {
+				fprintf(stderr, "Invalid implementation\n");
+				exit(1);
+			}
+			implementation = implementations[i].impl;
+			break;
+
+		case 't':
+			selftest = 1;
+			break;
+
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	stream = malloc((size_t) frames * MAX_FRAME_SIZE);
+	if (!stream) {
+		fprintf(stderr, "Can't allocate stream buffer\n");
+		exit(1);
+	}
+
+	synthesize_pcm();
+
+	if (selftest)
+		printf("# implementation,operation,mismatching_configurations\n");
+	else
+		printf("# implementation,operation,subbands,blocks,mode,"
+				"bitpool,frames,frames_per_sec,ns_per_frame\n");
+
+	for (i = 0; implementations[i].name; i++) {
+		int impl = implementations[i].impl;
+		sbc_t sbc;
+
+		if (implementation && impl != implementation)
+			continue;
+
+		/* Skip implementations not built in or not supported */
+		if (sbc_init(&sbc, impl) < 0) {
+			if (implementation) {
+				fprintf(stderr, "Implementation not available\n");
+				exit(1);
+			}
+			continue;
+		}
+
+		if (selftest) {
+			int err = sbc_selftest(impl);
+
+			if (err < 0) {
+				fprintf(stderr, "Self-test failed: %s\n",
+							strerror(-err));
+				exit(1);
+			}
+
+			printf("%s,selftest,%d\n",
+					sbc_get_implementation_info(&sbc), err);
+			if (err > 0)
+				mismatches++;
+		} else
+			run(impl, frames, subbands, blocks, bitpool, decode);
+
+		sbc_finish(&sbc);
+	}
+	free(stream);
+
+	return mismatches ? 1 : 0;
+}
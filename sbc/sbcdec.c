@@ -170,11 +170,11 @@ static void decode(char *filename, char *output, int tofile)
 	count = len;
 
 	while (framelen > 0) {
-		/* we have completed an sbc_decode at this point sbc.len is the
-		 * length of the frame we just decoded count is the number of
-		 * decoded bytes yet to be written */
+		/* we have completed an sbc_decode at this point framelen is
+		 * the length of the data we just decoded, count is the number
+		 * of decoded bytes yet to be written */
 
-		if (count + len >= BUF_SIZE) {
+		if (count + sbc_get_codesize(&sbc) > BUF_SIZE) {
 			/* buffer is too full to stuff decoded audio in so it
 			 * must be written to the device */
 			written = write(ad, buf, count);
@@ -183,18 +183,19 @@ static void decode(char *filename, char *output, int tofile)
 		}
 
 		/* sanity check */
-		if (count + len >= BUF_SIZE) {
+		if (count + sbc_get_codesize(&sbc) > BUF_SIZE) {
 			fprintf(stderr,
 				"buffer size of %d is too small for decoded"
-				" data (%lu)\n", BUF_SIZE, (unsigned long) (len + count));
+				" data (%lu)\n", BUF_SIZE, (unsigned long)
+				(sbc_get_codesize(&sbc) + count));
 			exit(1);
 		}
 
 		/* push the pointer in the file forward to the next bit to be
-		 * decoded tell the decoder to decode up to the remaining
-		 * length of the file (!) */
+		 * decoded and decode as many frames as fit into the
+		 * remaining buffer space */
 		pos += framelen;
-		framelen = sbc_decode(&sbc, stream + pos, streamlen - pos,
+		framelen = sbc_decode_multi(&sbc, stream + pos, streamlen - pos,
 					buf + count, sizeof(buf) - count, &len);
 
 		/* increase the count */
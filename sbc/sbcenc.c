@@ -163,19 +163,16 @@ static void encode(char *filename, int subbands, int bitpool, int joint,
 			/* Not enough data for encoding even a single frame */
 			break;
 		}
-		/* encode all the data from the input buffer in a loop */
+		/* encode all the data from the input buffer in one go */
 		inp = input;
 		outp = output;
-		while (size >= codesize) {
-			len = sbc_encode(&sbc, inp, codesize,
-				outp, sizeof(output) - (outp - output),
-				&encoded);
-			if (len != codesize || encoded <= 0) {
-				fprintf(stderr,
-					"sbc_encode fail, len=%zd, encoded=%lu\n",
-					len, (unsigned long) encoded);
-				break;
-			}
+		len = sbc_encode_multi(&sbc, inp, size, outp, sizeof(output),
+								&encoded);
+		if (len < codesize || encoded <= 0) {
+			fprintf(stderr,
+				"sbc_encode_multi fail, len=%zd, encoded=%lu\n",
+				len, (unsigned long) encoded);
+		} else {
 			size -= len;
 			inp += len;
 			outp += encoded;
@@ -27,10 +27,18 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <sndfile.h>
 #include <math.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "sbc.h"
 
 #define MAXCHANNELS 2
 #define DEFACCURACY 7
@@ -244,6 +252,141 @@ static int check_absolute_diff(SNDFILE * sndref, SF_INFO * infosref,
 	return verdict;
 }
 
+static double elapsed_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) * 1000000.0 +
+					(now.tv_usec - start->tv_usec);
+}
+
+static void print_speed(const char *name, int frames, double usec)
+{
+	if (frames <= 0 || usec <= 0) {
+		printf("%s: no frames\n", name);
+		return;
+	}
+
+	printf("%s: %d frames in %.3f s, %.0f frames/s, %.1f ns/frame\n",
+			name, frames, usec / 1000000.0,
+			frames * 1000000.0 / usec, usec * 1000.0 / frames);
+}
+
+static int benchmark(const char *filename, int iterations)
+{
+	struct stat st;
+	struct timeval start;
+	unsigned char *stream, *pcm, out[512];
+	size_t len, pos, pcm_len, codesize, written;
+	ssize_t consumed;
+	int fd, i, frames, total;
+	sbc_t sbc, params;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open file %s: %s\n",
+						filename, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		fprintf(stderr, "Can't stat file %s\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	len = st.st_size;
+	stream = malloc(len);
+	if (!stream || read(fd, stream, len) != (ssize_t) len) {
+		fprintf(stderr, "Can't read file %s\n", filename);
+		free(stream);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	/* Decode once to count the frames and to get the encoder input */
+	sbc_init(&sbc, 0L);
+	sbc.endian = SBC_BE;
+
+	consumed = sbc_parse(&sbc, stream, len);
+	if (consumed <= 0) {
+		fprintf(stderr, "No SBC frames in %s\n", filename);
+		sbc_finish(&sbc);
+		free(stream);
+		return -1;
+	}
+
+	codesize = sbc_get_codesize(&sbc);
+	pcm = malloc(len / consumed * codesize + codesize);
+	if (!pcm) {
+		sbc_finish(&sbc);
+		free(stream);
+		return -1;
+	}
+
+	frames = 0;
+	pcm_len = 0;
+	for (pos = 0; pos < len; pos += consumed) {
+		consumed = sbc_decode(&sbc, stream + pos, len - pos,
+					pcm + pcm_len, codesize, &written);
+		if (consumed <= 0)
+			break;
+		pcm_len += written;
+		frames++;
+	}
+
+	printf("%s: %d frames, %d subbands, %d blocks, bitpool %d\n",
+				filename, frames, sbc.subbands ? 8 : 4,
+				(sbc.blocks + 1) * 4, sbc.bitpool);
+
+	params = sbc;
+
+	total = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		sbc_reinit(&sbc, 0L);
+		sbc.endian = SBC_BE;
+		for (pos = 0; pos < len; pos += consumed) {
+			consumed = sbc_decode(&sbc, stream + pos, len - pos,
+							out, sizeof(out), &written);
+			if (consumed <= 0)
+				break;
+			total++;
+		}
+	}
+	print_speed("decode", total, elapsed_usec(&start));
+
+	total = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		sbc_reinit(&sbc, 0L);
+		sbc.frequency = params.frequency;
+		sbc.blocks = params.blocks;
+		sbc.subbands = params.subbands;
+		sbc.mode = params.mode;
+		sbc.allocation = params.allocation;
+		sbc.bitpool = params.bitpool;
+		sbc.endian = SBC_BE;
+		for (pos = 0; pos + codesize <= pcm_len; pos += codesize) {
+			if (sbc_encode(&sbc, pcm + pos, codesize,
+					out, sizeof(out), &written) <= 0)
+				break;
+			total++;
+		}
+	}
+	print_speed("encode", total, elapsed_usec(&start));
+
+	sbc_finish(&sbc);
+	free(pcm);
+	free(stream);
+
+	return 0;
+}
+
 static void usage()
 {
 	printf("SBC conformance test ver %s\n", VERSION);
@@ -253,6 +396,7 @@ static void usage()
 	printf("Usage:\n"
 		"\tsbctester reference.wav checkfile.wav\n"
 		"\tsbctester integer\n"
+		"\tsbctester -b file.sbc [iterations]\n"
 		"\n");
 
 	printf("To test the encoder:\n");
@@ -263,6 +407,10 @@ static void usage()
 
 	printf("\tA file called out.csv is generated to use the data in a\n");
 	printf("\tspreadsheet application or database.\n\n");
+
+	printf("To measure the codec speed:\n");
+	printf("\tRun sbctester -b with an SBC file, it is decoded and the\n");
+	printf("\tresult encoded again with the same parameters\n\n");
 }
 
 int main(int argc, char *argv[])
@@ -275,6 +423,14 @@ int main(int argc, char *argv[])
 	char *tst;
 	int pass_rms, pass_absolute, pass, accuracy;
 
+	if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+		int iterations = argc > 3 ? atoi(argv[3]) : 100;
+
+		if (benchmark(argv[2], iterations > 0 ? iterations : 1) < 0)
+			exit(1);
+		exit(0);
+	}
+
 	if (argc == 2) {
 		double db;
 
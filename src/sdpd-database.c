@@ -31,8 +31,11 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 
+#include <netinet/in.h>
+
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/l2cap.h>
 #include <bluetooth/sdp.h>
@@ -41,48 +44,563 @@
 #include "sdpd.h"
 #include "logging.h"
 
-static sdp_list_t *service_db;
-static sdp_list_t *access_db;
-
+/*
+ * The service repository: a contiguous array in sorted order, the
+ * service record handle is the sort key. Every record comes with
+ * the device it was registered for, as checked by sdp_check_access
+ */
 typedef struct {
-	uint32_t handle;
+	sdp_record_t *record;
 	bdaddr_t device;
-} sdp_access_t;
+} sdp_service_t;
+
+static sdp_service_t *service_db;
+static int service_db_count;
+static int service_db_size;
+
+/* View of the repository as a list, for sdp_get_record_list */
+static sdp_list_t *record_list;
+static int record_list_valid;
+
+static sdp_service_t *service_find(uint32_t handle, int *pos)
+{
+	int low = 0, high = service_db_count - 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		uint32_t h = service_db[mid].record->handle;
+
+		if (h == handle) {
+			if (pos)
+				*pos = mid;
+			return &service_db[mid];
+		}
+
+		if (h < handle)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	if (pos)
+		*pos = low;
+
+	return NULL;
+}
+
+/*
+ * Inverted index of the service repository: for every UUID found
+ * in the record patterns, the records holding it, sorted by handle.
+ * The entries are kept sorted by their 128-bit UUID so a service
+ * search only looks up the UUIDs it asks for.
+ */
+typedef struct {
+	uuid_t uuid;
+	sdp_record_t **records;
+	int count;
+	int size;
+} sdp_uuid_index_t;
+
+static sdp_uuid_index_t *uuid_index;
+static int uuid_index_count;
+static int uuid_index_size;
+
+/* Result of the last sdp_record_match */
+static sdp_record_t **match_buf;
+static int match_size;
+
+static void uuid_to_uuid128(const uuid_t *uuid, uuid_t *uuid128)
+{
+	switch (uuid->type) {
+	case SDP_UUID128:
+		*uuid128 = *uuid;
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(uuid128, (uuid_t *) uuid);
+		break;
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(uuid128, (uuid_t *) uuid);
+		break;
+	default:
+		memset(uuid128, 0, sizeof(*uuid128));
+		break;
+	}
+}
+
+/*
+ * Binary search of the index entry of a 128-bit UUID. When it is
+ * missing, pos is set to where it would be inserted
+ */
+static sdp_uuid_index_t *uuid_index_find(const uuid_t *uuid128, int *pos)
+{
+	int low = 0, high = uuid_index_count - 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		int cmp = sdp_uuid128_cmp(&uuid_index[mid].uuid, uuid128);
+
+		if (cmp == 0) {
+			if (pos)
+				*pos = mid;
+			return &uuid_index[mid];
+		}
+
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	if (pos)
+		*pos = low;
+
+	return NULL;
+}
+
+static int posting_find(sdp_uuid_index_t *entry, uint32_t handle,
+								int *pos)
+{
+	int low = 0, high = entry->count - 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		uint32_t h = entry->records[mid]->handle;
+
+		if (h == handle) {
+			*pos = mid;
+			return 1;
+		}
+
+		if (h < handle)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	*pos = low;
+
+	return 0;
+}
+
+static int uuid_index_add(const uuid_t *uuid, sdp_record_t *rec)
+{
+	sdp_uuid_index_t *entry;
+	uuid_t uuid128;
+	int pos;
+
+	uuid_to_uuid128(uuid, &uuid128);
+
+	entry = uuid_index_find(&uuid128, &pos);
+	if (!entry) {
+		if (uuid_index_count == uuid_index_size) {
+			int size = uuid_index_size ? uuid_index_size * 2 : 16;
+			sdp_uuid_index_t *tmp;
+
+			tmp = realloc(uuid_index, size * sizeof(*tmp));
+			if (!tmp)
+				return -1;
+
+			uuid_index = tmp;
+			uuid_index_size = size;
+		}
+
+		memmove(&uuid_index[pos + 1], &uuid_index[pos],
+				(uuid_index_count - pos) * sizeof(*uuid_index));
+		uuid_index_count++;
+
+		entry = &uuid_index[pos];
+		memset(entry, 0, sizeof(*entry));
+		entry->uuid = uuid128;
+	}
+
+	if (posting_find(entry, rec->handle, &pos)) {
+		entry->records[pos] = rec;
+		return 0;
+	}
+
+	if (entry->count == entry->size) {
+		int size = entry->size ? entry->size * 2 : 4;
+		sdp_record_t **tmp;
+
+		tmp = realloc(entry->records, size * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+
+		entry->records = tmp;
+		entry->size = size;
+	}
+
+	memmove(&entry->records[pos + 1], &entry->records[pos],
+				(entry->count - pos) * sizeof(*entry->records));
+	entry->records[pos] = rec;
+	entry->count++;
+
+	return 0;
+}
+
+static void uuid_index_remove(const uuid_t *uuid, uint32_t handle)
+{
+	sdp_uuid_index_t *entry;
+	uuid_t uuid128;
+	int pos;
+
+	uuid_to_uuid128(uuid, &uuid128);
+
+	entry = uuid_index_find(&uuid128, NULL);
+	if (!entry || !posting_find(entry, handle, &pos))
+		return;
+
+	entry->count--;
+	memmove(&entry->records[pos], &entry->records[pos + 1],
+				(entry->count - pos) * sizeof(*entry->records));
+
+	if (entry->count > 0)
+		return;
+
+	free(entry->records);
+
+	pos = entry - uuid_index;
+	uuid_index_count--;
+	memmove(&uuid_index[pos], &uuid_index[pos + 1],
+				(uuid_index_count - pos) * sizeof(*uuid_index));
+}
 
 /*
- * Ordering function called when inserting a service record.
- * The service repository is a linked list in sorted order
- * and the service record handle is the sort key
+ * Add the UUIDs of a record pattern to the index. Record patterns
+ * only grow, so indexing them again is enough after a change
  */
-static int record_sort(const void *r1, const void *r2)
+static void record_index(sdp_record_t *rec)
 {
-	const sdp_record_t *rec1 = (const sdp_record_t *) r1;
-	const sdp_record_t *rec2 = (const sdp_record_t *) r2;
+	sdp_list_t *p;
 
-	if (!rec1 || !rec2) {
-		error("NULL RECORD LIST FATAL");
+	for (p = rec->pattern; p; p = p->next) {
+		if (p->data == NULL)
+			continue;
+
+		if (uuid_index_add(p->data, rec) < 0)
+			error("Can't index record 0x%x: out of memory",
+								rec->handle);
+	}
+}
+
+/*
+ * Encoded attribute lists of the records, sorted by handle, so
+ * that attribute requests are answered by copying slices of them
+ */
+static sdp_cached_pdu_t *pdu_cache;
+static int pdu_cache_count;
+static int pdu_cache_size;
+
+static void pdu_free(sdp_cached_pdu_t *pdu)
+{
+	free(pdu->data);
+	free(pdu->attrs);
+}
+
+static sdp_cached_pdu_t *pdu_cache_find(uint32_t handle, int *pos)
+{
+	int low = 0, high = pdu_cache_count - 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+
+		if (pdu_cache[mid].handle == handle) {
+			*pos = mid;
+			return &pdu_cache[mid];
+		}
+
+		if (pdu_cache[mid].handle < handle)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	*pos = low;
+
+	return NULL;
+}
+
+/*
+ * Size of the data element at p. The low bits of the type descriptor
+ * give the size of the data, or of the length field that follows it
+ */
+static int data_element_size(const uint8_t *p, uint32_t left)
+{
+	uint32_t size;
+
+	if (left < sizeof(uint8_t))
 		return -1;
+
+	switch (*p & 0x07) {
+	case 0:
+		size = *p == SDP_DATA_NIL ? 0 : 1;
+		break;
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+		size = 1 << (*p & 0x07);
+		break;
+	case 5:
+		if (left < 2)
+			return -1;
+		size = sizeof(uint8_t) + p[1];
+		break;
+	case 6:
+		if (left < 3)
+			return -1;
+		size = sizeof(uint16_t) +
+			ntohs(bt_get_unaligned((uint16_t *) (p + 1)));
+		break;
+	default:
+		if (left < 5)
+			return -1;
+		size = sizeof(uint32_t) +
+			ntohl(bt_get_unaligned((uint32_t *) (p + 1)));
+		break;
 	}
 
-	return rec1->handle - rec2->handle;
+	size += sizeof(uint8_t);
+	if (size > left)
+		return -1;
+
+	return size;
 }
 
-static int access_sort(const void *r1, const void *r2)
+static int pdu_build(sdp_record_t *rec, sdp_cached_pdu_t *pdu)
 {
-	const sdp_access_t *rec1 = (const sdp_access_t *) r1;
-	const sdp_access_t *rec2 = (const sdp_access_t *) r2;
+	sdp_buf_t buf;
+	uint32_t offset = 0;
+	uint8_t dtd;
+	int scanned, seqlen, len;
+
+	memset(pdu, 0, sizeof(*pdu));
+	pdu->handle = rec->handle;
+
+	if (rec->attrlist == NULL)
+		return 0;
 
-	if (!rec1 || !rec2) {
-		error("NULL RECORD LIST FATAL");
+	if (sdp_gen_record_pdu(rec, &buf) < 0)
 		return -1;
+
+	len = sdp_list_len(rec->attrlist);
+	pdu->attrs = malloc(len * sizeof(*pdu->attrs));
+	if (!pdu->attrs)
+		goto failed;
+
+	/* Keep the attributes only, the sequence header depends on
+	 * which of them are requested */
+	scanned = sdp_extract_seqtype(buf.data, buf.data_size, &dtd, &seqlen);
+	if (scanned <= 0 || scanned + seqlen != (int) buf.data_size)
+		goto failed;
+
+	pdu->size = seqlen;
+	memmove(buf.data, buf.data + scanned, pdu->size);
+	pdu->data = buf.data;
+
+	while (offset < pdu->size) {
+		uint8_t *p = pdu->data + offset;
+		uint16_t attr;
+		int size;
+
+		if (pdu->size - offset < sizeof(uint8_t) + sizeof(uint16_t) ||
+					*p != SDP_UINT16 || pdu->count == len)
+			goto failed;
+
+		attr = ntohs(bt_get_unaligned((uint16_t *) (p + 1)));
+		if (pdu->count > 0 && attr <= pdu->attrs[pdu->count - 1].attr)
+			goto failed;
+
+		size = data_element_size(p + 3, pdu->size - offset - 3);
+		if (size < 0)
+			goto failed;
+
+		pdu->attrs[pdu->count].attr = attr;
+		pdu->attrs[pdu->count].offset = offset;
+		pdu->count++;
+
+		offset += 3 + size;
+	}
+
+	return 0;
+
+failed:
+	error("Can't encode the attributes of record 0x%x", rec->handle);
+	free(buf.data);
+	free(pdu->attrs);
+	memset(pdu, 0, sizeof(*pdu));
+	pdu->handle = rec->handle;
+	return -1;
+}
+
+static void pdu_cache_update(sdp_record_t *rec)
+{
+	sdp_cached_pdu_t *pdu, new;
+	int pos;
+
+	pdu_build(rec, &new);
+
+	pdu = pdu_cache_find(rec->handle, &pos);
+	if (pdu) {
+		pdu_free(pdu);
+		*pdu = new;
+		return;
+	}
+
+	if (pdu_cache_count == pdu_cache_size) {
+		int size = pdu_cache_size ? pdu_cache_size * 2 : 16;
+		sdp_cached_pdu_t *tmp;
+
+		tmp = realloc(pdu_cache, size * sizeof(*tmp));
+		if (!tmp) {
+			pdu_free(&new);
+			return;
+		}
+
+		pdu_cache = tmp;
+		pdu_cache_size = size;
 	}
 
-	return rec1->handle - rec2->handle;
+	memmove(&pdu_cache[pos + 1], &pdu_cache[pos],
+				(pdu_cache_count - pos) * sizeof(*pdu_cache));
+	pdu_cache[pos] = new;
+	pdu_cache_count++;
 }
 
-static void access_free(void *p)
+static void pdu_cache_remove(uint32_t handle)
 {
-	free(p);
+	sdp_cached_pdu_t *pdu;
+	int pos;
+
+	pdu = pdu_cache_find(handle, &pos);
+	if (!pdu)
+		return;
+
+	pdu_free(pdu);
+
+	pdu_cache_count--;
+	memmove(&pdu_cache[pos], &pdu_cache[pos + 1],
+				(pdu_cache_count - pos) * sizeof(*pdu_cache));
+}
+
+/*
+ * Return the encoded attributes of a record. The encoding is
+ * attempted again if it failed when the record was last changed
+ */
+sdp_cached_pdu_t *sdp_record_get_pdu(sdp_record_t *rec)
+{
+	sdp_cached_pdu_t *pdu;
+	int pos;
+
+	pdu = pdu_cache_find(rec->handle, &pos);
+	if (!pdu || (rec->attrlist && !pdu->data)) {
+		pdu_cache_update(rec);
+		pdu = pdu_cache_find(rec->handle, &pos);
+	}
+
+	if (!pdu || (rec->attrlist && !pdu->data))
+		return NULL;
+
+	return pdu;
+}
+
+/*
+ * Must be called whenever a record in the repository is changed,
+ * to index the UUIDs added to its pattern and encode it again
+ */
+void sdp_record_refresh(sdp_record_t *rec)
+{
+	record_index(rec);
+	pdu_cache_update(rec);
+}
+
+static int match_buf_grow(int count)
+{
+	sdp_record_t **tmp;
+
+	if (count <= match_size)
+		return 0;
+
+	tmp = realloc(match_buf, count * sizeof(*tmp));
+	if (!tmp)
+		return -1;
+
+	match_buf = tmp;
+	match_size = count;
+
+	return 0;
+}
+
+/*
+ * Find the records whose pattern holds each and every UUID of the
+ * search pattern. The smallest list of the index is walked and its
+ * records are looked up in the lists of the other UUIDs. The matches
+ * are returned in handle order in an array owned by the database,
+ * valid until the next search or change of the repository
+ */
+int sdp_record_match(sdp_list_t *search, sdp_record_t ***records)
+{
+	sdp_uuid_index_t *smallest = NULL;
+	sdp_list_t *s;
+	int i, count = 0;
+
+	*records = NULL;
+
+	/* An empty search pattern matches everything */
+	if (!search) {
+		if (match_buf_grow(service_db_count) < 0)
+			return 0;
+
+		for (count = 0; count < service_db_count; count++)
+			match_buf[count] = service_db[count].record;
+
+		*records = match_buf;
+		return count;
+	}
+
+	for (s = search; s; s = s->next) {
+		sdp_uuid_index_t *entry;
+		uuid_t uuid128;
+
+		if (s->data == NULL)
+			return 0;
+
+		uuid_to_uuid128(s->data, &uuid128);
+
+		entry = uuid_index_find(&uuid128, NULL);
+		if (!entry)
+			return 0;
+
+		if (!smallest || entry->count < smallest->count)
+			smallest = entry;
+	}
+
+	if (match_buf_grow(smallest->count) < 0)
+		return 0;
+
+	for (i = 0; i < smallest->count; i++) {
+		sdp_record_t *rec = smallest->records[i];
+
+		for (s = search; s; s = s->next) {
+			sdp_uuid_index_t *entry;
+			uuid_t uuid128;
+			int pos;
+
+			uuid_to_uuid128(s->data, &uuid128);
+
+			entry = uuid_index_find(&uuid128, NULL);
+			if (entry != smallest &&
+					!posting_find(entry, rec->handle, &pos))
+				break;
+		}
+
+		if (s == NULL)
+			match_buf[count++] = rec;
+	}
+
+	*records = match_buf;
+
+	return count;
 }
 
 /*
@@ -90,8 +608,32 @@ static void access_free(void *p)
  */
 void sdp_svcdb_reset()
 {
-	sdp_list_free(service_db, (sdp_free_func_t) sdp_record_free);
-	sdp_list_free(access_db, access_free);
+	int i;
+
+	for (i = 0; i < service_db_count; i++)
+		sdp_record_free(service_db[i].record);
+	free(service_db);
+	sdp_list_free(record_list, NULL);
+
+	for (i = 0; i < uuid_index_count; i++)
+		free(uuid_index[i].records);
+	free(uuid_index);
+	free(match_buf);
+
+	for (i = 0; i < pdu_cache_count; i++)
+		pdu_free(&pdu_cache[i]);
+	free(pdu_cache);
+
+	service_db = NULL;
+	service_db_count = service_db_size = 0;
+	record_list = NULL;
+	record_list_valid = 0;
+	uuid_index = NULL;
+	uuid_index_count = uuid_index_size = 0;
+	match_buf = NULL;
+	match_size = 0;
+	pdu_cache = NULL;
+	pdu_cache_count = pdu_cache_size = 0;
 }
 
 typedef struct _indexed {
@@ -108,6 +650,8 @@ void sdp_svcdb_collect_all(int sock)
 {
 	sdp_list_t *p, *q;
 
+	sdp_cstate_clean_buf(sock);
+
 	for (p = socket_index, q = 0; p; ) {
 		sdp_indexed_t *item = (sdp_indexed_t *) p->data;
 		if (item->sock == sock) {
@@ -168,51 +712,41 @@ void sdp_svcdb_set_collectable(sdp_record_t *record, int sock)
  */
 void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 {
-	sdp_access_t *dev;
+	sdp_service_t *service;
+	int pos;
 
 	SDPDBG("Adding rec : 0x%lx", (long) rec);
 	SDPDBG("with handle : 0x%x", rec->handle);
 
-	service_db = sdp_list_insert_sorted(service_db, rec, record_sort);
-
-	dev = malloc(sizeof(*dev));
-	if (!dev)
-		return;
-
-	bacpy(&dev->device, device);
-	dev->handle = rec->handle;
+	if (service_db_count == service_db_size) {
+		int size = service_db_size ? service_db_size * 2 : 16;
+		sdp_service_t *tmp;
 
-	access_db = sdp_list_insert_sorted(access_db, dev, access_sort);
-}
-
-static sdp_list_t *record_locate(uint32_t handle)
-{
-	if (service_db) {
-		sdp_list_t *p;
-		sdp_record_t r;
+		tmp = realloc(service_db, size * sizeof(*tmp));
+		if (!tmp) {
+			error("Can't add record 0x%x: %s", rec->handle,
+							strerror(ENOMEM));
+			return;
+		}
 
-		r.handle = handle;
-		p = sdp_list_find(service_db, &r, record_sort);
-		return p;
+		service_db = tmp;
+		service_db_size = size;
 	}
 
-	SDPDBG("Could not find svcRec for : 0x%x", handle);
-	return NULL;
-}
+	service_find(rec->handle, &pos);
 
-static sdp_list_t *access_locate(uint32_t handle)
-{
-	if (access_db) {
-		sdp_list_t *p;
-		sdp_access_t a;
+	memmove(&service_db[pos + 1], &service_db[pos],
+			(service_db_count - pos) * sizeof(*service_db));
+	service_db_count++;
 
-		a.handle = handle;
-		p = sdp_list_find(access_db, &a, access_sort);
-		return p;
-	}
+	service = &service_db[pos];
+	service->record = rec;
+	bacpy(&service->device, device);
 
-	SDPDBG("Could not find access data for : 0x%x", handle);
-	return NULL;
+	record_list_valid = 0;
+
+	record_index(rec);
+	pdu_cache_update(rec);
 }
 
 /*
@@ -220,14 +754,14 @@ static sdp_list_t *access_locate(uint32_t handle)
  */
 sdp_record_t *sdp_record_find(uint32_t handle)
 {
-	sdp_list_t *p = record_locate(handle);
+	sdp_service_t *service = service_find(handle, NULL);
 
-	if (!p) {
+	if (!service) {
 		SDPDBG("Couldn't find record for : 0x%x", handle);
 		return 0;
 	}
 
-	return (sdp_record_t *) p->data;
+	return service->record;
 }
 
 /*
@@ -235,70 +769,111 @@ sdp_record_t *sdp_record_find(uint32_t handle)
  */
 int sdp_record_remove(uint32_t handle)
 {
-	sdp_list_t *p = record_locate(handle);
-	sdp_record_t *r;
-	sdp_access_t *a;
+	sdp_service_t *service;
+	sdp_list_t *pat;
+	int pos;
 
-	if (!p) {
+	service = service_find(handle, &pos);
+	if (!service) {
 		error("Remove : Couldn't find record for : 0x%x", handle);
 		return -1;
 	}
 
-	r = (sdp_record_t *) p->data;
-	if (r)
-		service_db = sdp_list_remove(service_db, r);
+	for (pat = service->record->pattern; pat; pat = pat->next)
+		if (pat->data)
+			uuid_index_remove(pat->data, handle);
 
-	p = access_locate(handle);
-	if (p) {
-		a = (sdp_access_t *) p->data;
-		if (a) {
-			access_db = sdp_list_remove(access_db, a);
-			access_free(a);
-		}
-	}
+	service_db_count--;
+	memmove(&service_db[pos], &service_db[pos + 1],
+			(service_db_count - pos) * sizeof(*service_db));
+
+	record_list_valid = 0;
+
+	pdu_cache_remove(handle);
 
 	return 0;
 }
 
 /*
- * Return a pointer to the linked list containing the records in sorted order
+ * Iterate over the repository in handle order: return the record
+ * following rec, or the first one when rec is NULL. The record
+ * passed in may have been removed in the meantime
  */
-sdp_list_t *sdp_get_record_list(void)
+sdp_record_t *sdp_record_next(sdp_record_t *rec)
 {
-	return service_db;
+	int pos = 0;
+
+	if (rec && service_find(rec->handle, &pos))
+		pos++;
+
+	if (pos >= service_db_count)
+		return NULL;
+
+	return service_db[pos].record;
 }
 
-sdp_list_t *sdp_get_access_list(void)
+/*
+ * Return a linked list containing the records in sorted order. The
+ * list is owned by the repository and rebuilt after it changed
+ */
+sdp_list_t *sdp_get_record_list(void)
 {
-	return access_db;
+	int i;
+
+	if (record_list_valid)
+		return record_list;
+
+	sdp_list_free(record_list, NULL);
+	record_list = NULL;
+
+	for (i = service_db_count - 1; i >= 0; i--) {
+		sdp_list_t *p = malloc(sizeof(sdp_list_t));
+
+		if (!p) {
+			sdp_list_free(record_list, NULL);
+			record_list = NULL;
+			return NULL;
+		}
+
+		p->data = service_db[i].record;
+		p->next = record_list;
+		record_list = p;
+	}
+
+	record_list_valid = 1;
+
+	return record_list;
 }
 
 int sdp_check_access(uint32_t handle, bdaddr_t *device)
 {
-	sdp_list_t *p = access_locate(handle);
-	sdp_access_t *a;
-
-	if (!p)
-		return 1;
+	sdp_service_t *service = service_find(handle, NULL);
 
-	a = (sdp_access_t *) p->data;
-	if (!a)
+	if (!service)
 		return 1;
 
-	if (bacmp(&a->device, device) &&
-			bacmp(&a->device, BDADDR_ANY) &&
+	if (bacmp(&service->device, device) &&
+			bacmp(&service->device, BDADDR_ANY) &&
 			bacmp(device, BDADDR_ANY))
 		return 0;
 
 	return 1;
 }
 
+/*
+ * The lowest free handle: the records from 0x10000 on are walked
+ * until one of them doesn't hold the handle its position implies
+ */
 uint32_t sdp_next_handle(void)
 {
 	uint32_t handle = 0x10000;
+	int pos;
+
+	service_find(handle, &pos);
 
-	while (sdp_record_find(handle))
-		handle++;
+	for (; pos < service_db_count; pos++, handle++)
+		if (service_db[pos].record->handle != handle)
+			break;
 
 	return handle;
 }
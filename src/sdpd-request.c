@@ -47,41 +47,287 @@
 
 #define MIN(x, y) ((x) < (y)) ? (x): (y)
 
+/*
+ * Responses too large for the MTU are cached until the client has
+ * fetched all of them with continuation states. The cache is hashed
+ * by socket and continuation id and the responses a client doesn't
+ * come back for expire. Every socket has a memory quota, a client
+ * going over it loses its own oldest responses, while the limit on
+ * the whole cache is only a backstop
+ */
+#define CSTATE_HASH_SIZE	64
+#define CSTATE_SOCK_MEMORY	(128 * 1024)
+#define CSTATE_MAX_MEMORY	(4 * 1024 * 1024)
+#define CSTATE_TIMEOUT		30
+
 typedef struct _sdp_cstate_list sdp_cstate_list_t;
+typedef struct _sdp_cstate_sock sdp_cstate_sock_t;
 
 struct _sdp_cstate_list {
 	sdp_cstate_list_t *next;
+	sdp_cstate_list_t *older;
+	sdp_cstate_list_t *newer;
+	sdp_cstate_list_t *sock_older;
+	sdp_cstate_list_t *sock_newer;
+	sdp_cstate_sock_t *owner;
+	int sock;
 	uint32_t timestamp;
+	uint32_t created;
 	sdp_buf_t buf;
 };
 
-static sdp_cstate_list_t *cstates;
+/* The responses cached for one socket, oldest first */
+struct _sdp_cstate_sock {
+	sdp_cstate_sock_t *next;
+	int sock;
+	size_t memory;
+	sdp_cstate_list_t *oldest;
+	sdp_cstate_list_t *newest;
+};
+
+static sdp_cstate_list_t *cstates[CSTATE_HASH_SIZE];
+static sdp_cstate_sock_t *cstate_socks[CSTATE_HASH_SIZE];
+
+/* All cached responses, oldest first */
+static sdp_cstate_list_t *cstate_oldest;
+static sdp_cstate_list_t *cstate_newest;
+
+static size_t cstate_memory;
+static uint32_t cstate_next_id;
+
+static inline unsigned int cstate_hash(int sock, uint32_t timestamp)
+{
+	return (timestamp ^ ((uint32_t) sock * 31)) % CSTATE_HASH_SIZE;
+}
+
+static sdp_cstate_sock_t *cstate_sock_find(int sock)
+{
+	sdp_cstate_sock_t *owner;
+
+	for (owner = cstate_socks[cstate_hash(sock, 0)]; owner;
+							owner = owner->next)
+		if (owner->sock == sock)
+			return owner;
+
+	return NULL;
+}
+
+static sdp_cstate_sock_t *cstate_sock_get(int sock)
+{
+	sdp_cstate_sock_t *owner = cstate_sock_find(sock);
+	unsigned int hash;
+
+	if (owner)
+		return owner;
+
+	owner = malloc(sizeof(sdp_cstate_sock_t));
+	if (!owner)
+		return NULL;
+
+	memset(owner, 0, sizeof(sdp_cstate_sock_t));
+	owner->sock = sock;
+
+	hash = cstate_hash(sock, 0);
+	owner->next = cstate_socks[hash];
+	cstate_socks[hash] = owner;
+
+	return owner;
+}
+
+/* Sockets are forgotten as soon as they have nothing cached */
+static void cstate_sock_put(sdp_cstate_sock_t *owner)
+{
+	sdp_cstate_sock_t **p;
+
+	if (owner->oldest)
+		return;
+
+	for (p = &cstate_socks[cstate_hash(owner->sock, 0)]; *p;
+							p = &(*p)->next) {
+		if (*p == owner) {
+			*p = owner->next;
+			break;
+		}
+	}
+
+	free(owner);
+}
+
+static void cstate_free(sdp_cstate_list_t *cstate)
+{
+	sdp_cstate_sock_t *owner = cstate->owner;
+	sdp_cstate_list_t **p;
+
+	for (p = &cstates[cstate_hash(cstate->sock, cstate->timestamp)];
+						*p; p = &(*p)->next) {
+		if (*p == cstate) {
+			*p = cstate->next;
+			break;
+		}
+	}
+
+	if (cstate->older)
+		cstate->older->newer = cstate->newer;
+	else
+		cstate_oldest = cstate->newer;
+
+	if (cstate->newer)
+		cstate->newer->older = cstate->older;
+	else
+		cstate_newest = cstate->older;
+
+	if (cstate->sock_older)
+		cstate->sock_older->sock_newer = cstate->sock_newer;
+	else
+		owner->oldest = cstate->sock_newer;
 
-// FIXME: should probably remove it when it's found
-sdp_buf_t *sdp_get_cached_rsp(sdp_cont_state_t *cstate)
+	if (cstate->sock_newer)
+		cstate->sock_newer->sock_older = cstate->sock_older;
+	else
+		owner->newest = cstate->sock_older;
+
+	cstate_memory -= cstate->buf.data_size;
+	owner->memory -= cstate->buf.data_size;
+
+	cstate_sock_put(owner);
+
+	free(cstate->buf.data);
+	free(cstate);
+}
+
+static void cstate_expire(void)
+{
+	uint32_t now = sdp_get_time();
+
+	while (cstate_oldest && now - cstate_oldest->created >= CSTATE_TIMEOUT)
+		cstate_free(cstate_oldest);
+}
+
+static sdp_cstate_list_t *cstate_find(int sock, sdp_cont_state_t *cstate)
 {
 	sdp_cstate_list_t *p;
 
-	for (p = cstates; p; p = p->next)
-		if (p->timestamp == cstate->timestamp)
-			return &p->buf;
-	return 0;
+	cstate_expire();
+
+	for (p = cstates[cstate_hash(sock, cstate->timestamp)]; p; p = p->next)
+		if (p->sock == sock && p->timestamp == cstate->timestamp)
+			return p;
+
+	return NULL;
 }
 
-static uint32_t sdp_cstate_alloc_buf(sdp_buf_t *buf)
+static sdp_buf_t *sdp_get_cached_rsp(int sock, sdp_cont_state_t *cstate)
 {
-	sdp_cstate_list_t *cstate = malloc(sizeof(sdp_cstate_list_t));
-	uint8_t *data = malloc(buf->data_size);
+	sdp_cstate_list_t *p = cstate_find(sock, cstate);
+
+	return p ? &p->buf : NULL;
+}
 
-	memcpy(data, buf->data, buf->data_size);
-	memset((char *)cstate, 0, sizeof(sdp_cstate_list_t));
-	cstate->buf.data = data;
+/*
+ * Drop a cached response once its last part has been sent
+ */
+static void sdp_cstate_free_rsp(int sock, sdp_cont_state_t *cstate)
+{
+	sdp_cstate_list_t *p = cstate_find(sock, cstate);
+
+	if (p)
+		cstate_free(p);
+}
+
+/*
+ * Cache a response and return the continuation id identifying it,
+ * or 0 if it can't be cached. The oldest responses of the socket are
+ * dropped when it would go over its quota, and the oldest of all only
+ * when the whole cache would grow over its memory limit
+ */
+static uint32_t sdp_cstate_alloc_buf(int sock, sdp_buf_t *buf)
+{
+	sdp_cstate_sock_t *owner;
+	sdp_cstate_list_t *cstate;
+	unsigned int hash;
+
+	cstate_expire();
+
+	if (buf->data_size > CSTATE_SOCK_MEMORY)
+		return 0;
+
+	while ((owner = cstate_sock_find(sock)) &&
+			owner->memory + buf->data_size > CSTATE_SOCK_MEMORY)
+		cstate_free(owner->oldest);
+
+	while (cstate_oldest &&
+			cstate_memory + buf->data_size > CSTATE_MAX_MEMORY)
+		cstate_free(cstate_oldest);
+
+	owner = cstate_sock_get(sock);
+	if (!owner)
+		return 0;
+
+	cstate = malloc(sizeof(sdp_cstate_list_t));
+	if (!cstate)
+		goto failed;
+
+	memset(cstate, 0, sizeof(sdp_cstate_list_t));
+
+	cstate->buf.data = malloc(buf->data_size);
+	if (!cstate->buf.data) {
+		free(cstate);
+		goto failed;
+	}
+
+	memcpy(cstate->buf.data, buf->data, buf->data_size);
 	cstate->buf.data_size = buf->data_size;
 	cstate->buf.buf_size = buf->data_size;
-	cstate->timestamp = sdp_get_time();
-	cstate->next = cstates;
-	cstates = cstate;
+
+	/* Start from the time so that the ids of an earlier run of
+	 * the daemon aren't reused right away */
+	if (cstate_next_id == 0)
+		cstate_next_id = sdp_get_time();
+	if (++cstate_next_id == 0)
+		cstate_next_id++;
+
+	cstate->sock = sock;
+	cstate->timestamp = cstate_next_id;
+	cstate->created = sdp_get_time();
+	cstate->owner = owner;
+
+	hash = cstate_hash(sock, cstate->timestamp);
+	cstate->next = cstates[hash];
+	cstates[hash] = cstate;
+
+	cstate->older = cstate_newest;
+	if (cstate_newest)
+		cstate_newest->newer = cstate;
+	else
+		cstate_oldest = cstate;
+	cstate_newest = cstate;
+
+	cstate->sock_older = owner->newest;
+	if (owner->newest)
+		owner->newest->sock_newer = cstate;
+	else
+		owner->oldest = cstate;
+	owner->newest = cstate;
+
+	cstate_memory += cstate->buf.data_size;
+	owner->memory += cstate->buf.data_size;
+
 	return cstate->timestamp;
+
+failed:
+	cstate_sock_put(owner);
+	return 0;
+}
+
+/*
+ * Drop the responses cached for a connection going away
+ */
+void sdp_cstate_clean_buf(int sock)
+{
+	sdp_cstate_sock_t *owner;
+
+	while ((owner = cstate_sock_find(sock)))
+		cstate_free(owner->oldest);
 }
 
 /* Additional values for checking datatype (not in spec) */
@@ -96,6 +342,62 @@ struct attrid {
 	};
 };
 
+/*
+ * The elements of the sequences found in requests are taken from a
+ * pool reused by every request, sized for the request before it is
+ * processed so that the lists built from it never move
+ */
+struct des_elem {
+	sdp_list_t list;
+	union {
+		struct attrid aid;
+		uint16_t uint16;
+		uint32_t uint32;
+		uuid_t uuid;
+	};
+};
+
+static struct des_elem *des_pool;
+static int des_pool_size;
+static int des_pool_used;
+
+static int des_pool_reset(int len)
+{
+	/* Every element takes at least three bytes of the request */
+	int size = len / 3 + 1;
+
+	des_pool_used = 0;
+
+	if (size <= des_pool_size)
+		return 0;
+
+	free(des_pool);
+
+	des_pool = malloc(size * sizeof(struct des_elem));
+	if (!des_pool) {
+		des_pool_size = 0;
+		return -ENOMEM;
+	}
+
+	des_pool_size = size;
+
+	return 0;
+}
+
+static struct des_elem *des_elem_new(void)
+{
+	struct des_elem *elem;
+
+	if (des_pool_used == des_pool_size)
+		return NULL;
+
+	elem = &des_pool[des_pool_used++];
+	elem->list.next = NULL;
+	elem->list.data = &elem->aid;
+
+	return elem;
+}
+
 /*
  * Generic data element sequence extractor. Builds
  * a list whose elements are those found in the 
@@ -108,7 +410,7 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 	int scanned, data_size = 0;
 	short numberOfElements = 0;
 	int seqlen = 0;
-	sdp_list_t *pSeq = NULL;
+	sdp_list_t *pSeq = NULL, *pLast = NULL;
 	uint8_t dataType;
 	int status = 0;
 	const uint8_t *p;
@@ -127,7 +429,7 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 	SDPDBG("Data size : %d", data_size);
 
 	for (;;) {
-		char *pElem = NULL;
+		struct des_elem *elem;
 		int localSeqLength = 0;
 
 		if (bufsize < sizeof(uint8_t)) {
@@ -154,6 +456,12 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 			goto failed;
 		}
 
+		elem = des_elem_new();
+		if (!elem) {
+			SDPDBG("->Too many elements");
+			goto failed;
+		}
+
 		switch (dataType) {
 		case SDP_UINT16:
 			p += sizeof(uint8_t);
@@ -165,14 +473,11 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 			}
 
 			if (expectedType == SDP_TYPE_ATTRID) {
-				struct attrid *aid;
-				aid = malloc(sizeof(struct attrid));
-				aid->dtd = dataType;
-				bt_put_unaligned(ntohs(bt_get_unaligned((uint16_t *)p)), (uint16_t *)&aid->uint16);
-				pElem = (char *) aid;
+				elem->aid.dtd = dataType;
+				elem->aid.uint16 = ntohs(bt_get_unaligned((uint16_t *)p));
 			} else {
-				pElem = malloc(sizeof(uint16_t));
-				bt_put_unaligned(ntohs(bt_get_unaligned((uint16_t *)p)), (uint16_t *)pElem);
+				elem->uint16 = ntohs(bt_get_unaligned((uint16_t *)p));
+				elem->list.data = &elem->uint16;
 			}
 			p += sizeof(uint16_t);
 			seqlen += sizeof(uint16_t);
@@ -188,14 +493,11 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 			}
 
 			if (expectedType == SDP_TYPE_ATTRID) {
-				struct attrid *aid;
-				aid = malloc(sizeof(struct attrid));
-				aid->dtd = dataType;
-				bt_put_unaligned(ntohl(bt_get_unaligned((uint32_t *)p)), (uint32_t *)&aid->uint32);
-				pElem = (char *) aid;
+				elem->aid.dtd = dataType;
+				elem->aid.uint32 = ntohl(bt_get_unaligned((uint32_t *)p));
 			} else {
-				pElem = malloc(sizeof(uint32_t));
-				bt_put_unaligned(ntohl(bt_get_unaligned((uint32_t *)p)), (uint32_t *)pElem);
+				elem->uint32 = ntohl(bt_get_unaligned((uint32_t *)p));
+				elem->list.data = &elem->uint32;
 			}
 			p += sizeof(uint32_t);
 			seqlen += sizeof(uint32_t);
@@ -204,12 +506,10 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 		case SDP_UUID16:
 		case SDP_UUID32:
 		case SDP_UUID128:
-			pElem = malloc(sizeof(uuid_t));
-			status = sdp_uuid_extract(p, bufsize, (uuid_t *) pElem, &localSeqLength);
-			if (status < 0) {
-				free(pElem);
+			elem->list.data = &elem->uuid;
+			status = sdp_uuid_extract(p, bufsize, &elem->uuid, &localSeqLength);
+			if (status < 0)
 				goto failed;
-			}
 			seqlen += localSeqLength;
 			p += localSeqLength;
 			bufsize -= localSeqLength;
@@ -218,7 +518,11 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 			return -1;
 		}
 		if (status == 0) {
-			pSeq = sdp_list_append(pSeq, pElem);
+			if (pLast)
+				pLast->next = &elem->list;
+			else
+				pSeq = &elem->list;
+			pLast = &elem->list;
 			numberOfElements++;
 			SDPDBG("No of elements : %d", numberOfElements);
 
@@ -226,8 +530,7 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 				break;
 			else if (seqlen > data_size || seqlen > len)
 				goto failed;
-		} else
-			free(pElem);
+		}
 	}
 	*svcReqSeq = pSeq;
 	scanned += seqlen;
@@ -235,7 +538,6 @@ static int extract_des(uint8_t *buf, int len, sdp_list_t **svcReqSeq, uint8_t *p
 	return scanned;
 
 failed:
-	sdp_list_free(pSeq, free);
 	return -1;
 }
 
@@ -262,7 +564,7 @@ static int sdp_set_cstate_pdu(sdp_buf_t *buf, sdp_cont_state_t *cstate)
 }
 
 static int sdp_cstate_get(uint8_t *buffer, size_t len,
-						sdp_cont_state_t **cstate)
+				sdp_cont_state_t *state, sdp_cont_state_t **cstate)
 {
 	uint8_t cStateSize = *buffer;
 
@@ -284,11 +586,8 @@ static int sdp_cstate_get(uint8_t *buffer, size_t len,
 	 * to get response remainder from cache, else send error
 	 */
 
-	*cstate = malloc(sizeof(sdp_cont_state_t));
-	if (!(*cstate))
-		return -ENOMEM;
-
-	memcpy(*cstate, buffer, sizeof(sdp_cont_state_t));
+	memcpy(state, buffer, sizeof(sdp_cont_state_t));
+	*cstate = state;
 
 	SDPDBG("Cstate TS : 0x%x", (*cstate)->timestamp);
 	SDPDBG("Bytes sent : %d", (*cstate)->cStateValue.maxBytesSent);
@@ -296,45 +595,6 @@ static int sdp_cstate_get(uint8_t *buffer, size_t len,
 	return 0;
 }
 
-/*
- * The matching process is defined as "each and every UUID
- * specified in the "search pattern" must be present in the
- * "target pattern". Here "search pattern" is the set of UUIDs
- * specified by the service discovery client and "target pattern"
- * is the set of UUIDs present in a service record. 
- * 
- * Return 1 if each and every UUID in the search
- * pattern exists in the target pattern, 0 if the
- * match succeeds and -1 on error.
- */
-static int sdp_match_uuid(sdp_list_t *search, sdp_list_t *pattern)
-{
-	/*
-	 * The target is a sorted list, so we need not look
-	 * at all elements to confirm existence of an element
-	 * from the search pattern
-	 */
-	int patlen = sdp_list_len(pattern);
-
-	if (patlen < sdp_list_len(search))
-		return -1;
-	for (; search; search = search->next) {
-		uuid_t *uuid128;
-		void *data = search->data;
-		sdp_list_t *list;
-		if (data == NULL)
-			return -1;
-
-		// create 128-bit form of the search UUID
-		uuid128 = sdp_uuid_to_uuid128((uuid_t *)data);
-		list = sdp_list_find(pattern, uuid128, sdp_uuid128_cmp);
-		bt_free(uuid128);
-		if (!list)
-			return 0;
-	}
-	return 1;
-}
-
 /*
  * Service search request PDU. This method extracts the search pattern
  * (a sequence of UUIDs) and calls the matching function
@@ -346,7 +606,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	sdp_list_t *pattern = NULL;
 	uint16_t expected, actual, rsp_count = 0;
 	uint8_t dtd;
-	sdp_cont_state_t *cstate = NULL;
+	sdp_cont_state_t state, *cstate = NULL;
 	uint8_t *pCacheBuffer = NULL;
 	int handleSize = 0;
 	uint32_t cStateId = 0;
@@ -388,7 +648,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	 * Check if continuation state exists, if yes attempt
 	 * to get rsp remainder from cache, else send error
 	 */
-	if (sdp_cstate_get(pdata, data_left, &cstate) < 0) {
+	if (sdp_cstate_get(pdata, data_left, &state, &cstate) < 0) {
 		status = SDP_INVALID_SYNTAX;
 		goto done;
 	}
@@ -412,17 +672,17 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->data_size += sizeof(uint16_t);
 
 	if (cstate == NULL) {
-		/* for every record in the DB, do a pattern search */
-		sdp_list_t *list = sdp_get_record_list();
+		/* look up the records holding the search pattern */
+		sdp_record_t **recs;
+		int count = sdp_record_match(pattern, &recs);
 
 		handleSize = 0;
-		for (; list && rsp_count < expected; list = list->next) {
-			sdp_record_t *rec = (sdp_record_t *) list->data;
+		for (i = 0; i < count && rsp_count < expected; i++) {
+			sdp_record_t *rec = recs[i];
 
 			SDPDBG("Checking svcRec : 0x%x", rec->handle);
-				
-			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
-					sdp_check_access(rec->handle, &req->device)) {
+
+			if (sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
 				bt_put_unaligned(htonl(rec->handle), (uint32_t *)pdata);
 				pdata += sizeof(uint32_t);
@@ -438,7 +698,11 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 		if (rsp_count > actual) {
 			/* cache the rsp and generate a continuation state */
-			cStateId = sdp_cstate_alloc_buf(buf);
+			cStateId = sdp_cstate_alloc_buf(req->sock, buf);
+			if (cStateId == 0) {
+				status = SDP_INSUFFICIENT_RESOURCES;
+				goto done;
+			}
 			/*
 			 * subtract handleSize since we now send only
 			 * a subset of handles
@@ -459,7 +723,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			 * Get the previous sdp_cont_state_t and obtain
 			 * the cached rsp
 			 */
-			sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+			sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
 			if (pCache) {
 				pCacheBuffer = pCache->data;
 				/* get the rsp_count from the cached buffer */
@@ -467,6 +731,14 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 				/* get index of the last sdp_record_t sent */
 				lastIndex = cstate->cStateValue.lastIndexSent;
+
+				if (lastIndex < 0 || lastIndex > rsp_count ||
+						2 * sizeof(uint16_t) +
+						rsp_count * sizeof(uint32_t) >
+							pCache->data_size) {
+					status = SDP_INVALID_CSTATE;
+					goto done;
+				}
 			} else {
 				status = SDP_INVALID_CSTATE;
 				goto done;
@@ -505,6 +777,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 		if (i == rsp_count) {
 			/* set "null" continuationState */
 			sdp_set_cstate_pdu(buf, NULL);
+			if (cstate)
+				sdp_cstate_free_rsp(req->sock, cstate);
 		} else {
 			/*
 			 * there's more: set lastIndexSent to
@@ -525,25 +799,115 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 		}
 	}
 
-done:	
-	if (cstate)
-		free(cstate);
-	if (pattern)
-		sdp_list_free(pattern, free);
-
+done:
 	return status;
 }
 
+/*
+ * Header of a sequence of size bytes of elements, the same one
+ * sdp_append_to_buf would give it
+ */
+static int seq_header_size(uint32_t size)
+{
+	if (size + 2 * sizeof(uint8_t) <= UCHAR_MAX)
+		return 2 * sizeof(uint8_t);
+
+	return sizeof(uint8_t) + sizeof(uint16_t);
+}
+
+static int put_seq_header(uint8_t *p, uint32_t size)
+{
+	if (seq_header_size(size) == 2 * sizeof(uint8_t)) {
+		p[0] = SDP_SEQ8;
+		p[1] = size;
+	} else {
+		p[0] = SDP_SEQ16;
+		bt_put_unaligned(htons(size), (uint16_t *) (p + 1));
+	}
+
+	return seq_header_size(size);
+}
+
+/*
+ * Index of the first cached attribute with an id not lower than attr
+ */
+static int attr_lookup(sdp_cached_pdu_t *pdu, uint32_t attr)
+{
+	int low = 0, high = pdu->count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		if (pdu->attrs[mid].attr < attr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static uint32_t attr_offset(sdp_cached_pdu_t *pdu, int index)
+{
+	return index < pdu->count ? pdu->attrs[index].offset : pdu->size;
+}
+
+/*
+ * Locate the encoded attributes matching one attribute id or range.
+ * The attributes are sorted by id, so they are always contiguous
+ */
+static int attr_slice(sdp_cached_pdu_t *pdu, struct attrid *aid,
+					uint32_t *offset, uint32_t *len)
+{
+	uint16_t low, high;
+	int first, last;
+
+	SDPDBG("AttrDataType : %d", aid->dtd);
+
+	if (aid->dtd == SDP_UINT16) {
+		low = bt_get_unaligned((uint16_t *)&aid->uint16);
+		high = low;
+	} else if (aid->dtd == SDP_UINT32) {
+		uint32_t range = bt_get_unaligned((uint32_t *)&aid->uint32);
+		low = (0xffff0000 & range) >> 16;
+		high = 0x0000ffff & range;
+
+		SDPDBG("attr range : 0x%x", range);
+		SDPDBG("Low id : 0x%x", low);
+		SDPDBG("High id : 0x%x", high);
+
+		/* a reversed range only ever returned its high id */
+		if (low > high)
+			low = high;
+	} else {
+		error("Unexpected data type : 0x%x", aid->dtd);
+		error("Expect uint16_t or uint32_t");
+		return -1;
+	}
+
+	first = attr_lookup(pdu, low);
+	last = attr_lookup(pdu, (uint32_t) high + 1);
+
+	*offset = attr_offset(pdu, first);
+	*len = attr_offset(pdu, last) - *offset;
+
+	return 0;
+}
+
 /*
  * Extract attribute identifiers from the request PDU.
  * Clients could request a subset of attributes (by id)
  * from a service record, instead of the whole set. The
  * requested identifiers are present in the PDU form of
- * the request
+ * the request. The attributes are copied from the encoded
+ * form of the record kept by the service repository
  */
 static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 {
-	sdp_buf_t pdu;
+	sdp_cached_pdu_t *pdu;
+	sdp_list_t *l;
+	uint32_t offset, len, total = 0;
+	uint8_t *p;
 
 	if (!rec)
 		return SDP_INVALID_RECORD_HANDLE;
@@ -559,53 +923,31 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 		return 0;
 	}
 
-	sdp_gen_record_pdu(rec, &pdu);
-
-	for (; seq; seq = seq->next) {
-		struct attrid *aid = seq->data;
-
-		SDPDBG("AttrDataType : %d", aid->dtd);
-
-		if (aid->dtd == SDP_UINT16) {
-			uint16_t attr = bt_get_unaligned((uint16_t *)&aid->uint16);
-			sdp_data_t *a = (sdp_data_t *)sdp_data_get(rec, attr);
-			if (a)
-				sdp_append_to_pdu(buf, a);
-		} else if (aid->dtd == SDP_UINT32) {
-			uint32_t range = bt_get_unaligned((uint32_t *)&aid->uint32);
-			uint16_t attr;
-			uint16_t low = (0xffff0000 & range) >> 16;
-			uint16_t high = 0x0000ffff & range;
-			sdp_data_t *data;
-
-			SDPDBG("attr range : 0x%x", range);
-			SDPDBG("Low id : 0x%x", low);
-			SDPDBG("High id : 0x%x", high);
-
-			if (low == 0x0000 && high == 0xffff && pdu.data_size <= buf->buf_size) {
-				/* copy it */
-				memcpy(buf->data, pdu.data, pdu.data_size);
-				buf->data_size = pdu.data_size;
-				break;
-			}
-			/* (else) sub-range of attributes */
-			for (attr = low; attr < high; attr++) {
-				data = sdp_data_get(rec, attr);
-				if (data)
-					sdp_append_to_pdu(buf, data);
-			}
-			data = sdp_data_get(rec, high);
-			if (data)
-				sdp_append_to_pdu(buf, data);
-		} else {
-			error("Unexpected data type : 0x%x", aid->dtd);
-			error("Expect uint16_t or uint32_t");
-			free(pdu.data);
+	pdu = sdp_record_get_pdu(rec);
+	if (!pdu)
+		return SDP_INSUFFICIENT_RESOURCES;
+
+	for (l = seq; l; l = l->next) {
+		if (attr_slice(pdu, l->data, &offset, &len) < 0)
 			return SDP_INVALID_SYNTAX;
-		}
+		total += len;
 	}
 
-	free(pdu.data);
+	if (total == 0)
+		return 0;
+
+	if (seq_header_size(total) + total > buf->buf_size)
+		return SDP_INSUFFICIENT_RESOURCES;
+
+	p = buf->data + put_seq_header(buf->data, total);
+
+	for (l = seq; l; l = l->next) {
+		attr_slice(pdu, l->data, &offset, &len);
+		memcpy(p, pdu->data + offset, len);
+		p += len;
+	}
+
+	buf->data_size = p - buf->data;
 
 	return 0;
 }
@@ -618,7 +960,7 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
  */
 static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 {
-	sdp_cont_state_t *cstate = NULL;
+	sdp_cont_state_t state, *cstate = NULL;
 	uint8_t *pResponse = NULL;
 	short cstate_size = 0;
 	sdp_list_t *seq = NULL;
@@ -676,7 +1018,7 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	 * if continuation state exists, attempt
 	 * to get rsp remainder from cache, else send error
 	 */
-	if (sdp_cstate_get(pdata, data_left, &cstate) < 0) {
+	if (sdp_cstate_get(pdata, data_left, &state, &cstate) < 0) {
 		status = SDP_INVALID_SYNTAX;
 		goto done;
 	}
@@ -696,11 +1038,11 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->buf_size -= sizeof(uint16_t);
 
 	if (cstate) {
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
 
 		SDPDBG("Obtained cached rsp : %p", pCache);
 
-		if (pCache) {
+		if (pCache && cstate->cStateValue.maxBytesSent < pCache->data_size) {
 			short sent = MIN(max_rsp_size, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
@@ -709,9 +1051,10 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 
 			SDPDBG("Response size : %d sending now : %d bytes sent so far : %d",
 				pCache->data_size, sent, cstate->cStateValue.maxBytesSent);
-			if (cstate->cStateValue.maxBytesSent == pCache->data_size)
+			if (cstate->cStateValue.maxBytesSent == pCache->data_size) {
 				cstate_size = sdp_set_cstate_pdu(buf, NULL);
-			else
+				sdp_cstate_free_rsp(req->sock, cstate);
+			} else
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
@@ -724,7 +1067,9 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req->sock, buf);
+			if (newState.timestamp == 0)
+				status = SDP_INSUFFICIENT_RESOURCES;
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -735,7 +1080,7 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			cstate_size = sdp_set_cstate_pdu(buf, &newState);
 		} else {
 			if (buf->data_size == 0)
-				sdp_append_to_buf(buf, 0, 0);
+				buf->data_size = put_seq_header(buf->data, 0);
 			cstate_size = sdp_set_cstate_pdu(buf, NULL);
 		}
 	}
@@ -745,10 +1090,6 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->buf_size += sizeof(uint16_t);
 
 done:
-	if (cstate)
-		free(cstate);
-	if (seq)
-		sdp_list_free(seq, free);
 	if (status)
 		return status;
 
@@ -767,14 +1108,12 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	uint8_t *pdata, *pResponse = NULL;
 	unsigned int max;
 	int scanned, rsp_count = 0;
-	sdp_list_t *pattern = NULL, *seq = NULL, *svcList;
-	sdp_cont_state_t *cstate = NULL;
+	sdp_list_t *pattern = NULL, *seq = NULL;
+	sdp_cont_state_t state, *cstate = NULL;
 	short cstate_size = 0;
 	uint8_t dtd = 0;
-	sdp_buf_t tmpbuf;
 	size_t data_left = req->len;
 
-	tmpbuf.data = NULL;
 	pdata = req->buf + sizeof(sdp_pdu_hdr_t);
 	data_left = req->len - sizeof(sdp_pdu_hdr_t);
 	scanned = extract_des(pdata, data_left, &pattern, &dtd, SDP_TYPE_UUID);
@@ -828,18 +1167,11 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	 * if continuation state exists attempt
 	 * to get rsp remainder from cache, else send error
 	 */
-	if (sdp_cstate_get(pdata, data_left, &cstate) < 0) {
+	if (sdp_cstate_get(pdata, data_left, &state, &cstate) < 0) {
 		status = SDP_INVALID_SYNTAX;
 		goto done;
 	}
 
-	svcList = sdp_get_record_list();
-
-	tmpbuf.data = malloc(USHRT_MAX);
-	tmpbuf.data_size = 0;
-	tmpbuf.buf_size = USHRT_MAX;
-	memset(tmpbuf.data, 0, USHRT_MAX);
-
 	/* 
 	 * Calculate Attribute size acording to MTU
 	 * We can send only (MTU - sizeof(sdp_pdu_hdr_t) - sizeof(sdp_cont_state_t))
@@ -852,37 +1184,52 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 
 	if (cstate == NULL) {
 		/* no continuation state -> create new response */
-		sdp_list_t *p;
-		for (p = svcList; p; p = p->next) {
-			sdp_record_t *rec = (sdp_record_t *) p->data;
-			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
-					sdp_check_access(rec->handle, &req->device)) {
+		sdp_record_t **recs;
+		sdp_buf_t rec_buf;
+		uint8_t *start;
+		uint32_t size = 0;
+		int i, count = sdp_record_match(pattern, &recs);
+
+		/*
+		 * The attribute lists are extracted right into the
+		 * response, behind room for the largest header of
+		 * their sequence
+		 */
+		start = buf->data + seq_header_size(USHRT_MAX);
+
+		for (i = 0; i < count; i++) {
+			sdp_record_t *rec = recs[i];
+			if (sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
-				status = extract_attrs(rec, seq, &tmpbuf);
+
+				rec_buf.data = start + size;
+				rec_buf.data_size = 0;
+				rec_buf.buf_size = buf->buf_size -
+						(rec_buf.data - buf->data);
+
+				status = extract_attrs(rec, seq, &rec_buf);
 
 				SDPDBG("Response count : %d", rsp_count);
-				SDPDBG("Local PDU size : %d", tmpbuf.data_size);
+				SDPDBG("Local PDU size : %d", rec_buf.data_size);
 				if (status) {
 					SDPDBG("Extract attr from record returns err");
 					break;
 				}
-				if (buf->data_size + tmpbuf.data_size < buf->buf_size) {
-					// to be sure no relocations
-					sdp_append_to_buf(buf, tmpbuf.data, tmpbuf.data_size);
-					tmpbuf.data_size = 0;
-					memset(tmpbuf.data, 0, USHRT_MAX);
-				} else {
-					error("Relocation needed");
-					break;
-				}
-				SDPDBG("Net PDU size : %d", buf->data_size);
+				size += rec_buf.data_size;
+				SDPDBG("Net PDU size : %d", size);
 			}
 		}
+
+		buf->data_size = put_seq_header(buf->data, size);
+		memmove(buf->data + buf->data_size, start, size);
+		buf->data_size += size;
 		if (buf->data_size > max) {
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req->sock, buf);
+			if (newState.timestamp == 0)
+				status = SDP_INSUFFICIENT_RESOURCES;
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -894,16 +1241,17 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			cstate_size = sdp_set_cstate_pdu(buf, NULL);
 	} else {
 		/* continuation State exists -> get from cache */
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
-		if (pCache) {
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
+		if (pCache && cstate->cStateValue.maxBytesSent < pCache->data_size) {
 			uint16_t sent = MIN(max, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
 			buf->data_size += sent;
 			cstate->cStateValue.maxBytesSent += sent;
-			if (cstate->cStateValue.maxBytesSent == pCache->data_size)
+			if (cstate->cStateValue.maxBytesSent == pCache->data_size) {
 				cstate_size = sdp_set_cstate_pdu(buf, NULL);
-			else
+				sdp_cstate_free_rsp(req->sock, cstate);
+			} else
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
@@ -911,13 +1259,6 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 		}
 	}
 
-	if (!rsp_count && !cstate) {
-		// found nothing
-		buf->data_size = 0;
-		sdp_append_to_buf(buf, tmpbuf.data, tmpbuf.data_size);
-		sdp_set_cstate_pdu(buf, NULL);
-	}
-
 	// push header
 	buf->data -= sizeof(uint16_t);
 	buf->buf_size += sizeof(uint16_t);
@@ -929,14 +1270,6 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	}
 
 done:
-	if (cstate)
-		free(cstate);
-	if (tmpbuf.data)
-		free(tmpbuf.data);
-	if (pattern)
-		sdp_list_free(pattern, free);
-	if (seq)
-		sdp_list_free(seq, free);
 	return status;
 }
 
@@ -945,25 +1278,29 @@ done:
  * function based on request type. Handles service registration
  * client requests also.
  */
-static void process_request(sdp_req_t *req)
+static void process_request(sdp_req_t *req, uint8_t *buf)
 {
 	sdp_pdu_hdr_t *reqhdr = (sdp_pdu_hdr_t *)req->buf;
 	sdp_pdu_hdr_t *rsphdr;
 	sdp_buf_t rsp;
-	uint8_t *buf = malloc(USHRT_MAX);
 	int sent = 0;
 	int status = SDP_INVALID_SYNTAX;
 
-	memset(buf, 0, USHRT_MAX);
 	rsp.data = buf + sizeof(sdp_pdu_hdr_t);
 	rsp.data_size = 0;
-	rsp.buf_size = USHRT_MAX - sizeof(sdp_pdu_hdr_t);
+	rsp.buf_size = SDP_RSP_BUFFER_SIZE - sizeof(sdp_pdu_hdr_t);
 	rsphdr = (sdp_pdu_hdr_t *)buf;
 
-	if (ntohs(reqhdr->plen) != req->len - sizeof(sdp_pdu_hdr_t)) {
+	if (req->len < (int) sizeof(sdp_pdu_hdr_t) ||
+			ntohs(reqhdr->plen) != req->len - sizeof(sdp_pdu_hdr_t)) {
 		status = SDP_INVALID_PDU_SIZE;
 		goto send_rsp;
 	}
+
+	if (des_pool_reset(req->len) < 0) {
+		status = SDP_INSUFFICIENT_RESOURCES;
+		goto send_rsp;
+	}
 	switch (reqhdr->pdu_id) {
 	case SDP_SVC_SEARCH_REQ:
 		SDPDBG("Got a svc srch req");
@@ -1028,43 +1365,20 @@ send_rsp:
 	sent = send(req->sock, rsp.data, rsp.data_size, 0);
 
 	SDPDBG("Bytes Sent : %d", sent);
-
-	free(rsp.data);
-	free(req->buf);
 }
 
-void handle_request(int sk, uint8_t *data, int len)
+void handle_request(sdp_conn_t *conn, int len)
 {
-	struct sockaddr_l2 sa;
-	socklen_t size;
 	sdp_req_t req;
 
-	size = sizeof(sa);
-	if (getpeername(sk, (struct sockaddr *) &sa, &size) < 0)
-		return;
-
-	if (sa.l2_family == AF_BLUETOOTH) { 
-		struct l2cap_options lo;
-		memset(&lo, 0, sizeof(lo));
-		size = sizeof(lo);
-		getsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, &lo, &size);
-		bacpy(&req.bdaddr, &sa.l2_bdaddr);
-		req.mtu = lo.omtu;
-		req.local = 0;
-		memset(&sa, 0, sizeof(sa));
-		size = sizeof(sa);
-		getsockname(sk, (struct sockaddr *) &sa, &size);
-		bacpy(&req.device, &sa.l2_bdaddr);
-	} else {
-		bacpy(&req.device, BDADDR_ANY);
-		bacpy(&req.bdaddr, BDADDR_LOCAL);
-		req.mtu = 2048;
-		req.local = 1;
-	}
-
-	req.sock = sk;
-	req.buf  = data;
+	bacpy(&req.device, &conn->device);
+	bacpy(&req.bdaddr, &conn->bdaddr);
+	req.local = conn->local;
+	req.mtu = conn->mtu;
+	req.flags = 0;
+	req.sock = conn->sock;
+	req.buf  = conn->buf;
 	req.len  = len;
 
-	process_request(&req);
+	process_request(&req, conn->rsp);
 }
@@ -147,8 +147,8 @@ static int init_server(uint16_t mtu, int master, int compat)
 
 static gboolean io_session_event(GIOChannel *chan, GIOCondition cond, gpointer data)
 {
+	sdp_conn_t *conn = data;
 	sdp_pdu_hdr_t hdr;
-	uint8_t *buf;
 	int sk, len, size;
 
 	if (cond & G_IO_NVAL)
@@ -161,32 +161,115 @@ static gboolean io_session_event(GIOChannel *chan, GIOCondition cond, gpointer d
 		return FALSE;
 	}
 
-	len = recv(sk, &hdr, sizeof(sdp_pdu_hdr_t), MSG_PEEK);
-	if (len <= 0) {
-		sdp_svcdb_collect_all(sk);
-		return FALSE;
-	}
+	if (conn->local) {
+		/* The stream socket needs the length from the header */
+		len = recv(sk, &hdr, sizeof(sdp_pdu_hdr_t), MSG_PEEK);
+		if (len <= 0) {
+			sdp_svcdb_collect_all(sk);
+			return FALSE;
+		}
 
-	size = sizeof(sdp_pdu_hdr_t) + ntohs(hdr.plen);
-	buf = malloc(size);
-	if (!buf)
-		return TRUE;
+		size = sizeof(sdp_pdu_hdr_t) + ntohs(hdr.plen);
+		if (size > conn->buf_size) {
+			uint8_t *buf = realloc(conn->buf, size);
+			if (!buf)
+				return TRUE;
 
-	len = recv(sk, buf, size, 0);
+			conn->buf = buf;
+			conn->buf_size = size;
+		}
+	} else {
+		/* An L2CAP packet can't be larger than the incoming MTU */
+		size = conn->buf_size;
+	}
+
+	len = recv(sk, conn->buf, size, 0);
 	if (len <= 0) {
 		sdp_svcdb_collect_all(sk);
-		free(buf);
 		return FALSE;
 	}
 
-	handle_request(sk, buf, len);
+	handle_request(conn, len);
 
 	return TRUE;
 }
 
+static void conn_free(gpointer data)
+{
+	sdp_conn_t *conn = data;
+
+	free(conn->buf);
+	free(conn->rsp);
+	free(conn);
+}
+
+/*
+ * Look up what the requests of a new connection need once, instead
+ * of for every one of them
+ */
+static sdp_conn_t *conn_new(int sk, struct sockaddr_l2 *addr)
+{
+	sdp_conn_t *conn;
+
+	conn = malloc(sizeof(sdp_conn_t));
+	if (!conn)
+		return NULL;
+
+	memset(conn, 0, sizeof(sdp_conn_t));
+	conn->sock = sk;
+
+	if (addr) {
+		struct l2cap_options lo;
+		struct sockaddr_l2 sa;
+		socklen_t size;
+
+		memset(&lo, 0, sizeof(lo));
+		size = sizeof(lo);
+		if (getsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, &lo, &size) < 0) {
+			error("getsockopt: %s", strerror(errno));
+			goto failed;
+		}
+
+		memset(&sa, 0, sizeof(sa));
+		size = sizeof(sa);
+		if (getsockname(sk, (struct sockaddr *) &sa, &size) < 0) {
+			error("getsockname: %s", strerror(errno));
+			goto failed;
+		}
+
+		bacpy(&conn->bdaddr, &addr->l2_bdaddr);
+		bacpy(&conn->device, &sa.l2_bdaddr);
+		conn->mtu = lo.omtu;
+		conn->local = 0;
+		conn->buf_size = lo.imtu;
+	} else {
+		bacpy(&conn->device, BDADDR_ANY);
+		bacpy(&conn->bdaddr, BDADDR_LOCAL);
+		conn->mtu = 2048;
+		conn->local = 1;
+		conn->buf_size = conn->mtu;
+	}
+
+	if (conn->buf_size < (int) sizeof(sdp_pdu_hdr_t))
+		conn->buf_size = SDP_RSP_BUFFER_SIZE;
+
+	conn->buf = malloc(conn->buf_size);
+	conn->rsp = malloc(SDP_RSP_BUFFER_SIZE);
+	if (!conn->buf || !conn->rsp)
+		goto failed;
+
+	return conn;
+
+failed:
+	conn_free(conn);
+	return NULL;
+}
+
 static gboolean io_accept_event(GIOChannel *chan, GIOCondition cond, gpointer data)
 {
 	GIOChannel *io;
+	sdp_conn_t *conn;
+	struct sockaddr_l2 l2addr;
 	int nsk;
 
 	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
@@ -195,10 +278,9 @@ static gboolean io_accept_event(GIOChannel *chan, GIOCondition cond, gpointer da
 	}
 
 	if (data == &l2cap_sock) {
-		struct sockaddr_l2 addr;
-		socklen_t len = sizeof(addr);
+		socklen_t len = sizeof(l2addr);
 
-		nsk = accept(l2cap_sock, (struct sockaddr *) &addr, &len);
+		nsk = accept(l2cap_sock, (struct sockaddr *) &l2addr, &len);
 	} else if (data == &unix_sock) {
 		struct sockaddr_un addr;
 		socklen_t len = sizeof(addr);
@@ -212,11 +294,18 @@ static gboolean io_accept_event(GIOChannel *chan, GIOCondition cond, gpointer da
 		return TRUE;
 	}
 
+	conn = conn_new(nsk, data == &l2cap_sock ? &l2addr : NULL);
+	if (!conn) {
+		close(nsk);
+		return TRUE;
+	}
+
 	io = g_io_channel_unix_new(nsk);
 	g_io_channel_set_close_on_unref(io, TRUE);
 
-	g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
-					io_session_event, data);
+	g_io_add_watch_full(io, G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+				io_session_event, conn, conn_free);
 
 	g_io_channel_unref(io);
 
@@ -96,16 +96,15 @@ static void update_db_timestamp(void)
 	uint32_t dbts = sdp_get_time();
 	sdp_data_t *d = sdp_data_alloc(SDP_UINT32, &dbts);
 	sdp_attr_replace(server, SDP_ATTR_SVCDB_STATE, d);
+	sdp_record_refresh(server);
 }
 
 static void update_svclass_list(const bdaddr_t *src)
 {
-	sdp_list_t *list = sdp_get_record_list();
+	sdp_record_t *rec;
 	uint8_t val = 0;
 
-	for (; list; list = list->next) {
-		sdp_record_t *rec = (sdp_record_t *) list->data;
-
+	for (rec = sdp_record_next(NULL); rec; rec = sdp_record_next(rec)) {
 		if (rec->svclass.type != SDP_UUID16)
 			continue;
 
@@ -168,7 +167,7 @@ uint8_t get_service_classes(const bdaddr_t *bdaddr)
 
 void create_ext_inquiry_response(const char *name, uint8_t *data)
 {
-	sdp_list_t *list = sdp_get_record_list();
+	sdp_record_t *rec;
 	uint8_t *ptr = data;
 	uint16_t uuid[24];
 	int i, index = 0;
@@ -205,9 +204,7 @@ void create_ext_inquiry_response(const char *name, uint8_t *data)
 
 	ptr[1] = 0x03;
 
-	for (; list; list = list->next) {
-		sdp_record_t *rec = (sdp_record_t *) list->data;
-
+	for (rec = sdp_record_next(NULL); rec; rec = sdp_record_next(rec)) {
 		if (rec->svclass.type != SDP_UUID16)
 			continue;
 
@@ -249,7 +246,6 @@ void register_public_browse_group(void)
 
 	browse->handle = SDP_SERVER_RECORD_HANDLE + 1;
 
-	sdp_record_add(BDADDR_ANY, browse);
 	sdpdata = sdp_data_alloc(SDP_UINT32, &browse->handle);
 	sdp_attr_add(browse, SDP_ATTR_RECORD_HANDLE, sdpdata);
 
@@ -261,6 +257,8 @@ void register_public_browse_group(void)
 	sdp_uuid16_create(&pbgid, PUBLIC_BROWSE_GROUP);
 	sdp_attr_add_new(browse, SDP_ATTR_GROUP_ID,
 				SDP_UUID16, &pbgid.value.uuid16);
+
+	sdp_record_add(BDADDR_ANY, browse);
 }
 
 /*
@@ -284,7 +282,6 @@ void register_server_service(void)
 	/* Force the record to be SDP_SERVER_RECORD_HANDLE */
 	server->handle = SDP_SERVER_RECORD_HANDLE;
 
-	sdp_record_add(BDADDR_ANY, server);
 	sdp_attr_add(server, SDP_ATTR_RECORD_HANDLE,
 				sdp_data_alloc(SDP_UINT32, &server->handle));
 
@@ -316,6 +313,8 @@ void register_server_service(void)
 	free(versionDTDs);
 	sdp_attr_add(server, SDP_ATTR_VERSION_NUM_LIST, pData);
 
+	sdp_record_add(BDADDR_ANY, server);
+
 	update_db_timestamp();
 	update_svclass_list(BDADDR_ANY);
 }
@@ -340,7 +339,6 @@ void register_device_id(const uint16_t vendor, const uint16_t product,
 
 	record->handle = sdp_next_handle();
 
-	sdp_record_add(BDADDR_ANY, record);
 	sdp_data = sdp_data_alloc(SDP_UINT32, &record->handle);
 	sdp_attr_add(record, SDP_ATTR_RECORD_HANDLE, sdp_data);
 
@@ -378,6 +376,8 @@ void register_device_id(const uint16_t vendor, const uint16_t product,
 	source_data = sdp_data_alloc(SDP_UINT16, &source);
 	sdp_attr_add(record, 0x0205, source_data);
 
+	sdp_record_add(BDADDR_ANY, record);
+
 	update_db_timestamp();
 	update_svclass_list(BDADDR_ANY);
 }
@@ -398,8 +398,6 @@ int add_record_to_server(const bdaddr_t *src, sdp_record_t *rec)
 
 	debug("Adding record with handle 0x%05x", rec->handle);
 
-	sdp_record_add(src, rec);
-
 	data = sdp_data_alloc(SDP_UINT32, &rec->handle);
 	sdp_attr_replace(rec, SDP_ATTR_RECORD_HANDLE, data);
 
@@ -409,6 +407,9 @@ int add_record_to_server(const bdaddr_t *src, sdp_record_t *rec)
 		sdp_pattern_add_uuid(rec, &uuid);
 	}
 
+	/* add it once the pattern is complete so that it gets indexed */
+	sdp_record_add(src, rec);
+
 	for (pattern = rec->pattern; pattern; pattern = pattern->next) {
 		char uuid[32];
 
@@ -601,6 +602,9 @@ success:
 		sdp_pattern_add_uuid(rec, &uuid);
 	}
 
+	/* the record may have changed since it was added */
+	sdp_record_refresh(rec);
+
 	update_db_timestamp();
 	update_svclass_list(BDADDR_ANY);
 
@@ -650,6 +654,8 @@ int service_update_req(sdp_req_t *req, sdp_buf_t *rsp)
 
 	assert(nrec == orec);
 
+	sdp_record_refresh(nrec);
+
 	update_db_timestamp();
 	update_svclass_list(BDADDR_ANY);
 
@@ -45,7 +45,22 @@ typedef struct request {
 	int      len;
 } sdp_req_t;
 
-void handle_request(int sk, uint8_t *data, int len);
+/*
+ * State of a connection to the server, set up when it is accepted
+ * and reused by all of its requests
+ */
+typedef struct {
+	int      sock;
+	int      local;
+	bdaddr_t device;
+	bdaddr_t bdaddr;
+	int      mtu;
+	uint8_t  *buf;
+	int      buf_size;
+	uint8_t  *rsp;
+} sdp_conn_t;
+
+void handle_request(sdp_conn_t *conn, int len);
 
 int service_register_req(sdp_req_t *req, sdp_buf_t *rsp);
 int service_update_req(sdp_req_t *req, sdp_buf_t *rsp);
@@ -66,9 +81,7 @@ typedef struct {
 
 #define SDP_CONT_STATE_SIZE (sizeof(uint8_t) + sizeof(sdp_cont_state_t))
 
-sdp_buf_t *sdp_get_cached_rsp(sdp_cont_state_t *cstate);
-void sdp_cstate_cache_init(void);
-void sdp_cstate_clean_buf(void);
+void sdp_cstate_clean_buf(int sock);
 
 void sdp_svcdb_reset(void);
 void sdp_svcdb_collect_all(int sock);
@@ -77,8 +90,29 @@ void sdp_svcdb_collect(sdp_record_t *rec);
 sdp_record_t *sdp_record_find(uint32_t handle);
 void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec);
 int sdp_record_remove(uint32_t handle);
+void sdp_record_refresh(sdp_record_t *rec);
+int sdp_record_match(sdp_list_t *search, sdp_record_t ***records);
+
+/*
+ * Attribute list of a record encoded as in the responses, without
+ * the sequence header, and the offset of every attribute in it
+ */
+typedef struct {
+	uint16_t attr;
+	uint32_t offset;
+} sdp_attr_offset_t;
+
+typedef struct {
+	uint32_t handle;
+	uint8_t *data;
+	uint32_t size;
+	sdp_attr_offset_t *attrs;
+	int count;
+} sdp_cached_pdu_t;
+
+sdp_cached_pdu_t *sdp_record_get_pdu(sdp_record_t *rec);
+sdp_record_t *sdp_record_next(sdp_record_t *rec);
 sdp_list_t *sdp_get_record_list(void);
-sdp_list_t *sdp_get_access_list(void);
 int sdp_check_access(uint32_t handle, bdaddr_t *device);
 uint32_t sdp_next_handle(void);
 
@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/time.h>
 
 #include <glib.h>
 
@@ -105,6 +106,8 @@ struct userdata {
 	size_t block_size;
 	gboolean debug_stream_read : 1;
 	gboolean debug_stream_write : 1;
+	gboolean time_first_write : 1;
+	struct timeval setup_start; /* Set when timing a stream setup */
 };
 
 static struct userdata data = {
@@ -149,14 +152,26 @@ static int service_recv(struct userdata *u, bt_audio_msg_header_t *rsp)
 {
 	int err;
 	const char *type, *name;
-	uint16_t length;
+	ssize_t r;
 
 	assert(u);
 
-	length = rsp->length ? : BT_SUGGESTED_BUFFER_SIZE;
-
 	DBG("trying to receive msg from audio service...");
-	if (recv(u->service_fd, rsp, length, 0) > 0) {
+
+	/* Header first so that a queued indication is left alone, the
+	 * buffer is always BT_SUGGESTED_BUFFER_SIZE long */
+	r = recv(u->service_fd, rsp, sizeof(*rsp), MSG_WAITALL);
+	if (r == sizeof(*rsp) && rsp->length > sizeof(*rsp)) {
+		if (rsp->length > BT_SUGGESTED_BUFFER_SIZE) {
+			ERR("Too long message received from audio service");
+			return -EINVAL;
+		}
+
+		r = recv(u->service_fd, (uint8_t *) rsp + sizeof(*rsp),
+				rsp->length - sizeof(*rsp), MSG_WAITALL);
+	}
+
+	if (r > 0) {
 		type = bt_audio_strtype(rsp->type);
 		name = bt_audio_strname(rsp->name);
 		if (type && name) {
@@ -186,8 +201,12 @@ static ssize_t service_expect(struct userdata *u, bt_audio_msg_header_t *rsp,
 	assert(u->service_fd >= 0);
 	assert(rsp);
 
-	if ((r = service_recv(u, rsp)) < 0)
-		return r;
+	/* Delay reports may come at any time */
+	do {
+		if ((r = service_recv(u, rsp)) < 0)
+			return r;
+	} while (rsp->type == BT_INDICATION && rsp->name == BT_DELAY_REPORT &&
+					expected_name != BT_DELAY_REPORT);
 
 	if ((rsp->type != BT_INDICATION && rsp->type != BT_RESPONSE) ||
 			(rsp->name != expected_name)) {
@@ -599,6 +618,39 @@ static int bt_open(struct userdata *u)
 	return 0;
 }
 
+/* Fills in the requested codec, returns how much longer than
+ * codec_capabilities_t it is */
+static size_t set_codec(struct userdata *u, codec_capabilities_t *codec)
+{
+	if (u->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
+		memcpy(codec, &u->a2dp.sbc_capabilities,
+			sizeof(u->a2dp.sbc_capabilities));
+		return codec->length - sizeof(*codec);
+	}
+
+	codec->transport = BT_CAPABILITIES_TRANSPORT_SCO;
+	codec->seid = BT_A2DP_SEID_RANGE + 1;
+	codec->length = sizeof(pcm_capabilities_t);
+
+	return 0;
+}
+
+static void set_link_mtu(struct userdata *u, uint16_t link_mtu)
+{
+	u->link_mtu = link_mtu;
+
+	/* setup SBC encoder now we agree on parameters */
+	if (u->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
+		setup_sbc(&u->a2dp);
+		u->block_size = u->a2dp.codesize;
+		DBG("SBC parameters:\n\tallocation=%u\n"
+			"\tsubbands=%u\n\tblocks=%u\n\tbitpool=%u\n",
+			u->a2dp.sbc.allocation, u->a2dp.sbc.subbands,
+			u->a2dp.sbc.blocks, u->a2dp.sbc.bitpool);
+	} else
+		u->block_size = u->link_mtu;
+}
+
 static int set_conf(struct userdata *u)
 {
 	union {
@@ -618,16 +670,7 @@ static int set_conf(struct userdata *u)
 	msg.setconf_req.h.name = BT_SET_CONFIGURATION;
 	msg.setconf_req.h.length = sizeof(msg.setconf_req);
 
-	if (u->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
-		memcpy(&msg.setconf_req.codec, &u->a2dp.sbc_capabilities,
-			sizeof(u->a2dp.sbc_capabilities));
-		msg.setconf_req.h.length += msg.setconf_req.codec.length -
-			sizeof(msg.setconf_req.codec);
-	} else {
-		msg.setconf_req.codec.transport = BT_CAPABILITIES_TRANSPORT_SCO;
-		msg.setconf_req.codec.seid = BT_A2DP_SEID_RANGE + 1;
-		msg.setconf_req.codec.length = sizeof(pcm_capabilities_t);
-	}
+	msg.setconf_req.h.length += set_codec(u, &msg.setconf_req.codec);
 
 	if (service_send(u, &msg.setconf_req.h) < 0)
 		return -1;
@@ -636,18 +679,7 @@ static int set_conf(struct userdata *u)
 	if (service_expect(u, &msg.setconf_rsp.h, BT_SET_CONFIGURATION) < 0)
 		return -1;
 
-	u->link_mtu = msg.setconf_rsp.link_mtu;
-
-	/* setup SBC encoder now we agree on parameters */
-	if (u->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
-		setup_sbc(&u->a2dp);
-		u->block_size = u->a2dp.codesize;
-		DBG("SBC parameters:\n\tallocation=%u\n"
-			"\tsubbands=%u\n\tblocks=%u\n\tbitpool=%u\n",
-			u->a2dp.sbc.allocation, u->a2dp.sbc.subbands,
-			u->a2dp.sbc.blocks, u->a2dp.sbc.bitpool);
-	} else
-		u->block_size = u->link_mtu;
+	set_link_mtu(u, msg.setconf_rsp.link_mtu);
 
 	return 0;
 }
@@ -766,6 +798,19 @@ static ssize_t pa_write(int fd, const void *buf, size_t count)
 	return write(fd, buf, count);
 }
 
+static void print_setup_time(struct userdata *u)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &u->setup_start, &now);
+
+	DBG("first packet written %lu usec after setup started",
+		(unsigned long) (now.tv_sec * 1000000 + now.tv_usec));
+
+	u->time_first_write = FALSE;
+}
+
 static int write_stream(struct userdata *u)
 {
 	int ret = 0;
@@ -791,6 +836,8 @@ static int write_stream(struct userdata *u)
 			}
 		} else {
 			assert((size_t)l <= u->link_mtu);
+			if (u->time_first_write)
+				print_setup_time(u);
 			break;
 		}
 	}
@@ -823,13 +870,55 @@ fail:
 	return FALSE;
 }
 
+static void reset_stream_watch(struct userdata *u)
+{
+	if (u->stream_watch != 0) {
+		g_source_remove(u->stream_watch);
+		u->stream_watch = 0;
+	}
+	if (u->stream_channel != 0) {
+		g_io_channel_unref(u->stream_channel);
+		u->stream_channel = NULL;
+	}
+}
+
+/* Waits for the new stream indication and starts watching the stream */
+static int attach_stream(struct userdata *u)
+{
+	union {
+		bt_audio_msg_header_t rsp;
+		struct bt_new_stream_ind streamfd_ind;
+		bt_audio_error_t error;
+		uint8_t buf[BT_SUGGESTED_BUFFER_SIZE];
+	} msg;
+
+	msg.rsp.length = sizeof(msg.streamfd_ind);
+	if (service_expect(u, &msg.rsp, BT_NEW_STREAM) < 0)
+		return -1;
+
+	if ((u->stream_fd = bt_audio_service_get_data_fd(u->service_fd)) < 0) {
+		DBG("Failed to get stream fd from audio service.");
+		return -1;
+	}
+
+	make_fd_nonblock(u->stream_fd);
+	make_socket_low_delay(u->stream_fd);
+
+	assert(u->stream_channel = g_io_channel_unix_new(u->stream_fd));
+
+	u->stream_watch = g_io_add_watch(u->stream_channel,
+					G_IO_IN|G_IO_OUT|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
+					stream_cb, u);
+
+	return 0;
+}
+
 static int start_stream(struct userdata *u)
 {
 	union {
 		bt_audio_msg_header_t rsp;
 		struct bt_start_stream_req start_req;
 		struct bt_start_stream_rsp start_rsp;
-		struct bt_new_stream_ind streamfd_ind;
 		bt_audio_error_t error;
 		uint8_t buf[BT_SUGGESTED_BUFFER_SIZE];
 	} msg;
@@ -838,14 +927,8 @@ static int start_stream(struct userdata *u)
 
 	if (u->stream_fd >= 0)
 		return 0;
-	if (u->stream_watch != 0) {
-		g_source_remove(u->stream_watch);
-		u->stream_watch = 0;
-	}
-	if (u->stream_channel != 0) {
-		g_io_channel_unref(u->stream_channel);
-		u->stream_channel = NULL;
-	}
+
+	reset_stream_watch(u);
 
 	memset(msg.buf, 0, BT_SUGGESTED_BUFFER_SIZE);
 	msg.start_req.h.type = BT_REQUEST;
@@ -859,25 +942,82 @@ static int start_stream(struct userdata *u)
 	if (service_expect(u, &msg.rsp, BT_START_STREAM) < 0)
 		return -1;
 
-	msg.rsp.length = sizeof(msg.streamfd_ind);
-	if (service_expect(u, &msg.rsp, BT_NEW_STREAM) < 0)
+	return attach_stream(u);
+}
+
+/* Opens, configures and starts the stream with a single request */
+static int setup_stream(struct userdata *u)
+{
+	union {
+		bt_audio_msg_header_t rsp;
+		struct bt_setup_stream_req setup_req;
+		struct bt_setup_stream_rsp setup_rsp;
+		bt_audio_error_t error;
+		uint8_t buf[BT_SUGGESTED_BUFFER_SIZE];
+	} msg;
+
+	assert(u);
+
+	if (u->stream_fd >= 0)
+		return 0;
+
+	reset_stream_watch(u);
+
+	if (u->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
+		if (setup_a2dp(u) < 0)
+			return -1;
+	}
+
+	memset(msg.buf, 0, BT_SUGGESTED_BUFFER_SIZE);
+	msg.setup_req.h.type = BT_REQUEST;
+	msg.setup_req.h.name = BT_SETUP_STREAM;
+	msg.setup_req.h.length = sizeof(msg.setup_req);
+
+	strncpy(msg.setup_req.destination, u->address,
+			sizeof(msg.setup_req.destination));
+	msg.setup_req.lock = u->transport == BT_CAPABILITIES_TRANSPORT_A2DP ?
+				BT_WRITE_LOCK : BT_READ_LOCK | BT_WRITE_LOCK;
+
+	msg.setup_req.h.length += set_codec(u, &msg.setup_req.codec);
+
+	if (service_send(u, &msg.setup_req.h) < 0)
 		return -1;
 
-	if ((u->stream_fd = bt_audio_service_get_data_fd(u->service_fd)) < 0) {
-		DBG("Failed to get stream fd from audio service.");
+	msg.rsp.length = sizeof(msg.setup_rsp);
+	if (service_expect(u, &msg.rsp, BT_SETUP_STREAM) < 0)
 		return -1;
-	}
 
-	make_fd_nonblock(u->stream_fd);
-	make_socket_low_delay(u->stream_fd);
+	set_link_mtu(u, msg.setup_rsp.link_mtu);
 
-	assert(u->stream_channel = g_io_channel_unix_new(u->stream_fd));
+	return attach_stream(u);
+}
 
-	u->stream_watch = g_io_add_watch(u->stream_channel,
-					G_IO_IN|G_IO_OUT|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-					stream_cb, u);
+/* Measures the time from the first request to the first packet written,
+ * either with the separate open, configuration and start requests or
+ * with the combined one */
+static int time_setup(struct userdata *u, gboolean combined)
+{
+	int err;
 
-	return 0;
+	assert(u);
+
+	if (get_caps(u) < 0)
+		return -1;
+
+	gettimeofday(&u->setup_start, NULL);
+	u->time_first_write = TRUE;
+
+	if (combined)
+		err = setup_stream(u);
+	else if (bt_open(u) < 0 || set_conf(u) < 0)
+		err = -1;
+	else
+		err = start_stream(u);
+
+	if (err < 0)
+		u->time_first_write = FALSE;
+
+	return err;
 }
 
 static int stop_stream(struct userdata *u)
@@ -1009,6 +1149,26 @@ static gboolean input_cb(GIOChannel *gin, GIOCondition condition, gpointer data)
 		DBG("%d", start_stream(u));
 	}
 
+	IF_CMD(setup_stream) {
+		DBG("%d", setup_stream(u));
+	}
+
+	IF_CMD(time_setup) {
+		char *how = NULL;
+
+		if (sscanf(line, "%*s %as", &how) != 1)
+			DBG("time_setup [separate|combined]");
+		else if (strncmp(how, "separate", 9) == 0)
+			DBG("%d", time_setup(u, FALSE));
+		else if (strncmp(how, "combined", 9) == 0)
+			DBG("%d", time_setup(u, TRUE));
+		else
+			DBG("time_setup [separate|combined]");
+
+		if (how)
+			free(how);
+	}
+
 	IF_CMD(stop_stream) {
 		DBG("%d", stop_stream(u));
 	}
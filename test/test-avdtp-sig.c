@@ -0,0 +1,314 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2009  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "avdtp-sig.h"
+
+/* Signaling packets go over a SOCK_SEQPACKET socketpair instead of an
+ * L2CAP channel, both keep the packet boundaries */
+
+static int verbose = 0;
+
+static void vlog(const char *prefix, const char *format, va_list ap)
+{
+	if (!verbose)
+		return;
+
+	fprintf(stderr, "%s", prefix);
+	vfprintf(stderr, format, ap);
+	fprintf(stderr, "\n");
+}
+
+void info(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vlog("", format, ap);
+	va_end(ap);
+}
+
+void error(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vlog("error: ", format, ap);
+	va_end(ap);
+}
+
+void debug(const char *format, ...)
+{
+	va_list ap;
+
+	if (verbose < 2)
+		return;
+
+	va_start(ap, format);
+	vlog("", format, ap);
+	va_end(ap);
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &now);
+
+	return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+static int roundtrip(int sk[2], uint16_t omtu, struct avdtp_sig_in *in,
+					const uint8_t *data, size_t len)
+{
+	uint8_t transaction = len & 0x0f;
+	uint8_t signal_id = (len % 0x0d) + 1;
+	enum avdtp_parse_result res;
+
+	if (!avdtp_sig_send(sk[0], omtu, transaction,
+				AVDTP_MSG_TYPE_ACCEPT, signal_id, data, len))
+		return -1;
+
+	do {
+		res = avdtp_sig_recv(sk[1], in);
+	} while (res == PARSE_FRAGMENT);
+
+	if (res != PARSE_SUCCESS)
+		return -1;
+
+	if (in->transaction != transaction || in->signal_id != signal_id ||
+			in->message_type != AVDTP_MSG_TYPE_ACCEPT ||
+			in->data_size != len ||
+			memcmp(in->buf + in->offset, data, len) != 0)
+		return -1;
+
+	return 0;
+}
+
+/* Sends every message size through every MTU and checks the reassembled
+ * message, then times a fixed size message */
+static int test_throughput(int sk[2], uint16_t mtu, unsigned int count)
+{
+	static const uint16_t mtus[] = { 48, 100, 335, 672, 1027 };
+	struct avdtp_sig_in in;
+	uint8_t data[AVDTP_SIG_MAX_SIZE];
+	struct timeval start;
+	unsigned int i, m;
+	size_t len;
+	double secs;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	avdtp_sig_reset(&in);
+
+	for (m = 0; m < sizeof(mtus) / sizeof(mtus[0]); m++) {
+		for (len = 0; len <= sizeof(data); len++) {
+			if (roundtrip(sk, mtus[m], &in, data, len) < 0) {
+				printf("Message of %zu bytes with MTU %u "
+					"failed\n", len, mtus[m]);
+				return -1;
+			}
+		}
+	}
+
+	printf("All message sizes up to %zu bytes reassembled\n",
+								sizeof(data));
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < count; i++) {
+		if (roundtrip(sk, mtu, &in, data, sizeof(data) / 2) < 0) {
+			printf("Message %u failed\n", i);
+			return -1;
+		}
+	}
+
+	secs = elapsed(&start);
+
+	printf("%u messages of %zu bytes with MTU %u in %.3f sec "
+			"(%.0f msg/s, %.2f MB/s)\n", count, sizeof(data) / 2,
+			mtu, secs, count / secs,
+			count * (sizeof(data) / 2) / secs / 1000000);
+
+	return 0;
+}
+
+static size_t fuzz_packet(uint8_t *buf, size_t size, uint16_t mtu)
+{
+	struct avdtp_common_header *header = (void *) buf;
+	size_t len;
+	unsigned int i;
+
+	switch (rand() % 8) {
+	case 0:
+		len = rand() % 4;
+		break;
+	case 1:
+		/* Larger than the reassembly buffer */
+		len = size;
+		break;
+	default:
+		len = rand() % (mtu + 1);
+		break;
+	}
+
+	for (i = 0; i < len; i++)
+		buf[i] = rand();
+
+	/* Keep most packets in one transaction so that the fragments
+	 * get past the first checks */
+	if (len > 0 && rand() % 4) {
+		header->transaction = 1;
+		if (header->packet_type == AVDTP_PKT_TYPE_START &&
+								len > 1)
+			buf[1] = rand() % 5;
+	}
+
+	return len;
+}
+
+/* Feeds random and half-valid packets to the reassembly and checks that
+ * it never goes out of its buffer */
+static int test_fuzz(int sk[2], uint16_t mtu, unsigned int count)
+{
+	struct avdtp_sig_in in;
+	uint8_t buf[sizeof(in.buf) + 16];
+	unsigned long result[3] = { 0, 0, 0 };
+	unsigned int i;
+	size_t len;
+
+	avdtp_sig_reset(&in);
+
+	for (i = 0; i < count; i++) {
+		enum avdtp_parse_result res;
+
+		len = fuzz_packet(buf, sizeof(buf), mtu);
+
+		if (send(sk[0], buf, len, 0) != (ssize_t) len) {
+			perror("send");
+			return -1;
+		}
+
+		res = avdtp_sig_recv(sk[1], &in);
+		result[res]++;
+
+		if (in.offset + in.data_size > sizeof(in.buf)) {
+			printf("Packet %u overflowed the reassembly buffer\n",
+									i);
+			return -1;
+		}
+
+		/* The session would be disconnected */
+		if (res == PARSE_ERROR)
+			avdtp_sig_reset(&in);
+	}
+
+	printf("%u packets: %lu errors, %lu fragments, %lu messages\n",
+				count, result[PARSE_ERROR],
+				result[PARSE_FRAGMENT], result[PARSE_SUCCESS]);
+
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("test-avdtp-sig - AVDTP signaling fragmentation tester\n"
+		"Usage:\n");
+	printf("\ttest-avdtp-sig [options]\n");
+	printf("Options:\n"
+		"\t[-n count]   number of messages and fuzzed packets\n"
+		"\t[-m mtu]     MTU used for the timing (default 48)\n"
+		"\t[-s seed]    random seed\n"
+		"\t[-v]         verbose, twice for debug\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = 100000, seed = time(NULL);
+	uint16_t mtu = 48;
+	int sk[2], opt, err;
+
+	while ((opt = getopt(argc, argv, "n:m:s:vh")) != EOF) {
+		switch (opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'm':
+			mtu = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (mtu <= sizeof(struct avdtp_start_header) ||
+			mtu > sizeof(struct avdtp_start_header) +
+							AVDTP_SIG_MAX_SIZE) {
+		fprintf(stderr, "Invalid MTU %u\n", mtu);
+		exit(1);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sk) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+
+	printf("Random seed %u\n", seed);
+	srand(seed);
+
+	err = test_throughput(sk, mtu, count);
+	if (err == 0)
+		err = test_fuzz(sk, mtu, count);
+
+	close(sk[0]);
+	close(sk[1]);
+
+	return err < 0 ? 1 : 0;
+}